@@ -0,0 +1,366 @@
+#include "chiba_channel.h"
+#include "../basic_memory.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// -----------------------------------------------
+// Benchmark configuration
+// -----------------------------------------------
+#define MSGS 1000000LL // 每轮发送的消息总数
+#define ROUNDS 3       // 轮数
+#define MAX_THREADS 4  // 最多的 sender / receiver 线程数
+#define BOUNDED_CAP 1024 // bounded channel 的容量
+
+static inline u64 now_ns(void) { return get_time_in_nanoseconds(); }
+
+// -----------------------------------------------
+// Counting allocator: heap allocations made while messages are sent
+// -----------------------------------------------
+static _Atomic(long long) heap_allocs = 0;
+
+static anyptr count_malloc(size_t n) {
+  atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+  return malloc(n);
+}
+
+static anyptr count_aligned(size_t align, size_t n) {
+  atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+  return aligned_alloc(align, ((n + align - 1) / align) * align);
+}
+
+static anyptr count_realloc(anyptr ptr, size_t n) {
+  atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+  return realloc(ptr, n);
+}
+
+static void count_free(anyptr ptr) { free(ptr); }
+
+// -----------------------------------------------
+// 对照组: 原来的实现 (mutex + 每条消息 malloc 一个节点, capacity 0 = 无界)
+// -----------------------------------------------
+typedef struct locked_node {
+  void *data;
+  struct locked_node *next;
+} locked_node;
+
+typedef struct {
+  locked_node *head;
+  locked_node *tail;
+  _Atomic u64 len;
+  u64 capacity;
+  pthread_mutex_t mutex;
+} locked_queue;
+
+static locked_queue legacy;
+
+static bool locked_send(void *data) {
+  if (legacy.capacity &&
+      atomic_load_explicit(&legacy.len, memory_order_relaxed) >=
+          legacy.capacity)
+    return false;
+  locked_node *node = (locked_node *)CHIBA_INTERNAL_malloc(sizeof(locked_node));
+  if (!node)
+    return false;
+  node->data = data;
+  node->next = NULL;
+  pthread_mutex_lock(&legacy.mutex);
+  if (legacy.capacity &&
+      atomic_load_explicit(&legacy.len, memory_order_relaxed) >=
+          legacy.capacity) {
+    pthread_mutex_unlock(&legacy.mutex);
+    CHIBA_INTERNAL_free(node);
+    return false;
+  }
+  if (legacy.tail)
+    legacy.tail->next = node;
+  else
+    legacy.head = node;
+  legacy.tail = node;
+  atomic_fetch_add_explicit(&legacy.len, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&legacy.mutex);
+  return true;
+}
+
+static bool locked_recv(void **data_out) {
+  pthread_mutex_lock(&legacy.mutex);
+  locked_node *node = legacy.head;
+  if (!node) {
+    pthread_mutex_unlock(&legacy.mutex);
+    return false;
+  }
+  legacy.head = node->next;
+  if (!legacy.head)
+    legacy.tail = NULL;
+  atomic_fetch_sub_explicit(&legacy.len, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&legacy.mutex);
+  *data_out = node->data;
+  CHIBA_INTERNAL_free(node);
+  return true;
+}
+
+// -----------------------------------------------
+// 被测对象: chiba_channel_unbounded / chiba_channel_bounded
+// -----------------------------------------------
+static chiba_sender_t *chan_tx;
+static chiba_receiver_t *chan_rx;
+
+static bool channel_send(void *data) {
+  return chiba_sender_try_send(chan_tx, data) == CHIBA_CHAN_OK;
+}
+
+static bool channel_recv(void **data_out) {
+  return chiba_receiver_try_recv(chan_rx, data_out) == CHIBA_CHAN_OK;
+}
+
+// -----------------------------------------------
+// Workers
+// -----------------------------------------------
+typedef struct {
+  bool (*send)(void *data);
+  bool (*recv)(void **data_out);
+  int senders;
+  int receivers;
+} Scenario;
+
+static Scenario current;
+static _Atomic(long long) received = 0;
+static _Atomic(int) ready = 0;
+
+static anyptr sender_thread(anyptr arg) {
+  long long n = (long long)(intptr_t)arg;
+  atomic_fetch_add(&ready, 1);
+  while (atomic_load(&ready) < current.senders + current.receivers)
+    ;
+  // bounded 满了就让出 CPU 再重试
+  for (long long i = 1; i <= n; i++)
+    while (!current.send((void *)(intptr_t)i))
+      sched_yield();
+  return NULL;
+}
+
+static anyptr receiver_thread(anyptr arg) {
+  (void)arg;
+  void *msg;
+  atomic_fetch_add(&ready, 1);
+  while (atomic_load(&ready) < current.senders + current.receivers)
+    ;
+  while (atomic_load_explicit(&received, memory_order_relaxed) < MSGS) {
+    if (current.recv(&msg))
+      atomic_fetch_add_explicit(&received, 1, memory_order_relaxed);
+    else
+      sched_yield();
+  }
+  return NULL;
+}
+
+typedef struct {
+  double per_msg_ns;     // 单条消息耗时 (nanoseconds)
+  double allocs_per_msg; // 单条消息的堆分配次数
+} BenchResult;
+
+static BenchResult run(Scenario s) {
+  current = s;
+  u64 elapsed = 0;
+  long long allocs = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    pthread_t tx[MAX_THREADS], rx[MAX_THREADS];
+    atomic_store(&received, 0);
+    atomic_store(&ready, 0);
+    long long a0 = atomic_load(&heap_allocs);
+    u64 start = now_ns();
+    for (int i = 0; i < s.receivers; i++)
+      pthread_create(&rx[i], NULL, receiver_thread, NULL);
+    for (int i = 0; i < s.senders; i++)
+      pthread_create(&tx[i], NULL, sender_thread,
+                     (anyptr)(intptr_t)(MSGS / s.senders));
+    for (int i = 0; i < s.senders; i++)
+      pthread_join(tx[i], NULL);
+    for (int i = 0; i < s.receivers; i++)
+      pthread_join(rx[i], NULL);
+    elapsed += now_ns() - start;
+    allocs += atomic_load(&heap_allocs) - a0;
+  }
+  return (BenchResult){.per_msg_ns = (double)elapsed / (ROUNDS * MSGS),
+                       .allocs_per_msg = (double)allocs / (ROUNDS * MSGS)};
+}
+
+// -----------------------------------------------
+// 往返延迟: 两个线程用一对 channel 来回传一条消息
+// 对照组是 try_recv 失败后 usleep 的轮询, 被测对象是阻塞 recv
+// -----------------------------------------------
+#define PING_ROUNDS 2000 // 往返次数
+#define POLL_US 50       // 轮询间隔 (microseconds)
+
+static chiba_sender_t *ping_tx, *pong_tx;
+static chiba_receiver_t *ping_rx, *pong_rx;
+static bool ping_blocking;
+
+static void ping_recv(chiba_receiver_t *rx, void **msg) {
+  if (ping_blocking) {
+    chiba_receiver_recv(rx, msg);
+    return;
+  }
+  while (chiba_receiver_try_recv(rx, msg) != CHIBA_CHAN_OK)
+    CHIBA_INTERNAL_usleep(POLL_US);
+}
+
+static void ping_send(chiba_sender_t *tx, void *msg) {
+  if (ping_blocking) {
+    chiba_sender_send(tx, msg);
+    return;
+  }
+  while (chiba_sender_try_send(tx, msg) != CHIBA_CHAN_OK)
+    CHIBA_INTERNAL_usleep(POLL_US);
+}
+
+static anyptr pong_thread(anyptr arg) {
+  (void)arg;
+  void *msg;
+  for (int i = 0; i < PING_ROUNDS; i++) {
+    ping_recv(ping_rx, &msg);
+    ping_send(pong_tx, msg);
+  }
+  return NULL;
+}
+
+// 返回单次往返耗时 (nanoseconds)
+static double run_ping_pong(u64 capacity, bool blocking) {
+  ping_blocking = blocking;
+  chiba_channel_bounded(capacity, &ping_tx, &ping_rx);
+  chiba_channel_bounded(capacity, &pong_tx, &pong_rx);
+  pthread_t t;
+  pthread_create(&t, NULL, pong_thread, NULL);
+  void *msg;
+  u64 start = now_ns();
+  for (int i = 0; i < PING_ROUNDS; i++) {
+    ping_send(ping_tx, (void *)(intptr_t)i);
+    ping_recv(pong_rx, &msg);
+  }
+  u64 elapsed = now_ns() - start;
+  pthread_join(t, NULL);
+  chiba_sender_drop(&ping_tx);
+  chiba_receiver_drop(&ping_rx);
+  chiba_sender_drop(&pong_tx);
+  chiba_receiver_drop(&pong_rx);
+  return (double)elapsed / PING_ROUNDS;
+}
+
+// -----------------------------------------------
+// 多路复用: 一个 router 从 MAX_THREADS 个 channel 收消息
+// 对照组是轮流 try_recv 的忙等, 被测对象是 chiba_select
+// -----------------------------------------------
+#define ROUTER_MSGS 200000 // 每个输入 channel 的消息数
+
+static chiba_sender_t *router_tx[MAX_THREADS];
+static chiba_receiver_t *router_rx[MAX_THREADS];
+
+static anyptr router_input(anyptr arg) {
+  chiba_sender_t *tx = router_tx[(intptr_t)arg];
+  for (long long i = 1; i <= ROUTER_MSGS; i++)
+    chiba_sender_send(tx, (void *)(intptr_t)i);
+  return NULL;
+}
+
+// 返回单条消息耗时 (nanoseconds)
+static double run_router(bool use_select) {
+  for (int i = 0; i < MAX_THREADS; i++)
+    chiba_channel_bounded(BOUNDED_CAP, &router_tx[i], &router_rx[i]);
+  pthread_t t[MAX_THREADS];
+  u64 start = now_ns();
+  for (int i = 0; i < MAX_THREADS; i++)
+    pthread_create(&t[i], NULL, router_input, (anyptr)(intptr_t)i);
+
+  chiba_select_op_t ops[MAX_THREADS];
+  long long total = (long long)MAX_THREADS * ROUTER_MSGS;
+  long long got = 0;
+  int next = 0;
+  void *msg;
+  while (got < total) {
+    if (use_select) {
+      for (int i = 0; i < MAX_THREADS; i++)
+        ops[i] = (chiba_select_op_t){.rx = router_rx[i]};
+      u32 index;
+      if (chiba_select(ops, MAX_THREADS, UINT64_MAX, &index) == CHIBA_CHAN_OK)
+        got++;
+    } else {
+      if (chiba_receiver_try_recv(router_rx[next], &msg) == CHIBA_CHAN_OK)
+        got++;
+      next = (next + 1) % MAX_THREADS;
+    }
+  }
+  u64 elapsed = now_ns() - start;
+  for (int i = 0; i < MAX_THREADS; i++) {
+    pthread_join(t[i], NULL);
+    chiba_sender_drop(&router_tx[i]);
+    chiba_receiver_drop(&router_rx[i]);
+  }
+  return (double)elapsed / (double)total;
+}
+
+int main(void) {
+  CHIBA_INTERNAL_set_alloc_funcs(count_malloc, count_aligned, count_realloc,
+                                 count_free);
+  pthread_mutex_init(&legacy.mutex, NULL);
+
+  printf("========================================\n");
+  printf("  Channel Throughput Benchmark\n");
+  printf("========================================\n");
+  printf("  Messages per round: %lld, rounds: %d, bounded capacity: %d\n\n",
+         MSGS, ROUNDS, BOUNDED_CAP);
+
+  const char *names[] = {"SPSC", "MPSC", "MPMC"};
+  int senders[] = {1, MAX_THREADS, MAX_THREADS};
+  int receivers[] = {1, 1, MAX_THREADS};
+  for (int bounded = 0; bounded < 2; bounded++) {
+    legacy.capacity = bounded ? BOUNDED_CAP : 0;
+    if (bounded)
+      chiba_channel_bounded(BOUNDED_CAP, &chan_tx, &chan_rx);
+    else
+      chiba_channel_unbounded(&chan_tx, &chan_rx);
+    for (int i = 0; i < 3; i++) {
+      BenchResult locked = run((Scenario){.send = locked_send,
+                                          .recv = locked_recv,
+                                          .senders = senders[i],
+                                          .receivers = receivers[i]});
+      BenchResult lockfree = run((Scenario){.send = channel_send,
+                                            .recv = channel_recv,
+                                            .senders = senders[i],
+                                            .receivers = receivers[i]});
+      printf("Benchmark %d: %s %s (%d sender, %d receiver)\n",
+             bounded * 3 + i + 1, bounded ? "bounded" : "unbounded", names[i],
+             senders[i], receivers[i]);
+      printf("  mutex list: %.2f ns/msg, %.4f allocs/msg\n",
+             locked.per_msg_ns, locked.allocs_per_msg);
+      printf("  %s: %.2f ns/msg, %.4f allocs/msg (%.2fx)\n\n",
+             bounded ? "array     " : "block list", lockfree.per_msg_ns,
+             lockfree.allocs_per_msg, locked.per_msg_ns / lockfree.per_msg_ns);
+    }
+    chiba_sender_drop(&chan_tx);
+    chiba_receiver_drop(&chan_rx);
+  }
+
+  // rendezvous 没有缓冲, 轮询的双方永远碰不上, 只测阻塞版本
+  printf("Benchmark 7: ping-pong round trip (%d rounds)\n", PING_ROUNDS);
+  double polled = run_ping_pong(1, false);
+  double blocked = run_ping_pong(1, true);
+  printf("  try_recv + usleep(%d), bounded(1): %.0f ns/round trip\n", POLL_US,
+         polled);
+  printf("  blocking recv, bounded(1):        %.0f ns/round trip (%.2fx)\n",
+         blocked, polled / blocked);
+  printf("  blocking recv, rendezvous:        %.0f ns/round trip\n\n",
+         run_ping_pong(0, true));
+
+  printf("Benchmark 8: router over %d bounded channels (%d msgs each)\n",
+         MAX_THREADS, ROUTER_MSGS);
+  double polling = run_router(false);
+  double selecting = run_router(true);
+  printf("  round-robin try_recv: %.2f ns/msg\n", polling);
+  printf("  chiba_select:         %.2f ns/msg (%.2fx)\n\n", selecting,
+         polling / selecting);
+  printf("========================================\n");
+
+  pthread_mutex_destroy(&legacy.mutex);
+  return 0;
+}
@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+
+set -euo pipefail
+
+gcc -o chiba_channel.bench \
+  chiba_channel.bench.c \
+  ../basic_memory.c \
+  ../coroutine/coroutine.c \
+  ../scheched_coroutine/scheched_coroutine.c \
+  chiba_channel.c \
+  -I.. -pthread -std=c11 -Wall -Wextra -O2 -g
+
+echo "Running chiba_channel.bench..."
+./chiba_channel.bench
+
+if [ $? -ne 0 ]; then
+    echo "✗ chiba_channel.bench FAILED"
+    exit 1
+else
+    echo "✓ chiba_channel.bench PASSED"
+fi
+
+echo "Deleting benchmark binary..."
+rm -f chiba_channel.bench
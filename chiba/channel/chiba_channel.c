@@ -1,21 +1,33 @@
-#pragma once
-
 //////////////////////////////////////////////////////////////////////////////////
 // Chiba Channel - 总实现 (集成所有模块)
 //
 // 模块组织:
 // - chiba_channel_shared.h: 共享数据结构定义
 // - chiba_channel_core.h: 核心队列操作实现
+// - chiba_channel_list.h: unbounded channel 的无锁分段链表
+// - chiba_channel_waker.h: 阻塞操作的等待者登记和唤醒 (线程或 chiba_sco 协程)
+// - chiba_channel_zero.h: rendezvous channel 的直接交接
 // - chiba_channel_sender.h: Sender 操作
 // - chiba_channel_receiver.h: Receiver 操作
 // - chiba_channel_create.h: Channel 创建
+// - chiba_channel_select.h: 多个分支的 select
 //////////////////////////////////////////////////////////////////////////////////
 
+// 阻塞等待用的 futex (eventcount) 要调用 syscall(), -std=c11 下需要
+// _DEFAULT_SOURCE 才有声明, 必须在第一个系统头文件之前定义
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "chiba_channel.h"
 
 // 包含所有实现模块
 #include "chiba_channel_core.h"
 #include "chiba_channel_create.h"
+#include "chiba_channel_list.h"
 #include "chiba_channel_receiver.h"
+#include "chiba_channel_select.h"
 #include "chiba_channel_sender.h"
 #include "chiba_channel_shared.h"
+#include "chiba_channel_waker.h"
+#include "chiba_channel_zero.h"
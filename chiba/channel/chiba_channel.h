@@ -74,6 +74,22 @@ PUBLIC void chiba_sender_drop(chiba_sender_t **tx);
  */
 PUBLIC i32 chiba_sender_try_send(chiba_sender_t *tx, void *data);
 
+/**
+ * 阻塞发送 (bounded 满了等到有空位, rendezvous 等到 receiver 取走)
+ * 先短暂自旋, 然后休眠, 不占用 CPU
+ * @param tx sender
+ * @param data 要发送的指针 (void*)
+ * @return CHIBA_CHAN_OK | CHIBA_CHAN_DISCONNECTED
+ */
+PUBLIC i32 chiba_sender_send(chiba_sender_t *tx, void *data);
+
+/**
+ * 阻塞发送, 最多等待 nanosecs 纳秒 (UINT64_MAX 不限时)
+ * @return CHIBA_CHAN_OK | CHIBA_CHAN_TIMEOUT | CHIBA_CHAN_DISCONNECTED
+ */
+PUBLIC i32 chiba_sender_send_timeout(chiba_sender_t *tx, void *data,
+                                     u64 nanosecs);
+
 /**
  * 检查 receiver 是否已全部断开
  */
@@ -122,6 +138,22 @@ PUBLIC void chiba_receiver_drop(chiba_receiver_t **rx);
  */
 PUBLIC i32 chiba_receiver_try_recv(chiba_receiver_t *rx, void **data_out);
 
+/**
+ * 阻塞接收 (等到有消息或者所有 sender 断开)
+ * 先短暂自旋, 然后休眠, 不占用 CPU
+ * @param rx receiver
+ * @param data_out 输出参数: 接收到的指针
+ * @return CHIBA_CHAN_OK | CHIBA_CHAN_DISCONNECTED
+ */
+PUBLIC i32 chiba_receiver_recv(chiba_receiver_t *rx, void **data_out);
+
+/**
+ * 阻塞接收, 最多等待 nanosecs 纳秒 (UINT64_MAX 不限时)
+ * @return CHIBA_CHAN_OK | CHIBA_CHAN_TIMEOUT | CHIBA_CHAN_DISCONNECTED
+ */
+PUBLIC i32 chiba_receiver_recv_timeout(chiba_receiver_t *rx, void **data_out,
+                                       u64 nanosecs);
+
 /**
  * 检查 sender 是否已全部断开
  */
@@ -156,3 +188,28 @@ PUBLIC u64 chiba_receiver_capacity(chiba_receiver_t *rx);
 
 // 用于判断是否断开连接
 #define CHIBA_CHAN_IS_DISCONNECTED(ret) ((ret) == CHIBA_CHAN_DISCONNECTED)
+
+//////////////////////////////////////////////////////////////////////////////////
+// Select 操作
+//////////////////////////////////////////////////////////////////////////////////
+
+// select 的一个分支: tx 和 rx 只设置其中一个
+typedef struct chiba_select_op {
+  chiba_sender_t *tx;   // 发送分支
+  chiba_receiver_t *rx; // 接收分支
+  void *msg;            // 发送分支: 要发送的指针; 接收分支: 接收到的指针
+} chiba_select_op_t;
+
+/**
+ * 在多个发送 / 接收分支中完成恰好一个 (类似 Go 的 select)
+ * 同时登记到所有分支上等待, 不空转; 多个分支同时就绪时随机选一个
+ * @param ops 分支数组
+ * @param n 分支数
+ * @param nanosecs 最多等待多少纳秒 (UINT64_MAX 不限时, 0 表示都没就绪时
+ *                 立即返回, 相当于 default 分支)
+ * @param index_out 输出参数: 完成的分支下标
+ * @return CHIBA_CHAN_OK | CHIBA_CHAN_DISCONNECTED (该分支的对端已断开) |
+ *         CHIBA_CHAN_TIMEOUT (没有分支完成, index_out 不变)
+ */
+PUBLIC i32 chiba_select(chiba_select_op_t *ops, u32 n, u64 nanosecs,
+                        u32 *index_out);
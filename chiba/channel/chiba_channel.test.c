@@ -0,0 +1,688 @@
+#include "chiba_channel.h"
+#include "../chiba_testing.h"
+#include "../scheched_coroutine/scheched_coroutine.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+TEST_GROUP(channel);
+
+TEST_CASE(unbounded_fifo, channel, "Unbounded channels keep order", {
+  DESC(unbounded_fifo);
+
+  chiba_sender_t *tx;
+  chiba_receiver_t *rx;
+  chiba_channel_unbounded(&tx, &rx);
+  ASSERT_NOT_NULL(tx, "Sender created");
+  ASSERT_NOT_NULL(rx, "Receiver created");
+
+  void *msg = NULL;
+  ASSERT_EQ(CHIBA_CHAN_EMPTY, chiba_receiver_try_recv(rx, &msg),
+            "Nothing sent yet");
+  ASSERT_TRUE(chiba_receiver_is_empty(rx), "Empty before the first send");
+  ASSERT_EQ(UINT64_MAX, chiba_sender_capacity(tx), "No capacity");
+
+  // Several blocks' worth, with partial drains in between
+  i64 next_recv = 1;
+  i64 failed = 0;
+  for (i64 i = 1; i <= 1000; i++) {
+    failed += chiba_sender_try_send(tx, (void *)(intptr_t)i) != CHIBA_CHAN_OK;
+    if (i % 7 == 0) {
+      chiba_receiver_try_recv(rx, &msg);
+      failed += (intptr_t)msg != next_recv++;
+    }
+  }
+  ASSERT_EQ(0, failed, "Sends succeeded, messages came out in order");
+  ASSERT_EQ(1000 - (next_recv - 1), (i64)chiba_receiver_len(rx),
+            "Length counts queued messages");
+  ASSERT_TRUE(!chiba_sender_is_full(tx), "Never full");
+
+  // Messages sent before the last sender left are still delivered
+  chiba_sender_drop(&tx);
+  while (chiba_receiver_try_recv(rx, &msg) == CHIBA_CHAN_OK)
+    failed += (intptr_t)msg != next_recv++;
+  ASSERT_EQ(0, failed, "Drained in order");
+  ASSERT_EQ(1001, next_recv, "Every message received");
+  ASSERT_EQ(0, chiba_receiver_len(rx), "Drained");
+  ASSERT_EQ(CHIBA_CHAN_DISCONNECTED, chiba_receiver_try_recv(rx, &msg),
+            "Disconnected once drained");
+  chiba_receiver_drop(&rx);
+
+  // Dropping a channel with queued messages frees its blocks
+  chiba_channel_unbounded(&tx, &rx);
+  for (i64 i = 1; i <= 100; i++)
+    chiba_sender_try_send(tx, (void *)(intptr_t)i);
+  chiba_receiver_drop(&rx);
+  ASSERT_EQ(CHIBA_CHAN_DISCONNECTED,
+            chiba_sender_try_send(tx, (void *)(intptr_t)1),
+            "No receiver left");
+  chiba_sender_drop(&tx);
+  return 0;
+})
+
+//////////
+// many senders, many receivers
+//////////
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define PER_PRODUCER 100000
+
+PRIVATE chiba_sender_t *mpmc_tx[PRODUCERS];
+PRIVATE chiba_receiver_t *mpmc_rx[CONSUMERS];
+PRIVATE _Atomic(i64) received = 0;
+PRIVATE _Atomic(i64) received_sum = 0;
+PRIVATE _Atomic(i64) out_of_order = 0;
+
+PRIVATE anyptr producer(anyptr arg) {
+  i64 id = (i64)(intptr_t)arg;
+  for (i64 i = 1; i <= PER_PRODUCER; i++) {
+    // Bounded channels push back while full
+    void *msg = (void *)(intptr_t)(id * PER_PRODUCER + i);
+    while (chiba_sender_try_send(mpmc_tx[id], msg) == CHIBA_CHAN_FULL)
+      sched_yield();
+  }
+  chiba_sender_drop(&mpmc_tx[id]);
+  return NULL;
+}
+
+// Each producer's messages must come out in the order they went in
+PRIVATE anyptr consumer(anyptr arg) {
+  i64 id = (i64)(intptr_t)arg;
+  i64 last[PRODUCERS] = {0};
+  void *msg;
+  i32 ret;
+  while ((ret = chiba_receiver_try_recv(mpmc_rx[id], &msg)) !=
+         CHIBA_CHAN_DISCONNECTED) {
+    if (ret != CHIBA_CHAN_OK) {
+      sched_yield();
+      continue;
+    }
+    i64 v = (i64)(intptr_t)msg;
+    i64 from = (v - 1) / PER_PRODUCER;
+    if (v <= last[from])
+      atomic_fetch_add(&out_of_order, 1);
+    last[from] = v;
+    atomic_fetch_add(&received, 1);
+    atomic_fetch_add(&received_sum, v);
+  }
+  chiba_receiver_drop(&mpmc_rx[id]);
+  return NULL;
+}
+
+TEST_CASE(mpmc, channel, "Concurrent senders and receivers", {
+  DESC(mpmc);
+
+  // Unbounded, then bounded with a capacity far below the traffic
+  for (i32 bounded = 0; bounded < 2; bounded++) {
+    chiba_sender_t *tx;
+    chiba_receiver_t *rx;
+    if (bounded)
+      chiba_channel_bounded(16, &tx, &rx);
+    else
+      chiba_channel_unbounded(&tx, &rx);
+    for (i32 i = 0; i < PRODUCERS; i++)
+      mpmc_tx[i] = chiba_sender_clone(tx);
+    for (i32 i = 0; i < CONSUMERS; i++)
+      mpmc_rx[i] = chiba_receiver_clone(rx);
+    chiba_sender_drop(&tx);
+    chiba_receiver_drop(&rx);
+    atomic_store(&received, 0);
+    atomic_store(&received_sum, 0);
+    atomic_store(&out_of_order, 0);
+
+    pthread_t p[PRODUCERS];
+    pthread_t c[CONSUMERS];
+    for (i32 i = 0; i < CONSUMERS; i++)
+      pthread_create(&c[i], NULL, consumer, (anyptr)(intptr_t)i);
+    for (i32 i = 0; i < PRODUCERS; i++)
+      pthread_create(&p[i], NULL, producer, (anyptr)(intptr_t)i);
+    for (i32 i = 0; i < PRODUCERS; i++)
+      pthread_join(p[i], NULL);
+    for (i32 i = 0; i < CONSUMERS; i++)
+      pthread_join(c[i], NULL);
+
+    i64 n = (i64)PRODUCERS * PER_PRODUCER;
+    ASSERT_EQ(n, atomic_load(&received), "Every message received once");
+    ASSERT_EQ(n * (n + 1) / 2, atomic_load(&received_sum),
+              "No message changed");
+    ASSERT_EQ(0, atomic_load(&out_of_order), "Per-sender order kept");
+  }
+  return 0;
+})
+
+TEST_CASE(bounded_full, channel, "Bounded channels refuse sends when full", {
+  DESC(bounded_full);
+
+  chiba_sender_t *tx;
+  chiba_receiver_t *rx;
+  chiba_channel_bounded(4, &tx, &rx);
+  ASSERT_EQ(4, chiba_sender_capacity(tx), "Capacity");
+  for (i64 i = 1; i <= 4; i++)
+    chiba_sender_try_send(tx, (void *)(intptr_t)i);
+  ASSERT_TRUE(chiba_sender_is_full(tx), "Full");
+  ASSERT_EQ(CHIBA_CHAN_FULL, chiba_sender_try_send(tx, (void *)(intptr_t)5),
+            "Send refused");
+  void *msg = NULL;
+  ASSERT_EQ(CHIBA_CHAN_OK, chiba_receiver_try_recv(rx, &msg), "Received");
+  ASSERT_EQ(1, (intptr_t)msg, "Oldest first");
+  ASSERT_EQ(CHIBA_CHAN_OK, chiba_sender_try_send(tx, (void *)(intptr_t)5),
+            "Room again");
+  ASSERT_EQ(4, chiba_receiver_len(rx), "Length");
+
+  // NULL is a message like any other
+  while (chiba_receiver_try_recv(rx, &msg) == CHIBA_CHAN_OK)
+    ;
+  ASSERT_EQ(CHIBA_CHAN_OK, chiba_sender_try_send(tx, NULL), "NULL sent");
+  msg = (void *)1;
+  ASSERT_EQ(CHIBA_CHAN_OK, chiba_receiver_try_recv(rx, &msg), "NULL received");
+  ASSERT_NULL(msg, "Received NULL");
+  chiba_sender_drop(&tx);
+  chiba_receiver_drop(&rx);
+  return 0;
+})
+
+//////////
+// blocking send / recv
+//////////
+
+#define BLOCKING_ROUNDS 20000
+
+PRIVATE anyptr blocking_sender(anyptr arg) {
+  chiba_sender_t *tx = (chiba_sender_t *)arg;
+  for (i64 i = 1; i <= BLOCKING_ROUNDS; i++)
+    chiba_sender_send(tx, (void *)(intptr_t)i);
+  chiba_sender_drop(&tx);
+  return NULL;
+}
+
+TEST_CASE(blocking, channel, "Blocking operations wait for the other side", {
+  DESC(blocking);
+
+  // Unbounded, bounded(1), rendezvous
+  for (i32 flavor = 0; flavor < 3; flavor++) {
+    chiba_sender_t *tx;
+    chiba_receiver_t *rx;
+    if (flavor == 0)
+      chiba_channel_unbounded(&tx, &rx);
+    else
+      chiba_channel_bounded((u64)(2 - flavor), &tx, &rx);
+
+    pthread_t t;
+    pthread_create(&t, NULL, blocking_sender, tx);
+    void *msg = NULL;
+    i64 next = 1;
+    i64 failed = 0;
+    while (chiba_receiver_recv(rx, &msg) == CHIBA_CHAN_OK)
+      failed += (intptr_t)msg != next++;
+    pthread_join(t, NULL);
+    ASSERT_EQ(0, failed, "Messages came out in order");
+    ASSERT_EQ(BLOCKING_ROUNDS + 1, next, "Every message received");
+    chiba_receiver_drop(&rx);
+  }
+  return 0;
+})
+
+PRIVATE _Atomic(i32) waiter_result = -1;
+
+PRIVATE anyptr blocked_receiver(anyptr arg) {
+  chiba_receiver_t *rx = (chiba_receiver_t *)arg;
+  void *msg = NULL;
+  atomic_store(&waiter_result, chiba_receiver_recv(rx, &msg));
+  return NULL;
+}
+
+PRIVATE anyptr blocked_sender(anyptr arg) {
+  chiba_sender_t *tx = (chiba_sender_t *)arg;
+  atomic_store(&waiter_result, chiba_sender_send(tx, NULL));
+  return NULL;
+}
+
+TEST_CASE(rendezvous, channel, "Zero capacity channels hand messages over", {
+  DESC(rendezvous);
+
+  chiba_sender_t *tx;
+  chiba_receiver_t *rx;
+  chiba_channel_bounded(0, &tx, &rx);
+  ASSERT_EQ(0, chiba_sender_capacity(tx), "No capacity");
+  ASSERT_EQ(0, chiba_sender_len(tx), "Nothing buffered");
+  ASSERT_EQ(CHIBA_CHAN_FULL, chiba_sender_try_send(tx, (void *)(intptr_t)1),
+            "No receiver waiting");
+  void *msg = NULL;
+  ASSERT_EQ(CHIBA_CHAN_EMPTY, chiba_receiver_try_recv(rx, &msg),
+            "No sender waiting");
+
+  // try_send succeeds once a receiver waits
+  atomic_store(&waiter_result, -1);
+  pthread_t t;
+  pthread_create(&t, NULL, blocked_receiver, rx);
+  while (chiba_sender_try_send(tx, (void *)(intptr_t)7) != CHIBA_CHAN_OK)
+    CHIBA_INTERNAL_usleep(100);
+  pthread_join(t, NULL);
+  ASSERT_EQ(CHIBA_CHAN_OK, atomic_load(&waiter_result), "Handed over");
+
+  // and try_recv once a sender waits
+  atomic_store(&waiter_result, -1);
+  pthread_create(&t, NULL, blocked_sender, tx);
+  while (chiba_receiver_try_recv(rx, &msg) != CHIBA_CHAN_OK)
+    CHIBA_INTERNAL_usleep(100);
+  pthread_join(t, NULL);
+  ASSERT_EQ(CHIBA_CHAN_OK, atomic_load(&waiter_result), "Taken");
+  ASSERT_NULL(msg, "Sent NULL");
+
+  // Dropping the last sender wakes a blocked receiver
+  atomic_store(&waiter_result, -1);
+  pthread_create(&t, NULL, blocked_receiver, rx);
+  CHIBA_INTERNAL_usleep(20000);
+  chiba_sender_drop(&tx);
+  pthread_join(t, NULL);
+  ASSERT_EQ(CHIBA_CHAN_DISCONNECTED, atomic_load(&waiter_result),
+            "Receiver woke up disconnected");
+  chiba_receiver_drop(&rx);
+
+  // Same for a sender blocked on a full bounded channel
+  chiba_channel_bounded(1, &tx, &rx);
+  chiba_sender_send(tx, NULL);
+  atomic_store(&waiter_result, -1);
+  pthread_create(&t, NULL, blocked_sender, tx);
+  CHIBA_INTERNAL_usleep(20000);
+  ASSERT_EQ(-1, atomic_load(&waiter_result), "Sender blocked");
+  chiba_receiver_drop(&rx);
+  pthread_join(t, NULL);
+  ASSERT_EQ(CHIBA_CHAN_DISCONNECTED, atomic_load(&waiter_result),
+            "Sender woke up disconnected");
+  chiba_sender_drop(&tx);
+  return 0;
+})
+
+PRIVATE anyptr late_sender(anyptr arg) {
+  chiba_sender_t *tx = (chiba_sender_t *)arg;
+  CHIBA_INTERNAL_usleep(5000);
+  chiba_sender_send(tx, (void *)(intptr_t)42);
+  return NULL;
+}
+
+TEST_CASE(timeout, channel, "Timed operations give up at the deadline", {
+  DESC(timeout);
+
+  // Unbounded, bounded(1), rendezvous
+  for (i32 flavor = 0; flavor < 3; flavor++) {
+    chiba_sender_t *tx;
+    chiba_receiver_t *rx;
+    if (flavor == 0)
+      chiba_channel_unbounded(&tx, &rx);
+    else
+      chiba_channel_bounded((u64)(2 - flavor), &tx, &rx);
+
+    void *msg = NULL;
+    u64 start = get_time_in_nanoseconds();
+    ASSERT_EQ(CHIBA_CHAN_TIMEOUT,
+              chiba_receiver_recv_timeout(rx, &msg, 20000000ULL),
+              "Nothing to receive");
+    ASSERT_TRUE(get_time_in_nanoseconds() - start >= 20000000ULL,
+                "Waited until the deadline");
+    ASSERT_EQ(CHIBA_CHAN_TIMEOUT, chiba_receiver_recv_timeout(rx, &msg, 0),
+              "Zero timeout does not wait");
+
+    // Fill a bounded channel; a rendezvous one has no receiver waiting
+    if (flavor == 1)
+      chiba_sender_send(tx, NULL);
+    if (flavor != 0) {
+      ASSERT_EQ(CHIBA_CHAN_TIMEOUT,
+                chiba_sender_send_timeout(tx, NULL, 20000000ULL),
+                "No room");
+      if (flavor == 1)
+        chiba_receiver_recv(rx, &msg);
+    }
+
+    // The timed out waiter is gone, and a message in time is received
+    pthread_t t;
+    pthread_create(&t, NULL, late_sender, tx);
+    ASSERT_EQ(CHIBA_CHAN_OK,
+              chiba_receiver_recv_timeout(rx, &msg, 10000000000ULL),
+              "Received before the deadline");
+    ASSERT_EQ(42, (intptr_t)msg, "Right message");
+    pthread_join(t, NULL);
+    if (flavor == 2)
+      ASSERT_EQ(CHIBA_CHAN_FULL, chiba_sender_try_send(tx, NULL),
+                "No receiver left registered");
+    chiba_sender_drop(&tx);
+    chiba_receiver_drop(&rx);
+  }
+  return 0;
+})
+
+//////////
+// chiba_sco coroutines park, not the thread
+//////////
+
+#define CO_RECEIVERS 1000
+
+PRIVATE chiba_sender_t *co_tx;
+PRIVATE chiba_receiver_t *co_rx;
+PRIVATE _Atomic(i64) co_received = 0;
+PRIVATE _Atomic(i64) co_sum = 0;
+
+PRIVATE void co_receiver(anyptr arg) {
+  (void)arg;
+  void *msg = NULL;
+  if (chiba_receiver_recv(co_rx, &msg) == CHIBA_CHAN_OK) {
+    atomic_fetch_add(&co_received, 1);
+    atomic_fetch_add(&co_sum, (intptr_t)msg);
+  }
+}
+
+PRIVATE void co_sender(anyptr arg) {
+  (void)arg;
+  for (i64 i = 1; i <= CO_RECEIVERS; i++)
+    chiba_sender_send(co_tx, (void *)(intptr_t)i);
+}
+
+PRIVATE anyptr thread_sender(anyptr arg) {
+  co_sender(arg);
+  return NULL;
+}
+
+PRIVATE _Atomic(i32) co_timeouts = 0;
+
+PRIVATE void co_receiver_timeout(anyptr arg) {
+  (void)arg;
+  void *msg = NULL;
+  if (chiba_receiver_recv_timeout(co_rx, &msg, 20000000ULL) ==
+      CHIBA_CHAN_TIMEOUT)
+    atomic_fetch_add(&co_timeouts, 1);
+}
+
+PRIVATE void co_spawn(void (*entry)(anyptr)) {
+  chiba_sco_desc desc = {.entry = entry};
+  chiba_sco_spawn(&desc);
+}
+
+TEST_CASE(coroutines, channel, "Coroutines share channels on one thread", {
+  DESC(coroutines);
+
+  // Unbounded, bounded(1), rendezvous; senders on this thread, then another
+  for (i32 round = 0; round < 6; round++) {
+    i32 flavor = round % 3;
+    if (flavor == 0)
+      chiba_channel_unbounded(&co_tx, &co_rx);
+    else
+      chiba_channel_bounded((u64)(2 - flavor), &co_tx, &co_rx);
+    atomic_store(&co_received, 0);
+    atomic_store(&co_sum, 0);
+
+    for (i32 i = 0; i < CO_RECEIVERS; i++)
+      co_spawn(co_receiver);
+    ASSERT_EQ(CO_RECEIVERS, chiba_sco_info_all().paused,
+              "Receivers parked, the thread did not block");
+    pthread_t t;
+    if (round < 3)
+      co_spawn(co_sender);
+    else
+      pthread_create(&t, NULL, thread_sender, NULL);
+    while (chiba_sco_active())
+      chiba_sco_resume(0);
+    if (round >= 3)
+      pthread_join(t, NULL);
+
+    ASSERT_EQ(CO_RECEIVERS, atomic_load(&co_received), "Every receiver woke");
+    ASSERT_EQ((i64)CO_RECEIVERS * (CO_RECEIVERS + 1) / 2,
+              atomic_load(&co_sum), "Every message received once");
+    chiba_sender_drop(&co_tx);
+    chiba_receiver_drop(&co_rx);
+  }
+
+  // A timed wait parks too: the runloop wakes it at the deadline
+  chiba_channel_unbounded(&co_tx, &co_rx);
+  u64 start = get_time_in_nanoseconds();
+  co_spawn(co_receiver_timeout);
+  ASSERT_EQ(1, chiba_sco_info_all().paused, "Timed receiver parked");
+  chiba_sco_resume(0);
+  ASSERT_EQ(0, chiba_sco_info_all().scheduled, "Timed receiver not yielding");
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_EQ(1, atomic_load(&co_timeouts), "Timed receiver timed out");
+  ASSERT_TRUE(get_time_in_nanoseconds() - start >= 20000000ULL,
+              "Waited until the deadline");
+  chiba_sender_drop(&co_tx);
+  chiba_receiver_drop(&co_rx);
+  return 0;
+})
+
+//////////
+// select
+//////////
+
+#define SELECT_INPUTS 3
+#define SELECT_PER_INPUT 20000
+
+PRIVATE chiba_sender_t *sel_tx[SELECT_INPUTS];
+PRIVATE chiba_receiver_t *sel_rx[SELECT_INPUTS];
+
+// Unbounded, bounded(1), rendezvous
+PRIVATE void select_open(void) {
+  chiba_channel_unbounded(&sel_tx[0], &sel_rx[0]);
+  chiba_channel_bounded(1, &sel_tx[1], &sel_rx[1]);
+  chiba_channel_bounded(0, &sel_tx[2], &sel_rx[2]);
+}
+
+PRIVATE void select_close(void) {
+  for (i32 i = 0; i < SELECT_INPUTS; i++) {
+    chiba_sender_drop(&sel_tx[i]);
+    chiba_receiver_drop(&sel_rx[i]);
+  }
+}
+
+PRIVATE void select_recv_ops(chiba_select_op_t *ops) {
+  for (i32 i = 0; i < SELECT_INPUTS; i++) {
+    ops[i].tx = NULL;
+    ops[i].rx = sel_rx[i];
+    ops[i].msg = NULL;
+  }
+}
+
+PRIVATE _Atomic(i32) sel_target = 0;
+
+PRIVATE anyptr select_late_sender(anyptr arg) {
+  (void)arg;
+  CHIBA_INTERNAL_usleep(5000);
+  i32 i = atomic_load(&sel_target);
+  chiba_sender_send(sel_tx[i], (void *)(intptr_t)(i + 100));
+  return NULL;
+}
+
+PRIVATE anyptr select_input(anyptr arg) {
+  // The router replaces sel_tx[i] once it sees the disconnect
+  chiba_sender_t *tx = sel_tx[(intptr_t)arg];
+  for (i64 k = 1; k <= SELECT_PER_INPUT; k++)
+    chiba_sender_send(tx, (void *)(intptr_t)k);
+  chiba_sender_drop(&tx);
+  return NULL;
+}
+
+PRIVATE u32 shared_index = 0;
+PRIVATE i32 shared_ret = 0;
+PRIVATE u64 shared_waited = 0;
+
+PRIVATE anyptr select_shared_selector(anyptr arg) {
+  (void)arg;
+  chiba_select_op_t ops[SELECT_INPUTS];
+  select_recv_ops(ops);
+  chiba_select(ops, 2, UINT64_MAX, &shared_index);
+  return NULL;
+}
+
+PRIVATE anyptr select_shared_receiver(anyptr arg) {
+  (void)arg;
+  void *msg = NULL;
+  u64 start = get_time_in_nanoseconds();
+  shared_ret = chiba_receiver_recv_timeout(sel_rx[0], &msg, 2000000000ULL);
+  shared_waited = get_time_in_nanoseconds() - start;
+  return NULL;
+}
+
+TEST_CASE(select, channel, "Select completes exactly one operation", {
+  DESC(select);
+
+  select_open();
+  chiba_select_op_t ops[SELECT_INPUTS];
+  u32 index = 0;
+
+  // Default and timeout when nothing is ready
+  select_recv_ops(ops);
+  ASSERT_EQ(CHIBA_CHAN_TIMEOUT, chiba_select(ops, SELECT_INPUTS, 0, &index),
+            "Default case");
+  u64 start = get_time_in_nanoseconds();
+  ASSERT_EQ(CHIBA_CHAN_TIMEOUT,
+            chiba_select(ops, SELECT_INPUTS, 20000000ULL, &index),
+            "Timed out");
+  ASSERT_TRUE(get_time_in_nanoseconds() - start >= 20000000ULL,
+              "Waited until the deadline");
+
+  // A ready branch is taken without waiting
+  chiba_sender_send(sel_tx[1], (void *)(intptr_t)7);
+  ASSERT_EQ(CHIBA_CHAN_OK, chiba_select(ops, SELECT_INPUTS, 0, &index),
+            "Ready branch");
+  ASSERT_EQ(1, index, "Right branch");
+  ASSERT_EQ(7, (intptr_t)ops[1].msg, "Right message");
+
+  // A blocked select wakes for whichever channel gets a message
+  for (i32 i = 0; i < SELECT_INPUTS; i++) {
+    select_recv_ops(ops);
+    atomic_store(&sel_target, i);
+    pthread_t t;
+    pthread_create(&t, NULL, select_late_sender, NULL);
+    i32 ret = chiba_select(ops, SELECT_INPUTS, UINT64_MAX, &index);
+    pthread_join(t, NULL);
+    ASSERT_EQ(CHIBA_CHAN_OK, ret, "Woke up");
+    ASSERT_EQ((u32)i, index, "Woke up for the channel written to");
+    ASSERT_EQ(i + 100, (intptr_t)ops[i].msg, "Got its message");
+  }
+
+  // Send branches wait for room
+  chiba_select_op_t send_ops[2];
+  chiba_sender_send(sel_tx[1], NULL);
+  send_ops[0].tx = sel_tx[1];
+  send_ops[0].rx = NULL;
+  send_ops[0].msg = (void *)(intptr_t)9;
+  send_ops[1].tx = NULL;
+  send_ops[1].rx = sel_rx[0];
+  ASSERT_EQ(CHIBA_CHAN_TIMEOUT, chiba_select(send_ops, 2, 0, &index),
+            "Full and empty");
+  void *msg = NULL;
+  chiba_receiver_recv(sel_rx[1], &msg);
+  ASSERT_EQ(CHIBA_CHAN_OK, chiba_select(send_ops, 2, UINT64_MAX, &index),
+            "Room again");
+  ASSERT_EQ(0, index, "Sent");
+  chiba_receiver_recv(sel_rx[1], &msg);
+  ASSERT_EQ(9, (intptr_t)msg, "Sent the message");
+
+  // A disconnected branch completes
+  chiba_sender_drop(&sel_tx[2]);
+  sel_tx[2] = NULL;
+  select_recv_ops(ops);
+  ASSERT_EQ(CHIBA_CHAN_DISCONNECTED,
+            chiba_select(ops, SELECT_INPUTS, UINT64_MAX, &index),
+            "Disconnected");
+  ASSERT_EQ(2, index, "On the dropped channel");
+  select_close();
+
+  // Branches that are always ready are picked about equally often
+  select_open();
+  for (i64 k = 0; k < 3000; k++)
+    chiba_sender_try_send(sel_tx[0], NULL);
+  chiba_sender_send(sel_tx[1], NULL);
+  i64 picks[SELECT_INPUTS] = {0};
+  for (i32 k = 0; k < 2000; k++) {
+    select_recv_ops(ops);
+    chiba_select(ops, 2, 0, &index);
+    picks[index]++;
+    if (index == 1)
+      chiba_sender_send(sel_tx[1], NULL);
+  }
+  ASSERT_TRUE(picks[0] > 800, "First branch not starved");
+  ASSERT_TRUE(picks[1] > 800, "Second branch not starved");
+  select_close();
+  return 0;
+})
+
+TEST_CASE(select_shared, channel, "Select and plain receivers share a channel", {
+  DESC(select_shared);
+
+  // A select on channels 0 and 1 is notified first for channel 0, but may
+  // complete channel 1; the receiver behind it on channel 0 must still wake
+  for (i32 round = 0; round < 16; round++) {
+    chiba_channel_unbounded(&sel_tx[0], &sel_rx[0]);
+    chiba_channel_unbounded(&sel_tx[1], &sel_rx[1]);
+    pthread_t selector;
+    pthread_t receiver;
+    pthread_create(&selector, NULL, select_shared_selector, NULL);
+    CHIBA_INTERNAL_usleep(5000);
+    pthread_create(&receiver, NULL, select_shared_receiver, NULL);
+    CHIBA_INTERNAL_usleep(5000);
+    chiba_sender_send(sel_tx[0], (void *)(intptr_t)1);
+    chiba_sender_send(sel_tx[1], (void *)(intptr_t)2);
+    pthread_join(selector, NULL);
+    // The select took channel 0's message, give the receiver another one
+    if (shared_index == 0)
+      chiba_sender_send(sel_tx[0], (void *)(intptr_t)3);
+    pthread_join(receiver, NULL);
+    ASSERT_EQ(CHIBA_CHAN_OK, shared_ret, "Receiver got a message");
+    ASSERT_TRUE(shared_waited < 1000000000ULL, "Receiver was woken");
+    for (i32 i = 0; i < 2; i++) {
+      chiba_sender_drop(&sel_tx[i]);
+      chiba_receiver_drop(&sel_rx[i]);
+    }
+  }
+  return 0;
+})
+
+TEST_CASE(select_router, channel, "Select multiplexes concurrent inputs", {
+  DESC(select_router);
+
+  select_open();
+  pthread_t t[SELECT_INPUTS];
+  for (i32 i = 0; i < SELECT_INPUTS; i++)
+    pthread_create(&t[i], NULL, select_input, (anyptr)(intptr_t)i);
+
+  chiba_select_op_t ops[SELECT_INPUTS];
+  i64 next[SELECT_INPUTS];
+  for (i32 i = 0; i < SELECT_INPUTS; i++)
+    next[i] = 1;
+  i64 failed = 0;
+  i32 open = SELECT_INPUTS;
+  while (open > 0) {
+    select_recv_ops(ops);
+    u32 index = 0;
+    i32 ret = chiba_select(ops, SELECT_INPUTS, UINT64_MAX, &index);
+    if (ret == CHIBA_CHAN_DISCONNECTED) {
+      // Stop selecting on it by swapping in a channel that stays empty
+      chiba_receiver_drop(&sel_rx[index]);
+      chiba_channel_unbounded(&sel_tx[index], &sel_rx[index]);
+      open--;
+      continue;
+    }
+    failed += (intptr_t)ops[index].msg != next[index]++;
+  }
+  for (i32 i = 0; i < SELECT_INPUTS; i++)
+    pthread_join(t[i], NULL);
+  ASSERT_EQ(0, failed, "Per-input order kept");
+  for (i32 i = 0; i < SELECT_INPUTS; i++)
+    ASSERT_EQ(SELECT_PER_INPUT + 1, next[i], "Every message received");
+  select_close();
+  return 0;
+})
+
+REGISTER_TEST_GROUP(channel) {
+  REGISTER_TEST(unbounded_fifo, channel);
+  REGISTER_TEST(mpmc, channel);
+  REGISTER_TEST(bounded_full, channel);
+  REGISTER_TEST(blocking, channel);
+  REGISTER_TEST(rendezvous, channel);
+  REGISTER_TEST(timeout, channel);
+  REGISTER_TEST(coroutines, channel);
+  REGISTER_TEST(select, channel);
+  REGISTER_TEST(select_shared, channel);
+  REGISTER_TEST(select_router, channel);
+}
+
+ENABLE_TEST_GROUP(channel);
@@ -5,50 +5,47 @@
 //////////////////////////////////////////////////////////////////////////////////
 
 #include "chiba_channel_shared.h"
-
-//////////////////////////////////////////////////////////////////////////////////
-// 队列节点管理
-//////////////////////////////////////////////////////////////////////////////////
-
-PRIVATE chiba_chan_node_t *chiba_chan_node_new(void *data) {
-  chiba_chan_node_t *node =
-      (chiba_chan_node_t *)CHIBA_INTERNAL_malloc(sizeof(chiba_chan_node_t));
-  if (!node)
-    return NULL;
-  node->data = data;
-  node->next = NULL;
-  return node;
-}
-
-PRIVATE void chiba_chan_node_free(chiba_chan_node_t *node) {
-  CHIBA_INTERNAL_free(node);
-}
+#include <stdint.h>
 
 //////////////////////////////////////////////////////////////////////////////////
 // Channel 创建和销毁
 //////////////////////////////////////////////////////////////////////////////////
 
-PRIVATE chiba_channel_t *chiba_channel_new(u64 capacity) {
-  chiba_channel_t *chan =
-      (chiba_channel_t *)CHIBA_INTERNAL_malloc(sizeof(chiba_channel_t));
+PRIVATE chiba_channel_t *chiba_channel_new(chiba_chan_flavor_t flavor,
+                                           u64 capacity) {
+  // list 的 head / tail 按 cache line 对齐, aligned_alloc 要求大小是对齐的整数倍
+  chiba_channel_t *chan = (chiba_channel_t *)CHIBA_INTERNAL_malloc_aligned(
+      64, (sizeof(chiba_channel_t) + 63) & ~(size_t)63);
   if (!chan)
     return NULL;
 
+  chan->flavor = flavor;
+
   // 初始化队列为空
-  chan->head = NULL;
-  chan->tail = NULL;
+  chan_list_init(&chan->list);
+  chan->array = NULL;
+  chan_zero_init(&chan->zero);
+  chan_sync_waker_init(&chan->senders);
+  chan_sync_waker_init(&chan->receivers);
+  if (flavor == CHIBA_CHAN_FLAVOR_ARRAY) {
+    chan->array = chiba_arrayqueue_new(capacity);
+    if (!chan->array) {
+      chan_sync_waker_drop(&chan->receivers);
+      chan_sync_waker_drop(&chan->senders);
+      chan_zero_drop(&chan->zero);
+      CHIBA_INTERNAL_free(chan);
+      return NULL;
+    }
+  }
 
   // 设置容量
   chan->capacity = capacity;
 
   // 初始化原子变量
-  atomic_init(&chan->len, 0);
   atomic_init(&chan->sender_count, 1);
   atomic_init(&chan->receiver_count, 1);
   atomic_init(&chan->disconnected, false);
-
-  // 初始化互斥锁
-  pthread_mutex_init(&chan->mutex, NULL);
+  atomic_init(&chan->destroy, false);
 
   return chan;
 }
@@ -57,18 +54,14 @@ PRIVATE void chiba_channel_destroy(chiba_channel_t *chan) {
   if (!chan)
     return;
 
-  // 释放所有剩余节点
-  pthread_mutex_lock(&chan->mutex);
-  chiba_chan_node_t *node = chan->head;
-  while (node) {
-    chiba_chan_node_t *next = node->next;
-    chiba_chan_node_free(node);
-    node = next;
-  }
-  pthread_mutex_unlock(&chan->mutex);
-
-  // 销毁互斥锁
-  pthread_mutex_destroy(&chan->mutex);
+  // 释放剩余的 block / 环形队列
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST)
+    chan_list_drop(&chan->list);
+  else if (chan->flavor == CHIBA_CHAN_FLAVOR_ARRAY)
+    chiba_arrayqueue_drop(chan->array);
+  chan_zero_drop(&chan->zero);
+  chan_sync_waker_drop(&chan->senders);
+  chan_sync_waker_drop(&chan->receivers);
 
   // 释放 channel
   CHIBA_INTERNAL_free(chan);
@@ -84,79 +77,28 @@ PRIVATE bool chiba_channel_enqueue(chiba_channel_t *chan, void *data) {
     return false;
   }
 
-  // 检查容量 (bounded channel)
-  if (chan->capacity > 0) {
-    u64 current_len = atomic_load_explicit(&chan->len, memory_order_relaxed);
-    if (current_len >= chan->capacity) {
-      return false; // 队列已满
-    }
-  }
-
-  // 创建新节点
-  chiba_chan_node_t *node = chiba_chan_node_new(data);
-  if (!node)
-    return false;
-
-  // 加锁并入队
-  pthread_mutex_lock(&chan->mutex);
-
-  // 再次检查断开状态 (double-check)
-  if (atomic_load_explicit(&chan->disconnected, memory_order_relaxed)) {
-    pthread_mutex_unlock(&chan->mutex);
-    chiba_chan_node_free(node);
-    return false;
-  }
-
-  // 再次检查容量
-  if (chan->capacity > 0 &&
-      atomic_load_explicit(&chan->len, memory_order_relaxed) >=
-          chan->capacity) {
-    pthread_mutex_unlock(&chan->mutex);
-    chiba_chan_node_free(node);
-    return false;
-  }
-
-  // 入队操作
-  if (chan->tail) {
-    chan->tail->next = node;
-    chan->tail = node;
+  bool ok;
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST) {
+    // Unbounded: 无锁, 每个 block 分配一次
+    ok = chan_list_push(&chan->list, data);
   } else {
-    chan->head = node;
-    chan->tail = node;
+    // Bounded: 无锁, 不分配内存, 满了返回 false
+    ok = chiba_arrayqueue_push(chan->array, data);
   }
 
-  // 增加长度
-  atomic_fetch_add_explicit(&chan->len, 1, memory_order_relaxed);
-
-  pthread_mutex_unlock(&chan->mutex);
-  return true;
+  // 没有 receiver 阻塞时只是一次原子读
+  if (ok)
+    chan_sync_waker_notify(&chan->receivers);
+  return ok;
 }
 
 PRIVATE bool chiba_channel_dequeue(chiba_channel_t *chan, void **data_out) {
-  pthread_mutex_lock(&chan->mutex);
-
-  // 检查队列是否为空
-  if (!chan->head) {
-    pthread_mutex_unlock(&chan->mutex);
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST)
+    return chan_list_pop(&chan->list, data_out);
+  if (!chiba_arrayqueue_try_pop(chan->array, data_out))
     return false;
-  }
-
-  // 出队操作
-  chiba_chan_node_t *node = chan->head;
-  chan->head = node->next;
-  if (!chan->head) {
-    chan->tail = NULL; // 队列空了
-  }
-
-  // 减少长度
-  atomic_fetch_sub_explicit(&chan->len, 1, memory_order_relaxed);
-
-  pthread_mutex_unlock(&chan->mutex);
-
-  // 提取数据并释放节点
-  *data_out = node->data;
-  chiba_chan_node_free(node);
-
+  // 腾出了一个位置
+  chan_sync_waker_notify(&chan->senders);
   return true;
 }
 
@@ -169,22 +111,31 @@ PRIVATE bool chiba_channel_is_disconnected(chiba_channel_t *chan) {
 }
 
 PRIVATE bool chiba_channel_is_empty(chiba_channel_t *chan) {
-  return atomic_load_explicit(&chan->len, memory_order_relaxed) == 0;
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST)
+    return chan_list_is_empty(&chan->list);
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return true; // 从不缓冲消息
+  return chiba_arrayqueue_is_empty(chan->array);
 }
 
 PRIVATE bool chiba_channel_is_full(chiba_channel_t *chan) {
-  if (chan->capacity == 0)
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST)
     return false; // unbounded
-  return atomic_load_explicit(&chan->len, memory_order_relaxed) >=
-         chan->capacity;
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return true; // 没有 receiver 等待时发送不出去
+  return chiba_arrayqueue_is_full(chan->array);
 }
 
 PRIVATE u64 chiba_channel_len(chiba_channel_t *chan) {
-  return atomic_load_explicit(&chan->len, memory_order_relaxed);
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST)
+    return chan_list_len(&chan->list);
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return 0;
+  return chiba_arrayqueue_size(chan->array);
 }
 
 PRIVATE u64 chiba_channel_capacity(chiba_channel_t *chan) {
-  return chan->capacity == 0 ? UINT64_MAX : chan->capacity;
+  return chan->flavor == CHIBA_CHAN_FLAVOR_LIST ? UINT64_MAX : chan->capacity;
 }
 
 PRIVATE u64 chiba_channel_sender_count(chiba_channel_t *chan) {
@@ -199,6 +150,100 @@ PRIVATE u64 chiba_channel_receiver_count(chiba_channel_t *chan) {
 // 断开操作
 //////////////////////////////////////////////////////////////////////////////////
 
+// 置位后唤醒所有阻塞中的操作
 PRIVATE void chiba_channel_disconnect(chiba_channel_t *chan) {
-  atomic_store_explicit(&chan->disconnected, true, memory_order_release);
+  atomic_store_explicit(&chan->disconnected, true, memory_order_seq_cst);
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO) {
+    chan_zero_disconnect(&chan->zero);
+  } else {
+    chan_sync_waker_disconnect(&chan->senders);
+    chan_sync_waker_disconnect(&chan->receivers);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// 阻塞操作
+//
+// list / array flavor: 操作失败后先带退避地重试一小会儿 (协程里不空转, 让出
+// 线程给对端), 然后在 sync waker 里
+// 登记一个栈上的 context, 登记后再检查一次 channel, 然后 park 直到对端通知、
+// 断开或者超时, 醒来后注销并重试.
+// zero flavor 见 chiba_channel_zero.h
+//
+// deadline 是 get_time_in_nanoseconds 的绝对时间, UINT64_MAX 表示不限时
+//////////////////////////////////////////////////////////////////////////////////
+
+// 在 waiters 里等到 ready 返回 true、被唤醒或者 deadline 过去
+PRIVATE void chiba_channel_block(chiba_channel_t *chan,
+                                 chiba_chan_sync_waker_t *waiters,
+                                 bool (*ready)(chiba_channel_t *chan),
+                                 u64 deadline) {
+  chiba_chan_context_t cx;
+  chan_context_init(&cx);
+  chan_sync_waker_register(waiters, (uintptr_t)&cx, &cx);
+  // 登记前对端可能已经改变了 channel
+  if (ready(chan) || chiba_channel_is_disconnected(chan))
+    chan_context_try_select(&cx, CHAN_SEL_ABORTED);
+  chan_context_wait_until(&cx, deadline);
+  chan_sync_waker_unregister(waiters, (uintptr_t)&cx);
+  chan_context_drop(&cx);
+}
+
+PRIVATE bool chiba_channel_has_room(chiba_channel_t *chan) {
+  return !chiba_channel_is_full(chan);
+}
+
+PRIVATE bool chiba_channel_has_msg(chiba_channel_t *chan) {
+  return !chiba_channel_is_empty(chan);
+}
+
+PRIVATE i32 chiba_channel_send(chiba_channel_t *chan, void *data,
+                               u64 deadline) {
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return chan_zero_send(&chan->zero, data, deadline);
+  bool spin = !chiba_sco_id();
+  chiba_backoff b = {.step = 0};
+  for (;;) {
+    if (chiba_channel_enqueue(chan, data))
+      return CHIBA_CHAN_OK;
+    if (chiba_channel_is_disconnected(chan))
+      return CHIBA_CHAN_DISCONNECTED;
+    // unbounded 只会因为内存不足失败, 等也没用
+    if (chan->flavor == CHIBA_CHAN_FLAVOR_LIST)
+      return CHIBA_CHAN_FULL;
+    if (chan_deadline_passed(deadline))
+      return CHIBA_CHAN_TIMEOUT;
+    if (spin && !backoff_is_completed(&b)) {
+      backoff_snooze(&b);
+      continue;
+    }
+    chiba_channel_block(chan, &chan->senders, chiba_channel_has_room,
+                        deadline);
+  }
+}
+
+PRIVATE i32 chiba_channel_recv(chiba_channel_t *chan, void **data_out,
+                               u64 deadline) {
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return chan_zero_recv(&chan->zero, data_out, deadline);
+  bool spin = !chiba_sco_id();
+  chiba_backoff b = {.step = 0};
+  for (;;) {
+    if (chiba_channel_dequeue(chan, data_out))
+      return CHIBA_CHAN_OK;
+    // 断开后仍然先取完剩余的消息
+    if (chiba_channel_is_disconnected(chan)) {
+      if (chiba_channel_dequeue(chan, data_out))
+        return CHIBA_CHAN_OK;
+      return CHIBA_CHAN_DISCONNECTED;
+    }
+    if (chan_deadline_passed(deadline))
+      return CHIBA_CHAN_TIMEOUT;
+    if (spin && !backoff_is_completed(&b)) {
+      backoff_snooze(&b);
+      continue;
+    }
+    chiba_channel_block(chan, &chan->receivers, chiba_channel_has_msg,
+                        deadline);
+  }
 }
@@ -17,7 +17,7 @@ PUBLIC void chiba_channel_unbounded(chiba_sender_t **tx_out,
     return;
 
   // 创建 channel (capacity = 0 表示 unbounded)
-  chiba_channel_t *chan = chiba_channel_new(0);
+  chiba_channel_t *chan = chiba_channel_new(CHIBA_CHAN_FLAVOR_LIST, 0);
   if (!chan) {
     *tx_out = NULL;
     *rx_out = NULL;
@@ -60,8 +60,9 @@ PUBLIC void chiba_channel_bounded(u64 capacity, chiba_sender_t **tx_out,
   if (!tx_out || !rx_out)
     return;
 
-  // 创建 channel
-  chiba_channel_t *chan = chiba_channel_new(capacity);
+  // 创建 channel (capacity = 0 表示 rendezvous)
+  chiba_channel_t *chan = chiba_channel_new(
+      capacity ? CHIBA_CHAN_FLAVOR_ARRAY : CHIBA_CHAN_FLAVOR_ZERO, capacity);
   if (!chan) {
     *tx_out = NULL;
     *rx_out = NULL;
@@ -0,0 +1,305 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////////
+// Chiba Channel - 无界 channel (list flavor)
+//
+// 无锁分段链表, 参考 crossbeam-channel 的 list flavor:
+// - 消息存放在固定大小的 block 中, 每 CHAN_BLOCK_CAP 条消息才分配一次
+// - head / tail 是单调递增的位置, sender 和 receiver 各自 CAS 抢占一个位置,
+//   快路径上没有锁
+// - 位置的低位 CHAN_MARK_BIT: head 上表示 "head 和 tail 不在同一个 block",
+//   此时 receiver 不需要读 tail 来判断是否为空
+// - block 由最后一个读完它的 receiver 释放
+//////////////////////////////////////////////////////////////////////////////////
+
+#include "../basic_memory.h"
+#include "../utils/backoff.h"
+#include <stdatomic.h>
+
+#define CHAN_LAP CHIBA_CHAN_BLOCK_LAP
+#define CHAN_BLOCK_CAP (CHAN_LAP - 1) // 每个 lap 的最后一个位置用于切换 block
+#define CHAN_SHIFT 1
+#define CHAN_MARK_BIT 1ULL
+
+// slot 状态位
+#define CHAN_SLOT_WRITE 1u   // 消息已写入
+#define CHAN_SLOT_READ 2u    // 消息已读出
+#define CHAN_SLOT_DESTROY 4u // block 等待这个 slot 的 reader 释放
+
+typedef struct chiba_chan_slot {
+  void *msg;
+  _Atomic u32 state;
+} chiba_chan_slot_t;
+
+typedef struct chiba_chan_block {
+  _Atomic(struct chiba_chan_block *) next;
+  chiba_chan_slot_t slots[CHAN_BLOCK_CAP];
+} chiba_chan_block_t;
+
+// head / tail 各占一条 cache line
+typedef struct chiba_chan_position {
+  _Atomic u64 index;
+  _Atomic(chiba_chan_block_t *) block;
+} __attribute__((aligned(64))) chiba_chan_position_t;
+
+typedef struct chiba_chan_list {
+  chiba_chan_position_t head;
+  chiba_chan_position_t tail;
+} chiba_chan_list_t;
+
+//////////////////////////////////////////////////////////////////////////////////
+// Block 管理
+//////////////////////////////////////////////////////////////////////////////////
+
+UTILS chiba_chan_block_t *chan_block_new(void) {
+  chiba_chan_block_t *block =
+      (chiba_chan_block_t *)CHIBA_INTERNAL_malloc(sizeof(chiba_chan_block_t));
+  if (!block)
+    return NULL;
+  atomic_init(&block->next, NULL);
+  for (i32 i = 0; i < CHAN_BLOCK_CAP; i++) {
+    block->slots[i].msg = NULL;
+    atomic_init(&block->slots[i].state, 0);
+  }
+  return block;
+}
+
+// 等待下一个 block 被挂上 (sender 在抢到最后一个位置后才挂)
+UTILS chiba_chan_block_t *chan_block_wait_next(chiba_chan_block_t *block) {
+  chiba_backoff b = {.step = 0};
+  chiba_chan_block_t *next;
+  while (!(next = atomic_load_explicit(&block->next, memory_order_acquire)))
+    backoff_snooze(&b);
+  return next;
+}
+
+// 从 start 开始, 所有 slot 都读完了才释放 block; 还在读的 reader 会接手
+UTILS void chan_block_destroy(chiba_chan_block_t *block, i32 start) {
+  // 最后一个 slot 的 reader 总会调用 destroy, 不用检查它
+  for (i32 i = start; i < CHAN_BLOCK_CAP - 1; i++) {
+    chiba_chan_slot_t *slot = &block->slots[i];
+    if (!(atomic_load_explicit(&slot->state, memory_order_acquire) &
+          CHAN_SLOT_READ) &&
+        !(atomic_fetch_or_explicit(&slot->state, CHAN_SLOT_DESTROY,
+                                   memory_order_acq_rel) &
+          CHAN_SLOT_READ))
+      return;
+  }
+  CHIBA_INTERNAL_free(block);
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// 初始化和销毁
+//////////////////////////////////////////////////////////////////////////////////
+
+// 第一个 block 在第一次发送时才分配
+UTILS void chan_list_init(chiba_chan_list_t *list) {
+  atomic_init(&list->head.index, 0);
+  atomic_init(&list->head.block, NULL);
+  atomic_init(&list->tail.index, 0);
+  atomic_init(&list->tail.block, NULL);
+}
+
+// 没有 sender / receiver 在操作时释放剩余的 block
+UTILS void chan_list_drop(chiba_chan_list_t *list) {
+  u64 head = atomic_load_explicit(&list->head.index, memory_order_relaxed) &
+             ~CHAN_MARK_BIT;
+  u64 tail = atomic_load_explicit(&list->tail.index, memory_order_relaxed) &
+             ~CHAN_MARK_BIT;
+  chiba_chan_block_t *block =
+      atomic_load_explicit(&list->head.block, memory_order_relaxed);
+  while (head != tail) {
+    if (((head >> CHAN_SHIFT) % CHAN_LAP) == CHAN_BLOCK_CAP) {
+      chiba_chan_block_t *next =
+          atomic_load_explicit(&block->next, memory_order_relaxed);
+      CHIBA_INTERNAL_free(block);
+      block = next;
+    }
+    head += 1ULL << CHAN_SHIFT;
+  }
+  CHIBA_INTERNAL_free(block);
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// 发送和接收
+//////////////////////////////////////////////////////////////////////////////////
+
+// 入队, 只有内存不足时返回 false
+UTILS bool chan_list_push(chiba_chan_list_t *list, void *msg) {
+  chiba_backoff b = {.step = 0};
+  u64 tail = atomic_load_explicit(&list->tail.index, memory_order_acquire);
+  chiba_chan_block_t *block =
+      atomic_load_explicit(&list->tail.block, memory_order_acquire);
+  chiba_chan_block_t *next_block = NULL;
+
+  for (;;) {
+    u64 offset = (tail >> CHAN_SHIFT) % CHAN_LAP;
+
+    // 另一个 sender 正在挂下一个 block
+    if (offset == CHAN_BLOCK_CAP) {
+      backoff_snooze(&b);
+      tail = atomic_load_explicit(&list->tail.index, memory_order_acquire);
+      block = atomic_load_explicit(&list->tail.block, memory_order_acquire);
+      continue;
+    }
+
+    // 即将占用 block 的最后一个 slot, 提前分配下一个 block, 缩短别人等待的时间
+    if (offset + 1 == CHAN_BLOCK_CAP && !next_block) {
+      next_block = chan_block_new();
+      if (!next_block)
+        return false;
+    }
+
+    // 第一条消息: 分配第一个 block
+    if (unlikely(!block)) {
+      chiba_chan_block_t *first = next_block ? next_block : chan_block_new();
+      if (!first)
+        return false;
+      chiba_chan_block_t *expected = NULL;
+      if (atomic_compare_exchange_strong_explicit(
+              &list->tail.block, &expected, first, memory_order_release,
+              memory_order_relaxed)) {
+        atomic_store_explicit(&list->head.block, first, memory_order_release);
+        block = first;
+        next_block = NULL;
+      } else {
+        next_block = first;
+        tail = atomic_load_explicit(&list->tail.index, memory_order_acquire);
+        block = atomic_load_explicit(&list->tail.block, memory_order_acquire);
+        continue;
+      }
+    }
+
+    u64 new_tail = tail + (1ULL << CHAN_SHIFT);
+    if (atomic_compare_exchange_weak_explicit(&list->tail.index, &tail,
+                                              new_tail, memory_order_seq_cst,
+                                              memory_order_acquire)) {
+      // 占到了最后一个 slot, 挂上下一个 block 并跳过切换位置
+      if (offset + 1 == CHAN_BLOCK_CAP) {
+        atomic_store_explicit(&list->tail.block, next_block,
+                              memory_order_release);
+        atomic_fetch_add_explicit(&list->tail.index, 1ULL << CHAN_SHIFT,
+                                  memory_order_release);
+        atomic_store_explicit(&block->next, next_block, memory_order_release);
+        next_block = NULL;
+      }
+      chiba_chan_slot_t *slot = &block->slots[offset];
+      slot->msg = msg;
+      atomic_fetch_or_explicit(&slot->state, CHAN_SLOT_WRITE,
+                               memory_order_release);
+      CHIBA_INTERNAL_free(next_block);
+      return true;
+    }
+    block = atomic_load_explicit(&list->tail.block, memory_order_acquire);
+    backoff_spin(&b);
+  }
+}
+
+// 出队, 为空时返回 false
+UTILS bool chan_list_pop(chiba_chan_list_t *list, void **msg_out) {
+  chiba_backoff b = {.step = 0};
+  u64 head = atomic_load_explicit(&list->head.index, memory_order_acquire);
+  chiba_chan_block_t *block =
+      atomic_load_explicit(&list->head.block, memory_order_acquire);
+
+  for (;;) {
+    u64 offset = (head >> CHAN_SHIFT) % CHAN_LAP;
+
+    // 另一个 receiver 正在切换到下一个 block
+    if (offset == CHAN_BLOCK_CAP) {
+      backoff_snooze(&b);
+      head = atomic_load_explicit(&list->head.index, memory_order_acquire);
+      block = atomic_load_explicit(&list->head.block, memory_order_acquire);
+      continue;
+    }
+
+    u64 new_head = head + (1ULL << CHAN_SHIFT);
+    if (!(new_head & CHAN_MARK_BIT)) {
+      atomic_thread_fence(memory_order_seq_cst);
+      u64 tail = atomic_load_explicit(&list->tail.index, memory_order_relaxed);
+
+      // 为空
+      if ((head >> CHAN_SHIFT) == (tail >> CHAN_SHIFT))
+        return false;
+
+      // head 和 tail 不在同一个 block
+      if ((head >> CHAN_SHIFT) / CHAN_LAP != (tail >> CHAN_SHIFT) / CHAN_LAP)
+        new_head |= CHAN_MARK_BIT;
+    }
+
+    // 第一个 block 还没挂到 head 上
+    if (unlikely(!block)) {
+      backoff_snooze(&b);
+      head = atomic_load_explicit(&list->head.index, memory_order_acquire);
+      block = atomic_load_explicit(&list->head.block, memory_order_acquire);
+      continue;
+    }
+
+    if (atomic_compare_exchange_weak_explicit(&list->head.index, &head,
+                                              new_head, memory_order_seq_cst,
+                                              memory_order_acquire)) {
+      // 读到了 block 的最后一个 slot, head 移到下一个 block
+      if (offset + 1 == CHAN_BLOCK_CAP) {
+        chiba_chan_block_t *next = chan_block_wait_next(block);
+        u64 next_index = (new_head & ~CHAN_MARK_BIT) + (1ULL << CHAN_SHIFT);
+        if (atomic_load_explicit(&next->next, memory_order_relaxed))
+          next_index |= CHAN_MARK_BIT;
+        atomic_store_explicit(&list->head.block, next, memory_order_release);
+        atomic_store_explicit(&list->head.index, next_index,
+                              memory_order_release);
+      }
+
+      // 等 sender 写完
+      chiba_chan_slot_t *slot = &block->slots[offset];
+      chiba_backoff wb = {.step = 0};
+      while (!(atomic_load_explicit(&slot->state, memory_order_acquire) &
+               CHAN_SLOT_WRITE))
+        backoff_snooze(&wb);
+      *msg_out = slot->msg;
+
+      if (offset + 1 == CHAN_BLOCK_CAP)
+        chan_block_destroy(block, 0);
+      else if (atomic_fetch_or_explicit(&slot->state, CHAN_SLOT_READ,
+                                        memory_order_acq_rel) &
+               CHAN_SLOT_DESTROY)
+        chan_block_destroy(block, (i32)offset + 1);
+      return true;
+    }
+    block = atomic_load_explicit(&list->head.block, memory_order_acquire);
+    backoff_spin(&b);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// 查询
+//////////////////////////////////////////////////////////////////////////////////
+
+UTILS u64 chan_list_len(chiba_chan_list_t *list) {
+  for (;;) {
+    // 读一对一致的 head / tail
+    u64 tail = atomic_load_explicit(&list->tail.index, memory_order_seq_cst);
+    u64 head = atomic_load_explicit(&list->head.index, memory_order_seq_cst);
+    if (atomic_load_explicit(&list->tail.index, memory_order_seq_cst) != tail)
+      continue;
+
+    tail &= ~CHAN_MARK_BIT;
+    head &= ~CHAN_MARK_BIT;
+    // 停在切换位置上的 index 算作下一个 block 的开头
+    if (((tail >> CHAN_SHIFT) & (CHAN_LAP - 1)) == CHAN_LAP - 1)
+      tail += 1ULL << CHAN_SHIFT;
+    if (((head >> CHAN_SHIFT) & (CHAN_LAP - 1)) == CHAN_LAP - 1)
+      head += 1ULL << CHAN_SHIFT;
+
+    // 以 head 所在的 lap 为 0 点, 减去每个 lap 的切换位置
+    u64 lap = (head >> CHAN_SHIFT) / CHAN_LAP;
+    tail = (tail >> CHAN_SHIFT) - lap * CHAN_LAP;
+    head = (head >> CHAN_SHIFT) - lap * CHAN_LAP;
+    return tail - head - tail / CHAN_LAP;
+  }
+}
+
+UTILS bool chan_list_is_empty(chiba_chan_list_t *list) {
+  u64 head = atomic_load_explicit(&list->head.index, memory_order_seq_cst);
+  u64 tail = atomic_load_explicit(&list->tail.index, memory_order_seq_cst);
+  return (head >> CHAN_SHIFT) == (tail >> CHAN_SHIFT);
+}
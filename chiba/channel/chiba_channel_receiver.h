@@ -32,7 +32,6 @@ PUBLIC chiba_receiver_t *chiba_receiver_clone(chiba_receiver_t *rx) {
 }
 
 PUBLIC void chiba_receiver_drop(chiba_receiver_t **rx) {
-  printf("chiba_receiver_drop called\n");
   if (!rx || !*rx || !(*rx)->chan)
     return;
 
@@ -40,16 +39,14 @@ PUBLIC void chiba_receiver_drop(chiba_receiver_t **rx) {
 
   // 引用计数递减
   u64 old_count =
-      atomic_fetch_sub_explicit(&chan->receiver_count, 1, memory_order_release);
+      atomic_fetch_sub_explicit(&chan->receiver_count, 1, memory_order_acq_rel);
 
   // 如果是最后一个 receiver,断开连接
   if (old_count == 1) {
     chiba_channel_disconnect(chan);
 
-    // 检查是否需要销毁 channel
-    u64 tx_count =
-        atomic_load_explicit(&chan->sender_count, memory_order_acquire);
-    if (tx_count == 0) {
+    // 两端都走到这里时, 后到的一方销毁 channel
+    if (atomic_exchange_explicit(&chan->destroy, true, memory_order_acq_rel)) {
       chiba_channel_destroy(chan);
     }
   }
@@ -68,6 +65,10 @@ PUBLIC i32 chiba_receiver_try_recv(chiba_receiver_t *rx, void **data_out) {
 
   chiba_channel_t *chan = rx->chan;
 
+  // rendezvous: 只能从正在等待的 sender 取
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return chan_zero_try_recv(&chan->zero, data_out);
+
   // 尝试出队
   if (chiba_channel_dequeue(chan, data_out)) {
     return CHIBA_CHAN_OK;
@@ -82,6 +83,20 @@ PUBLIC i32 chiba_receiver_try_recv(chiba_receiver_t *rx, void **data_out) {
   return CHIBA_CHAN_EMPTY;
 }
 
+PUBLIC i32 chiba_receiver_recv_timeout(chiba_receiver_t *rx, void **data_out,
+                                       u64 nanosecs) {
+  if (!rx || !rx->chan || !data_out)
+    return CHIBA_CHAN_DISCONNECTED;
+  u64 deadline = UINT64_MAX;
+  if (nanosecs != UINT64_MAX)
+    deadline = get_time_in_nanoseconds() + nanosecs;
+  return chiba_channel_recv(rx->chan, data_out, deadline);
+}
+
+PUBLIC i32 chiba_receiver_recv(chiba_receiver_t *rx, void **data_out) {
+  return chiba_receiver_recv_timeout(rx, data_out, UINT64_MAX);
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Receiver 查询操作
 //////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,199 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////////
+// Chiba Channel - Select 实现
+//
+// 参考 crossbeam-channel 的 Select:
+// 1. 从随机的分支开始把每个分支非阻塞地试一遍, 有能完成的就返回
+// 2. 都不行时把同一个 context 登记到所有分支的 waker 上, 操作 id 是分支的
+//    地址; 每登记一个就检查它是否已经就绪, 就绪则放弃等待
+// 3. park 直到某个对端选中 context (只有一方能成功), 注销全部分支
+// - rendezvous 分支被选中时消息已经通过 packet 交接完成, 直接返回它
+// - 其他分支被选中只是通知, 回到第 1 步重试, 并且先试被通知的分支; 最后
+//   完成的若不是它, 把通知转给同一 waker 上的其他等待者, 否则对端留下的
+//   消息 / 空位可能没人来取
+//////////////////////////////////////////////////////////////////////////////////
+
+#include "chiba_channel.h"
+#include "chiba_channel_core.h"
+
+// 分支不多时 packet 放在栈上
+#define CHIBA_SELECT_STACK_OPS 16
+
+// 0 表示还没播种; 按线程播种, 各线程的第一次 select 不会从同一个分支开始
+PRIVATE THREAD_LOCAL u64 chiba_select_rng = 0;
+
+PRIVATE u32 chiba_select_start(u32 n) {
+  if (unlikely(!chiba_select_rng))
+    chiba_select_rng = CHIBA_HASH_mix13((u64)(uintptr_t)&chiba_select_rng ^
+                                        get_time_in_nanoseconds()) |
+                       1;
+  chiba_select_rng ^= chiba_select_rng << 13;
+  chiba_select_rng ^= chiba_select_rng >> 7;
+  chiba_select_rng ^= chiba_select_rng << 17;
+  return (u32)(chiba_select_rng % n);
+}
+
+PRIVATE chiba_channel_t *chiba_select_chan(chiba_select_op_t *op) {
+  return op->tx ? op->tx->chan : op->rx->chan;
+}
+
+// 非阻塞地尝试一个分支, 完成 (包括对端已断开) 时返回 true
+PRIVATE bool chiba_select_try(chiba_select_op_t *op, i32 *ret) {
+  if (op->tx) {
+    *ret = chiba_sender_try_send(op->tx, op->msg);
+    return *ret != CHIBA_CHAN_FULL;
+  }
+  void *msg = NULL;
+  *ret = chiba_receiver_try_recv(op->rx, &msg);
+  if (*ret == CHIBA_CHAN_OK)
+    op->msg = msg;
+  return *ret != CHIBA_CHAN_EMPTY;
+}
+
+// 对端有没有不属于 self 的等待者
+PRIVATE bool chiba_select_zero_can_select(chiba_chan_waker_t *w,
+                                          chiba_chan_context_t *self) {
+  for (u32 i = 0; i < w->len; i++) {
+    chiba_chan_context_t *cx = w->entries[i].cx;
+    if (cx != self && atomic_load_explicit(&cx->select, memory_order_acquire) ==
+                          CHAN_SEL_WAITING)
+      return true;
+  }
+  return false;
+}
+
+// 登记分支, 返回它是否已经就绪
+PRIVATE bool chiba_select_register(chiba_select_op_t *op,
+                                   chiba_chan_packet_t *packet,
+                                   chiba_chan_context_t *cx) {
+  chiba_channel_t *chan = chiba_select_chan(op);
+  uintptr_t oper = (uintptr_t)op;
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO) {
+    chiba_chan_zero_t *z = &chan->zero;
+    packet->msg = op->tx ? op->msg : NULL;
+    atomic_init(&packet->ready, false);
+    pthread_mutex_lock(&z->lock);
+    chan_waker_register(op->tx ? &z->senders : &z->receivers, oper, packet,
+                        cx);
+    bool ready = z->disconnected ||
+                 chiba_select_zero_can_select(
+                     op->tx ? &z->receivers : &z->senders, cx);
+    pthread_mutex_unlock(&z->lock);
+    return ready;
+  }
+  chan_sync_waker_register(op->tx ? &chan->senders : &chan->receivers, oper,
+                           cx);
+  if (chiba_channel_is_disconnected(chan))
+    return true;
+  return op->tx ? !chiba_channel_is_full(chan) : !chiba_channel_is_empty(chan);
+}
+
+// list / array 分支登记在哪个 waker 上
+PRIVATE chiba_chan_sync_waker_t *chiba_select_waker(chiba_select_op_t *op) {
+  chiba_channel_t *chan = chiba_select_chan(op);
+  return op->tx ? &chan->senders : &chan->receivers;
+}
+
+PRIVATE void chiba_select_unregister(chiba_select_op_t *op) {
+  chiba_channel_t *chan = chiba_select_chan(op);
+  uintptr_t oper = (uintptr_t)op;
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO) {
+    chiba_chan_zero_t *z = &chan->zero;
+    pthread_mutex_lock(&z->lock);
+    chan_waker_unregister(op->tx ? &z->senders : &z->receivers, oper);
+    pthread_mutex_unlock(&z->lock);
+    return;
+  }
+  chan_sync_waker_unregister(chiba_select_waker(op), oper);
+}
+
+PUBLIC i32 chiba_select(chiba_select_op_t *ops, u32 n, u64 nanosecs,
+                        u32 *index_out) {
+  if (!ops || n == 0 || !index_out)
+    return CHIBA_CHAN_TIMEOUT;
+  for (u32 i = 0; i < n; i++) {
+    if ((!ops[i].tx || !ops[i].tx->chan) && (!ops[i].rx || !ops[i].rx->chan)) {
+      *index_out = i;
+      return CHIBA_CHAN_DISCONNECTED;
+    }
+  }
+
+  u64 deadline = UINT64_MAX;
+  if (nanosecs != UINT64_MAX)
+    deadline = get_time_in_nanoseconds() + nanosecs;
+
+  chiba_chan_packet_t stack_packets[CHIBA_SELECT_STACK_OPS];
+  chiba_chan_packet_t *packets = stack_packets;
+  if (n > CHIBA_SELECT_STACK_OPS) {
+    packets = (chiba_chan_packet_t *)CHIBA_INTERNAL_malloc(
+        sizeof(chiba_chan_packet_t) * n);
+    if (!packets)
+      CHIBA_PANIC("Could not allocate memory for select\n");
+  }
+
+  i32 ret = CHIBA_CHAN_TIMEOUT;
+  chiba_select_op_t *notified = NULL; // 最近一次通知了我们的 list / array 分支
+  for (;;) {
+    // 对端通知的是这个分支, 它的消息 / 空位先取
+    if (notified && chiba_select_try(notified, &ret)) {
+      *index_out = (u32)(notified - ops);
+      notified = NULL;
+      goto done;
+    }
+
+    // 随机起点, 多个分支同时就绪时不会总是偏向前面的
+    u32 start = chiba_select_start(n);
+    for (u32 k = 0; k < n; k++) {
+      u32 i = (start + k) % n;
+      if (chiba_select_try(&ops[i], &ret)) {
+        *index_out = i;
+        goto done;
+      }
+    }
+    // nanosecs = 0 相当于 default 分支
+    if (chan_deadline_passed(deadline)) {
+      ret = CHIBA_CHAN_TIMEOUT;
+      goto done;
+    }
+
+    chiba_chan_context_t cx;
+    chan_context_init(&cx);
+    u32 registered = 0;
+    while (registered < n) {
+      u32 i = (start + registered) % n;
+      registered++;
+      if (chiba_select_register(&ops[i], &packets[i], &cx)) {
+        chan_context_try_select(&cx, CHAN_SEL_ABORTED);
+        break;
+      }
+    }
+    uintptr_t sel = chan_context_wait_until(&cx, deadline);
+    for (u32 k = 0; k < registered; k++)
+      chiba_select_unregister(&ops[(start + k) % n]);
+    chan_context_drop(&cx);
+
+    // 被 rendezvous 的对端选中: 交接已经完成
+    if (sel > CHAN_SEL_DISCONNECTED) {
+      chiba_select_op_t *op = (chiba_select_op_t *)sel;
+      if (chiba_select_chan(op)->flavor == CHIBA_CHAN_FLAVOR_ZERO) {
+        u32 i = (u32)(op - ops);
+        chan_packet_wait_ready(&packets[i]);
+        if (op->rx)
+          op->msg = packets[i].msg;
+        *index_out = i;
+        ret = CHIBA_CHAN_OK;
+        goto done;
+      }
+      notified = op;
+    }
+  }
+
+done:
+  // 通知被我们占用了却没有用在那个分支上, 转给还在等的其他操作
+  if (notified && (ret == CHIBA_CHAN_TIMEOUT || &ops[*index_out] != notified))
+    chan_sync_waker_notify(chiba_select_waker(notified));
+  if (packets != stack_packets)
+    CHIBA_INTERNAL_free(packets);
+  return ret;
+}
@@ -31,7 +31,6 @@ PUBLIC chiba_sender_t *chiba_sender_clone(chiba_sender_t *tx) {
 }
 
 PUBLIC void chiba_sender_drop(chiba_sender_t **tx) {
-  printf("chiba_sender_drop called\n");
   if (!tx || !*tx || !(*tx)->chan)
     return;
 
@@ -39,16 +38,14 @@ PUBLIC void chiba_sender_drop(chiba_sender_t **tx) {
 
   // 引用计数递减
   u64 old_count =
-      atomic_fetch_sub_explicit(&chan->sender_count, 1, memory_order_release);
+      atomic_fetch_sub_explicit(&chan->sender_count, 1, memory_order_acq_rel);
 
   // 如果是最后一个 sender,断开连接
   if (old_count == 1) {
     chiba_channel_disconnect(chan);
 
-    // 检查是否需要销毁 channel
-    u64 rx_count =
-        atomic_load_explicit(&chan->receiver_count, memory_order_acquire);
-    if (rx_count == 0) {
+    // 两端都走到这里时, 后到的一方销毁 channel
+    if (atomic_exchange_explicit(&chan->destroy, true, memory_order_acq_rel)) {
       chiba_channel_destroy(chan);
     }
   }
@@ -67,6 +64,10 @@ PUBLIC i32 chiba_sender_try_send(chiba_sender_t *tx, void *data) {
 
   chiba_channel_t *chan = tx->chan;
 
+  // rendezvous: 只能交给正在等待的 receiver
+  if (chan->flavor == CHIBA_CHAN_FLAVOR_ZERO)
+    return chan_zero_try_send(&chan->zero, data);
+
   // 检查是否断开
   if (chiba_channel_is_disconnected(chan)) {
     return CHIBA_CHAN_DISCONNECTED;
@@ -86,6 +87,20 @@ PUBLIC i32 chiba_sender_try_send(chiba_sender_t *tx, void *data) {
   return CHIBA_CHAN_FULL;
 }
 
+PUBLIC i32 chiba_sender_send_timeout(chiba_sender_t *tx, void *data,
+                                     u64 nanosecs) {
+  if (!tx || !tx->chan)
+    return CHIBA_CHAN_DISCONNECTED;
+  u64 deadline = UINT64_MAX;
+  if (nanosecs != UINT64_MAX)
+    deadline = get_time_in_nanoseconds() + nanosecs;
+  return chiba_channel_send(tx->chan, data, deadline);
+}
+
+PUBLIC i32 chiba_sender_send(chiba_sender_t *tx, void *data) {
+  return chiba_sender_send_timeout(tx, data, UINT64_MAX);
+}
+
 //////////////////////////////////////////////////////////////////////////////////
 // Sender 查询操作
 //////////////////////////////////////////////////////////////////////////////////
@@ -5,31 +5,40 @@
 //////////////////////////////////////////////////////////////////////////////////
 
 #include "../basic_memory.h"
-
-//////////////////////////////////////////////////////////////////////////////////
-// 简单的无锁队列节点 (单向链表)
-//////////////////////////////////////////////////////////////////////////////////
-
-typedef struct chiba_chan_node {
-  void *data;
-  struct chiba_chan_node *next;
-} chiba_chan_node_t;
+#include "../concurrency/array_queue.h"
+#include "chiba_channel_list.h"
+#include "chiba_channel_waker.h"
+#include "chiba_channel_zero.h"
 
 //////////////////////////////////////////////////////////////////////////////////
 // 共享 Channel 结构
 //////////////////////////////////////////////////////////////////////////////////
 
+typedef enum chiba_chan_flavor {
+  CHIBA_CHAN_FLAVOR_LIST,  // unbounded: 无锁分段链表
+  CHIBA_CHAN_FLAVOR_ARRAY, // bounded: 预分配的无锁环形队列
+  CHIBA_CHAN_FLAVOR_ZERO,  // capacity 0: rendezvous, 直接交接
+} chiba_chan_flavor_t;
+
 typedef struct chiba_channel {
-  // 队列头尾指针 (用 mutex 保护)
-  chiba_chan_node_t *head;
-  chiba_chan_node_t *tail;
+  // Unbounded channel 的队列 (cache line 对齐, 放在最前面)
+  chiba_chan_list_t list;
+
+  // Bounded channel 的队列 (chiba_arrayqueue, 创建时分配好所有 slot)
+  chiba_arrayqueue *array;
+
+  // Rendezvous channel 的等待者
+  chiba_chan_zero_t zero;
+
+  // list / array flavor 阻塞中的 sender (等空位) 和 receiver (等消息)
+  chiba_chan_sync_waker_t senders;
+  chiba_chan_sync_waker_t receivers;
+
+  chiba_chan_flavor_t flavor;
 
   // Bounded channel 的容量 (0 = unbounded)
   u64 capacity;
 
-  // 当前队列长度 (原子操作)
-  _Atomic u64 len;
-
   // 引用计数
   _Atomic u64 sender_count;
   _Atomic u64 receiver_count;
@@ -37,22 +46,17 @@ typedef struct chiba_channel {
   // 断开标志
   _Atomic bool disconnected;
 
-  // 互斥锁 (保护队列操作)
-  pthread_mutex_t mutex;
+  // 最后一个 sender 和最后一个 receiver 中先释放的一方置位
+  _Atomic bool destroy;
 } chiba_channel_t;
 
 //////////////////////////////////////////////////////////////////////////////////
 // 内部辅助函数声明
 //////////////////////////////////////////////////////////////////////////////////
 
-// 创建队列节点
-PRIVATE chiba_chan_node_t *chiba_chan_node_new(void *data);
-
-// 释放队列节点
-PRIVATE void chiba_chan_node_free(chiba_chan_node_t *node);
-
 // 初始化 channel
-PRIVATE chiba_channel_t *chiba_channel_new(u64 capacity);
+PRIVATE chiba_channel_t *chiba_channel_new(chiba_chan_flavor_t flavor,
+                                           u64 capacity);
 
 // 销毁 channel (当所有 sender/receiver 都释放后)
 PRIVATE void chiba_channel_destroy(chiba_channel_t *chan);
@@ -62,3 +66,9 @@ PRIVATE bool chiba_channel_enqueue(chiba_channel_t *chan, void *data);
 
 // 出队 (返回 true 且填充 data_out,或返回 false)
 PRIVATE bool chiba_channel_dequeue(chiba_channel_t *chan, void **data_out);
+
+// 阻塞发送 / 接收 (返回 CHIBA_CHAN_*)
+PRIVATE i32 chiba_channel_send(chiba_channel_t *chan, void *data,
+                               u64 deadline);
+PRIVATE i32 chiba_channel_recv(chiba_channel_t *chan, void **data_out,
+                               u64 deadline);
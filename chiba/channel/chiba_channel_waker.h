@@ -0,0 +1,262 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////////
+// Chiba Channel - 等待者 (阻塞操作的登记和唤醒)
+//
+// 参考 crossbeam-channel 的 Context / Waker:
+// - 每个阻塞操作在自己的栈上放一个 context, 登记到 channel 的 waker 里再 park
+// - 对端通过 CAS context 的 select 字段 "选中" 它, 只有一方能成功, 然后唤醒它
+// - 选中和唤醒都在 waker 的锁里完成; 等待者醒来后总会再拿一次这个锁把自己
+//   注销, 所以它返回 (栈上的 context 失效) 时对端一定已经不再访问 context
+// - 在 chiba_sco 协程里等待时只 park 协程, 不阻塞线程: 同一线程上的其他协程
+//   照常运行, 对端用 chiba_sco_unpark 唤醒它 (可以来自别的线程)
+//////////////////////////////////////////////////////////////////////////////////
+
+#include "../basic_memory.h"
+#include "../scheched_coroutine/scheched_coroutine.h"
+#include "../utils/eventcount.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+// select 字段的取值; 其他值是选中的操作 id (操作的地址, 一定大于 2)
+#define CHAN_SEL_WAITING 0
+#define CHAN_SEL_ABORTED 1
+#define CHAN_SEL_DISCONNECTED 2
+
+typedef struct chiba_chan_context {
+  _Atomic uintptr_t select; // 等待中 / 放弃 / 断开 / 被选中的操作
+  void *packet;             // 选中方留下的 packet (rendezvous 交接用)
+  chiba_sco_id_t co;        // 等待的协程, 0 表示等待的是线程
+  chiba_event parked;       // 线程在这里 park
+} chiba_chan_context_t;
+
+// 等待一条消息交接的双方共用的记录, 放在等待者的栈上
+typedef struct chiba_chan_packet {
+  void *msg;
+  _Atomic bool ready; // 对端读完 / 写完 msg
+} chiba_chan_packet_t;
+
+UTILS void chan_context_init(chiba_chan_context_t *cx) {
+  atomic_init(&cx->select, CHAN_SEL_WAITING);
+  cx->packet = NULL;
+  cx->co = chiba_sco_id();
+  chiba_event_init(&cx->parked);
+}
+
+UTILS void chan_context_drop(chiba_chan_context_t *cx) {
+  chiba_event_drop(&cx->parked);
+}
+
+// 尝试把等待中的 context 标记为 sel, 只有第一个成功
+UTILS bool chan_context_try_select(chiba_chan_context_t *cx, uintptr_t sel) {
+  uintptr_t expected = CHAN_SEL_WAITING;
+  return atomic_compare_exchange_strong_explicit(
+      &cx->select, &expected, sel, memory_order_acq_rel, memory_order_acquire);
+}
+
+UTILS void chan_context_unpark(chiba_chan_context_t *cx) {
+  if (cx->co)
+    chiba_sco_unpark(cx->co);
+  else
+    chiba_event_notify(&cx->parked, 1);
+}
+
+// deadline 是否已经过去
+UTILS bool chan_deadline_passed(u64 deadline) {
+  return deadline != UINT64_MAX && get_time_in_nanoseconds() >= deadline;
+}
+
+// 协程版本: park 住协程, 带 deadline 时由 runloop 到点唤醒, 不占着线程空转
+UTILS uintptr_t chan_context_wait_co(chiba_chan_context_t *cx, u64 deadline) {
+  for (;;) {
+    uintptr_t sel = atomic_load_explicit(&cx->select, memory_order_acquire);
+    if (sel != CHAN_SEL_WAITING)
+      return sel;
+    if (chan_deadline_passed(deadline)) {
+      if (chan_context_try_select(cx, CHAN_SEL_ABORTED))
+        return CHAN_SEL_ABORTED;
+      continue;
+    }
+    chiba_sco_park_until(deadline);
+  }
+}
+
+// 等到被选中 / 断开, 或者 deadline (get_time_in_nanoseconds, UINT64_MAX 不限时)
+// 过去, 返回 select 的值. 超时时把自己标记为 ABORTED; 对端若抢先一步选中了它,
+// 仍然返回选中的操作
+UTILS uintptr_t chan_context_wait_until(chiba_chan_context_t *cx,
+                                        u64 deadline) {
+  if (cx->co)
+    return chan_context_wait_co(cx, deadline);
+  for (;;) {
+    u32 key = chiba_event_prepare(&cx->parked);
+    uintptr_t sel = atomic_load_explicit(&cx->select, memory_order_acquire);
+    if (sel != CHAN_SEL_WAITING) {
+      chiba_event_cancel(&cx->parked);
+      return sel;
+    }
+    if (!chiba_event_wait_until(&cx->parked, key, deadline)) {
+      if (chan_context_try_select(cx, CHAN_SEL_ABORTED))
+        return CHAN_SEL_ABORTED;
+      return atomic_load_explicit(&cx->select, memory_order_acquire);
+    }
+  }
+}
+
+// 等到被选中 / 断开, 返回 select 的值
+UTILS uintptr_t chan_context_wait(chiba_chan_context_t *cx) {
+  return chan_context_wait_until(cx, UINT64_MAX);
+}
+
+// 等对端读完 / 写完 packet
+UTILS void chan_packet_wait_ready(chiba_chan_packet_t *packet) {
+  chiba_backoff b = {.step = 0};
+  while (!atomic_load_explicit(&packet->ready, memory_order_acquire))
+    backoff_snooze(&b);
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Waker: 登记在某一端等待的操作 (调用方负责加锁)
+//////////////////////////////////////////////////////////////////////////////////
+
+typedef struct chiba_chan_entry {
+  uintptr_t oper;          // 操作 id
+  void *packet;            // 操作的 packet, 没有则为 NULL
+  chiba_chan_context_t *cx; // 等待者
+} chiba_chan_entry_t;
+
+typedef struct chiba_chan_waker {
+  chiba_chan_entry_t *entries; // 按登记顺序排列, 先来的先被选中
+  u32 len;
+  u32 cap;
+} chiba_chan_waker_t;
+
+UTILS void chan_waker_init(chiba_chan_waker_t *w) {
+  w->entries = NULL;
+  w->len = 0;
+  w->cap = 0;
+}
+
+UTILS void chan_waker_drop(chiba_chan_waker_t *w) {
+  CHIBA_INTERNAL_free(w->entries);
+  w->entries = NULL;
+  w->len = w->cap = 0;
+}
+
+UTILS void chan_waker_register(chiba_chan_waker_t *w, uintptr_t oper,
+                               void *packet, chiba_chan_context_t *cx) {
+  if (w->len == w->cap) {
+    u32 cap = w->cap ? w->cap * 2 : 4;
+    chiba_chan_entry_t *entries = (chiba_chan_entry_t *)CHIBA_INTERNAL_realloc(
+        w->entries, sizeof(chiba_chan_entry_t) * cap);
+    if (!entries)
+      CHIBA_PANIC("Could not allocate memory for channel waiters\n");
+    w->entries = entries;
+    w->cap = cap;
+  }
+  w->entries[w->len++] =
+      (chiba_chan_entry_t){.oper = oper, .packet = packet, .cx = cx};
+}
+
+UTILS void chan_waker_remove(chiba_chan_waker_t *w, u32 i) {
+  memmove(&w->entries[i], &w->entries[i + 1],
+          sizeof(chiba_chan_entry_t) * (w->len - i - 1));
+  w->len--;
+}
+
+// 注销操作, 返回它是否还在 (没有被选中方移除)
+UTILS bool chan_waker_unregister(chiba_chan_waker_t *w, uintptr_t oper) {
+  for (u32 i = 0; i < w->len; i++) {
+    if (w->entries[i].oper == oper) {
+      chan_waker_remove(w, i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// 选中第一个还在等待的操作 (跳过 self 自己的), 唤醒它并移除, 写到 out
+UTILS bool chan_waker_try_select(chiba_chan_waker_t *w,
+                                 chiba_chan_context_t *self,
+                                 chiba_chan_entry_t *out) {
+  for (u32 i = 0; i < w->len; i++) {
+    chiba_chan_entry_t *e = &w->entries[i];
+    if (e->cx == self || !chan_context_try_select(e->cx, e->oper))
+      continue;
+    e->cx->packet = e->packet;
+    chan_context_unpark(e->cx);
+    *out = *e;
+    chan_waker_remove(w, i);
+    return true;
+  }
+  return false;
+}
+
+// 通知所有等待者 channel 已断开; 它们自己注销
+UTILS void chan_waker_disconnect(chiba_chan_waker_t *w) {
+  for (u32 i = 0; i < w->len; i++) {
+    if (chan_context_try_select(w->entries[i].cx, CHAN_SEL_DISCONNECTED))
+      chan_context_unpark(w->entries[i].cx);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Sync waker: 自带锁的 waker, 给 list / array flavor 用
+//
+// is_empty 在锁外可读: 没有等待者时 notify 只是一次原子读, 不加锁也不进内核.
+// 等待者登记后会再检查一次 channel, 和对端 "先改 channel 再读 is_empty"
+// 配合 (都是 seq_cst), 两边至少有一方能看到对方, 不会丢失唤醒
+//////////////////////////////////////////////////////////////////////////////////
+
+typedef struct chiba_chan_sync_waker {
+  pthread_mutex_t lock;
+  chiba_chan_waker_t inner;
+  _Atomic bool is_empty; // inner 里没有登记的操作
+} chiba_chan_sync_waker_t;
+
+UTILS void chan_sync_waker_init(chiba_chan_sync_waker_t *w) {
+  pthread_mutex_init(&w->lock, NULL);
+  chan_waker_init(&w->inner);
+  atomic_init(&w->is_empty, true);
+}
+
+UTILS void chan_sync_waker_drop(chiba_chan_sync_waker_t *w) {
+  chan_waker_drop(&w->inner);
+  pthread_mutex_destroy(&w->lock);
+}
+
+UTILS void chan_sync_waker_register(chiba_chan_sync_waker_t *w,
+                                    uintptr_t oper, chiba_chan_context_t *cx) {
+  pthread_mutex_lock(&w->lock);
+  chan_waker_register(&w->inner, oper, NULL, cx);
+  atomic_store_explicit(&w->is_empty, false, memory_order_seq_cst);
+  pthread_mutex_unlock(&w->lock);
+}
+
+UTILS void chan_sync_waker_unregister(chiba_chan_sync_waker_t *w,
+                                      uintptr_t oper) {
+  pthread_mutex_lock(&w->lock);
+  chan_waker_unregister(&w->inner, oper);
+  atomic_store_explicit(&w->is_empty, w->inner.len == 0,
+                        memory_order_seq_cst);
+  pthread_mutex_unlock(&w->lock);
+}
+
+// 唤醒一个等待者
+UTILS void chan_sync_waker_notify(chiba_chan_sync_waker_t *w) {
+  if (atomic_load_explicit(&w->is_empty, memory_order_seq_cst))
+    return;
+  chiba_chan_entry_t e;
+  pthread_mutex_lock(&w->lock);
+  if (chan_waker_try_select(&w->inner, NULL, &e))
+    atomic_store_explicit(&w->is_empty, w->inner.len == 0,
+                          memory_order_seq_cst);
+  pthread_mutex_unlock(&w->lock);
+}
+
+// 等待者被唤醒后自己注销
+UTILS void chan_sync_waker_disconnect(chiba_chan_sync_waker_t *w) {
+  pthread_mutex_lock(&w->lock);
+  chan_waker_disconnect(&w->inner);
+  pthread_mutex_unlock(&w->lock);
+}
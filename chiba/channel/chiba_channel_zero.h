@@ -0,0 +1,161 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////////
+// Chiba Channel - 零容量 channel (rendezvous / zero flavor)
+//
+// 不缓冲任何消息: sender 直接和一个正在等待的 receiver 配对, 反之亦然.
+// 等待的一方把 packet 放在自己的栈上并登记到 waker, 到来的一方选中它后
+// 直接读写这个 packet, 消息不经过任何队列.
+// - sender 等待时 packet 里是消息, receiver 读走后置 ready
+// - receiver 等待时 packet 是空的, sender 写入后置 ready
+// 等待的一方看到 ready 才返回, 所以对端写 ready 之后就不再访问它的栈
+//////////////////////////////////////////////////////////////////////////////////
+
+#include "chiba_channel_waker.h"
+#include <stdint.h>
+
+typedef struct chiba_chan_zero {
+  pthread_mutex_t lock;         // 保护下面所有字段
+  chiba_chan_waker_t senders;   // 等待中的 sender
+  chiba_chan_waker_t receivers; // 等待中的 receiver
+  bool disconnected;
+} chiba_chan_zero_t;
+
+UTILS void chan_zero_init(chiba_chan_zero_t *z) {
+  pthread_mutex_init(&z->lock, NULL);
+  chan_waker_init(&z->senders);
+  chan_waker_init(&z->receivers);
+  z->disconnected = false;
+}
+
+UTILS void chan_zero_drop(chiba_chan_zero_t *z) {
+  chan_waker_drop(&z->senders);
+  chan_waker_drop(&z->receivers);
+  pthread_mutex_destroy(&z->lock);
+}
+
+// 断开并唤醒两端所有等待者
+UTILS void chan_zero_disconnect(chiba_chan_zero_t *z) {
+  pthread_mutex_lock(&z->lock);
+  if (!z->disconnected) {
+    z->disconnected = true;
+    chan_waker_disconnect(&z->senders);
+    chan_waker_disconnect(&z->receivers);
+  }
+  pthread_mutex_unlock(&z->lock);
+}
+
+// 把消息写进等待中的 receiver 的 packet
+UTILS void chan_zero_put(chiba_chan_entry_t *e, void *msg) {
+  chiba_chan_packet_t *packet = (chiba_chan_packet_t *)e->packet;
+  packet->msg = msg;
+  atomic_store_explicit(&packet->ready, true, memory_order_release);
+}
+
+// 从等待中的 sender 的 packet 取走消息
+UTILS void *chan_zero_take(chiba_chan_entry_t *e) {
+  chiba_chan_packet_t *packet = (chiba_chan_packet_t *)e->packet;
+  void *msg = packet->msg;
+  atomic_store_explicit(&packet->ready, true, memory_order_release);
+  return msg;
+}
+
+// 交给一个等待中的 receiver; 没有则返回 CHIBA_CHAN_FULL
+UTILS i32 chan_zero_try_send(chiba_chan_zero_t *z, void *msg) {
+  chiba_chan_entry_t e;
+  pthread_mutex_lock(&z->lock);
+  if (chan_waker_try_select(&z->receivers, NULL, &e)) {
+    pthread_mutex_unlock(&z->lock);
+    chan_zero_put(&e, msg);
+    return CHIBA_CHAN_OK;
+  }
+  i32 ret = z->disconnected ? CHIBA_CHAN_DISCONNECTED : CHIBA_CHAN_FULL;
+  pthread_mutex_unlock(&z->lock);
+  return ret;
+}
+
+// 从一个等待中的 sender 取消息; 没有则返回 CHIBA_CHAN_EMPTY
+UTILS i32 chan_zero_try_recv(chiba_chan_zero_t *z, void **msg_out) {
+  chiba_chan_entry_t e;
+  pthread_mutex_lock(&z->lock);
+  if (chan_waker_try_select(&z->senders, NULL, &e)) {
+    pthread_mutex_unlock(&z->lock);
+    *msg_out = chan_zero_take(&e);
+    return CHIBA_CHAN_OK;
+  }
+  i32 ret = z->disconnected ? CHIBA_CHAN_DISCONNECTED : CHIBA_CHAN_EMPTY;
+  pthread_mutex_unlock(&z->lock);
+  return ret;
+}
+
+// 登记到 waiters 里等对端选中; 断开或超时则注销自己. 调用时持有 z->lock
+UTILS i32 chan_zero_wait(chiba_chan_zero_t *z, chiba_chan_waker_t *waiters,
+                         chiba_chan_packet_t *packet, chiba_chan_context_t *cx,
+                         u64 deadline) {
+  if (chan_deadline_passed(deadline)) {
+    pthread_mutex_unlock(&z->lock);
+    return CHIBA_CHAN_TIMEOUT;
+  }
+  chan_waker_register(waiters, (uintptr_t)packet, packet, cx);
+  pthread_mutex_unlock(&z->lock);
+
+  uintptr_t sel = chan_context_wait_until(cx, deadline);
+  if (sel == CHAN_SEL_DISCONNECTED || sel == CHAN_SEL_ABORTED) {
+    pthread_mutex_lock(&z->lock);
+    chan_waker_unregister(waiters, (uintptr_t)packet);
+    pthread_mutex_unlock(&z->lock);
+    return sel == CHAN_SEL_ABORTED ? CHIBA_CHAN_TIMEOUT
+                                   : CHIBA_CHAN_DISCONNECTED;
+  }
+  // 被对端选中, 等它读完 / 写完
+  chan_packet_wait_ready(packet);
+  return CHIBA_CHAN_OK;
+}
+
+// 阻塞直到一个 receiver 取走消息或者 deadline 过去
+UTILS i32 chan_zero_send(chiba_chan_zero_t *z, void *msg, u64 deadline) {
+  chiba_chan_entry_t e;
+  pthread_mutex_lock(&z->lock);
+  if (chan_waker_try_select(&z->receivers, NULL, &e)) {
+    pthread_mutex_unlock(&z->lock);
+    chan_zero_put(&e, msg);
+    return CHIBA_CHAN_OK;
+  }
+  if (z->disconnected) {
+    pthread_mutex_unlock(&z->lock);
+    return CHIBA_CHAN_DISCONNECTED;
+  }
+
+  chiba_chan_context_t cx;
+  chiba_chan_packet_t packet = {.msg = msg};
+  atomic_init(&packet.ready, false);
+  chan_context_init(&cx);
+  i32 ret = chan_zero_wait(z, &z->senders, &packet, &cx, deadline);
+  chan_context_drop(&cx);
+  return ret;
+}
+
+// 阻塞直到一个 sender 交来消息或者 deadline 过去
+UTILS i32 chan_zero_recv(chiba_chan_zero_t *z, void **msg_out, u64 deadline) {
+  chiba_chan_entry_t e;
+  pthread_mutex_lock(&z->lock);
+  if (chan_waker_try_select(&z->senders, NULL, &e)) {
+    pthread_mutex_unlock(&z->lock);
+    *msg_out = chan_zero_take(&e);
+    return CHIBA_CHAN_OK;
+  }
+  if (z->disconnected) {
+    pthread_mutex_unlock(&z->lock);
+    return CHIBA_CHAN_DISCONNECTED;
+  }
+
+  chiba_chan_context_t cx;
+  chiba_chan_packet_t packet = {.msg = NULL};
+  atomic_init(&packet.ready, false);
+  chan_context_init(&cx);
+  i32 ret = chan_zero_wait(z, &z->receivers, &packet, &cx, deadline);
+  if (ret == CHIBA_CHAN_OK)
+    *msg_out = packet.msg;
+  chan_context_drop(&cx);
+  return ret;
+}
@@ -39,6 +39,21 @@
 
 // Minimum stack size for coroutines (16 KB)
 #define CHIBA_CO_MINSTACKSIZE 16384
+// Stack size used by chiba_co_spawn when no size is requested (64 KB)
+#define CHIBA_CO_DEFAULT_STACKSIZE 65536
+// Idle stacks a thread may keep per pool size class (4 MB)
+#define CHIBA_CO_STACK_POOL_BYTES 4194304
+// Stack shared by a thread's copy-stack coroutines (128 KB)
+#define CHIBA_CO_SHARED_STACKSIZE 131072
+// Pooled stacks unused for this long are madvise'd back to the kernel (1 s)
+#define CHIBA_CO_STACK_PURGE_NS 1000000000ULL
+// Entry functions tracked by the stack profiler (power of two)
+#define CHIBA_CO_STACK_PROFILE_SLOTS 1024
+// Extra stack given on top of a profiled peak (4 KB)
+#define CHIBA_CO_STACK_HEADROOM 4096
+// Smallest stack a profiled size may pick (never below CHIBA_CO_MINSTACKSIZE)
+#define CHIBA_CO_STACK_PROFILE_FLOOR CHIBA_CO_MINSTACKSIZE
+// #define CHIBA_CO_STACK_NOMMAP // Use malloc instead of mmap for stacks
 // #define CHIBA_CO_NOASM // Disable assembly implementations
 
 #define COROUTINE_SINGLECORE_IMPL // enable single-core coroutine implementation
@@ -48,4 +63,39 @@
 #define CHIBA_BINARY
 // #define CHIBA_LIB
 
-#define CHIBA_SCO_NSHARDS 512
\ No newline at end of file
+#define CHIBA_SCO_NSHARDS 512
+// Coroutine slots are allocated in chunks of this many (power of two)
+#define CHIBA_SCO_SLOT_CHUNK 1024
+// Maximum number of slot chunks (64M live coroutines)
+#define CHIBA_SCO_SLOT_CHUNKS 65536
+// Concurrent scheduler: shards of the id -> coroutine table (power of two)
+#define CHIBA_CSCO_NSHARDS 64
+// Initial per-worker run queue capacity (power of two, grows on demand)
+#define CHIBA_CSCO_RUNQ_CAP 256
+// Capacity of the queue for coroutines woken from outside the workers
+#define CHIBA_CSCO_INJECTOR_CAP 4096
+// Workers check the shared injector queue first once every this many picks
+#define CHIBA_CSCO_FAIR_TICK 61
+// Resolution of coroutine sleeps and deadlines (nanoseconds per timer tick)
+#define CHIBA_CSCO_TIMER_TICK_NS 1000000
+// Readiness events taken from the kernel per epoll_wait call
+#define CHIBA_CSCO_POLL_EVENTS 64
+
+// Submission slots of each csco worker's io_uring ring
+#define CHIBA_CSCO_URING_ENTRIES 256
+// #define CHIBA_URING_DISABLE // Do csco I/O on epoll readiness, not io_uring
+
+// Thread pool: initial per-worker deque capacity (power of two, grows)
+#define CHIBA_TP_DEQUE_CAP 256
+// Thread pool: capacity of the queue for jobs submitted from outside the pool
+#define CHIBA_TP_INJECTOR_CAP 65536
+// Thread pool: jobs allocated at a time by a worker with no free jobs left
+#define CHIBA_TP_JOB_CHUNK 256
+// Thread pool: jobs chiba_thread_pool_add_work_batch queues per reservation
+#define CHIBA_TP_SUBMIT_BATCH 64
+// Thread pool: highest CPU number + 1 that workers can be pinned to (x64)
+#define CHIBA_TP_MAX_CPUS 1024
+
+// Channel: one more than the messages per block of unbounded channels
+// (power of two)
+#define CHIBA_CHAN_BLOCK_LAP 32
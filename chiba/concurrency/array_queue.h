@@ -188,9 +188,76 @@ UTILS bool chiba_arrayqueue_push(chiba_arrayqueue *queue, anyptr value) {
                                     NULL);
 }
 
-// Attempts to pop an element from the queue
-// Returns NULL if the queue is empty
-UTILS anyptr chiba_arrayqueue_pop(chiba_arrayqueue *queue) {
+// Position `k` slots after `pos`, crossing laps as needed
+UTILS u64 chiba_arrayqueue_advance(const chiba_arrayqueue *queue, u64 pos,
+                                   u64 k) {
+  u64 lin = (pos / queue->one_lap) * queue->capacity +
+            (pos & (queue->one_lap - 1)) + k;
+  return (lin / queue->capacity) * queue->one_lap + lin % queue->capacity;
+}
+
+// Attempts to push the first `n` elements of `values` with one reservation
+// of the tail
+// Only slots whose stamps already show them free are reserved, so the slots
+// are filled right after the reservation without waiting on consumers
+// Returns how many were pushed, at most the free slots in a row at the tail;
+// 0 if the queue is full
+UTILS u64 chiba_arrayqueue_push_n(chiba_arrayqueue *queue,
+                                  const anyptr *values, u64 n) {
+  chiba_backoff backoff = {.step = 0};
+  u64 tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  u64 k;
+
+  while (1) {
+    // Count the free slots from the tail on
+    u64 new_tail = tail;
+    for (k = 0; k < n; k++) {
+      chiba_arrayqueue_slot *slot =
+          &queue->buffer[new_tail & (queue->one_lap - 1)];
+      if (atomic_load_explicit(&slot->stamp, memory_order_acquire) != new_tail)
+        break;
+      new_tail = chiba_arrayqueue_advance(queue, new_tail, 1);
+    }
+
+    if (k > 0) {
+      // Claim k slots at once
+      if (atomic_compare_exchange_weak_explicit(&queue->tail, &tail, new_tail,
+                                                memory_order_seq_cst,
+                                                memory_order_relaxed))
+        break;
+      backoff_spin(&backoff);
+      continue;
+    }
+
+    // The slot at the tail is not free: the queue is full, a consumer is
+    // still reading it, or the tail is stale
+    chiba_arrayqueue_slot *slot = &queue->buffer[tail & (queue->one_lap - 1)];
+    u64 stamp = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+    if (stamp + queue->one_lap == tail + 1) {
+      atomic_thread_fence(memory_order_seq_cst);
+      u64 head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+      if (head + queue->one_lap == tail)
+        return 0;
+      backoff_spin(&backoff);
+    } else {
+      backoff_snooze(&backoff);
+    }
+    tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  }
+
+  // Fill the claimed slots
+  for (u64 i = 0; i < k; i++) {
+    chiba_arrayqueue_slot *slot = &queue->buffer[tail & (queue->one_lap - 1)];
+    slot->value = values[i];
+    atomic_store_explicit(&slot->stamp, tail + 1, memory_order_release);
+    tail = chiba_arrayqueue_advance(queue, tail, 1);
+  }
+  return k;
+}
+
+// Attempts to pop an element from the queue into `out`
+// Returns false if the queue is empty; unlike pop, NULL elements are fine
+UTILS bool chiba_arrayqueue_try_pop(chiba_arrayqueue *queue, anyptr *out) {
   chiba_backoff backoff = {.step = 0};
   u64 head = atomic_load_explicit(&queue->head, memory_order_relaxed);
 
@@ -219,10 +286,10 @@ UTILS anyptr chiba_arrayqueue_pop(chiba_arrayqueue *queue) {
                                                 memory_order_seq_cst,
                                                 memory_order_relaxed)) {
         // Read the value from the slot and update the stamp
-        anyptr msg = slot->value;
+        *out = slot->value;
         atomic_store_explicit(&slot->stamp, head + queue->one_lap,
                               memory_order_release);
-        return msg;
+        return true;
       }
       backoff_spin(&backoff);
     } else if (stamp == head) {
@@ -231,10 +298,12 @@ UTILS anyptr chiba_arrayqueue_pop(chiba_arrayqueue *queue) {
 
       // If the tail equals the head, the queue is empty
       if (tail == head) {
-        return NULL;
+        return false;
       }
 
-      backoff_spin(&backoff);
+      // A producer claimed the slot but has not written it yet; it may have
+      // been preempted, so snooze rather than spin
+      backoff_snooze(&backoff);
       head = atomic_load_explicit(&queue->head, memory_order_relaxed);
     } else {
       // Snooze because we need to wait for the stamp to get updated
@@ -244,6 +313,13 @@ UTILS anyptr chiba_arrayqueue_pop(chiba_arrayqueue *queue) {
   }
 }
 
+// Attempts to pop an element from the queue
+// Returns NULL if the queue is empty
+UTILS anyptr chiba_arrayqueue_pop(chiba_arrayqueue *queue) {
+  anyptr msg;
+  return chiba_arrayqueue_try_pop(queue, &msg) ? msg : NULL;
+}
+
 // Returns the capacity of the queue
 UTILS u64 chiba_arrayqueue_capacity(const chiba_arrayqueue *queue) {
   return queue->capacity;
@@ -475,6 +475,150 @@ TEST_CASE(ten_producers_one_consumer_ordered, array_queue,
             return 0;
           })
 
+TEST_CASE(push_n, array_queue, "Batch push fills what fits", {
+  DESC(push_n);
+
+  chiba_arrayqueue *queue = chiba_arrayqueue_new(5);
+  ASSERT_NOT_NULL(queue, "Queue should be created");
+  anyptr values[8];
+  for (i64 i = 0; i < 8; i++)
+    values[i] = (anyptr)(i + 1);
+
+  ASSERT_EQ(3, chiba_arrayqueue_push_n(queue, values, 3),
+            "All three should be pushed");
+  ASSERT_EQ(1, (i64)chiba_arrayqueue_pop(queue), "Pop should return 1");
+  ASSERT_EQ(2, (i64)chiba_arrayqueue_pop(queue), "Pop should return 2");
+
+  // Only four slots are left; the batch wraps around the buffer
+  ASSERT_EQ(4, chiba_arrayqueue_push_n(queue, values + 3, 5),
+            "Batch should stop at the capacity");
+  ASSERT_TRUE(chiba_arrayqueue_is_full(queue), "Queue should be full");
+  ASSERT_EQ(0, chiba_arrayqueue_push_n(queue, values + 7, 1),
+            "Push into a full queue should fail");
+
+  for (i64 i = 3; i <= 7; i++)
+    ASSERT_EQ(i, (i64)chiba_arrayqueue_pop(queue), "Pop should keep order");
+  ASSERT_TRUE(chiba_arrayqueue_is_empty(queue), "Queue should be empty");
+
+  chiba_arrayqueue_drop(queue);
+  return 0;
+})
+
+// Pushes values thread_id * 1000000 + 1 .. + iterations in batches of 7
+void *batch_producer_thread(void *arg) {
+  ThreadArgs *args = (ThreadArgs *)arg;
+  anyptr batch[7];
+  i64 next = 1;
+
+  while (next <= args->iterations) {
+    u64 n = 0;
+    while (n < 7 && next + (i64)n <= args->iterations) {
+      batch[n] = (anyptr)(args->thread_id * 1000000 + next + (i64)n);
+      n++;
+    }
+    u64 done = 0;
+    while (done < n) {
+      u64 k = chiba_arrayqueue_push_n(args->queue, batch + done, n - done);
+      // Full: let the consumers run rather than burn the time slice
+      if (k == 0)
+        sched_yield();
+      done += k;
+    }
+    next += (i64)n;
+  }
+
+  return NULL;
+}
+
+typedef struct {
+  chiba_arrayqueue *queue;
+  _Atomic(i64) *remaining;
+  i64 sum;
+} BatchConsumerArgs;
+
+void *batch_consumer_thread(void *arg) {
+  BatchConsumerArgs *args = (BatchConsumerArgs *)arg;
+
+  while (atomic_load(args->remaining) > 0) {
+    anyptr value = chiba_arrayqueue_pop(args->queue);
+    if (value != NULL) {
+      args->sum += (i64)value;
+      atomic_fetch_sub(args->remaining, 1);
+    } else {
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}
+
+TEST_CASE(try_pop_null, array_queue, "try_pop tells NULL from empty", {
+  DESC(try_pop_null);
+
+  chiba_arrayqueue *queue = chiba_arrayqueue_new(2);
+  anyptr out = (anyptr)1;
+  ASSERT_TRUE(!chiba_arrayqueue_try_pop(queue, &out), "Empty queue");
+  ASSERT_TRUE(chiba_arrayqueue_push(queue, NULL), "NULL pushed");
+  ASSERT_TRUE(chiba_arrayqueue_try_pop(queue, &out), "NULL popped");
+  ASSERT_NULL(out, "Popped value is NULL");
+  ASSERT_TRUE(!chiba_arrayqueue_try_pop(queue, &out), "Empty again");
+
+  chiba_arrayqueue_drop(queue);
+  return 0;
+})
+
+TEST_CASE(concurrent_push_n, array_queue,
+          "Batch producers and single consumers", {
+            DESC(concurrent_push_n);
+
+            chiba_arrayqueue *queue = chiba_arrayqueue_new(16);
+            ASSERT_NOT_NULL(queue, "Queue should be created");
+
+            const int num_producers = 4;
+            const int num_consumers = 2;
+            const i64 items_per_producer = 2000;
+            _Atomic(i64) remaining = num_producers * items_per_producer;
+
+            pthread_t producers[num_producers];
+            pthread_t consumers[num_consumers];
+            ThreadArgs prod_args[num_producers];
+            BatchConsumerArgs cons_args[num_consumers];
+
+            for (int i = 0; i < num_consumers; i++) {
+              cons_args[i].queue = queue;
+              cons_args[i].remaining = &remaining;
+              cons_args[i].sum = 0;
+              pthread_create(&consumers[i], NULL, batch_consumer_thread,
+                             &cons_args[i]);
+            }
+            for (int i = 0; i < num_producers; i++) {
+              prod_args[i].queue = queue;
+              prod_args[i].thread_id = i + 1;
+              prod_args[i].iterations = items_per_producer;
+              pthread_create(&producers[i], NULL, batch_producer_thread,
+                             &prod_args[i]);
+            }
+
+            for (int i = 0; i < num_producers; i++)
+              pthread_join(producers[i], NULL);
+            i64 sum = 0;
+            for (int i = 0; i < num_consumers; i++) {
+              pthread_join(consumers[i], NULL);
+              sum += cons_args[i].sum;
+            }
+
+            i64 expected = 0;
+            for (i64 t = 1; t <= num_producers; t++)
+              expected += t * 1000000 * items_per_producer +
+                          items_per_producer * (items_per_producer + 1) / 2;
+            ASSERT_EQ(expected, sum, "Every value should arrive once");
+            ASSERT_TRUE(chiba_arrayqueue_is_empty(queue),
+                        "Queue should be empty");
+
+            chiba_arrayqueue_drop(queue);
+            return 0;
+          })
+
 REGISTER_TEST_GROUP(array_queue) {
   REGISTER_TEST(create_destroy, array_queue);
   REGISTER_TEST(single_push_pop, array_queue);
@@ -484,6 +628,9 @@ REGISTER_TEST_GROUP(array_queue) {
   REGISTER_TEST(concurrent_mixed_operations, array_queue);
   REGISTER_TEST(four_producers_two_consumers, array_queue);
   REGISTER_TEST(ten_producers_one_consumer_ordered, array_queue);
+  REGISTER_TEST(push_n, array_queue);
+  REGISTER_TEST(try_pop_null, array_queue);
+  REGISTER_TEST(concurrent_push_n, array_queue);
 }
 
 ENABLE_TEST_GROUP(array_queue);
@@ -2,6 +2,8 @@
 
 #include "../arc/arc.h"
 #include "../basic_memory.h"
+#include "../utils/eventcount.h"
+#include <stdint.h>
 
 //////////////////////////////////////////////////////////////////////////////////
 // Future 状态和错误码
@@ -11,7 +13,8 @@ typedef enum {
   FUTURE_PENDING = 0,   // 任务待执行
   FUTURE_RUNNING = 1,   // 任务执行中
   FUTURE_COMPLETED = 2, // 任务完成
-  FUTURE_CANCELLED = 4  // 任务被取消
+  FUTURE_CANCELLED = 4, // 任务被取消
+  FUTURE_COMPLETING = 8 // 内部: 已抢到完成权, 结果写入中
 } FutureState;
 
 typedef enum {
@@ -36,6 +39,13 @@ typedef struct chiba_future {
   // 任务执行的线程 ID (用于检测线程挂掉)
   pthread_t worker_tid;
 
+  // 等待者在此休眠, 完成或取消时唤醒
+  chiba_event done;
+
+  // 由 chiba_thread_pool_submit 填写的任务
+  anyptr (*task)(anyptr arg);
+  anyptr task_arg;
+
 } chiba_future;
 
 //////////////////////////////////////////////////////////////////////////////////
@@ -49,10 +59,71 @@ UTILS void _chiba_future_init(anyptr self, anyptr args) {
   atomic_init(&future->error, FUTURE_ERR_OK);
   atomic_init(&future->result, NULL);
   future->worker_tid = 0;
+  chiba_event_init(&future->done);
+  future->task = NULL;
+  future->task_arg = NULL;
+}
+
+UTILS void _chiba_future_drop(anyptr self) {
+  chiba_future *future = (chiba_future *)self;
+  chiba_event_drop(&future->done);
 }
 
 UTILS chiba_shared_ptr_param(chiba_future) chiba_future_init() {
-  return chiba_shared_new(sizeof(chiba_future), NULL, _chiba_future_init, NULL);
+  return chiba_shared_new(sizeof(chiba_future), NULL, _chiba_future_init,
+                          _chiba_future_drop);
+}
+
+UTILS bool _chiba_future_state_done(FutureState state) {
+  return state == FUTURE_COMPLETED || state == FUTURE_CANCELLED;
+}
+
+// 结局已定: 完成或取消, 或者正在写入结果
+UTILS bool _chiba_future_state_settled(FutureState state) {
+  return _chiba_future_state_done(state) || state == FUTURE_COMPLETING;
+}
+
+/**
+ * 设置结果并唤醒等待者 (执行任务的一方调用)
+ * 已被取消的 future 保持取消状态
+ */
+UTILS void chiba_future_complete(chiba_shared_ptr_param(chiba_future) ptr,
+                                 anyptr result) {
+  chiba_future *future = (chiba_future *)chiba_shared_get(&ptr);
+  if (!future)
+    return;
+
+  // 先抢完成权再写结果, 已取消的 future 不会被写入;
+  // 等待者要看到 FUTURE_COMPLETED 才读结果
+  FutureState state = atomic_load(&future->state);
+  do {
+    if (_chiba_future_state_settled(state))
+      return;
+  } while (!atomic_compare_exchange_weak(&future->state, &state,
+                                         FUTURE_COMPLETING));
+  atomic_store(&future->result, result);
+  atomic_store(&future->state, FUTURE_COMPLETED);
+  chiba_event_notify_all(&future->done);
+}
+
+/**
+ * 以错误结束 future 并唤醒等待者, 状态变为 FUTURE_CANCELLED
+ */
+UTILS void chiba_future_fail(chiba_shared_ptr_param(chiba_future) ptr,
+                             FutureError error) {
+  chiba_future *future = (chiba_future *)chiba_shared_get(&ptr);
+  if (!future)
+    return;
+
+  // 错误码先于状态写入, 看到 FUTURE_CANCELLED 的等待者一定能读到它
+  FutureError none = FUTURE_ERR_OK;
+  atomic_compare_exchange_strong(&future->error, &none, error);
+  FutureState state = atomic_load(&future->state);
+  while (!_chiba_future_state_settled(state) &&
+         !atomic_compare_exchange_weak(&future->state, &state,
+                                       FUTURE_CANCELLED))
+    ;
+  chiba_event_notify_all(&future->done);
 }
 
 // ========== PUBLIC API ==========
@@ -80,13 +151,10 @@ UTILS bool chiba_future_try_get(chiba_shared_ptr_param(chiba_future) ptr,
 /**
  * 请求取消任务
  * 注意: 只是设置取消标志,任务函数需要主动检查
+ * 尚未执行的任务不再执行; 等待者立即返回 FUTURE_ERR_CANCELLED
  */
 UTILS void chiba_future_cancel(chiba_shared_ptr_param(chiba_future) ptr) {
-  chiba_future *future = (chiba_future *)chiba_shared_get(&ptr);
-  if (!future)
-    return;
-
-  atomic_store(&future->state, FUTURE_CANCELLED);
+  chiba_future_fail(ptr, FUTURE_ERR_CANCELLED);
 }
 
 /**
@@ -108,7 +176,8 @@ UTILS FutureState chiba_future_state(chiba_shared_ptr_param(chiba_future) ptr) {
   if (!future)
     return FUTURE_PENDING;
 
-  return atomic_load(&future->state);
+  FutureState state = atomic_load(&future->state);
+  return state == FUTURE_COMPLETING ? FUTURE_RUNNING : state;
 }
 
 /**
@@ -132,4 +201,53 @@ UTILS bool chiba_future_is_done(chiba_shared_ptr_param(chiba_future) ptr) {
 
   FutureState state = atomic_load(&future->state);
   return state == FUTURE_COMPLETED || state == FUTURE_CANCELLED;
-}
\ No newline at end of file
+}
+/**
+ * 阻塞等待 future 完成或取消, 最多等待 nanosecs 纳秒 (UINT64_MAX 不限时)
+ * 先短暂自旋, 然后休眠, 不占用 CPU
+ * @param result_out 完成时输出结果, 可为 NULL
+ * @return FUTURE_ERR_OK 已完成; FUTURE_ERR_TIMEOUT 超时; 否则为取消/失败原因
+ */
+UTILS FutureError
+chiba_future_wait_timeout(chiba_shared_ptr_param(chiba_future) ptr,
+                          u64 nanosecs, anyptr *result_out) {
+  chiba_future *future = (chiba_future *)chiba_shared_get(&ptr);
+  if (!future)
+    return FUTURE_ERR_CANCELLED;
+
+  u64 deadline = UINT64_MAX;
+  if (nanosecs != UINT64_MAX)
+    deadline = get_time_in_nanoseconds() + nanosecs;
+
+  chiba_backoff b = {.step = 0};
+  while (!_chiba_future_state_done(atomic_load(&future->state))) {
+    if (!backoff_is_completed(&b)) {
+      backoff_snooze(&b);
+      continue;
+    }
+    u32 key = chiba_event_prepare(&future->done);
+    if (_chiba_future_state_done(atomic_load(&future->state))) {
+      chiba_event_cancel(&future->done);
+      break;
+    }
+    if (!chiba_event_wait_until(&future->done, key, deadline) &&
+        !_chiba_future_state_done(atomic_load(&future->state)))
+      return FUTURE_ERR_TIMEOUT;
+  }
+
+  if (atomic_load(&future->state) == FUTURE_CANCELLED) {
+    FutureError error = atomic_load(&future->error);
+    return error != FUTURE_ERR_OK ? error : FUTURE_ERR_CANCELLED;
+  }
+  if (result_out)
+    *result_out = atomic_load(&future->result);
+  return FUTURE_ERR_OK;
+}
+
+/**
+ * 阻塞等待 future 完成或取消
+ */
+UTILS FutureError chiba_future_wait(chiba_shared_ptr_param(chiba_future) ptr,
+                                    anyptr *result_out) {
+  return chiba_future_wait_timeout(ptr, UINT64_MAX, result_out);
+}
@@ -1,240 +1,1272 @@
+// accept4, syscall (io_uring) and pthread_condattr_setclock are extensions
+// to ISO C; ask for them before any system header is pulled in
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "cs_coroutine.h"
+#include "../utils/backoff.h"
+#include "../utils/idmap.h"
+#include "../utils/timing_wheel.h"
+#include "../utils/uring.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <unistd.h>
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define CHIBA_CSCO_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#endif
+
+// Chiba Concurrent Scheduled Coroutines
+// Scheduling:
+// - every worker thread runs a scheduler loop on its own stack and switches
+//   into one coroutine at a time; coroutines always switch back to that loop,
+//   never directly to each other, so the loop can requeue them on whatever
+//   thread they happen to be on
+// - runnable coroutines sit in the worker's chiba_wsqueue. The owner pushes
+//   at the bottom and takes from the top, like the thieves do, so its own
+//   queue is FIFO and a yielding coroutine goes behind everything already
+//   queued
+// - wakeups from threads outside the runtime go through a bounded MPMC
+//   injector queue, polled after the local queue and, for fairness, before
+//   it once every CHIBA_CSCO_FAIR_TICK picks
+// - a worker with nothing to run steals from the other workers starting at a
+//   random victim, backs off, then parks on a condition variable until work
+//   is pushed or the last coroutine finishes
+// Suspend/resume is a per-coroutine atomic state machine, so a resume may come
+// from any thread at any time without losing the wakeup.
+// Deadlines: each worker has a hierarchical timing wheel. A coroutine arms its
+// timer on the wheel of the worker it suspends on, and that worker fires it
+// between picks or when its timed park runs out. The coroutine may have been
+// resumed elsewhere in the meantime, so each wheel has its own small lock and
+// a timer is always disarmed through the wheel it was filed on.
+// Readiness: the runtime owns one epoll instance. Waiters of an fd are kept in
+// a list per fd and the fd is registered EPOLLONESHOT with the union of their
+// events, re-armed after every wakeup while waiters remain. Busy workers poll
+// it without blocking whenever they run out of local work and once every
+// CHIBA_CSCO_FAIR_TICK picks; an idle worker takes over epoll_wait as the
+// poller, blocking until an fd is ready, its next timer is due, or an eventfd
+// is written because work was pushed.
+// I/O: each worker owns an io_uring ring. Coroutines running on the worker
+// queue their operations on it without entering the kernel, and the worker
+// submits everything queued with one io_uring_enter once its run queue has
+// drained, or every CHIBA_CSCO_FAIR_TICK picks while it stays busy.
+// Completions are reaped by the owner on every pass, or, while it is idle, by
+// the poller: ring fds are part of the epoll set and turn readable when
+// completions are waiting.
+
 //////////
-// Linked list utilities
+// chiba_csco structure
 //////////
 
+// Coroutine states
+// RUNNABLE: queued or running
+// NOTIFIED: queued or running, with a pending resume for the next suspend
+// PARKING:  switching out to suspend; the scheduler finishes the transition
+// PARKED:   suspended, only a resume makes it runnable again
+// DONE:     finished, about to be freed
+enum {
+  CHIBA_CSCO_RUNNABLE,
+  CHIBA_CSCO_NOTIFIED,
+  CHIBA_CSCO_PARKING,
+  CHIBA_CSCO_PARKED,
+  CHIBA_CSCO_DONE,
+};
+
+// What a coroutine asked its scheduler to do when it switched out
+enum {
+  CHIBA_CSCO_ACT_NONE,
+  CHIBA_CSCO_ACT_YIELD,
+  CHIBA_CSCO_ACT_PARK,
+  CHIBA_CSCO_ACT_EXIT,
+};
+
 typedef struct chiba_csco chiba_csco;
 
-// typedef struct chiba_csco_link {
-//   chiba_csco *prev;
-//   chiba_csco *next;
-// } chiba_csco_link;
-
-// typedef struct chiba_csco_list {
-//   chiba_csco_link head;
-//   chiba_csco_link tail;
-// } chiba_csco_list;
-
-// UTILS void chiba_csco_remove_from_list(chiba_csco *co) {
-//   chiba_csco_link *link = (anyptr)co;
-//   ((chiba_csco_link *)link->prev)->next = link->next;
-//   ((chiba_csco_link *)link->next)->prev = link->prev;
-//   link->next = (chiba_csco *)link;
-//   link->prev = (chiba_csco *)link;
-// }
-// UTILS void chiba_csco_list_init(chiba_csco_list *list) {
-//   list->head.prev = NULL;
-//   list->head.next = (chiba_csco *)(&list->tail);
-//   list->tail.prev = (chiba_csco *)(&list->head);
-//   list->tail.next = NULL;
-// }
-// UTILS void chiba_csco_list_push_back(chiba_csco_list *list, chiba_csco *co) {
-//   chiba_csco_remove_from_list(co);
-//   chiba_csco_link *link = (anyptr)co;
-//   ((chiba_csco_link *)list->tail.prev)->next = (chiba_csco *)link;
-//   link->prev = list->tail.prev;
-//   link->next = (chiba_csco *)(&list->tail);
-//   list->tail.prev = (chiba_csco *)link;
-// }
-// UTILS chiba_csco *chiba_csco_list_pop_front(chiba_csco_list *list,
-//                                             chiba_csco **out_co) {
-//   chiba_csco *co = list->head.next;
-//   if (unlikely(co == (chiba_csco *)(&list->tail))) {
-//     return NULL;
-//   }
-//   chiba_csco_remove_from_list(co);
-//   return co;
-// }
-// UTILS bool chiba_csco_list_is_empty(chiba_csco_list *list) {
-//   return list->head.next == (chiba_csco *)(&list->tail);
-// }
-
-//////////
-// cleanup stack
-//////////
-typedef struct chiba_csco_cleanup chiba_csco_cleanup;
-
-typedef struct chiba_csco_cleanup {
-  chiba_csco_entry_t func;
-  anyptr arg;
-  chiba_csco_cleanup *next;
-} chiba_csco_cleanup;
-
-//////////
-// chiba_csco structure and aatrees for coroutine management
-//////////
-
-// 我这个和neco不一样的点：
-// 我这个eventdata 和 eventkind 是 anyptr 和 ATOM，而neco是i32 fd 和 i32
-// evkind 我这个设计更通用一些，并不是局限于文件事件
-// TODO: 是不是还得写一个event handler map？ 让用户可以注册event handler？
-typedef struct chiba_csco {
-  chiba_csco *prev;
-  chiba_csco *next;
+// Join record, lives on the waiting coroutine's stack
+typedef struct chiba_csco_joiner {
+  chiba_csco *waiter;
+  struct chiba_csco_joiner *next;
+} chiba_csco_joiner;
+
+// fd wait record, lives on the waiting coroutine's stack
+typedef struct chiba_csco_fdwaiter {
+  chiba_csco *waiter;
+  u32 events;  // CHIBA_CSCO_WAIT_* wanted
+  u32 revents; // set by the poller when it wakes the waiter
+  struct chiba_csco_fdwaiter *next;
+} chiba_csco_fdwaiter;
 
-  chiba_csco_id_t id;         // coroutine id (sco_id())
+// io_uring operation, lives on the issuing coroutine's stack. The reaper
+// resumes the issuer by id, since it may finish as soon as `done` is set.
+typedef struct chiba_csco_ioop {
+  chiba_csco_id_t id;
+  i32 res;
+  _Atomic(bool) done;
+} chiba_csco_ioop;
+
+typedef struct chiba_csco {
+  chiba_csco_id_t id;         // coroutine id
   chiba_csco_id_t last_id;    // last coroutine id
   chiba_csco_id_t starter_id; // starter coroutine id
 
-  anyptr stack;             // coroutine stack
   chiba_csco_entry_t entry; // coroutine entry function
   anyptr ctx;
-  chiba_csco_cleanup *cleanup; // cancelation cleanup stack
-
-  chiba_csco_ts_t deadline;
-
-  // Event, before and after handles event
-  // - evdata should be NULL
-  // - evkind should be 0
-  anyptr evdata;
-  ATOM evkind;
-
-  bool paused;       // coroutine is paused
-  bool deadlined;    // coroutine operation was deadlined
-  bool suspended;    // coroutine is suspended
-  bool mutex_locked; // coroutine holds a mutex lock
-
-  // ===== Links for aatrees =====
-
-  AAT_FIELDS(chiba_csco, all_left, all_right,
-             all_level) // For the rt->all comap, which stores all active
-                        //  coroutines
-  AAT_FIELDS(chiba_csco, dl_left, dl_right,
-             dl_level) // Deadline for pause. All paused will have this set to
-                       // something.
-  AAT_FIELDS(chiba_csco, evleft, evright, evlevel) // Event waiters
+  chiba_co *co; // NULL until the coroutine first runs
+
+  _Atomic(u32) state;
+  chiba_csco_joiner *joiners; // guarded by the id shard lock
+
+  // Deadline of the current suspend, guarded by the owning wheel's lock
+  chiba_twheel_timer timer;
+  struct chiba_csco_worker *timer_owner;
+  bool timedout;
 } chiba_csco;
 
-///////
+//////////
 // chiba_csco_runtime structure
-///////
-
-typedef struct chiba_csco_runtime_info {
-  i64 ndeadlines; // total number of paused coroutines
-  i64 ntotal;     // total number of coroutines ever created
-  i64 nsleepers;
-  i64 nlocked;
-  i64 nreceivers;
-  i64 nsenders;
-  i64 nwaitgroupers; // number of waitgroup blocked coroutines
-  i64 ncondwaiters;  // number of cond blocked coroutines
-  i64 nworkers;      // number of background workers
-  i64 nsuspended;    // number of suspended coroutines
-} chiba_csco_runtime_info;
+//////////
+
+typedef struct chiba_csco_worker {
+  chiba_wsqueue *runq;
+  chiba_csco *cur; // running coroutine
+  u32 action;      // set by cur before it switches back
+  u32 tick;
+  u64 rng;
+  _Atomic(i64) steals;
+  pthread_t thread;
+  i32 index;
+
+  // Timers of coroutines suspended on this worker. Only the owner inserts
+  // and advances; any thread may cancel.
+  _Atomic(bool) timer_locker;
+  _Atomic(u64) ntimers; // wheel.count, readable without the lock
+  chiba_twheel wheel;
+
+#ifdef CHIBA_URING
+  // I/O ring of coroutines running on this worker. Only the owner queues and
+  // submits; completions are reaped under ring_locker.
+  bool has_ring;
+  _Atomic(bool) ring_locker;
+  _Atomic(i64) inflight;
+  _Atomic(i64) io_ops;
+  _Atomic(i64) io_enters;
+  chiba_uring ring;
+#endif
+} __attribute__((aligned(64))) chiba_csco_worker;
+
+// id -> coroutine table, sharded to keep resumes on different coroutines
+// from contending
+typedef struct chiba_csco_shard {
+  _Atomic(bool) locker;
+  chiba_idmap map;
+} __attribute__((aligned(64))) chiba_csco_shard;
 
 typedef struct chiba_csco_runtime {
-  chiba_arrayqueue cancellist; // waiting coroutines
-  chiba_arrayqueue joinlist;   // waiting coroutines
+  chiba_csco_worker *workers;
+  i32 nworkers;
+  chiba_arrayqueue *injector;
+
+  _Atomic(i64) live; // started and not yet finished
+  _Atomic(bool) shutdown;
+
+  // parking of idle workers
+  _Atomic(i32) nidle;
+  pthread_mutex_t idle_mu;
+  pthread_cond_t idle_cv;
+
+  // fd readiness
+  i32 epfd;
+  i32 evfd;                   // written to interrupt a blocked epoll_wait
+  _Atomic(bool) polling;      // a worker owns epoll_wait
+  _Atomic(bool) poll_blocked; // ... and may be blocked in it
+  _Atomic(i64) nfdwaiters;
+  _Atomic(i64) nioops; // io_uring operations in flight on any worker
+  _Atomic(bool) fd_locker;
+  chiba_idmap fds; // fd + 1 -> first chiba_csco_fdwaiter
+
+  chiba_csco_shard shards[CHIBA_CSCO_NSHARDS];
+} chiba_csco_runtime;
+
+PRIVATE _Atomic(chiba_csco_runtime *) chiba_csco_rt = NULL;
+PRIVATE _Atomic(i64) chiba_csco_next_id = 0;
+PRIVATE THREAD_LOCAL chiba_csco_worker *chiba_csco_self = NULL;
+
+UTILS chiba_csco_runtime *chiba_csco_runtime_get(void) {
+  return atomic_load_explicit(&chiba_csco_rt, memory_order_acquire);
+}
+
+UTILS chiba_csco *chiba_csco_current(void) {
+  return chiba_csco_self ? chiba_csco_self->cur : NULL;
+}
+
+//////////
+// id shards
+//////////
+
+UTILS chiba_csco_shard *chiba_csco_shard_of(chiba_csco_runtime *rt,
+                                            chiba_csco_id_t id) {
+  return &rt->shards[(u64)id & (CHIBA_CSCO_NSHARDS - 1)];
+}
+
+UTILS void chiba_csco_spin_lock(_Atomic(bool) *locker) {
+  bool expected = false;
+  chiba_backoff b = {.step = 0};
+  while (!atomic_compare_exchange_weak(locker, &expected, true)) {
+    expected = false;
+    backoff_snooze(&b);
+  }
+}
+
+UTILS void chiba_csco_spin_unlock(_Atomic(bool) *locker) {
+  atomic_store(locker, false);
+}
+
+UTILS void chiba_csco_shard_lock(chiba_csco_shard *shard) {
+  chiba_csco_spin_lock(&shard->locker);
+}
+
+UTILS void chiba_csco_shard_unlock(chiba_csco_shard *shard) {
+  chiba_csco_spin_unlock(&shard->locker);
+}
+
+//////////
+// run queues
+//////////
+
+// Get the poller out of epoll_wait
+UTILS void chiba_csco_reactor_interrupt(chiba_csco_runtime *rt) {
+#ifdef CHIBA_CSCO_EPOLL
+  u64 one = 1;
+  if (write(rt->evfd, &one, sizeof(one)) < 0) {
+    // The counter is already non-zero, the poller will wake anyway
+  }
+#else
+  (void)rt;
+#endif
+}
+
+// Wake one parked worker, if any, after work was pushed
+UTILS void chiba_csco_notify(chiba_csco_runtime *rt) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&rt->poll_blocked, memory_order_relaxed))
+    chiba_csco_reactor_interrupt(rt);
+  if (atomic_load_explicit(&rt->nidle, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&rt->idle_mu);
+    pthread_cond_signal(&rt->idle_cv);
+    pthread_mutex_unlock(&rt->idle_mu);
+  }
+}
+
+// Queue a runnable coroutine on the calling worker, or on the injector when
+// called from outside the runtime
+PRIVATE void chiba_csco_push(chiba_csco_runtime *rt, chiba_csco *co) {
+  chiba_csco_worker *w = chiba_csco_self;
+  if (w) {
+    if (unlikely(!chiba_wsqueue_push(w->runq, co, true)))
+      CHIBA_PANIC("Could not grow the run queue of worker %d", w->index);
+  } else {
+    chiba_backoff b = {.step = 0};
+    while (!chiba_arrayqueue_push(rt->injector, co))
+      backoff_snooze(&b);
+  }
+  chiba_csco_notify(rt);
+}
+
+// Make `co` runnable if it is suspended, otherwise leave it a pending resume
+PRIVATE void chiba_csco_wake(chiba_csco_runtime *rt, chiba_csco *co) {
+  u32 state = atomic_load_explicit(&co->state, memory_order_acquire);
+  for (;;) {
+    switch (state) {
+    case CHIBA_CSCO_PARKED:
+      if (atomic_compare_exchange_weak(&co->state, &state,
+                                       CHIBA_CSCO_RUNNABLE)) {
+        chiba_csco_push(rt, co);
+        return;
+      }
+      break;
+    case CHIBA_CSCO_RUNNABLE:
+    case CHIBA_CSCO_PARKING:
+      if (atomic_compare_exchange_weak(&co->state, &state,
+                                       CHIBA_CSCO_NOTIFIED))
+        return;
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+UTILS bool chiba_csco_has_work(chiba_csco_runtime *rt) {
+  if (!chiba_arrayqueue_is_empty(rt->injector))
+    return true;
+  for (i32 i = 0; i < rt->nworkers; i++) {
+    if (!chiba_wsqueue_is_empty(rt->workers[i].runq))
+      return true;
+  }
+  return false;
+}
+
+// Pick the next coroutine for worker `w`, or NULL if none could be found
+PRIVATE chiba_csco *chiba_csco_next(chiba_csco_runtime *rt,
+                                    chiba_csco_worker *w) {
+  chiba_csco *co;
+  if (++w->tick % CHIBA_CSCO_FAIR_TICK == 0 &&
+      (co = (chiba_csco *)chiba_arrayqueue_pop(rt->injector)))
+    return co;
+  // The owner competes with thieves for the top; a lost race only means
+  // someone else took that coroutine
+  while (!chiba_wsqueue_is_empty(w->runq)) {
+    if ((co = (chiba_csco *)chiba_wsqueue_steal(w->runq)))
+      return co;
+  }
+  if ((co = (chiba_csco *)chiba_arrayqueue_pop(rt->injector)))
+    return co;
+  if (rt->nworkers > 1) {
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    i32 start = (i32)(w->rng % (u64)rt->nworkers);
+    for (i32 i = 0; i < rt->nworkers; i++) {
+      chiba_csco_worker *victim = &rt->workers[(start + i) % rt->nworkers];
+      if (victim == w || chiba_wsqueue_is_empty(victim->runq))
+        continue;
+      if ((co = (chiba_csco *)chiba_wsqueue_steal(victim->runq))) {
+        atomic_fetch_add_explicit(&w->steals, 1, memory_order_relaxed);
+        return co;
+      }
+    }
+  }
+  return NULL;
+}
+
+//////////
+// timers
+//////////
+
+UTILS u64 chiba_csco_tick_now(void) {
+  return get_time_in_nanoseconds() / CHIBA_CSCO_TIMER_TICK_NS;
+}
 
-  chiba_csco_runtime_info info; // runtime info
+// Arm the deadline of the running coroutine on the calling worker's wheel.
+// Timers fire at the first tick at or after the deadline.
+PRIVATE void chiba_csco_timer_arm(chiba_csco *co, chiba_csco_ts_t deadline) {
+  chiba_csco_worker *w = chiba_csco_self;
+  u64 tick = ((u64)deadline + CHIBA_CSCO_TIMER_TICK_NS - 1) /
+             CHIBA_CSCO_TIMER_TICK_NS;
+  chiba_csco_spin_lock(&w->timer_locker);
+  co->timedout = false;
+  co->timer_owner = w;
+  chiba_twheel_insert(&w->wheel, &co->timer, tick);
+  atomic_store_explicit(&w->ntimers, w->wheel.count, memory_order_relaxed);
+  chiba_csco_spin_unlock(&w->timer_locker);
+}
 
-  chiba_csco_evmap evwaiters; // coroutines waiting on events (aat root)
-  i64 nevwaiters;
+// Disarm the timer if it has not fired yet. Returns true if it had fired.
+PRIVATE bool chiba_csco_timer_disarm(chiba_csco *co) {
+  chiba_csco_worker *w = co->timer_owner;
+  chiba_csco_spin_lock(&w->timer_locker);
+  chiba_twheel_cancel(&w->wheel, &co->timer);
+  atomic_store_explicit(&w->ntimers, w->wheel.count, memory_order_relaxed);
+  bool timedout = co->timedout;
+  chiba_csco_spin_unlock(&w->timer_locker);
+  return timedout;
+}
 
-  // list of coroutines waiting to be resumed by the scheduler
-  i32 nresumers;
-  chiba_arrayqueue resumers;
+// Fire the due timers of worker `w`. Coroutines are woken under the wheel
+// lock: their disarm takes the same lock, so none of them can return from
+// its suspend and finish before it has been woken.
+PRIVATE void chiba_csco_timers(chiba_csco_runtime *rt, chiba_csco_worker *w) {
+  if (!atomic_load_explicit(&w->ntimers, memory_order_relaxed))
+    return;
+  u64 tick = chiba_csco_tick_now();
+  if (tick <= w->wheel.now)
+    return;
+  chiba_csco_spin_lock(&w->timer_locker);
+  chiba_twheel_timer *t = chiba_twheel_advance(&w->wheel, tick);
+  atomic_store_explicit(&w->ntimers, w->wheel.count, memory_order_relaxed);
+  while (t) {
+    chiba_twheel_timer *next = t->prev;
+    chiba_csco *co = (chiba_csco *)((char *)t - offsetof(chiba_csco, timer));
+    co->timedout = true;
+    chiba_csco_wake(rt, co);
+    t = next;
+  }
+  chiba_csco_spin_unlock(&w->timer_locker);
+}
 
-  anyptr runtime_user_info_ext;
+//////////
+// io_uring
+//////////
+
+#ifdef CHIBA_URING
+
+// Submit whatever the coroutines run by `w` queued since the last pass
+UTILS void chiba_csco_io_submit(chiba_csco_worker *w) {
+  if (!w->has_ring || !chiba_uring_pending(&w->ring))
+    return;
+  if (chiba_uring_submit(&w->ring, 0) >= 0)
+    atomic_fetch_add_explicit(&w->io_enters, 1, memory_order_relaxed);
+}
+
+// Post the completions waiting on `w`'s ring and resume their coroutines.
+// The owner only tries the lock; the poller waits for it, since a ring fd it
+// leaves unreaped stays readable.
+PRIVATE void chiba_csco_io_reap(chiba_csco_runtime *rt, chiba_csco_worker *w,
+                                bool wait) {
+  if (!atomic_load_explicit(&w->inflight, memory_order_relaxed))
+    return;
+  if (wait) {
+    chiba_csco_spin_lock(&w->ring_locker);
+  } else {
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&w->ring_locker, &expected, true))
+      return;
+  }
+  struct io_uring_cqe *cqe;
+  while ((cqe = chiba_uring_peek(&w->ring))) {
+    chiba_csco_ioop *op = (chiba_csco_ioop *)(uintptr_t)cqe->user_data;
+    i32 res = cqe->res;
+    chiba_uring_seen(&w->ring);
+    chiba_csco_id_t id = op->id;
+    op->res = res;
+    atomic_store_explicit(&op->done, true, memory_order_release);
+    atomic_fetch_sub_explicit(&w->inflight, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&rt->nioops, 1, memory_order_relaxed);
+    chiba_csco_resume(id);
+  }
+  chiba_csco_spin_unlock(&w->ring_locker);
+}
+
+// Claim a submission slot on the calling worker's ring, or NULL if the
+// worker has no ring
+PRIVATE struct io_uring_sqe *chiba_csco_io_sqe(void) {
+  chiba_csco_worker *w = chiba_csco_self;
+  if (!w->has_ring)
+    return NULL;
+  struct io_uring_sqe *sqe;
+  // A full ring is pushed to the kernel early, which frees every slot
+  while (!(sqe = chiba_uring_sqe(&w->ring))) {
+    if (chiba_uring_submit(&w->ring, 0) >= 0)
+      atomic_fetch_add_explicit(&w->io_enters, 1, memory_order_relaxed);
+    else if (errno != EAGAIN && errno != EBUSY && errno != EINTR)
+      CHIBA_PANIC("io_uring_enter failed on worker %d", w->index);
+  }
+  return sqe;
+}
+
+// Queue `sqe`, claimed by chiba_csco_io_sqe, and suspend until it completes
+PRIVATE i64 chiba_csco_io_wait(struct io_uring_sqe *sqe) {
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  chiba_csco_worker *w = chiba_csco_self;
+  chiba_csco_ioop op = {.id = chiba_csco_getid(), .res = 0};
+  atomic_init(&op.done, false);
+  sqe->user_data = (u64)(uintptr_t)&op;
+  atomic_fetch_add_explicit(&w->inflight, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&rt->nioops, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&w->io_ops, 1, memory_order_relaxed);
+  while (!atomic_load_explicit(&op.done, memory_order_acquire))
+    chiba_csco_suspend();
+  if (op.res < 0) {
+    errno = -op.res;
+    return CHIBA_CSCO_ERROR;
+  }
+  return op.res;
+}
+
+#else
+
+UTILS void chiba_csco_io_submit(chiba_csco_worker *w) { (void)w; }
+
+UTILS void chiba_csco_io_reap(chiba_csco_runtime *rt, chiba_csco_worker *w,
+                              bool wait) {
+  (void)rt;
+  (void)w;
+  (void)wait;
+}
 
-#ifdef SCO_MULTITHREAD_WORKERS
-  struct worker *worker;
-  pthread_mutex_t iomu;
-  chiba_arrayqueue iolist;
-  i64 niowaiters;
 #endif
-} chiba_csco_runtime;
 
-///////
-// AATree definitions and implementations
-///////
-UTILS i32 chiba_csco_all_compare(chiba_csco *a, chiba_csco *b) {
-  return a->id < b->id ? -1 : a->id > b->id;
+//////////
+// reactor
+//////////
+
+#ifdef CHIBA_CSCO_EPOLL
+
+UTILS u32 chiba_csco_fd_interest(chiba_csco_fdwaiter *head) {
+  u32 events = 0;
+  for (; head; head = head->next)
+    events |= head->events;
+  return events;
+}
+
+// (Re-)register `fd` for one wakeup on `events`. Registrations are never
+// removed; closing the fd drops it from the epoll set.
+PRIVATE bool chiba_csco_fd_arm(chiba_csco_runtime *rt, i32 fd, u32 events) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLONESHOT;
+  if (events & CHIBA_CSCO_WAIT_READ)
+    ev.events |= EPOLLIN | EPOLLRDHUP;
+  if (events & CHIBA_CSCO_WAIT_WRITE)
+    ev.events |= EPOLLOUT;
+  ev.data.u64 = (u64)fd;
+  if (epoll_ctl(rt->epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+    return true;
+  return errno == ENOENT && epoll_ctl(rt->epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+// Store the new head of `fd`'s waiter list, called with fd_locker held
+UTILS void chiba_csco_fd_set(chiba_csco_runtime *rt, i32 fd,
+                             chiba_csco_fdwaiter *head) {
+  if (head)
+    chiba_idmap_insert(&rt->fds, (i64)fd + 1, head);
+  else
+    chiba_idmap_delete(&rt->fds, (i64)fd + 1);
+}
+
+// Wake the waiters of `fd` that `epevents` satisfies. As with timers, they
+// are woken under the lock their own cleanup takes, so no wait record goes
+// away while it is still linked.
+PRIVATE void chiba_csco_fd_ready(chiba_csco_runtime *rt, i32 fd,
+                                 u32 epevents) {
+  u32 ready = 0;
+  if (epevents & (EPOLLIN | EPOLLRDHUP))
+    ready |= CHIBA_CSCO_WAIT_READ;
+  if (epevents & EPOLLOUT)
+    ready |= CHIBA_CSCO_WAIT_WRITE;
+  if (epevents & (EPOLLERR | EPOLLHUP))
+    ready = CHIBA_CSCO_WAIT_READ | CHIBA_CSCO_WAIT_WRITE;
+  chiba_csco_spin_lock(&rt->fd_locker);
+  chiba_csco_fdwaiter *head =
+      (chiba_csco_fdwaiter *)chiba_idmap_get(&rt->fds, (i64)fd + 1);
+  chiba_csco_fdwaiter **link = &head;
+  while (*link) {
+    chiba_csco_fdwaiter *fw = *link;
+    if (fw->events & ready) {
+      *link = fw->next;
+      fw->revents = fw->events & ready;
+      atomic_fetch_sub_explicit(&rt->nfdwaiters, 1, memory_order_relaxed);
+      chiba_csco_wake(rt, fw->waiter);
+    } else {
+      link = &fw->next;
+    }
+  }
+  chiba_csco_fd_set(rt, fd, head);
+  // The one-shot registration is spent, keep watching for the others
+  if (head && !chiba_csco_fd_arm(rt, fd, chiba_csco_fd_interest(head))) {
+    for (chiba_csco_fdwaiter *fw = head; fw; fw = fw->next) {
+      fw->revents = fw->events;
+      atomic_fetch_sub_explicit(&rt->nfdwaiters, 1, memory_order_relaxed);
+      chiba_csco_wake(rt, fw->waiter);
+    }
+    chiba_csco_fd_set(rt, fd, NULL);
+  }
+  chiba_csco_spin_unlock(&rt->fd_locker);
+}
+
+// Run one epoll_wait and wake whoever became ready. Only the worker holding
+// rt->polling may call this.
+PRIVATE void chiba_csco_poll(chiba_csco_runtime *rt, i32 timeout_ms) {
+  struct epoll_event evs[CHIBA_CSCO_POLL_EVENTS];
+  i32 n = epoll_wait(rt->epfd, evs, CHIBA_CSCO_POLL_EVENTS, timeout_ms);
+  for (i32 i = 0; i < n; i++) {
+    if (evs[i].data.u64 == UINT64_MAX) {
+      u64 count;
+      if (read(rt->evfd, &count, sizeof(count)) < 0) {
+        // Drained by an earlier event of the same batch
+      }
+      continue;
+    }
+    if (evs[i].data.u64 > (u64)INT32_MAX) {
+      chiba_csco_io_reap(rt, &rt->workers[~evs[i].data.u64 - 1], true);
+      continue;
+    }
+    chiba_csco_fd_ready(rt, (i32)evs[i].data.u64, evs[i].events);
+  }
+}
+
+UTILS bool chiba_csco_poll_acquire(chiba_csco_runtime *rt) {
+  if (!atomic_load_explicit(&rt->nfdwaiters, memory_order_relaxed) &&
+      !atomic_load_explicit(&rt->nioops, memory_order_relaxed))
+    return false;
+  bool expected = false;
+  return !atomic_load_explicit(&rt->polling, memory_order_relaxed) &&
+         atomic_compare_exchange_strong(&rt->polling, &expected, true);
+}
+
+// Collect ready fds without blocking, unless there are no fd waiters or
+// another worker is polling. Returns true if it polled.
+PRIVATE bool chiba_csco_reactor(chiba_csco_runtime *rt) {
+  if (!chiba_csco_poll_acquire(rt))
+    return false;
+  chiba_csco_poll(rt, 0);
+  atomic_store_explicit(&rt->polling, false, memory_order_release);
+  return true;
+}
+
+// Block the idle worker `w` in epoll_wait until an fd is ready, its timer
+// tick `expiry` comes, or work is pushed. Returns false if there is nothing
+// to wait for or another worker is already the poller.
+PRIVATE bool chiba_csco_reactor_block(chiba_csco_runtime *rt, u64 expiry) {
+  if (!chiba_csco_poll_acquire(rt))
+    return false;
+  atomic_store(&rt->poll_blocked, true);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load(&rt->shutdown) && !chiba_csco_has_work(rt)) {
+    i32 timeout_ms = -1;
+    if (expiry != UINT64_MAX) {
+      u64 now = get_time_in_nanoseconds();
+      u64 at = expiry * CHIBA_CSCO_TIMER_TICK_NS;
+      u64 ms = at > now ? (at - now + 999999) / 1000000 : 0;
+      timeout_ms = ms > INT32_MAX ? INT32_MAX : (i32)ms;
+    }
+    chiba_csco_poll(rt, timeout_ms);
+  }
+  atomic_store(&rt->poll_blocked, false);
+  atomic_store_explicit(&rt->polling, false, memory_order_release);
+  return true;
+}
+
+#else
+
+UTILS bool chiba_csco_reactor(chiba_csco_runtime *rt) {
+  (void)rt;
+  return false;
+}
+
+UTILS bool chiba_csco_reactor_block(chiba_csco_runtime *rt, u64 expiry) {
+  (void)rt;
+  (void)expiry;
+  return false;
+}
+
+#endif
+
+// Park the calling worker until work is pushed, its next timer is due or the
+// runtime shuts down. Idle stacks pooled by the worker are purged on the way
+// and the park is cut short when the next purge is due.
+PRIVATE void chiba_csco_idle(chiba_csco_runtime *rt, chiba_csco_worker *w) {
+  u64 expiry = UINT64_MAX;
+  if (atomic_load_explicit(&w->ntimers, memory_order_relaxed)) {
+    chiba_csco_spin_lock(&w->timer_locker);
+    expiry = chiba_twheel_next_expiry(&w->wheel);
+    chiba_csco_spin_unlock(&w->timer_locker);
+    if (expiry <= chiba_csco_tick_now())
+      return;
+  }
+  u64 purge = chiba_co_stack_pool_tick();
+  if (purge != UINT64_MAX) {
+    purge = (purge + CHIBA_CSCO_TIMER_TICK_NS - 1) / CHIBA_CSCO_TIMER_TICK_NS;
+    if (purge < expiry)
+      expiry = purge;
+  }
+  if (chiba_csco_reactor_block(rt, expiry))
+    return;
+  pthread_mutex_lock(&rt->idle_mu);
+  atomic_fetch_add(&rt->nidle, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load(&rt->shutdown) && !chiba_csco_has_work(rt)) {
+    if (expiry == UINT64_MAX) {
+      pthread_cond_wait(&rt->idle_cv, &rt->idle_mu);
+    } else {
+      u64 ns = expiry * CHIBA_CSCO_TIMER_TICK_NS;
+      struct timespec ts = {.tv_sec = (time_t)(ns / 1000000000ULL),
+                            .tv_nsec = (long)(ns % 1000000000ULL)};
+      pthread_cond_timedwait(&rt->idle_cv, &rt->idle_mu, &ts);
+    }
+  }
+  atomic_fetch_sub(&rt->nidle, 1);
+  pthread_mutex_unlock(&rt->idle_mu);
 }
-AAT_DEF(UTILS, chiba_csco_all_aat, chiba_csco)
-AAT_IMPL(chiba_csco_all_aat, chiba_csco, all_left, all_right, all_level,
-         chiba_csco_all_compare)
 
-UTILS i32 chiba_csco_dl_compare(chiba_csco *a, chiba_csco *b) {
-  return a->deadline < b->deadline   ? -1
-         : a->deadline > b->deadline ? 1
-         : a->id < b->id             ? -1
-                                     : a->id > b->id;
+//////////
+// running coroutines
+//////////
+
+PRIVATE void chiba_csco_entry(anyptr arg) {
+  chiba_csco *co = (chiba_csco *)arg;
+  co->co = chiba_co_current();
+  co->entry(co->ctx);
+  chiba_csco_exit();
+}
+
+PRIVATE void chiba_csco_run(chiba_csco_runtime *rt, chiba_csco_worker *w,
+                            chiba_csco *co) {
+  w->cur = co;
+  w->action = CHIBA_CSCO_ACT_NONE;
+  if (!co->co) {
+    chiba_co_desc desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.entry = chiba_csco_entry;
+    desc.ctx = co;
+    chiba_co_spawn_keyed(&desc, false, (anyptr)co->entry);
+  } else {
+    chiba_co_switch(co->co, false);
+  }
+  w->cur = NULL;
+
+  // The coroutine's context is saved now, so it is safe to let other
+  // workers pick it up
+  switch (w->action) {
+  case CHIBA_CSCO_ACT_YIELD:
+    chiba_csco_push(rt, co);
+    break;
+  case CHIBA_CSCO_ACT_PARK: {
+    u32 state = CHIBA_CSCO_PARKING;
+    if (!atomic_compare_exchange_strong(&co->state, &state,
+                                        CHIBA_CSCO_PARKED)) {
+      // Resumed while switching out
+      atomic_store(&co->state, CHIBA_CSCO_RUNNABLE);
+      chiba_csco_push(rt, co);
+    }
+    break;
+  }
+  case CHIBA_CSCO_ACT_EXIT:
+    CHIBA_INTERNAL_free(co);
+    if (atomic_fetch_sub(&rt->live, 1) == 1) {
+      pthread_mutex_lock(&rt->idle_mu);
+      atomic_store(&rt->shutdown, true);
+      pthread_cond_broadcast(&rt->idle_cv);
+      pthread_mutex_unlock(&rt->idle_mu);
+      chiba_csco_reactor_interrupt(rt);
+    }
+    break;
+  default:
+    CHIBA_PANIC("Coroutine %lld switched out without telling the scheduler",
+                (long long)co->id);
+  }
+}
+
+// Switch from the running coroutine back to its worker's scheduler loop
+UTILS void chiba_csco_switch_out(u32 action) {
+  chiba_csco_self->action = action;
+  chiba_co_switch(NULL, action == CHIBA_CSCO_ACT_EXIT);
+}
+
+PRIVATE void chiba_csco_worker_loop(chiba_csco_runtime *rt,
+                                    chiba_csco_worker *w) {
+  chiba_csco_self = w;
+  chiba_backoff b = {.step = 0};
+  while (!atomic_load_explicit(&rt->shutdown, memory_order_acquire)) {
+    // Operations queued while the run queue drains go out together
+    if (chiba_wsqueue_is_empty(w->runq) ||
+        w->tick % CHIBA_CSCO_FAIR_TICK == 0)
+      chiba_csco_io_submit(w);
+    chiba_csco_io_reap(rt, w, false);
+    chiba_csco_timers(rt, w);
+    if (w->tick % CHIBA_CSCO_FAIR_TICK == 0)
+      chiba_csco_reactor(rt);
+    chiba_csco *co = chiba_csco_next(rt, w);
+    if (!co && chiba_csco_reactor(rt))
+      co = chiba_csco_next(rt, w);
+    if (co) {
+      chiba_csco_run(rt, w, co);
+      b.step = 0;
+    } else if (!backoff_is_completed(&b)) {
+      backoff_snooze(&b);
+    } else {
+      chiba_csco_idle(rt, w);
+      b.step = 0;
+    }
+  }
+  chiba_csco_self = NULL;
+}
+
+PRIVATE void *chiba_csco_worker_thread(void *arg) {
+  chiba_csco_worker *w = (chiba_csco_worker *)arg;
+  chiba_csco_worker_loop(chiba_csco_runtime_get(), w);
+  return NULL;
+}
+
+//////////
+// runtime lifetime
+//////////
+
+PRIVATE chiba_csco_runtime *chiba_csco_runtime_new(i32 nworkers) {
+  chiba_csco_runtime *rt = (chiba_csco_runtime *)CHIBA_INTERNAL_malloc_aligned(
+      64, sizeof(chiba_csco_runtime));
+  chiba_csco_worker *workers =
+      (chiba_csco_worker *)CHIBA_INTERNAL_malloc_aligned(
+          64, sizeof(chiba_csco_worker) * nworkers);
+  if (!rt || !workers) {
+    CHIBA_INTERNAL_free(rt);
+    CHIBA_INTERNAL_free(workers);
+    return NULL;
+  }
+  memset(rt, 0, sizeof(chiba_csco_runtime));
+  memset(workers, 0, sizeof(chiba_csco_worker) * nworkers);
+  rt->workers = workers;
+  rt->nworkers = nworkers;
+  rt->injector = chiba_arrayqueue_new(CHIBA_CSCO_INJECTOR_CAP);
+  for (i32 i = 0; i < nworkers; i++) {
+    workers[i].index = i;
+    workers[i].rng = CHIBA_HASH_mix13((u64)i + 1) | 1;
+    workers[i].runq = chiba_wsqueue_new(CHIBA_CSCO_RUNQ_CAP);
+    if (!workers[i].runq)
+      CHIBA_PANIC("Could not allocate the run queue of worker %d", i);
+    chiba_twheel_init(&workers[i].wheel, chiba_csco_tick_now());
+  }
+  pthread_mutex_init(&rt->idle_mu, NULL);
+  // Timed parks wait for timer ticks, which are on the monotonic clock
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&rt->idle_cv, &attr);
+  pthread_condattr_destroy(&attr);
+  rt->epfd = -1;
+  rt->evfd = -1;
+#ifdef CHIBA_CSCO_EPOLL
+  rt->epfd = epoll_create1(EPOLL_CLOEXEC);
+  rt->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = UINT64_MAX;
+  if (rt->epfd < 0 || rt->evfd < 0 ||
+      epoll_ctl(rt->epfd, EPOLL_CTL_ADD, rt->evfd, &ev) != 0)
+    CHIBA_PANIC("Could not set up the coroutine reactor");
+#endif
+#ifdef CHIBA_URING
+  // Without io_uring (old kernel, seccomp) I/O falls back to readiness
+  for (i32 i = 0; i < nworkers; i++) {
+    chiba_csco_worker *w = &workers[i];
+    w->has_ring = chiba_uring_init(&w->ring, CHIBA_CSCO_URING_ENTRIES);
+    if (!w->has_ring)
+      continue;
+    ev.events = EPOLLIN;
+    ev.data.u64 = ~(u64)(i + 1);
+    if (epoll_ctl(rt->epfd, EPOLL_CTL_ADD, w->ring.fd, &ev) != 0) {
+      chiba_uring_drop(&w->ring);
+      w->has_ring = false;
+    }
+  }
+#endif
+  return rt;
 }
-AAT_DEF(UTILS, chiba_csco_dl_aat, chiba_csco)
-AAT_IMPL(chiba_csco_dl_aat, chiba_csco, dl_left, dl_right, dl_level,
-         chiba_csco_dl_compare)
 
-UTILS i32 chiba_csco_ev_compare(chiba_csco *a, chiba_csco *b) {
-  // order by evfd, evkind, id
-  return a->evdata < b->evdata   ? -1
-         : a->evdata > b->evdata ? 1
-         : a->evkind < b->evkind ? -1
-         : a->evkind > b->evkind ? 1
-         : a->id < b->id         ? -1
-                                 : a->id > b->id;
+PRIVATE void chiba_csco_runtime_drop(chiba_csco_runtime *rt) {
+  for (i32 i = 0; i < rt->nworkers; i++) {
+    chiba_wsqueue_drop(rt->workers[i].runq);
+#ifdef CHIBA_URING
+    if (rt->workers[i].has_ring)
+      chiba_uring_drop(&rt->workers[i].ring);
+#endif
+  }
+  for (i32 i = 0; i < CHIBA_CSCO_NSHARDS; i++)
+    chiba_idmap_free(&rt->shards[i].map);
+  chiba_idmap_free(&rt->fds);
+  if (rt->epfd >= 0)
+    close(rt->epfd);
+  if (rt->evfd >= 0)
+    close(rt->evfd);
+  chiba_arrayqueue_drop(rt->injector);
+  pthread_mutex_destroy(&rt->idle_mu);
+  pthread_cond_destroy(&rt->idle_cv);
+  CHIBA_INTERNAL_free(rt->workers);
+  CHIBA_INTERNAL_free(rt);
 }
 
-AAT_DEF(UTILS, chiba_csco_ev_aat, chiba_csco)
-AAT_IMPL(chiba_csco_ev_aat, chiba_csco, evleft, evright, evlevel,
-         chiba_csco_ev_compare)
+i32 chiba_csco_main(i32 nworkers, chiba_csco_entry_t entry, anyptr arg) {
+  if (!entry)
+    return CHIBA_CSCO_INVAL;
+  // The scheduler loop has to run on the thread's own stack
+  if (chiba_co_current())
+    return CHIBA_CSCO_PERM;
+  if (nworkers <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = ncpu > 0 ? (i32)ncpu : 1;
+  }
+  chiba_csco_runtime *rt = chiba_csco_runtime_new(nworkers);
+  if (!rt)
+    return CHIBA_CSCO_NOMEM;
+  chiba_csco_runtime *expected = NULL;
+  if (!atomic_compare_exchange_strong(&chiba_csco_rt, &expected, rt)) {
+    chiba_csco_runtime_drop(rt);
+    return CHIBA_CSCO_PERM;
+  }
+
+  chiba_csco_self = &rt->workers[0];
+  i32 ret = chiba_csco_start(entry, arg);
+  if (ret == CHIBA_CSCO_OK) {
+    for (i32 i = 1; i < nworkers; i++) {
+      if (pthread_create(&rt->workers[i].thread, NULL, chiba_csco_worker_thread,
+                         &rt->workers[i]) != 0)
+        CHIBA_PANIC("Could not start coroutine worker %d", i);
+    }
+    chiba_csco_worker_loop(rt, &rt->workers[0]);
+    for (i32 i = 1; i < nworkers; i++)
+      pthread_join(rt->workers[i].thread, NULL);
+  }
+  chiba_csco_self = NULL;
+
+  atomic_store(&chiba_csco_rt, NULL);
+  chiba_csco_runtime_drop(rt);
+  return ret;
+}
 
 //////////
-// maps
+// coroutine operations
 //////////
 
-typedef struct chiba_csco_map {
-  chiba_csco *roots[CHIBA_SCO_NSHARDS];
-  i32 count;
-} chiba_csco_map;
+i32 chiba_csco_start(chiba_csco_entry_t e, anyptr arg) {
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  if (!rt)
+    return CHIBA_CSCO_PERM;
+  if (!e)
+    return CHIBA_CSCO_INVAL;
+  chiba_csco *co = (chiba_csco *)CHIBA_INTERNAL_malloc(sizeof(chiba_csco));
+  if (!co)
+    return CHIBA_CSCO_NOMEM;
+  memset(co, 0, sizeof(chiba_csco));
+  co->id = atomic_fetch_add(&chiba_csco_next_id, 1) + 1;
+  co->entry = e;
+  co->ctx = arg;
+  atomic_init(&co->state, CHIBA_CSCO_RUNNABLE);
+
+  chiba_csco *cur = chiba_csco_current();
+  if (cur) {
+    co->starter_id = cur->id;
+    cur->last_id = co->id;
+  }
+
+  atomic_fetch_add(&rt->live, 1);
+  chiba_csco_shard *shard = chiba_csco_shard_of(rt, co->id);
+  chiba_csco_shard_lock(shard);
+  chiba_idmap_insert(&shard->map, co->id, co);
+  chiba_csco_shard_unlock(shard);
+  chiba_csco_push(rt, co);
+  return CHIBA_CSCO_OK;
+}
+
+i32 chiba_csco_yield(void) {
+  if (!chiba_csco_current())
+    return CHIBA_CSCO_PERM;
+  chiba_csco_switch_out(CHIBA_CSCO_ACT_YIELD);
+  return CHIBA_CSCO_OK;
+}
+
+i32 chiba_csco_suspend(void) {
+  chiba_csco *co = chiba_csco_current();
+  if (!co)
+    return CHIBA_CSCO_PERM;
+  u32 state = CHIBA_CSCO_RUNNABLE;
+  if (!atomic_compare_exchange_strong(&co->state, &state,
+                                      CHIBA_CSCO_PARKING)) {
+    // A resume is already pending, consume it
+    atomic_store(&co->state, CHIBA_CSCO_RUNNABLE);
+    return CHIBA_CSCO_OK;
+  }
+  chiba_csco_switch_out(CHIBA_CSCO_ACT_PARK);
+  return CHIBA_CSCO_OK;
+}
+
+i32 chiba_csco_suspend_dl(chiba_csco_ts_t deadline) {
+  chiba_csco *co = chiba_csco_current();
+  if (!co)
+    return CHIBA_CSCO_PERM;
+  if (deadline <= (chiba_csco_ts_t)get_time_in_nanoseconds())
+    return CHIBA_CSCO_TIMEDOUT;
+  chiba_csco_timer_arm(co, deadline);
+  chiba_csco_suspend();
+  return chiba_csco_timer_disarm(co) ? CHIBA_CSCO_TIMEDOUT : CHIBA_CSCO_OK;
+}
+
+i32 chiba_csco_sleep_dl(chiba_csco_ts_t deadline) {
+  if (!chiba_csco_current())
+    return CHIBA_CSCO_PERM;
+  // Resumes do not cut a sleep short
+  while (chiba_csco_suspend_dl(deadline) != CHIBA_CSCO_TIMEDOUT)
+    ;
+  return CHIBA_CSCO_OK;
+}
+
+i32 chiba_csco_sleep(chiba_csco_ts_t nanosecs) {
+  if (nanosecs <= 0)
+    return chiba_csco_yield();
+  return chiba_csco_sleep_dl((chiba_csco_ts_t)get_time_in_nanoseconds() +
+                             nanosecs);
+}
+
+i32 chiba_csco_wait(i32 fd, i32 events) {
+  return chiba_csco_wait_dl(fd, events, INT64_MAX);
+}
 
-#define csco_map_getaat(sco)                                                   \
-  (&map->roots[CHIBA_HASH_mix13((sco)->id) & (CHIBA_SCO_NSHARDS - 1)])
+i32 chiba_csco_wait_dl(i32 fd, i32 events, chiba_csco_ts_t deadline) {
+  chiba_csco *co = chiba_csco_current();
+  if (!co)
+    return CHIBA_CSCO_PERM;
+  events &= CHIBA_CSCO_WAIT_READ | CHIBA_CSCO_WAIT_WRITE;
+  if (fd < 0 || !events)
+    return CHIBA_CSCO_INVAL;
+#ifdef CHIBA_CSCO_EPOLL
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  chiba_csco_fdwaiter fw = {.waiter = co, .events = (u32)events};
+  chiba_csco_spin_lock(&rt->fd_locker);
+  fw.next = (chiba_csco_fdwaiter *)chiba_idmap_get(&rt->fds, (i64)fd + 1);
+  if (!chiba_csco_fd_arm(rt, fd, chiba_csco_fd_interest(&fw))) {
+    chiba_csco_spin_unlock(&rt->fd_locker);
+    return CHIBA_CSCO_ERROR;
+  }
+  chiba_csco_fd_set(rt, fd, &fw);
+  atomic_fetch_add_explicit(&rt->nfdwaiters, 1, memory_order_relaxed);
+  chiba_csco_spin_unlock(&rt->fd_locker);
 
-UTILS chiba_csco *chiba_csco_map_insert(chiba_csco_map *map, chiba_csco *sco) {
-  chiba_csco *prev = chiba_csco_all_aat_insert(csco_map_getaat(sco), sco);
-  map->count++;
-  return prev;
+  for (;;) {
+    i32 ret = deadline == INT64_MAX ? chiba_csco_suspend()
+                                    : chiba_csco_suspend_dl(deadline);
+    chiba_csco_spin_lock(&rt->fd_locker);
+    if (fw.revents) {
+      chiba_csco_spin_unlock(&rt->fd_locker);
+      return (i32)fw.revents;
+    }
+    if (ret == CHIBA_CSCO_TIMEDOUT) {
+      // Still linked, leave the registration to fire once more for nothing
+      chiba_csco_fdwaiter *head =
+          (chiba_csco_fdwaiter *)chiba_idmap_get(&rt->fds, (i64)fd + 1);
+      chiba_csco_fdwaiter **link = &head;
+      while (*link != &fw)
+        link = &(*link)->next;
+      *link = fw.next;
+      chiba_csco_fd_set(rt, fd, head);
+      atomic_fetch_sub_explicit(&rt->nfdwaiters, 1, memory_order_relaxed);
+      chiba_csco_spin_unlock(&rt->fd_locker);
+      return CHIBA_CSCO_TIMEDOUT;
+    }
+    chiba_csco_spin_unlock(&rt->fd_locker);
+  }
+#else
+  (void)deadline;
+  errno = ENOSYS;
+  return CHIBA_CSCO_ERROR;
+#endif
 }
 
-UTILS chiba_csco *chiba_csco_map_search(chiba_csco_map *map, chiba_csco *key) {
-  return chiba_csco_all_aat_search(csco_map_getaat(key), key);
+i64 chiba_csco_read(i32 fd, anyptr buf, u64 count) {
+  if (!chiba_csco_current())
+    return CHIBA_CSCO_PERM;
+#ifdef CHIBA_URING
+  struct io_uring_sqe *sqe = chiba_csco_io_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)buf;
+    sqe->len = (u32)(count > UINT32_MAX ? UINT32_MAX : count);
+    sqe->off = (u64)-1; // current file position
+    return chiba_csco_io_wait(sqe);
+  }
+#endif
+  for (;;) {
+    ssize_t n = read(fd, buf, count);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return n < 0 ? CHIBA_CSCO_ERROR : (i64)n;
+    if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_READ) < 0)
+      return CHIBA_CSCO_ERROR;
+  }
 }
 
-UTILS chiba_csco *chiba_csco_map_delete(chiba_csco_map *map, chiba_csco *key) {
-  chiba_csco *prev = chiba_csco_all_aat_delete(csco_map_getaat(key), key);
-  map->count--;
-  return prev;
+i64 chiba_csco_write(i32 fd, const void *buf, u64 count) {
+  if (!chiba_csco_current())
+    return CHIBA_CSCO_PERM;
+#ifdef CHIBA_URING
+  struct io_uring_sqe *sqe = chiba_csco_io_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)buf;
+    sqe->len = (u32)(count > UINT32_MAX ? UINT32_MAX : count);
+    sqe->off = (u64)-1;
+    return chiba_csco_io_wait(sqe);
+  }
+#endif
+  for (;;) {
+    ssize_t n = write(fd, buf, count);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return n < 0 ? CHIBA_CSCO_ERROR : (i64)n;
+    if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_WRITE) < 0)
+      return CHIBA_CSCO_ERROR;
+  }
 }
 
-typedef struct chiba_csco_evmap {
-  chiba_csco *roots[CHIBA_SCO_NSHARDS];
-  i32 count;
-} chiba_csco_evmap;
+i32 chiba_csco_accept(i32 fd, anyptr addr, u32 *addrlen, i32 flags) {
+  if (!chiba_csco_current())
+    return CHIBA_CSCO_PERM;
+#ifdef CHIBA_URING
+  struct io_uring_sqe *sqe = chiba_csco_io_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)addr;
+    sqe->addr2 = (u64)(uintptr_t)addrlen;
+    sqe->accept_flags = (u32)flags;
+    return (i32)chiba_csco_io_wait(sqe);
+  }
+#endif
+#ifdef CHIBA_CSCO_EPOLL
+  for (;;) {
+    i32 nfd = accept4(fd, (struct sockaddr *)addr, (socklen_t *)addrlen, flags);
+    if (nfd >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      return nfd < 0 ? CHIBA_CSCO_ERROR : nfd;
+    if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_READ) < 0)
+      return CHIBA_CSCO_ERROR;
+  }
+#else
+  (void)fd;
+  (void)addr;
+  (void)addrlen;
+  (void)flags;
+  errno = ENOSYS;
+  return CHIBA_CSCO_ERROR;
+#endif
+}
 
-#define csco_evmap_getaat(sco)                                                 \
-  (&map->roots[CHIBA_HASH_mix13((u64)(sco)->evdata) & (CHIBA_SCO_NSHARDS - 1)])
+i32 chiba_csco_connect(i32 fd, const void *addr, u32 addrlen) {
+  if (!chiba_csco_current())
+    return CHIBA_CSCO_PERM;
+#ifdef CHIBA_URING
+  struct io_uring_sqe *sqe = chiba_csco_io_sqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)addr;
+    sqe->off = addrlen;
+    return (i32)chiba_csco_io_wait(sqe);
+  }
+#endif
+#ifdef CHIBA_CSCO_EPOLL
+  if (connect(fd, (const struct sockaddr *)addr, (socklen_t)addrlen) == 0)
+    return CHIBA_CSCO_OK;
+  if (errno != EINPROGRESS)
+    return CHIBA_CSCO_ERROR;
+  if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_WRITE) < 0)
+    return CHIBA_CSCO_ERROR;
+  i32 err = 0;
+  socklen_t len = sizeof(err);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+    return CHIBA_CSCO_ERROR;
+  if (err) {
+    errno = err;
+    return CHIBA_CSCO_ERROR;
+  }
+  return CHIBA_CSCO_OK;
+#else
+  (void)fd;
+  (void)addr;
+  (void)addrlen;
+  errno = ENOSYS;
+  return CHIBA_CSCO_ERROR;
+#endif
+}
 
-UTILS chiba_csco *chiba_csco_evmap_insert(chiba_csco_evmap *map,
-                                          chiba_csco *sco) {
-  chiba_csco *prev = chiba_csco_ev_aat_insert(csco_evmap_getaat(sco), sco);
-  map->count++;
-  return prev;
+i32 chiba_csco_resume(chiba_csco_id_t id) {
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  if (!rt)
+    return CHIBA_CSCO_PERM;
+  // The shard lock keeps the coroutine from finishing and being freed while
+  // it is woken
+  chiba_csco_shard *shard = chiba_csco_shard_of(rt, id);
+  chiba_csco_shard_lock(shard);
+  chiba_csco *co = (chiba_csco *)chiba_idmap_get(&shard->map, id);
+  if (co)
+    chiba_csco_wake(rt, co);
+  chiba_csco_shard_unlock(shard);
+  return co ? CHIBA_CSCO_OK : CHIBA_CSCO_NOTFOUND;
 }
 
-UTILS chiba_csco *chiba_csco_evmap_iter(chiba_csco_evmap *map,
-                                        chiba_csco *key) {
-  return chiba_csco_ev_aat_iter(csco_evmap_getaat(key), key);
+i32 chiba_csco_join(chiba_csco_id_t id) {
+  return chiba_csco_join_dl(id, INT64_MAX);
 }
 
-UTILS chiba_csco *chiba_csco_evmap_next(chiba_csco_evmap *map,
-                                        chiba_csco *key) {
-  return chiba_csco_ev_aat_next(csco_evmap_getaat(key), key);
+i32 chiba_csco_join_dl(chiba_csco_id_t id, chiba_csco_ts_t deadline) {
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  chiba_csco *self = chiba_csco_current();
+  if (!self)
+    return CHIBA_CSCO_PERM;
+  if (id == self->id)
+    return CHIBA_CSCO_INVAL;
+  chiba_csco_shard *shard = chiba_csco_shard_of(rt, id);
+  chiba_csco_joiner joiner = {.waiter = self, .next = NULL};
+  chiba_csco_shard_lock(shard);
+  chiba_csco *co = (chiba_csco *)chiba_idmap_get(&shard->map, id);
+  if (co) {
+    joiner.next = co->joiners;
+    co->joiners = &joiner;
+  }
+  chiba_csco_shard_unlock(shard);
+  // Ids are never reused, so the coroutine is done once its id is gone
+  while (co) {
+    i32 ret = deadline == INT64_MAX ? chiba_csco_suspend()
+                                    : chiba_csco_suspend_dl(deadline);
+    chiba_csco_shard_lock(shard);
+    co = (chiba_csco *)chiba_idmap_get(&shard->map, id);
+    if (co && ret == CHIBA_CSCO_TIMEDOUT) {
+      chiba_csco_joiner **link = &co->joiners;
+      while (*link != &joiner)
+        link = &(*link)->next;
+      *link = joiner.next;
+      chiba_csco_shard_unlock(shard);
+      return CHIBA_CSCO_TIMEDOUT;
+    }
+    chiba_csco_shard_unlock(shard);
+  }
+  return CHIBA_CSCO_OK;
 }
 
-UTILS chiba_csco *chiba_csco_evmap_delete(chiba_csco_evmap *map,
-                                          chiba_csco *key) {
-  chiba_csco *prev = chiba_csco_ev_aat_delete(csco_evmap_getaat(key), key);
-  map->count--;
-  return prev;
+void chiba_csco_exit(void) {
+  chiba_csco *co = chiba_csco_current();
+  if (!co)
+    return;
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  // Joiners are woken under the lock, so none of them can see the id gone,
+  // return and free its join record before it has been woken
+  chiba_csco_shard *shard = chiba_csco_shard_of(rt, co->id);
+  chiba_csco_shard_lock(shard);
+  chiba_idmap_delete(&shard->map, co->id);
+  for (chiba_csco_joiner *j = co->joiners; j; j = j->next)
+    chiba_csco_wake(rt, j->waiter);
+  atomic_store(&co->state, CHIBA_CSCO_DONE);
+  chiba_csco_shard_unlock(shard);
+  chiba_csco_switch_out(CHIBA_CSCO_ACT_EXIT);
+}
+
+chiba_csco_id_t chiba_csco_getid(void) {
+  chiba_csco *co = chiba_csco_current();
+  return co ? co->id : 0;
+}
+
+chiba_csco_id_t chiba_csco_lastid(void) {
+  chiba_csco *co = chiba_csco_current();
+  return co ? co->last_id : 0;
+}
+
+chiba_csco_id_t chiba_csco_starterid(void) {
+  chiba_csco *co = chiba_csco_current();
+  return co ? co->starter_id : 0;
+}
+
+i32 chiba_csco_worker_index(void) {
+  return chiba_csco_self ? chiba_csco_self->index : -1;
+}
+
+chiba_csco_info chiba_csco_getinfo(void) {
+  chiba_csco_info info = {0};
+  chiba_csco_runtime *rt = chiba_csco_runtime_get();
+  if (!rt)
+    return info;
+  info.nworkers = rt->nworkers;
+  info.live = atomic_load_explicit(&rt->live, memory_order_relaxed);
+  info.fdwaiters = atomic_load_explicit(&rt->nfdwaiters, memory_order_relaxed);
+  for (i32 i = 0; i < rt->nworkers; i++) {
+    info.steals += atomic_load_explicit(&rt->workers[i].steals,
+                                        memory_order_relaxed);
+#ifdef CHIBA_URING
+    info.io_ops += atomic_load_explicit(&rt->workers[i].io_ops,
+                                        memory_order_relaxed);
+    info.io_enters += atomic_load_explicit(&rt->workers[i].io_enters,
+                                           memory_order_relaxed);
+#endif
+  }
+  return info;
 }
@@ -1,29 +1,119 @@
 #pragma once
 #include "../basic_memory.h"
-#include "../concurrency/aatree.h"
 #include "../concurrency/array_queue.h"
 #include "../concurrency/dequeue.h"
-#include "../scheched_coroutine/scheched_coroutine.h"
+#include "../coroutine/coroutine.h"
+
+// Chiba Concurrent Scheduled Coroutines
+// M:N scheduler: coroutines run on a fixed set of worker threads, one per core
+// by default. Each worker owns a Chase-Lev run queue (chiba_wsqueue) which it
+// drains oldest first; idle workers steal runnable coroutines from the queues
+// of busy ones, so a coroutine may continue on a different thread every time
+// it is rescheduled.
+// Coroutines waiting for fd readiness are parked on an epoll reactor that the
+// workers poll between picks; an idle worker blocks in epoll_wait instead of
+// sleeping only when there is nothing to run.
+// Reads, writes, accepts and connects go through a per-worker io_uring ring
+// where the kernel supports it: every operation queued by the coroutines that
+// ran during one scheduler pass is submitted with a single io_uring_enter.
 
 typedef i64 chiba_csco_id_t;
+// Nanoseconds. Deadlines are absolute times on the get_time_in_nanoseconds()
+// clock and are rounded up to the next CHIBA_CSCO_TIMER_TICK_NS.
 typedef i64 chiba_csco_ts_t;
 typedef void (*chiba_csco_entry_t)(anyptr ctx);
 
+// Return codes
+#define CHIBA_CSCO_OK 0
+#define CHIBA_CSCO_ERROR -1
+#define CHIBA_CSCO_INVAL -2
+#define CHIBA_CSCO_PERM -3     // not allowed from the calling context
+#define CHIBA_CSCO_NOMEM -4
+#define CHIBA_CSCO_NOTFOUND -6 // no such coroutine, or it already finished
+#define CHIBA_CSCO_TIMEDOUT -10
+
+// Run `entry(arg)` as the first coroutine on `nworkers` worker threads and
+// return once every coroutine has finished. The calling thread becomes worker
+// 0. nworkers <= 0 starts one worker per online CPU. Only one runtime may run
+// at a time.
+i32 chiba_csco_main(i32 nworkers, chiba_csco_entry_t entry, anyptr arg);
+
+// Start a new coroutine. It is queued on the calling worker and may be stolen
+// by any other; its id is available from chiba_csco_lastid().
 i32 chiba_csco_start(chiba_csco_entry_t e, anyptr arg);
+
+// Put the calling coroutine at the back of its worker's run queue.
 i32 chiba_csco_yield(void);
+
+// Put the calling coroutine to sleep for `nanosecs`, or until `deadline`.
+// Resumes do not end a sleep early.
 i32 chiba_csco_sleep(chiba_csco_ts_t nanosecs);
 i32 chiba_csco_sleep_dl(chiba_csco_ts_t deadline);
+
+// Wait until the coroutine `id` has finished. The _dl variant gives up with
+// CHIBA_CSCO_TIMEDOUT at `deadline`.
 i32 chiba_csco_join(chiba_csco_id_t id);
 i32 chiba_csco_join_dl(chiba_csco_id_t id, chiba_csco_ts_t deadline);
+
+// Suspend the calling coroutine until chiba_csco_resume is called for it.
+// A resume that arrives while the coroutine is still running is remembered,
+// and the next suspend returns immediately, so a wakeup racing with the call
+// is never lost. Callers waiting for a condition should recheck it after
+// returning.
 i32 chiba_csco_suspend(void);
+
+// Same as chiba_csco_suspend, but returns CHIBA_CSCO_TIMEDOUT if no resume
+// arrived by `deadline`.
 i32 chiba_csco_suspend_dl(chiba_csco_ts_t deadline);
+
+// Events for chiba_csco_wait
+#define CHIBA_CSCO_WAIT_READ 1
+#define CHIBA_CSCO_WAIT_WRITE 2
+
+// Suspend the calling coroutine until `fd` is ready for one of `events`
+// (CHIBA_CSCO_WAIT_READ and/or CHIBA_CSCO_WAIT_WRITE). Returns the subset of
+// `events` that is ready; errors and hangups report every requested event so
+// the next read or write sees them. Returns CHIBA_CSCO_ERROR with errno set if
+// the fd cannot be polled (e.g. a regular file, or no epoll on this platform).
+// The _dl variant gives up with CHIBA_CSCO_TIMEDOUT at `deadline`.
+i32 chiba_csco_wait(i32 fd, i32 events);
+i32 chiba_csco_wait_dl(i32 fd, i32 events, chiba_csco_ts_t deadline);
+
+// I/O that suspends only the calling coroutine. Results follow read(2),
+// write(2), accept4(2) and connect(2): a byte count, a new fd or
+// CHIBA_CSCO_OK on success, CHIBA_CSCO_ERROR with errno set on failure.
+// Operations are queued on the calling worker's io_uring ring and submitted
+// in a batch once the worker's run queue drains. Without io_uring they fall
+// back to the nonblocking call plus chiba_csco_wait, which needs O_NONBLOCK
+// fds.
+i64 chiba_csco_read(i32 fd, anyptr buf, u64 count);
+i64 chiba_csco_write(i32 fd, const void *buf, u64 count);
+i32 chiba_csco_accept(i32 fd, anyptr addr, u32 *addrlen, i32 flags);
+i32 chiba_csco_connect(i32 fd, const void *addr, u32 addrlen);
+
+// Wake a suspended coroutine. May be called from any thread, including
+// threads outside the runtime.
 i32 chiba_csco_resume(chiba_csco_id_t id);
+
+// Finish the calling coroutine.
 void chiba_csco_exit(void);
 
+// Id of the calling coroutine, of the last coroutine it started, and of the
+// coroutine that started it. Zero outside a coroutine.
 chiba_csco_id_t chiba_csco_getid(void);
 chiba_csco_id_t chiba_csco_lastid(void);
 chiba_csco_id_t chiba_csco_starterid(void);
 
-#if !defined(__EMSCRIPTEN__)
-#define SCO_MULTITHREAD_WORKERS
-#endif
+// Index of the worker running the calling thread, or -1 outside the runtime.
+i32 chiba_csco_worker_index(void);
+
+typedef struct chiba_csco_info {
+  i64 nworkers;
+  i64 live;      // started and not yet finished
+  i64 steals;    // coroutines taken from another worker's run queue
+  i64 fdwaiters; // coroutines waiting in chiba_csco_wait
+  i64 io_ops;    // operations queued on io_uring rings
+  i64 io_enters; // io_uring_enter calls that submitted them
+} chiba_csco_info;
+
+chiba_csco_info chiba_csco_getinfo(void);
@@ -0,0 +1,612 @@
+#include "cs_coroutine.h"
+#include "../chiba_testing.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+TEST_GROUP(cs_coroutine);
+
+//////////
+// start / join / ids
+//////////
+
+#define NCHILDREN 100
+
+PRIVATE _Atomic(i64) children_done = 0;
+PRIVATE _Atomic(i64) starter_mismatch = 0;
+PRIVATE chiba_csco_id_t parent_id = 0;
+
+PRIVATE void co_child(anyptr ctx) {
+  if (chiba_csco_starterid() != parent_id)
+    atomic_fetch_add(&starter_mismatch, 1);
+  chiba_csco_yield();
+  atomic_fetch_add(&children_done, (i64)(intptr_t)ctx);
+}
+
+PRIVATE void co_parent(anyptr ctx) {
+  (void)ctx;
+  parent_id = chiba_csco_getid();
+  chiba_csco_id_t ids[NCHILDREN];
+  for (i64 i = 0; i < NCHILDREN; i++) {
+    chiba_csco_start(co_child, (anyptr)(intptr_t)(i + 1));
+    ids[i] = chiba_csco_lastid();
+  }
+  for (i64 i = 0; i < NCHILDREN; i++)
+    chiba_csco_join(ids[i]);
+  // Every child has finished once the joins return
+  if (atomic_load(&children_done) != NCHILDREN * (NCHILDREN + 1) / 2)
+    atomic_fetch_add(&starter_mismatch, 1000);
+}
+
+TEST_CASE(start_join, cs_coroutine, "Start children and join them", {
+  DESC(start_join);
+
+  atomic_store(&children_done, 0);
+  atomic_store(&starter_mismatch, 0);
+  ASSERT_EQ(CHIBA_CSCO_PERM, chiba_csco_start(co_child, NULL),
+            "Start outside a runtime is refused");
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(2, co_parent, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(NCHILDREN * (NCHILDREN + 1) / 2, atomic_load(&children_done),
+            "All children ran");
+  ASSERT_EQ(0, atomic_load(&starter_mismatch),
+            "Starter ids match and joins waited");
+  ASSERT_EQ(-1, chiba_csco_worker_index(), "Caller left the runtime");
+  return 0;
+})
+
+//////////
+// yield order on a single worker
+//////////
+
+PRIVATE char order[64];
+PRIVATE i32 norder = 0;
+
+PRIVATE void co_letter(anyptr ctx) {
+  for (i32 i = 0; i < 3; i++) {
+    order[norder++] = (char)(intptr_t)ctx;
+    chiba_csco_yield();
+  }
+}
+
+PRIVATE void co_letters(anyptr ctx) {
+  (void)ctx;
+  chiba_csco_start(co_letter, (anyptr)(intptr_t)'a');
+  chiba_csco_start(co_letter, (anyptr)(intptr_t)'b');
+  chiba_csco_start(co_letter, (anyptr)(intptr_t)'c');
+}
+
+TEST_CASE(yield_fifo, cs_coroutine, "Yield goes behind queued coroutines", {
+  DESC(yield_fifo);
+
+  memset(order, 0, sizeof(order));
+  norder = 0;
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(1, co_letters, NULL),
+            "Runtime ran to completion");
+  ASSERT_TRUE(strcmp(order, "abcabcabc") == 0, "Round-robin order");
+  return 0;
+})
+
+//////////
+// suspend / resume
+//////////
+
+PRIVATE _Atomic(i64) sleeper_id = 0;
+PRIVATE _Atomic(i64) wakeups = 0;
+PRIVATE _Atomic(bool) flag = false;
+
+PRIVATE void co_sleeper(anyptr ctx) {
+  (void)ctx;
+  atomic_store(&sleeper_id, chiba_csco_getid());
+  while (!atomic_load(&flag))
+    chiba_csco_suspend();
+  atomic_fetch_add(&wakeups, 1);
+}
+
+PRIVATE void co_waker(anyptr ctx) {
+  (void)ctx;
+  chiba_csco_start(co_sleeper, NULL);
+  chiba_csco_id_t id = chiba_csco_lastid();
+  // Resumes before the sleeper ever suspended must not be lost
+  chiba_csco_resume(id);
+  chiba_csco_yield();
+  atomic_store(&flag, true);
+  chiba_csco_resume(id);
+  chiba_csco_join(id);
+  if (chiba_csco_resume(id) == CHIBA_CSCO_NOTFOUND)
+    atomic_fetch_add(&wakeups, 10);
+}
+
+TEST_CASE(suspend_resume, cs_coroutine, "Suspend, resume and late resume", {
+  DESC(suspend_resume);
+
+  atomic_store(&wakeups, 0);
+  atomic_store(&flag, false);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(2, co_waker, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(11, atomic_load(&wakeups),
+            "Sleeper woke once and its id is gone afterwards");
+  return 0;
+})
+
+//////////
+// resume from a thread outside the runtime
+//////////
+
+#define NREMOTE 1000
+
+PRIVATE _Atomic(i64) remote_turn = 0;
+
+PRIVATE void co_remote(anyptr ctx) {
+  (void)ctx;
+  atomic_store(&sleeper_id, chiba_csco_getid());
+  for (i64 i = 1; i <= NREMOTE; i++) {
+    while (atomic_load(&remote_turn) != 2 * i - 1)
+      chiba_csco_suspend();
+    atomic_store(&remote_turn, 2 * i);
+  }
+}
+
+PRIVATE void *remote_thread(void *arg) {
+  (void)arg;
+  while (!atomic_load(&sleeper_id))
+    sched_yield();
+  for (i64 i = 1; i <= NREMOTE; i++) {
+    atomic_store(&remote_turn, 2 * i - 1);
+    chiba_csco_resume(atomic_load(&sleeper_id));
+    while (atomic_load(&remote_turn) != 2 * i)
+      sched_yield();
+  }
+  return NULL;
+}
+
+TEST_CASE(remote_resume, cs_coroutine, "Resume from a foreign thread", {
+  DESC(remote_resume);
+
+  atomic_store(&sleeper_id, 0);
+  atomic_store(&remote_turn, 0);
+  pthread_t th;
+  pthread_create(&th, NULL, remote_thread, NULL);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(2, co_remote, NULL),
+            "Runtime ran to completion");
+  pthread_join(th, NULL);
+  ASSERT_EQ(2 * NREMOTE, atomic_load(&remote_turn), "Every handoff seen");
+  return 0;
+})
+
+//////////
+// work stealing
+//////////
+
+#define NWORKERS 4
+#define NTASKS 2000
+
+PRIVATE _Atomic(i64) tasks_done = 0;
+PRIVATE _Atomic(i64) ran_on[NWORKERS];
+
+PRIVATE void co_task(anyptr ctx) {
+  (void)ctx;
+  volatile u64 x = 0;
+  for (i32 round = 0; round < 4; round++) {
+    for (i32 i = 0; i < 2000; i++)
+      x += (u64)i;
+    atomic_fetch_add(&ran_on[chiba_csco_worker_index()], 1);
+    chiba_csco_yield();
+  }
+  atomic_fetch_add(&tasks_done, 1);
+}
+
+PRIVATE void co_spawner(anyptr ctx) {
+  (void)ctx;
+  // Everything lands on one worker's queue; the others have to steal
+  for (i32 i = 0; i < NTASKS; i++)
+    chiba_csco_start(co_task, NULL);
+}
+
+TEST_CASE(work_stealing, cs_coroutine, "Idle workers steal queued work", {
+  DESC(work_stealing);
+
+  atomic_store(&tasks_done, 0);
+  for (i32 i = 0; i < NWORKERS; i++)
+    atomic_store(&ran_on[i], 0);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(NWORKERS, co_spawner, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(NTASKS, atomic_load(&tasks_done), "All tasks finished");
+  i64 total = 0;
+  for (i32 i = 0; i < NWORKERS; i++) {
+    total += atomic_load(&ran_on[i]);
+    printf("    worker %d ran %lld slices\n", i,
+           (long long)atomic_load(&ran_on[i]));
+  }
+  ASSERT_EQ(NTASKS * 4, total, "Every slice ran once");
+  return 0;
+})
+
+//////////
+// sleeps and deadlines
+//////////
+
+#define MS 1000000LL
+
+PRIVATE _Atomic(i64) wake_order[3];
+PRIVATE _Atomic(i32) nwoken = 0;
+PRIVATE _Atomic(i64) early = 0;
+PRIVATE i64 nap_base = 0;
+
+// Deadlines are taken from one common base, so how late each napper got to
+// run does not change the order they are due in
+PRIVATE void co_nap(anyptr ctx) {
+  i64 ms = (i64)(intptr_t)ctx;
+  i64 deadline = nap_base + ms * MS;
+  chiba_csco_sleep_dl(deadline);
+  if ((i64)get_time_in_nanoseconds() < deadline)
+    atomic_fetch_add(&early, 1);
+  atomic_store(&wake_order[atomic_fetch_add(&nwoken, 1)], ms);
+}
+
+PRIVATE void co_naps(anyptr ctx) {
+  (void)ctx;
+  nap_base = (i64)get_time_in_nanoseconds();
+  chiba_csco_start(co_nap, (anyptr)(intptr_t)30);
+  chiba_csco_start(co_nap, (anyptr)(intptr_t)10);
+  chiba_csco_start(co_nap, (anyptr)(intptr_t)20);
+}
+
+TEST_CASE(sleep_order, cs_coroutine, "Sleepers wake in deadline order", {
+  DESC(sleep_order);
+
+  atomic_store(&nwoken, 0);
+  atomic_store(&early, 0);
+  // One worker: every timer sits on the same wheel, which fires them in
+  // deadline order
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(1, co_naps, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(3, atomic_load(&nwoken), "All woke");
+  ASSERT_EQ(0, atomic_load(&early), "None woke before its deadline");
+  ASSERT_EQ(10, atomic_load(&wake_order[0]), "10ms first");
+  ASSERT_EQ(20, atomic_load(&wake_order[1]), "20ms second");
+  ASSERT_EQ(30, atomic_load(&wake_order[2]), "30ms last");
+  return 0;
+})
+
+PRIVATE _Atomic(i64) dl_results = 0;
+
+PRIVATE void co_dl_target(anyptr ctx) {
+  (void)ctx;
+  chiba_csco_sleep(20 * MS);
+}
+
+PRIVATE void co_dl(anyptr ctx) {
+  (void)ctx;
+  i64 now = (i64)get_time_in_nanoseconds();
+  // Nobody resumes us: times out
+  if (chiba_csco_suspend_dl(now + 5 * MS) == CHIBA_CSCO_TIMEDOUT &&
+      (i64)get_time_in_nanoseconds() >= now + 5 * MS)
+    atomic_fetch_add(&dl_results, 1);
+  // A pending resume beats the deadline
+  chiba_csco_resume(chiba_csco_getid());
+  if (chiba_csco_suspend_dl(now + 1000 * MS) == CHIBA_CSCO_OK)
+    atomic_fetch_add(&dl_results, 10);
+  if (chiba_csco_suspend_dl(now) == CHIBA_CSCO_TIMEDOUT)
+    atomic_fetch_add(&dl_results, 100);
+  // Join gives up on a coroutine that outlives the deadline, then succeeds
+  chiba_csco_start(co_dl_target, NULL);
+  chiba_csco_id_t id = chiba_csco_lastid();
+  now = (i64)get_time_in_nanoseconds();
+  if (chiba_csco_join_dl(id, now + 2 * MS) == CHIBA_CSCO_TIMEDOUT)
+    atomic_fetch_add(&dl_results, 1000);
+  if (chiba_csco_join_dl(id, now + 1000 * MS) == CHIBA_CSCO_OK)
+    atomic_fetch_add(&dl_results, 10000);
+}
+
+TEST_CASE(deadlines, cs_coroutine, "suspend_dl and join_dl time out", {
+  DESC(deadlines);
+
+  atomic_store(&dl_results, 0);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(2, co_dl, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(11111, atomic_load(&dl_results), "Every deadline case held");
+  return 0;
+})
+
+#define NTIMEOUTS 2000
+
+PRIVATE _Atomic(i64) timeouts_ok = 0;
+PRIVATE chiba_csco_id_t timeout_ids[NTIMEOUTS];
+
+PRIVATE void co_timeout_waiter(anyptr ctx) {
+  (void)ctx;
+  i64 now = (i64)get_time_in_nanoseconds();
+  if (chiba_csco_suspend_dl(now + 10000 * MS) == CHIBA_CSCO_OK)
+    atomic_fetch_add(&timeouts_ok, 1);
+}
+
+PRIVATE void co_timeouts(anyptr ctx) {
+  (void)ctx;
+  for (i32 i = 0; i < NTIMEOUTS; i++) {
+    chiba_csco_start(co_timeout_waiter, NULL);
+    timeout_ids[i] = chiba_csco_lastid();
+  }
+  chiba_csco_yield();
+  for (i32 i = 0; i < NTIMEOUTS; i++)
+    chiba_csco_resume(timeout_ids[i]);
+}
+
+TEST_CASE(cancelled_timeouts, cs_coroutine, "Timeouts cancelled by resume", {
+  DESC(cancelled_timeouts);
+
+  // Every waiter arms a 10s timeout and is resumed well before it; the
+  // runtime must finish without waiting for any of them
+  atomic_store(&timeouts_ok, 0);
+  u64 start = get_time_in_nanoseconds();
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(NWORKERS, co_timeouts, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(NTIMEOUTS, atomic_load(&timeouts_ok), "All resumed in time");
+  ASSERT_TRUE(get_time_in_nanoseconds() - start < 5000 * MS,
+              "No timeout was waited out");
+  return 0;
+})
+
+//////////
+// fd readiness
+//////////
+
+#define NPAIRS 64
+#define NROUNDS 100
+
+PRIVATE i32 pairs[NPAIRS][2];
+PRIVATE _Atomic(i64) pongs = 0;
+PRIVATE _Atomic(i64) fd_errors = 0;
+
+// Read one byte from `fd`, parking the coroutine until it is there
+PRIVATE bool co_read_byte(i32 fd, char *c) {
+  for (;;) {
+    ssize_t n = read(fd, c, 1);
+    if (n == 1)
+      return true;
+    if (n == 0 || errno != EAGAIN)
+      return false;
+    if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_READ) != CHIBA_CSCO_WAIT_READ)
+      atomic_fetch_add(&fd_errors, 1);
+  }
+}
+
+PRIVATE void co_echo(anyptr ctx) {
+  i32 fd = pairs[(intptr_t)ctx][1];
+  char c;
+  while (co_read_byte(fd, &c)) {
+    if (write(fd, &c, 1) != 1)
+      atomic_fetch_add(&fd_errors, 1);
+  }
+}
+
+PRIVATE void co_ping(anyptr ctx) {
+  i32 fd = pairs[(intptr_t)ctx][0];
+  for (i32 i = 0; i < NROUNDS; i++) {
+    char c = (char)i;
+    if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_WRITE) != CHIBA_CSCO_WAIT_WRITE ||
+        write(fd, &c, 1) != 1 || !co_read_byte(fd, &c) || c != (char)i)
+      atomic_fetch_add(&fd_errors, 1);
+    else
+      atomic_fetch_add(&pongs, 1);
+  }
+  // The echo coroutine sees end of file and finishes
+  shutdown(fd, SHUT_WR);
+}
+
+PRIVATE void co_pingpong(anyptr ctx) {
+  (void)ctx;
+  for (intptr_t i = 0; i < NPAIRS; i++) {
+    chiba_csco_start(co_echo, (anyptr)i);
+    chiba_csco_start(co_ping, (anyptr)i);
+  }
+}
+
+TEST_CASE(fd_pingpong, cs_coroutine, "Coroutines wait for socket readiness", {
+  DESC(fd_pingpong);
+
+  for (i32 i = 0; i < NPAIRS; i++) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pairs[i]),
+              "Socket pair created");
+  }
+  atomic_store(&pongs, 0);
+  atomic_store(&fd_errors, 0);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(NWORKERS, co_pingpong, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(NPAIRS * NROUNDS, atomic_load(&pongs), "Every byte came back");
+  ASSERT_EQ(0, atomic_load(&fd_errors), "No unexpected readiness");
+  for (i32 i = 0; i < NPAIRS; i++) {
+    close(pairs[i][0]);
+    close(pairs[i][1]);
+  }
+  return 0;
+})
+
+PRIVATE _Atomic(i64) wait_results = 0;
+
+PRIVATE void co_late_writer(anyptr ctx) {
+  (void)ctx;
+  chiba_csco_sleep(10 * MS);
+  if (write(pairs[0][1], "x", 1) == 1)
+    atomic_fetch_add(&wait_results, 1);
+}
+
+PRIVATE void co_wait_dl(anyptr ctx) {
+  (void)ctx;
+  i32 fd = pairs[0][0];
+  i64 now = (i64)get_time_in_nanoseconds();
+  // Nothing to read yet
+  if (chiba_csco_wait_dl(fd, CHIBA_CSCO_WAIT_READ, now + 5 * MS) ==
+          CHIBA_CSCO_TIMEDOUT &&
+      (i64)get_time_in_nanoseconds() >= now + 5 * MS)
+    atomic_fetch_add(&wait_results, 10);
+  // Only the ready half of the events is reported
+  if (chiba_csco_wait(fd, CHIBA_CSCO_WAIT_READ | CHIBA_CSCO_WAIT_WRITE) ==
+      CHIBA_CSCO_WAIT_WRITE)
+    atomic_fetch_add(&wait_results, 100);
+  // Readiness beats the deadline
+  chiba_csco_start(co_late_writer, NULL);
+  now = (i64)get_time_in_nanoseconds();
+  if (chiba_csco_wait_dl(fd, CHIBA_CSCO_WAIT_READ, now + 1000 * MS) ==
+      CHIBA_CSCO_WAIT_READ)
+    atomic_fetch_add(&wait_results, 1000);
+  if (chiba_csco_wait(fd, 0) == CHIBA_CSCO_INVAL)
+    atomic_fetch_add(&wait_results, 10000);
+}
+
+TEST_CASE(fd_deadlines, cs_coroutine, "wait_dl times out and wakes on data", {
+  DESC(fd_deadlines);
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pairs[0]),
+            "Socket pair created");
+  atomic_store(&wait_results, 0);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(2, co_wait_dl, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(11111, atomic_load(&wait_results), "Every wait case held");
+  close(pairs[0][0]);
+  close(pairs[0][1]);
+  return 0;
+})
+
+//////////
+// coroutine I/O
+//////////
+
+PRIVATE chiba_csco_info io_info;
+
+PRIVATE void co_io_echo(anyptr ctx) {
+  i32 fd = pairs[(intptr_t)ctx][1];
+  char buf[16];
+  i64 n;
+  while ((n = chiba_csco_read(fd, buf, sizeof(buf))) > 0) {
+    if (chiba_csco_write(fd, buf, (u64)n) != n)
+      atomic_fetch_add(&fd_errors, 1);
+  }
+  if (n < 0)
+    atomic_fetch_add(&fd_errors, 1);
+}
+
+PRIVATE void co_io_ping(anyptr ctx) {
+  i32 fd = pairs[(intptr_t)ctx][0];
+  for (i32 i = 0; i < NROUNDS; i++) {
+    char c = (char)i;
+    if (chiba_csco_write(fd, &c, 1) != 1 || chiba_csco_read(fd, &c, 1) != 1 ||
+        c != (char)i)
+      atomic_fetch_add(&fd_errors, 1);
+    else
+      atomic_fetch_add(&pongs, 1);
+  }
+  shutdown(fd, SHUT_WR);
+}
+
+PRIVATE void co_io_pingpong(anyptr ctx) {
+  (void)ctx;
+  chiba_csco_id_t ids[NPAIRS];
+  for (intptr_t i = 0; i < NPAIRS; i++) {
+    chiba_csco_start(co_io_echo, (anyptr)i);
+    chiba_csco_start(co_io_ping, (anyptr)i);
+    ids[i] = chiba_csco_lastid();
+  }
+  for (i32 i = 0; i < NPAIRS; i++)
+    chiba_csco_join(ids[i]);
+  io_info = chiba_csco_getinfo();
+}
+
+TEST_CASE(io_pingpong, cs_coroutine, "Coroutine read and write", {
+  DESC(io_pingpong);
+
+  for (i32 i = 0; i < NPAIRS; i++) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pairs[i]),
+              "Socket pair created");
+  }
+  atomic_store(&pongs, 0);
+  atomic_store(&fd_errors, 0);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(NWORKERS, co_io_pingpong, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(NPAIRS * NROUNDS, atomic_load(&pongs), "Every byte came back");
+  ASSERT_EQ(0, atomic_load(&fd_errors), "No failed I/O");
+  // Without io_uring both stay zero
+  ASSERT_TRUE(io_info.io_enters <= io_info.io_ops,
+              "Submissions are batched");
+  printf("   %lld io_uring ops in %lld io_uring_enter calls\n",
+         (long long)io_info.io_ops, (long long)io_info.io_enters);
+  for (i32 i = 0; i < NPAIRS; i++) {
+    close(pairs[i][0]);
+    close(pairs[i][1]);
+  }
+  return 0;
+})
+
+PRIVATE i32 listen_fd = -1;
+PRIVATE struct sockaddr_in listen_addr;
+PRIVATE _Atomic(i64) tcp_results = 0;
+
+PRIVATE void co_tcp_client(anyptr ctx) {
+  (void)ctx;
+  i32 fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (chiba_csco_connect(fd, &listen_addr, sizeof(listen_addr)) ==
+          CHIBA_CSCO_OK &&
+      chiba_csco_write(fd, "hi", 2) == 2)
+    atomic_fetch_add(&tcp_results, 1);
+  close(fd);
+}
+
+PRIVATE void co_tcp_server(anyptr ctx) {
+  (void)ctx;
+  chiba_csco_start(co_tcp_client, NULL);
+  struct sockaddr_in peer;
+  u32 len = sizeof(peer);
+  i32 fd = chiba_csco_accept(listen_fd, &peer, &len, SOCK_NONBLOCK);
+  if (fd < 0)
+    return;
+  char buf[2];
+  if (chiba_csco_read(fd, buf, 2) == 2 && memcmp(buf, "hi", 2) == 0)
+    atomic_fetch_add(&tcp_results, 10);
+  if (chiba_csco_read(fd, buf, 2) == 0)
+    atomic_fetch_add(&tcp_results, 100);
+  close(fd);
+}
+
+TEST_CASE(io_accept_connect, cs_coroutine, "Coroutine accept and connect", {
+  DESC(io_accept_connect);
+
+  listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  memset(&listen_addr, 0, sizeof(listen_addr));
+  listen_addr.sin_family = AF_INET;
+  listen_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(listen_addr);
+  ASSERT_EQ(0,
+            bind(listen_fd, (struct sockaddr *)&listen_addr,
+                 sizeof(listen_addr)),
+            "Bound to loopback");
+  ASSERT_EQ(0, listen(listen_fd, 16), "Listening");
+  getsockname(listen_fd, (struct sockaddr *)&listen_addr, &len);
+  atomic_store(&tcp_results, 0);
+  ASSERT_EQ(CHIBA_CSCO_OK, chiba_csco_main(2, co_tcp_server, NULL),
+            "Runtime ran to completion");
+  ASSERT_EQ(111, atomic_load(&tcp_results), "Connected, sent and closed");
+  close(listen_fd);
+  return 0;
+})
+
+REGISTER_TEST_GROUP(cs_coroutine) {
+  REGISTER_TEST(start_join, cs_coroutine);
+  REGISTER_TEST(yield_fifo, cs_coroutine);
+  REGISTER_TEST(suspend_resume, cs_coroutine);
+  REGISTER_TEST(remote_resume, cs_coroutine);
+  REGISTER_TEST(work_stealing, cs_coroutine);
+  REGISTER_TEST(sleep_order, cs_coroutine);
+  REGISTER_TEST(deadlines, cs_coroutine);
+  REGISTER_TEST(cancelled_timeouts, cs_coroutine);
+  REGISTER_TEST(fd_pingpong, cs_coroutine);
+  REGISTER_TEST(fd_deadlines, cs_coroutine);
+  REGISTER_TEST(io_pingpong, cs_coroutine);
+  REGISTER_TEST(io_accept_connect, cs_coroutine);
+}
+
+ENABLE_TEST_GROUP(cs_coroutine)
@@ -16,6 +16,9 @@ struct chiba_co_asmctx {
   anyptr d[8]; /* d8-d15 */
 };
 
+// Saved stack pointer of a switched-out context
+#define CHIBA_CO_ASMCTX_SP(ctx) ((ctx)->sp)
+
 void _chiba_co_asm_entry(void);
 i32 _chiba_co_asm_switch(struct chiba_co_asmctx *from,
                          struct chiba_co_asmctx *to);
@@ -15,6 +15,9 @@ struct chiba_co_asmctx {
   anyptr rip, rsp, rbp, rbx, r12, r13, r14, r15;
 };
 
+// Saved stack pointer of a switched-out context
+#define CHIBA_CO_ASMCTX_SP(ctx) ((ctx)->rsp)
+
 void _chiba_co_asm_entry(void);
 i32 _chiba_co_asm_switch(struct chiba_co_asmctx *from,
                          struct chiba_co_asmctx *to);
@@ -20,6 +20,9 @@ struct chiba_co_asmctx {
   anyptr stack_base;
 };
 
+// Saved stack pointer of a switched-out context
+#define CHIBA_CO_ASMCTX_SP(ctx) ((ctx)->rsp)
+
 #if defined(__GNUC__)
 #define CHIBA_CO_ASM_BLOB __attribute__((section(".text")))
 #elif defined(_MSC_VER)
@@ -0,0 +1,230 @@
+#include "coroutine.h"
+#include "../basic_memory.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// -----------------------------------------------
+// Benchmark configuration
+// -----------------------------------------------
+#define SWITCH_TARGET 1000000LL // 每种模式的切换次数
+#define IDLE_TARGET 10000LL     // 空闲协程数量
+#define SESSION_FRAME 256       // 每个空闲协程栈上的会话状态 (bytes)
+
+typedef struct {
+  double elapsed_us;    // 总耗时 (microseconds)
+  double throughput_ms; // 每毫秒切换次数 (switches / ms)
+  double per_switch_us; // 单次切换耗时 (microseconds)
+} BenchResult;
+
+static inline u64 now_ns(void) { return get_time_in_nanoseconds(); }
+
+// -----------------------------------------------
+// Counting allocator: heap bytes currently owned by the coroutine layer
+// -----------------------------------------------
+#define HDR 16
+static long long heap_live = 0;
+
+static anyptr count_malloc(size_t n) {
+  char *p = malloc(n + HDR);
+  if (!p)
+    return NULL;
+  ((size_t *)p)[0] = n;
+  ((anyptr *)p)[1] = p;
+  heap_live += (long long)n;
+  return p + HDR;
+}
+
+static anyptr count_aligned(size_t align, size_t n) {
+  if (align < HDR)
+    align = HDR;
+  char *base = aligned_alloc(align, ((n + align + align - 1) / align) * align);
+  if (!base)
+    return NULL;
+  char *p = base + align;
+  ((size_t *)(p - HDR))[0] = n;
+  ((anyptr *)(p - HDR))[1] = base;
+  heap_live += (long long)n;
+  return p;
+}
+
+static anyptr count_realloc(anyptr ptr, size_t n) {
+  if (!ptr)
+    return count_malloc(n);
+  char *p = (char *)ptr - HDR;
+  size_t old = ((size_t *)p)[0];
+  char *q = realloc(p, n + HDR);
+  if (!q)
+    return NULL;
+  ((size_t *)q)[0] = n;
+  ((anyptr *)q)[1] = q;
+  heap_live += (long long)n - (long long)old;
+  return q + HDR;
+}
+
+static void count_free(anyptr ptr) {
+  char *p = (char *)ptr - HDR;
+  heap_live -= (long long)((size_t *)p)[0];
+  free(((anyptr *)p)[1]);
+}
+
+// -----------------------------------------------
+// Ping-pong between two coroutines
+// -----------------------------------------------
+static chiba_co *pp_co[2];
+static long long pp_rounds = 0;
+static bool pp_stop = false;
+
+static void free_stack(anyptr s, u64 n, anyptr u) {
+  (void)n;
+  (void)u;
+  CHIBA_INTERNAL_free(s);
+}
+
+static void co_pingpong(anyptr u) {
+  int me = (int)(uintptr_t)u;
+  pp_co[me] = chiba_co_current();
+  chiba_co_switch(NULL, false);
+  while (!pp_stop) {
+    if (me == 0 && ++pp_rounds * 2 >= SWITCH_TARGET)
+      chiba_co_switch(NULL, false);
+    else
+      chiba_co_switch(pp_co[1 - me], false);
+  }
+  chiba_co_switch(NULL, true);
+}
+
+static BenchResult bench_pingpong(bool shared) {
+  pp_rounds = 0;
+  pp_stop = false;
+  chiba_co_desc d[2];
+  for (int i = 0; i < 2; i++) {
+    memset(&d[i], 0, sizeof(d[i]));
+    d[i].entry = co_pingpong;
+    d[i].ctx = (anyptr)(uintptr_t)i;
+    if (shared) {
+      chiba_co_start_shared(&d[i], false);
+    } else {
+      d[i].stack = CHIBA_INTERNAL_malloc(CHIBA_CO_MINSTACKSIZE);
+      d[i].stack_size = CHIBA_CO_MINSTACKSIZE;
+      d[i].defer = free_stack;
+      chiba_co_start(&d[i], false);
+    }
+  }
+
+  u64 start_ns = now_ns();
+  chiba_co_switch(pp_co[0], false);
+  u64 end_ns = now_ns();
+
+  // 结束两个协程
+  pp_stop = true;
+  chiba_co_switch(pp_co[0], false);
+  chiba_co_switch(pp_co[1], false);
+
+  double elapsed_us = (double)(end_ns - start_ns) / 1000.0;
+  BenchResult r;
+  r.elapsed_us = elapsed_us;
+  r.throughput_ms = (pp_rounds * 2) / (elapsed_us / 1000.0);
+  r.per_switch_us = elapsed_us / (pp_rounds * 2);
+  return r;
+}
+
+// -----------------------------------------------
+// Idle fan-out: many coroutines parked with a small session frame
+// -----------------------------------------------
+static chiba_co *idle_co[IDLE_TARGET];
+static long long idle_n = 0;
+static bool idle_quit = false;
+
+NOINLINE static void session_wait(long long id) {
+  volatile char state[SESSION_FRAME];
+  memset((char *)state, (int)id, sizeof(state));
+  while (!idle_quit)
+    chiba_co_switch(NULL, false);
+}
+
+static void co_idle(anyptr u) {
+  (void)u;
+  idle_co[idle_n] = chiba_co_current();
+  session_wait(idle_n++);
+  chiba_co_switch(NULL, true);
+}
+
+// Returns the memory held per idle coroutine (bytes)
+static double bench_idle(bool shared, double *elapsed_us) {
+  idle_n = 0;
+  idle_quit = false;
+  long long before = heap_live;
+  u64 start_ns = now_ns();
+  for (long long i = 0; i < IDLE_TARGET; i++) {
+    chiba_co_desc d;
+    memset(&d, 0, sizeof(d));
+    d.entry = co_idle;
+    if (shared) {
+      chiba_co_start_shared(&d, false);
+    } else {
+      d.stack = CHIBA_INTERNAL_malloc(CHIBA_CO_MINSTACKSIZE);
+      d.stack_size = CHIBA_CO_MINSTACKSIZE;
+      d.defer = free_stack;
+      chiba_co_start(&d, false);
+    }
+  }
+  // 再唤醒一轮, 每个协程都经历一次换出/换入
+  for (long long i = 0; i < IDLE_TARGET; i++)
+    chiba_co_switch(idle_co[i], false);
+  *elapsed_us = (double)(now_ns() - start_ns) / 1000.0;
+  long long held = heap_live - before;
+
+  idle_quit = true;
+  for (long long i = 0; i < IDLE_TARGET; i++)
+    chiba_co_switch(idle_co[i], false);
+  return (double)held / IDLE_TARGET;
+}
+
+// -----------------------------------------------
+// Main
+// -----------------------------------------------
+int main(void) {
+  CHIBA_INTERNAL_set_alloc_funcs(count_malloc, count_aligned, count_realloc,
+                                 count_free);
+
+  printf("========================================\n");
+  printf("  Stack-per-coroutine vs Shared-stack Benchmark\n");
+  printf("========================================\n");
+  printf("  Method: %s\n", chiba_co_method(NULL));
+  printf("  Target switches: %lld\n", (long long)SWITCH_TARGET);
+  printf("  Idle coroutines: %lld (%d byte frames)\n", (long long)IDLE_TARGET,
+         SESSION_FRAME);
+  printf("\n");
+
+  printf("========================================\n");
+  printf("Benchmark 1: coroutine <-> coroutine ping-pong\n");
+  printf("========================================\n");
+  BenchResult own = bench_pingpong(false);
+  printf("  own stacks:   %.2f us (%.2f switches/ms, %.4f us/switch)\n",
+         own.elapsed_us, own.throughput_ms, own.per_switch_us);
+  BenchResult sh = bench_pingpong(true);
+  printf("  shared stack: %.2f us (%.2f switches/ms, %.4f us/switch)\n\n",
+         sh.elapsed_us, sh.throughput_ms, sh.per_switch_us);
+
+  printf("========================================\n");
+  printf("Benchmark 2: idle fan-out\n");
+  printf("========================================\n");
+  double own_us = 0, sh_us = 0;
+  double own_mem = bench_idle(false, &own_us);
+  printf("  own stacks:   %.2f us, %.0f bytes/coroutine\n", own_us, own_mem);
+  double sh_mem = bench_idle(true, &sh_us);
+  printf("  shared stack: %.2f us, %.0f bytes/coroutine (+%d byte shared "
+         "stack per thread)\n\n",
+         sh_us, sh_mem, CHIBA_CO_SHARED_STACKSIZE);
+
+  printf("========================================\n");
+  printf("Summary\n");
+  printf("========================================\n");
+  printf("Switch factor (elapsed, >1 => shared slower): %.2fx\n",
+         sh.elapsed_us / own.elapsed_us);
+  printf("Memory factor (bytes, >1 => own stacks larger): %.2fx\n",
+         own_mem / sh_mem);
+  printf("========================================\n");
+  return 0;
+}
@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+
+set -euo pipefail
+
+gcc -o coroutine.bench \
+  coroutine.bench.c \
+  ../basic_memory.c \
+  coroutine.c \
+  -I.. -pthread -std=c11 -Wall -Wextra -O2 -g
+
+echo "Running coroutine.bench..."
+./coroutine.bench
+
+if [ $? -ne 0 ]; then
+    echo "✗ coroutine.bench FAILED"
+    exit 1
+else
+    echo "✓ coroutine.bench PASSED"
+fi
+
+echo "Deleting benchmark binary..."
+rm -f coroutine.bench
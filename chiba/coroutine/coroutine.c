@@ -2,9 +2,22 @@
 // IMPLEMENTATION
 //////////////////////////////////////////////////////////////////////////////////
 
+// mmap flags and madvise used by the stack pool are not part of ISO C; ask for
+// them before any system header is pulled in
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "coroutine.h"
 
 #include "./context/context.c"
+#include "./stack/stack_pool.c"
+
+// Shared-stack (copy-stack) coroutines need to read a paused context's stack
+// pointer, so they are only available with the assembly backends
+#if defined(CHIBA_CO_ASM) && !defined(CHIBA_CO_NOSHARED)
+#define CHIBA_CO_SHARED
+#endif
 
 // Exit function for coroutines
 NOINLINE PRIVATE void chiba_co_exit(void) __attribute__((noreturn));
@@ -23,6 +36,13 @@ typedef struct chiba_co {
 #elif defined(CHIBA_CO_WASM)
   emscripten_fiber_t fiber;
 #endif
+#if defined(CHIBA_CO_SHARED)
+  bool shared; // runs on the thread's shared stack
+  bool fresh;  // shared coroutine that has not run yet
+  i8 *save_buf;  // live stack slice while not on the shared stack
+  u64 save_size; // bytes used in save_buf
+  u64 save_cap;  // bytes allocated for save_buf
+#endif
 } chiba_co;
 
 PRIVATE THREAD_LOCAL struct chiba_co chiba_co_thread = {0};
@@ -41,6 +61,120 @@ PRIVATE THREAD_LOCAL volatile bool chiba_co_defer_active = false;
     }                                                                          \
   }
 
+////////////////////////////////////////////////////////////////////////////////
+// Shared stack
+////////////////////////////////////////////////////////////////////////////////
+// Shared coroutines of a thread all execute on one large stack. A paused
+// shared coroutine keeps only the slice between its stack pointer and the top
+// of the shared stack, copied into a heap buffer, so an idle coroutine costs a
+// few hundred bytes instead of a whole stack.
+// - the slice of the coroutine that last ran (the occupant) is only copied out
+//   when another shared coroutine needs the stack, so switching between one
+//   shared coroutine and ordinary ones never copies
+// - a copy cannot run on the stack being overwritten, so shared -> shared
+//   switches go through a small per-thread copier context
+// - shared coroutines are heap allocated and bound to their thread
+
+#if defined(CHIBA_CO_SHARED)
+typedef struct chiba_co_shared_env {
+  i8 *stack;
+  u64 stack_size;
+  struct chiba_co *occupant; // owner of the frames on the shared stack
+  struct chiba_co *dead;     // finished coroutine waiting to be freed
+  struct chiba_co *next;     // coroutine the copier switches to
+  struct chiba_co copier;
+  anyptr copier_stack;
+  u64 copier_size;
+  u64 live; // shared coroutines alive on this thread
+} chiba_co_shared_env;
+
+PRIVATE THREAD_LOCAL chiba_co_shared_env chiba_co_shared = {0};
+
+// Copy the occupant's live slice off the shared stack
+PRIVATE void chiba_co_shared_save(struct chiba_co *co) {
+  i8 *top = chiba_co_shared.stack + chiba_co_shared.stack_size;
+  i8 *sp = (i8 *)CHIBA_CO_ASMCTX_SP(&co->ctx);
+  u64 n = (u64)(top - sp);
+  if (n > co->save_cap) {
+    i8 *buf = (i8 *)CHIBA_INTERNAL_realloc(co->save_buf, n);
+    if (unlikely(!buf)) {
+      fprintf(stderr, "chiba_co: out of memory saving a shared stack\n");
+      abort();
+    }
+    co->save_buf = buf;
+    co->save_cap = n;
+  }
+  memcpy(co->save_buf, sp, n);
+  co->save_size = n;
+}
+
+// Make `co` the occupant of the shared stack. Must not run on the shared
+// stack.
+PRIVATE void chiba_co_shared_enter(struct chiba_co *co) {
+  struct chiba_co *occupant = chiba_co_shared.occupant;
+  if (occupant == co)
+    return;
+  if (occupant && occupant != chiba_co_shared.dead)
+    chiba_co_shared_save(occupant);
+  if (co->fresh) {
+    co->fresh = false;
+    chiba_co_asmctx_make(&co->ctx, chiba_co_shared.stack,
+                         chiba_co_shared.stack_size, co);
+  } else {
+    memcpy(chiba_co_shared.stack + chiba_co_shared.stack_size - co->save_size,
+           co->save_buf, co->save_size);
+  }
+  chiba_co_shared.occupant = co;
+}
+
+NOINLINE PRIVATE void chiba_co_shared_copier(void) __attribute__((noreturn));
+PRIVATE void chiba_co_shared_copier(void) {
+  for (;;) {
+    struct chiba_co *next = chiba_co_shared.next;
+    chiba_co_shared_enter(next);
+    _chiba_co_asm_switch(&chiba_co_shared.copier.ctx, &next->ctx);
+  }
+}
+
+// Switch to a shared coroutine
+PRIVATE void chiba_co_shared_switch(struct chiba_co *from,
+                                    struct chiba_co *to) {
+  if (!from->shared) {
+    chiba_co_shared_enter(to);
+    _chiba_co_asm_switch(&from->ctx, &to->ctx);
+    return;
+  }
+  // running on the shared stack: let the copier swap the slices
+  if (!chiba_co_shared.copier_stack) {
+    chiba_co_shared.copier_stack = chiba_co_stack_acquire(
+        CHIBA_CO_MINSTACKSIZE, &chiba_co_shared.copier_size);
+    chiba_co_asmctx_make(&chiba_co_shared.copier.ctx,
+                         chiba_co_shared.copier_stack,
+                         chiba_co_shared.copier_size, &chiba_co_shared.copier);
+  }
+  chiba_co_shared.next = to;
+  _chiba_co_asm_switch(&from->ctx, &chiba_co_shared.copier.ctx);
+}
+
+// Free a finished shared coroutine, and the shared stacks with the last one
+PRIVATE void chiba_co_shared_free(struct chiba_co *co) {
+  chiba_co_shared.dead = NULL;
+  if (chiba_co_shared.occupant == co)
+    chiba_co_shared.occupant = NULL;
+  CHIBA_INTERNAL_free(co->save_buf);
+  CHIBA_INTERNAL_free(co);
+  if (--chiba_co_shared.live > 0)
+    return;
+  chiba_co_stack_release(chiba_co_shared.stack, chiba_co_shared.stack_size);
+  chiba_co_shared.stack = NULL;
+  if (chiba_co_shared.copier_stack) {
+    chiba_co_stack_release(chiba_co_shared.copier_stack,
+                           chiba_co_shared.copier_size);
+    chiba_co_shared.copier_stack = NULL;
+  }
+}
+#endif
+
 // Execute pending defer handler
 PRIVATE void chiba_co_defer_last(void) {
   if (chiba_co_defer_needed) {
@@ -52,6 +186,10 @@ PRIVATE void chiba_co_defer_last(void) {
       chiba_co_defer_active = false;
     }
     chiba_co_defer_needed = false;
+#if defined(CHIBA_CO_SHARED)
+    if (chiba_co_shared.dead)
+      chiba_co_shared_free(chiba_co_shared.dead);
+#endif
   }
 }
 
@@ -63,6 +201,14 @@ PRIVATE void chiba_co_entry_wrap(anyptr arg) {
   chiba_co_cur = arg;
   chiba_co_cur->desc = chiba_co_desc_temp;
 #else
+#if defined(CHIBA_CO_SHARED)
+  if (arg) {
+    // shared coroutines live on the heap, see chiba_co_start_shared
+    chiba_co_cur = arg;
+    chiba_co_cur->desc.entry(chiba_co_cur->desc.ctx);
+    return;
+  }
+#endif
   (void)arg;
   struct chiba_co self = {.desc = chiba_co_desc_temp};
   chiba_co_cur = &self;
@@ -72,6 +218,10 @@ PRIVATE void chiba_co_entry_wrap(anyptr arg) {
 
 // Coroutine entry point (externally visible for asm context creation)
 NOINLINE void chiba_co_entry(anyptr arg) {
+#if defined(CHIBA_CO_SHARED)
+  if (arg == &chiba_co_shared.copier)
+    chiba_co_shared_copier();
+#endif
   chiba_co_entry_wrap(arg);
   chiba_co_exit();
 }
@@ -128,13 +278,22 @@ PRIVATE void chiba_co_switch0(struct chiba_co_desc *desc, struct chiba_co *co,
       chiba_co_defer_needed = true;
       memcpy((void *)&chiba_co_defer_desc, &from->desc,
              sizeof(struct chiba_co_desc));
+#if defined(CHIBA_CO_SHARED)
+      if (from->shared)
+        chiba_co_shared.dead = from;
+#endif
     }
     if (desc) {
       chiba_co_desc_temp = *desc;
       chiba_co_switch1(from, NULL, desc->stack, desc->stack_size);
     } else {
       chiba_co_cur = to;
-      chiba_co_switch1(from, to, NULL, 0);
+#if defined(CHIBA_CO_SHARED)
+      if (to->shared)
+        chiba_co_shared_switch(from, to);
+      else
+#endif
+        chiba_co_switch1(from, to, NULL, 0);
     }
     chiba_co_defer_last();
   }
@@ -155,13 +314,73 @@ PUBLIC void chiba_co_start(struct chiba_co_desc *desc, bool final) {
   chiba_co_switch0(desc, NULL, final);
 }
 
+// Start a new coroutine on a pooled stack, profiled under `key`
+PUBLIC void chiba_co_spawn_keyed(struct chiba_co_desc *desc, bool final,
+                                 anyptr key) {
+  if (!desc) {
+    fprintf(stderr, "chiba_co_spawn: missing descriptor\n");
+    abort();
+  }
+  struct chiba_co_desc pooled = *desc;
+  u64 size = desc->stack_size;
+  if (size == 0)
+    size = chiba_co_stack_profile_size(key);
+  pooled.stack = chiba_co_stack_acquire(size, &pooled.stack_size);
+  chiba_co_stack_hdr *hdr = chiba_co_stack_hdr_of(pooled.stack, pooled.stack_size);
+  hdr->defer = desc->defer;
+  if (unlikely(atomic_load_explicit(&chiba_co_stack_profiling,
+                                    memory_order_relaxed)))
+    chiba_co_stack_profile_arm(hdr, key);
+  pooled.defer = chiba_co_stack_defer;
+  chiba_co_start(&pooled, final);
+}
+
+// Start a new coroutine on a pooled stack
+PUBLIC void chiba_co_spawn(struct chiba_co_desc *desc, bool final) {
+  chiba_co_spawn_keyed(desc, final, desc ? (anyptr)desc->entry : NULL);
+}
+
+// Start a new coroutine on the calling thread's shared stack
+PUBLIC void chiba_co_start_shared(struct chiba_co_desc *desc, bool final) {
+  if (!desc) {
+    fprintf(stderr, "chiba_co_start_shared: missing descriptor\n");
+    abort();
+  }
+#if defined(CHIBA_CO_SHARED)
+  chiba_co_defer_guard();
+  struct chiba_co *co =
+      (struct chiba_co *)CHIBA_INTERNAL_malloc(sizeof(struct chiba_co));
+  if (unlikely(!co)) {
+    fprintf(stderr, "chiba_co_start_shared: out of memory\n");
+    abort();
+  }
+  memset(co, 0, sizeof(struct chiba_co));
+  co->desc = *desc;
+  co->desc.stack = NULL;
+  co->desc.stack_size = 0;
+  co->shared = true;
+  co->fresh = true;
+  if (!chiba_co_shared.stack)
+    chiba_co_shared.stack = (i8 *)chiba_co_stack_acquire(
+        CHIBA_CO_SHARED_STACKSIZE, &chiba_co_shared.stack_size);
+  chiba_co_shared.live++;
+  chiba_co_switch0(NULL, co, final);
+#else
+  chiba_co_spawn(desc, final);
+#endif
+}
+
 // Switch to another coroutine
 PUBLIC void chiba_co_switch(struct chiba_co *co, bool final) {
 #if defined(CHIBA_CO_ASM)
   // Fast track context switch. Saves a few nanoseconds by checking the
   // exception condition first.
   if (!chiba_co_defer_active && chiba_co_cur && co && chiba_co_cur != co &&
-      !final) {
+      !final
+#if defined(CHIBA_CO_SHARED)
+      && !co->shared
+#endif
+  ) {
     struct chiba_co *from = chiba_co_cur;
     chiba_co_cur = co;
     _chiba_co_asm_switch(&from->ctx, &co->ctx);
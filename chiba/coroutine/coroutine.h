@@ -24,8 +24,81 @@ PUBLIC chiba_co *chiba_co_current(void);
 // Start a new coroutine
 PUBLIC void chiba_co_start(chiba_co_desc *desc, bool final);
 
+// Start a new coroutine on a stack taken from the stack pool.
+// desc->stack is ignored and desc->stack_size is the minimum size wanted.
+// 0 lets the pool pick: the profiled size of desc->entry if one was recorded
+// and profiling or autosizing is on (see chiba_co_stack_profile_enable), else
+// CHIBA_CO_DEFAULT_STACKSIZE.
+// desc->defer, if set, runs before the stack goes back to the pool.
+PUBLIC void chiba_co_spawn(chiba_co_desc *desc, bool final);
+
+// Same as chiba_co_spawn, with stack profiles kept under `key` rather than
+// desc->entry. For wrappers whose entry trampoline is shared by many
+// different coroutine bodies.
+PUBLIC void chiba_co_spawn_keyed(chiba_co_desc *desc, bool final, anyptr key);
+
+// Start a new coroutine on the calling thread's shared stack (copy-stack
+// mode). While paused, the coroutine only keeps its live stack slice, copied
+// to the heap, which suits large numbers of mostly idle coroutines at the cost
+// of a copy whenever another shared coroutine takes the stack. Shared
+// coroutines must stay on the thread that started them and their frames must
+// fit in CHIBA_CO_SHARED_STACKSIZE; desc->stack and desc->stack_size are
+// ignored and desc->defer receives a NULL stack. Without an assembly context
+// backend this falls back to chiba_co_spawn.
+PUBLIC void chiba_co_start_shared(chiba_co_desc *desc, bool final);
+
 // Switch to another coroutine
 PUBLIC void chiba_co_switch(chiba_co *co, bool final);
 
 // Get the coroutine method name (e.g., "asm,aarch64", "ucontext")
 PUBLIC cstr chiba_co_method(anyptr caps);
+
+// Stack pool
+
+// Take a stack of at least `size` bytes from the calling thread's pool.
+// The usable size (rounded up to the size class) is written to size_out and
+// must be passed back to chiba_co_stack_release.
+PUBLIC anyptr chiba_co_stack_acquire(u64 size, u64 *size_out);
+
+// Return a pooled stack. May be called from any thread.
+PUBLIC void chiba_co_stack_release(anyptr stack, u64 stack_size);
+
+// Defer handler releasing a pooled stack, for use as chiba_co_desc.defer
+PUBLIC void chiba_co_stack_defer(anyptr stack, u64 stack_size, anyptr ctx);
+
+// Free every idle stack cached by the calling thread
+PUBLIC void chiba_co_stack_pool_trim(void);
+
+// Give the memory of the calling thread's idle stacks back to the kernel
+// (madvise) without unmapping them. Idle stacks are also purged
+// automatically once they have sat unused for CHIBA_CO_STACK_PURGE_NS.
+// Returns the number of bytes advised.
+PUBLIC u64 chiba_co_stack_pool_purge(void);
+
+// Run the automatic purge above from an idle loop: a thread that stops
+// spawning coroutines otherwise never reaches it. Returns the time
+// (get_time_in_nanoseconds) of the next purge, or UINT64_MAX when no idle
+// stack of the thread holds memory any more.
+PUBLIC u64 chiba_co_stack_pool_tick(void);
+
+// Stack profiling
+
+// Fill the stacks of spawned coroutines with a canary and, when they finish,
+// record the deepest stack use per entry function. While it is on, spawns
+// with stack_size == 0 get the recorded peak plus 25% and
+// CHIBA_CO_STACK_HEADROOM, rounded up to a pool size class and never below
+// CHIBA_CO_STACK_PROFILE_FLOOR. Profiling touches every page of a stack, so
+// enable it to train sizes rather than for good.
+PUBLIC void chiba_co_stack_profile_enable(bool on);
+
+// Keep sizing spawns from the recorded peaks after profiling is turned off.
+// Off by default: a peak only covers the inputs seen while training, and a
+// deeper run later overflows into the guard page (or, with
+// CHIBA_CO_STACK_NOMMAP, into whatever lies below the stack).
+PUBLIC void chiba_co_stack_profile_autosize(bool on);
+
+// Deepest stack use recorded for an entry (or spawn key), 0 if unknown
+PUBLIC u64 chiba_co_stack_profile_peak(anyptr entry);
+
+// Forget all recorded peaks. Must not race with profiled spawns.
+PUBLIC void chiba_co_stack_profile_reset(void);
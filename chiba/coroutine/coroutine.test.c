@@ -2,6 +2,7 @@
 #include "coroutine.h"
 #include "../chiba_testing.h"
 #if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <stdint.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #endif
@@ -443,6 +444,253 @@ TEST_CASE(child_final_start_cleans_parent, coroutine,
             return 0;
           })
 
+// 9. stack_pool_reuse: released stacks are handed out again per size class
+TEST_CASE(stack_pool_reuse, coroutine, "stack pool reuses released stacks", {
+  DESC(stack_pool_reuse);
+  u64 size = 0;
+  anyptr a = chiba_co_stack_acquire(20000, &size);
+  ASSERT_NOT_NULL(a, "acquired stack");
+  ASSERT_EQ(32768, size, "rounded up to the 32K class");
+  chiba_co_stack_release(a, size);
+  u64 size2 = 0;
+  anyptr b = chiba_co_stack_acquire(32768, &size2);
+  ASSERT_TRUE(a == b, "same class hands back the released stack");
+  ASSERT_EQ(size, size2, "same usable size");
+  u64 size3 = 0;
+  anyptr c = chiba_co_stack_acquire(0, &size3);
+  ASSERT_EQ(CHIBA_CO_DEFAULT_STACKSIZE, size3, "zero selects default size");
+  ASSERT_TRUE(c != b, "different class gets a different stack");
+  chiba_co_stack_release(b, size2);
+  chiba_co_stack_release(c, size3);
+  chiba_co_stack_pool_trim();
+  return 0;
+})
+
+// 10. spawn_pooled: spawned coroutines run on pooled stacks and the user
+// defer runs before the stack is recycled
+static int sp_defer_calls = 0;
+static int sp_runs = 0;
+static u64 sp_frames[2] = {0};
+static void sp_defer(anyptr s, u64 n, anyptr u) {
+  (void)u;
+  if (s && n >= CHIBA_CO_MINSTACKSIZE)
+    sp_defer_calls++;
+}
+static void sp_entry(anyptr u) {
+  volatile int local = 0;
+  sp_frames[(intptr_t)u] = (u64)&local;
+  sp_runs++;
+  chiba_co_switch(NULL, true);
+}
+TEST_CASE(spawn_pooled, coroutine, "spawn runs on recycled pooled stacks", {
+  DESC(spawn_pooled);
+  sp_defer_calls = 0;
+  sp_runs = 0;
+  for (intptr_t i = 0; i < 2; i++) {
+    struct chiba_co_desc d;
+    d.stack = NULL;
+    d.stack_size = STKSZ;
+    d.entry = sp_entry;
+    d.defer = sp_defer;
+    d.ctx = (anyptr)i;
+    chiba_co_spawn(&d, false);
+  }
+  ASSERT_EQ(2, sp_runs, "both coroutines ran");
+  ASSERT_EQ(2, sp_defer_calls, "user defer ran for both");
+  ASSERT_TRUE(sp_frames[0] == sp_frames[1], "second spawn reused the stack");
+  chiba_co_stack_pool_trim();
+  return 0;
+})
+
+// 11. stack_pool_cross_thread: stacks released on a foreign thread return to
+// the owning thread, and survive the owner exiting
+#if !defined(__EMSCRIPTEN__)
+static anyptr xt_stack = NULL;
+static u64 xt_size = 0;
+static void *xt_release(void *arg) {
+  (void)arg;
+  chiba_co_stack_release(xt_stack, xt_size);
+  return NULL;
+}
+static void *xt_acquire(void *arg) {
+  (void)arg;
+  xt_stack = chiba_co_stack_acquire(STKSZ, &xt_size);
+  return NULL;
+}
+TEST_CASE(stack_pool_cross_thread, coroutine,
+          "stack pool cross-thread return path", {
+            DESC(stack_pool_cross_thread);
+            pthread_t th;
+            xt_stack = chiba_co_stack_acquire(STKSZ, &xt_size);
+            anyptr mine = xt_stack;
+            ASSERT_EQ(0, pthread_create(&th, NULL, xt_release, NULL),
+                      "create releasing thread");
+            pthread_join(th, NULL);
+            u64 size = 0;
+            anyptr again = chiba_co_stack_acquire(STKSZ, &size);
+            ASSERT_TRUE(again == mine, "owner reclaimed its stack");
+            chiba_co_stack_release(again, size);
+            ASSERT_EQ(0, pthread_create(&th, NULL, xt_acquire, NULL),
+                      "create acquiring thread");
+            pthread_join(th, NULL);
+            ASSERT_NOT_NULL(xt_stack, "acquired on exited thread");
+            // owner is gone, the stack must be freed on release
+            chiba_co_stack_release(xt_stack, xt_size);
+            chiba_co_stack_pool_trim();
+            return 0;
+          })
+#else
+TEST_CASE(stack_pool_cross_thread, coroutine,
+          "stack pool cross-thread return path (skipped)", {
+            DESC(stack_pool_cross_thread);
+            return 0;
+          })
+#endif
+
+// 12. stack_pool_purge: idle dirty stacks are advised away once, and stay
+// usable afterwards
+TEST_CASE(stack_pool_purge, coroutine, "stack pool purges idle stacks", {
+  DESC(stack_pool_purge);
+  u64 size = 0;
+  char *stk = (char *)chiba_co_stack_acquire(STKSZ, &size);
+  ASSERT_NOT_NULL(stk, "acquired stack");
+  for (u64 i = 0; i < size; i += 1024)
+    stk[i] = (char)i;
+  chiba_co_stack_release(stk, size);
+  ASSERT_TRUE(chiba_co_stack_pool_tick() != UINT64_MAX,
+              "idle loop is told when the dirty stack gets purged");
+  u64 first = chiba_co_stack_pool_purge();
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) &&                           \
+    !defined(CHIBA_CO_STACK_NOMMAP)
+  ASSERT_TRUE(first > 0, "dirty idle stack was advised");
+#else
+  (void)first;
+#endif
+  ASSERT_EQ(0, chiba_co_stack_pool_purge(), "clean stacks are skipped");
+  ASSERT_TRUE(chiba_co_stack_pool_tick() == UINT64_MAX,
+              "nothing left for the idle loop to purge");
+  u64 size2 = 0;
+  char *again = (char *)chiba_co_stack_acquire(STKSZ, &size2);
+  ASSERT_TRUE(again == stk, "purged stack is reused");
+  for (u64 i = 0; i < size2; i += 1024)
+    again[i] = 1;
+  ASSERT_EQ(1, again[0], "purged stack is writable");
+  chiba_co_stack_release(again, size2);
+  chiba_co_stack_pool_trim();
+  return 0;
+})
+
+// 13. shared_stack_switching: copy-stack coroutines keep their frames across
+// switches between each other and with the main context
+#define SH_ROUNDS 64
+static chiba_co *sh_co[2] = {NULL, NULL};
+static int sh_count[2] = {0, 0};
+static int sh_bad = 0;
+static int sh_defers = 0;
+static void sh_defer(anyptr s, u64 n, anyptr u) {
+  (void)u;
+  if (!s && !n)
+    sh_defers++;
+}
+static void sh_entry(anyptr u) {
+  int me = (int)(u64)u;
+  volatile char buf[700];
+  for (int i = 0; i < (int)sizeof(buf); i++)
+    buf[i] = (char)(me * 31 + i);
+  sh_co[me] = chiba_co_current();
+  chiba_co_switch(me == 0 ? NULL : sh_co[0], false);
+  for (;;) {
+    for (int i = 0; i < (int)sizeof(buf); i++)
+      if (buf[i] != (char)(me * 31 + i))
+        sh_bad++;
+    if (++sh_count[me] == SH_ROUNDS)
+      chiba_co_switch(me == 0 ? sh_co[1] : NULL, true);
+    chiba_co_switch(sh_co[1 - me], false);
+  }
+}
+
+TEST_CASE(shared_stack_switching, coroutine,
+          "shared-stack coroutines preserve their frames", {
+            DESC(shared_stack_switching);
+            chiba_co_desc d;
+            memset(&d, 0, sizeof(d));
+            d.entry = sh_entry;
+            d.defer = sh_defer;
+            d.ctx = (anyptr)(u64)0;
+            chiba_co_start_shared(&d, false);
+            ASSERT_NOT_NULL(sh_co[0], "first shared coroutine paused");
+            d.ctx = (anyptr)(u64)1;
+            chiba_co_start_shared(&d, false);
+            ASSERT_EQ(SH_ROUNDS, sh_count[0], "first coroutine rounds");
+            ASSERT_EQ(SH_ROUNDS, sh_count[1], "second coroutine rounds");
+            ASSERT_EQ(0, sh_bad, "stack slices restored intact");
+            ASSERT_EQ(2, sh_defers, "defers ran with no stack");
+            return 0;
+          })
+
+// 14. stack_profile_autosize: profiled peaks size later default spawns only
+// once autosizing is opted into
+static u64 pf_sizes[2] = {0, 0};
+static void pf_defer(anyptr s, u64 n, anyptr u) {
+  (void)s;
+  pf_sizes[(intptr_t)u] = n;
+}
+static void pf_deep(anyptr u) {
+  volatile char frame[20000];
+  for (u64 i = 0; i < sizeof(frame); i += 512)
+    frame[i] = (char)i;
+  (void)u;
+  chiba_co_switch(NULL, true);
+}
+static void pf_shallow(anyptr u) {
+  (void)u;
+  chiba_co_switch(NULL, true);
+}
+TEST_CASE(stack_profile_autosize, coroutine,
+          "stack profiles pick per-entry stack sizes", {
+            DESC(stack_profile_autosize);
+            struct chiba_co_desc d;
+            memset(&d, 0, sizeof(d));
+            d.stack_size = 0;
+            d.defer = pf_defer;
+            chiba_co_stack_profile_enable(true);
+            d.entry = pf_deep;
+            chiba_co_spawn(&d, false);
+            d.entry = pf_shallow;
+            chiba_co_spawn(&d, false);
+            chiba_co_stack_profile_enable(false);
+            u64 deep = chiba_co_stack_profile_peak((anyptr)pf_deep);
+            u64 shallow = chiba_co_stack_profile_peak((anyptr)pf_shallow);
+            ASSERT_TRUE(deep >= 20000 && deep < 32768, "deep peak measured");
+            ASSERT_TRUE(shallow > 0 && shallow < 4096, "shallow peak measured");
+            d.ctx = (anyptr)(intptr_t)0;
+            d.entry = pf_deep;
+            chiba_co_spawn(&d, false);
+            d.ctx = (anyptr)(intptr_t)1;
+            d.entry = pf_shallow;
+            chiba_co_spawn(&d, false);
+            ASSERT_EQ(CHIBA_CO_DEFAULT_STACKSIZE, pf_sizes[0],
+                      "peaks are ignored once profiling is off");
+            ASSERT_EQ(CHIBA_CO_DEFAULT_STACKSIZE, pf_sizes[1],
+                      "peaks are ignored once profiling is off");
+            chiba_co_stack_profile_autosize(true);
+            d.ctx = (anyptr)(intptr_t)0;
+            d.entry = pf_deep;
+            chiba_co_spawn(&d, false);
+            d.ctx = (anyptr)(intptr_t)1;
+            d.entry = pf_shallow;
+            chiba_co_spawn(&d, false);
+            chiba_co_stack_profile_autosize(false);
+            ASSERT_EQ(32768, pf_sizes[0], "deep entry gets the 32K class");
+            ASSERT_EQ(CHIBA_CO_MINSTACKSIZE, pf_sizes[1],
+                      "shallow entry gets the smallest class");
+            chiba_co_stack_profile_reset();
+            ASSERT_EQ(0, chiba_co_stack_profile_peak((anyptr)pf_deep),
+                      "reset forgets peaks");
+            chiba_co_stack_pool_trim();
+            return 0;
+          })
+
 // Register
 REGISTER_TEST_GROUP(coroutine) {
   REGISTER_TEST(sequence_and_cleanup_order, coroutine);
@@ -455,6 +703,12 @@ REGISTER_TEST_GROUP(coroutine) {
   // heavy_switch_pressure: test heavy switching with minimal work
   REGISTER_TEST(heavy_switch_pressure, coroutine);
   REGISTER_TEST(performance_switching, coroutine);
+  REGISTER_TEST(stack_pool_reuse, coroutine);
+  REGISTER_TEST(spawn_pooled, coroutine);
+  REGISTER_TEST(stack_pool_cross_thread, coroutine);
+  REGISTER_TEST(stack_pool_purge, coroutine);
+  REGISTER_TEST(shared_stack_switching, coroutine);
+  REGISTER_TEST(stack_profile_autosize, coroutine);
 }
 
 ENABLE_TEST_GROUP(coroutine)
@@ -0,0 +1,575 @@
+// Chiba Coroutine Stack Pool
+// Reusable coroutine stacks so that spawning a coroutine does not cost a
+// malloc/free round trip:
+// - stacks are grouped in power-of-two size classes
+//   (CHIBA_CO_MINSTACKSIZE .. API_MAX_STACK_USAGE)
+// - every thread keeps its own LIFO free list per size class (no locking)
+// - a stack released on a foreign thread (migrated coroutine) is pushed onto
+//   the owning thread's lock-free inbox and reclaimed on its next miss
+// - on POSIX stacks are mmap'd: address space is reserved up front, pages are
+//   faulted in on demand, a PROT_NONE guard page sits below the stack, and
+//   stacks idle in the pool for a whole purge period are madvise'd away, on
+//   pool traffic or from the owning thread's idle loop (chiba_co_stack_pool_tick)
+// - optional profiling fills spawned stacks with a canary, measures how deep
+//   each coroutine went when its stack comes back, and keeps the peak per
+//   entry function so later spawns of that entry can use a smaller stack;
+//   peaks only size spawns while profiling or autosizing is on
+
+#pragma once
+#include "../../basic_memory.h"
+#include <stdint.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) &&                           \
+    !defined(CHIBA_CO_STACK_NOMMAP)
+#define CHIBA_CO_STACK_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+#if defined(MADV_FREE)
+#define CHIBA_CO_STACK_MADV MADV_FREE
+#else
+#define CHIBA_CO_STACK_MADV MADV_DONTNEED
+#endif
+#endif
+
+#define CHIBA_CO_STACK_NCLASSES 7 // 16K, 32K, 64K, 128K, 256K, 512K, 1M
+#define CHIBA_CO_STACK_HDRSIZE 64
+
+typedef struct chiba_co_stack_cache chiba_co_stack_cache;
+
+// Bookkeeping stored right above the usable stack area. Stacks grow
+// downwards, so an overflow runs away from the header.
+typedef struct chiba_co_stack_hdr {
+  struct chiba_co_stack_hdr *next; // free list / inbox link
+  chiba_co_stack_cache *home;      // owning thread cache, NULL if unpooled
+  void (*defer)(anyptr stack, u64 stack_size, anyptr ctx); // user defer
+  u64 size;                                                // usable size
+  i32 klass; // size class, -1 if unpooled
+  bool dirty; // touched since it was last purged
+  anyptr profile; // profile key if canary filled, else NULL
+} chiba_co_stack_hdr;
+
+_Static_assert(sizeof(chiba_co_stack_hdr) <= CHIBA_CO_STACK_HDRSIZE,
+               "stack header does not fit in CHIBA_CO_STACK_HDRSIZE");
+
+// Per-thread stack cache
+typedef struct chiba_co_stack_cache {
+  chiba_co_stack_hdr *free[CHIBA_CO_STACK_NCLASSES];
+  u32 nfree[CHIBA_CO_STACK_NCLASSES];
+  // lowest nfree seen during the current purge period: that many stacks at
+  // the cold end of the free list have not been used for the whole period
+  u32 lowwater[CHIBA_CO_STACK_NCLASSES];
+  u64 purge_at; // next purge deadline (ns)
+  u32 ops;      // pool operations since the clock was last read
+  u32 ndirty;   // free stacks touched since they were last purged
+  // stacks returned by other threads
+  _Atomic(chiba_co_stack_hdr *) inbox;
+  // outstanding stacks + 1 for the owning thread
+  _Atomic(i64) refs;
+} chiba_co_stack_cache;
+
+// Inbox value once the owning thread has exited
+#define CHIBA_CO_STACK_INBOX_CLOSED ((chiba_co_stack_hdr *)1)
+
+PRIVATE THREAD_LOCAL chiba_co_stack_cache *chiba_co_stack_tls = NULL;
+PRIVATE pthread_key_t chiba_co_stack_key;
+PRIVATE pthread_once_t chiba_co_stack_key_once = PTHREAD_ONCE_INIT;
+
+UTILS chiba_co_stack_hdr *chiba_co_stack_hdr_of(anyptr stack, u64 stack_size) {
+  return (chiba_co_stack_hdr *)((i8 *)stack + stack_size);
+}
+
+UTILS anyptr chiba_co_stack_of(chiba_co_stack_hdr *hdr) {
+  return (i8 *)hdr - hdr->size;
+}
+
+// Size class for a requested size, -1 if it is too large to be pooled
+UTILS i32 chiba_co_stack_class(u64 size) {
+  u64 csize = CHIBA_CO_MINSTACKSIZE;
+  for (i32 k = 0; k < CHIBA_CO_STACK_NCLASSES; k++, csize <<= 1) {
+    if (size <= csize)
+      return k;
+  }
+  return -1;
+}
+
+UTILS u64 chiba_co_stack_class_size(i32 klass) {
+  return (u64)CHIBA_CO_MINSTACKSIZE << klass;
+}
+
+// Number of idle stacks a thread keeps per size class
+UTILS u32 chiba_co_stack_class_cap(i32 klass) {
+  u64 cap = CHIBA_CO_STACK_POOL_BYTES / chiba_co_stack_class_size(klass);
+  return cap < 4 ? 4 : (u32)cap;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stack blocks
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(CHIBA_CO_STACK_MMAP)
+UTILS u64 chiba_co_stack_page_size(void) {
+  static u64 page = 0;
+  if (unlikely(!page)) {
+    long n = sysconf(_SC_PAGESIZE);
+    page = n > 0 ? (u64)n : 4096;
+  }
+  return page;
+}
+
+// Mapping layout, low to high:
+//   [guard page][slack | usable stack | header]
+// The header shares the top page with the entry frame, so an idle stack
+// costs a single resident page.
+PRIVATE i8 *chiba_co_stack_block_alloc(u64 size) {
+  u64 page = chiba_co_stack_page_size();
+  u64 len = page + size + page;
+  i8 *base = (i8 *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (unlikely(base == (i8 *)MAP_FAILED))
+    return NULL;
+  if (unlikely(mprotect(base, page, PROT_NONE) != 0)) {
+    munmap(base, len);
+    return NULL;
+  }
+  return base + len - CHIBA_CO_STACK_HDRSIZE - size;
+}
+
+PRIVATE void chiba_co_stack_block_free(anyptr stack, u64 size) {
+  u64 page = chiba_co_stack_page_size();
+  i8 *end = (i8 *)stack + size + CHIBA_CO_STACK_HDRSIZE;
+  u64 len = page + size + page;
+  munmap(end - len, len);
+}
+
+// Hand the pages of an idle stack back to the kernel, keeping the top page
+// with the header. Returns the number of bytes advised.
+PRIVATE u64 chiba_co_stack_block_purge(chiba_co_stack_hdr *hdr) {
+  if (!hdr->dirty)
+    return 0;
+  hdr->dirty = false;
+  u64 page = chiba_co_stack_page_size();
+  if (hdr->size <= page)
+    return 0;
+  i8 *start = (i8 *)chiba_co_stack_of(hdr) + CHIBA_CO_STACK_HDRSIZE;
+  u64 len = hdr->size - page;
+  if (madvise(start, len, CHIBA_CO_STACK_MADV) != 0)
+    return 0;
+  return len;
+}
+#else
+PRIVATE i8 *chiba_co_stack_block_alloc(u64 size) {
+  return (i8 *)CHIBA_INTERNAL_malloc_aligned(CHIBA_CO_STACK_HDRSIZE,
+                                             size + CHIBA_CO_STACK_HDRSIZE);
+}
+
+PRIVATE void chiba_co_stack_block_free(anyptr stack, u64 size) {
+  (void)size;
+  CHIBA_INTERNAL_free(stack);
+}
+
+PRIVATE u64 chiba_co_stack_block_purge(chiba_co_stack_hdr *hdr) {
+  hdr->dirty = false;
+  return 0;
+}
+#endif
+
+PRIVATE chiba_co_stack_hdr *chiba_co_stack_block_new(u64 size, i32 klass,
+                                                     chiba_co_stack_cache *home) {
+  i8 *block = chiba_co_stack_block_alloc(size);
+  if (unlikely(!block))
+    return NULL;
+  chiba_co_stack_hdr *hdr = (chiba_co_stack_hdr *)(block + size);
+  hdr->next = NULL;
+  hdr->home = home;
+  hdr->defer = NULL;
+  hdr->size = size;
+  hdr->klass = klass;
+  hdr->dirty = false;
+  if (home)
+    atomic_fetch_add_explicit(&home->refs, 1, memory_order_relaxed);
+  return hdr;
+}
+
+PRIVATE void chiba_co_stack_cache_unref(chiba_co_stack_cache *cache) {
+  if (atomic_fetch_sub_explicit(&cache->refs, 1, memory_order_acq_rel) == 1)
+    CHIBA_INTERNAL_free(cache);
+}
+
+PRIVATE void chiba_co_stack_block_drop(chiba_co_stack_hdr *hdr) {
+  chiba_co_stack_cache *home = hdr->home;
+  chiba_co_stack_block_free(chiba_co_stack_of(hdr), hdr->size);
+  if (home)
+    chiba_co_stack_cache_unref(home);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Per-thread caches
+////////////////////////////////////////////////////////////////////////////////
+
+// Purge the `count` coldest stacks of a size class
+PRIVATE u64 chiba_co_stack_cache_purge_class(chiba_co_stack_cache *cache,
+                                             i32 k, u32 count) {
+  u64 bytes = 0;
+  u32 skip = cache->nfree[k] > count ? cache->nfree[k] - count : 0;
+  chiba_co_stack_hdr *hdr = cache->free[k];
+  for (; hdr && skip; skip--)
+    hdr = hdr->next;
+  for (; hdr; hdr = hdr->next) {
+    if (hdr->dirty)
+      cache->ndirty--;
+    bytes += chiba_co_stack_block_purge(hdr);
+  }
+  return bytes;
+}
+
+// Once per purge period, purge the stacks that sat unused in the pool for the
+// whole period
+PRIVATE void chiba_co_stack_cache_purge_due(chiba_co_stack_cache *cache,
+                                            u64 now) {
+  if (now < cache->purge_at)
+    return;
+  for (i32 k = 0; k < CHIBA_CO_STACK_NCLASSES; k++) {
+    if (cache->lowwater[k])
+      chiba_co_stack_cache_purge_class(cache, k, cache->lowwater[k]);
+    cache->lowwater[k] = cache->nfree[k];
+  }
+  cache->purge_at = now + CHIBA_CO_STACK_PURGE_NS;
+}
+
+// Pool traffic: reading the clock is amortized over a batch of operations
+PRIVATE void chiba_co_stack_cache_tick(chiba_co_stack_cache *cache) {
+  if (likely(++cache->ops & 63))
+    return;
+  chiba_co_stack_cache_purge_due(cache, get_time_in_nanoseconds());
+}
+
+// Keep a stack in the local free list, or drop it if the class is full
+PRIVATE void chiba_co_stack_cache_put(chiba_co_stack_cache *cache,
+                                      chiba_co_stack_hdr *hdr) {
+  i32 k = hdr->klass;
+  if (cache->nfree[k] >= chiba_co_stack_class_cap(k)) {
+    chiba_co_stack_block_drop(hdr);
+    return;
+  }
+  hdr->next = cache->free[k];
+  cache->free[k] = hdr;
+  cache->nfree[k]++;
+  if (hdr->dirty)
+    cache->ndirty++;
+  chiba_co_stack_cache_tick(cache);
+}
+
+// Move every stack returned by other threads into the local free lists
+PRIVATE void chiba_co_stack_cache_drain(chiba_co_stack_cache *cache) {
+  if (!atomic_load_explicit(&cache->inbox, memory_order_relaxed))
+    return;
+  chiba_co_stack_hdr *hdr =
+      atomic_exchange_explicit(&cache->inbox, NULL, memory_order_acquire);
+  while (hdr) {
+    chiba_co_stack_hdr *next = hdr->next;
+    chiba_co_stack_cache_put(cache, hdr);
+    hdr = next;
+  }
+}
+
+PRIVATE void chiba_co_stack_cache_clear(chiba_co_stack_cache *cache) {
+  for (i32 k = 0; k < CHIBA_CO_STACK_NCLASSES; k++) {
+    chiba_co_stack_hdr *hdr = cache->free[k];
+    while (hdr) {
+      chiba_co_stack_hdr *next = hdr->next;
+      chiba_co_stack_block_drop(hdr);
+      hdr = next;
+    }
+    cache->free[k] = NULL;
+    cache->nfree[k] = 0;
+    cache->lowwater[k] = 0;
+  }
+  cache->ndirty = 0;
+}
+
+// Thread exit: close the inbox so late returns are freed by the releasing
+// thread, then drop everything the thread still caches.
+PRIVATE void chiba_co_stack_cache_exit(anyptr arg) {
+  chiba_co_stack_cache *cache = (chiba_co_stack_cache *)arg;
+  chiba_co_stack_hdr *hdr = atomic_exchange_explicit(
+      &cache->inbox, CHIBA_CO_STACK_INBOX_CLOSED, memory_order_acquire);
+  while (hdr) {
+    chiba_co_stack_hdr *next = hdr->next;
+    chiba_co_stack_block_drop(hdr);
+    hdr = next;
+  }
+  chiba_co_stack_cache_clear(cache);
+  chiba_co_stack_tls = NULL;
+  chiba_co_stack_cache_unref(cache);
+}
+
+PRIVATE void chiba_co_stack_key_init(void) {
+  pthread_key_create(&chiba_co_stack_key, chiba_co_stack_cache_exit);
+}
+
+UTILS chiba_co_stack_cache *chiba_co_stack_cache_get(void) {
+  if (likely(chiba_co_stack_tls))
+    return chiba_co_stack_tls;
+  chiba_co_stack_cache *cache = (chiba_co_stack_cache *)CHIBA_INTERNAL_malloc(
+      sizeof(chiba_co_stack_cache));
+  if (unlikely(!cache))
+    CHIBA_PANIC("Could not allocate coroutine stack cache");
+  memset(cache, 0, sizeof(chiba_co_stack_cache));
+  atomic_init(&cache->inbox, NULL);
+  atomic_init(&cache->refs, 1);
+  cache->purge_at = get_time_in_nanoseconds() + CHIBA_CO_STACK_PURGE_NS;
+  pthread_once(&chiba_co_stack_key_once, chiba_co_stack_key_init);
+  pthread_setspecific(chiba_co_stack_key, cache);
+  chiba_co_stack_tls = cache;
+  return cache;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Stack profiles
+////////////////////////////////////////////////////////////////////////////////
+// Global lock-free table of the deepest stack use seen per entry function.
+// Slots are claimed once and never removed; samples are dropped when full.
+
+#define CHIBA_CO_STACK_CANARY 0xC5C5C5C5C5C5C5C5ULL
+
+typedef struct chiba_co_stack_profile_slot {
+  _Atomic(anyptr) key;
+  _Atomic(u64) peak;
+} chiba_co_stack_profile_slot;
+
+PRIVATE chiba_co_stack_profile_slot
+    chiba_co_stack_profiles[CHIBA_CO_STACK_PROFILE_SLOTS];
+PRIVATE _Atomic(bool) chiba_co_stack_profiling = false;
+PRIVATE _Atomic(bool) chiba_co_stack_autosizing = false;
+
+_Static_assert((CHIBA_CO_STACK_PROFILE_SLOTS &
+                (CHIBA_CO_STACK_PROFILE_SLOTS - 1)) == 0,
+               "CHIBA_CO_STACK_PROFILE_SLOTS must be a power of two");
+
+// Find the slot of `key`, claiming a free one if `insert` is set
+PRIVATE chiba_co_stack_profile_slot *chiba_co_stack_profile_slot_of(anyptr key,
+                                                                    bool insert) {
+  u64 mask = CHIBA_CO_STACK_PROFILE_SLOTS - 1;
+  u64 i = CHIBA_HASH_mix13((u64)key) & mask;
+  for (u64 n = 0; n <= mask; n++, i = (i + 1) & mask) {
+    chiba_co_stack_profile_slot *slot = &chiba_co_stack_profiles[i];
+    anyptr cur = atomic_load_explicit(&slot->key, memory_order_acquire);
+    if (cur == key)
+      return slot;
+    if (cur)
+      continue;
+    if (!insert)
+      return NULL;
+    if (atomic_compare_exchange_strong_explicit(&slot->key, &cur, key,
+                                                memory_order_acq_rel,
+                                                memory_order_acquire) ||
+        cur == key)
+      return slot;
+  }
+  return NULL;
+}
+
+// Fill a stack with the canary before the coroutine starts on it
+PRIVATE void chiba_co_stack_profile_arm(chiba_co_stack_hdr *hdr, anyptr key) {
+  u64 *word = (u64 *)chiba_co_stack_of(hdr);
+  u64 n = hdr->size / sizeof(u64);
+  for (u64 i = 0; i < n; i++)
+    word[i] = CHIBA_CO_STACK_CANARY;
+  hdr->profile = key;
+}
+
+// Measure how far the canary was overwritten and fold it into the profile
+PRIVATE void chiba_co_stack_profile_record(chiba_co_stack_hdr *hdr) {
+  u64 *word = (u64 *)chiba_co_stack_of(hdr);
+  u64 n = hdr->size / sizeof(u64);
+  u64 i = 0;
+  while (i < n && word[i] == CHIBA_CO_STACK_CANARY)
+    i++;
+  u64 used = hdr->size - i * sizeof(u64);
+  chiba_co_stack_profile_slot *slot =
+      chiba_co_stack_profile_slot_of(hdr->profile, true);
+  hdr->profile = NULL;
+  if (!slot)
+    return;
+  u64 peak = atomic_load_explicit(&slot->peak, memory_order_relaxed);
+  while (used > peak &&
+         !atomic_compare_exchange_weak_explicit(&slot->peak, &peak, used,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+    ;
+}
+
+// Stack size to use for `key`, or 0 if it was never profiled or learned sizes
+// are not in use
+PRIVATE u64 chiba_co_stack_profile_size(anyptr key) {
+  if (!atomic_load_explicit(&chiba_co_stack_profiling, memory_order_relaxed) &&
+      !atomic_load_explicit(&chiba_co_stack_autosizing, memory_order_relaxed))
+    return 0;
+  chiba_co_stack_profile_slot *slot = chiba_co_stack_profile_slot_of(key, false);
+  if (!slot)
+    return 0;
+  u64 peak = atomic_load_explicit(&slot->peak, memory_order_relaxed);
+  if (!peak)
+    return 0;
+  u64 size = peak + peak / 4 + CHIBA_CO_STACK_HEADROOM;
+  if (size < CHIBA_CO_STACK_PROFILE_FLOOR)
+    size = CHIBA_CO_STACK_PROFILE_FLOOR;
+  if (size < CHIBA_CO_MINSTACKSIZE)
+    size = CHIBA_CO_MINSTACKSIZE;
+  return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public API Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+// Take a stack of at least `size` bytes from the calling thread's pool
+PUBLIC anyptr chiba_co_stack_acquire(u64 size, u64 *size_out) {
+  if (size == 0)
+    size = CHIBA_CO_DEFAULT_STACKSIZE;
+  if (size < CHIBA_CO_MINSTACKSIZE)
+    size = CHIBA_CO_MINSTACKSIZE;
+  i32 k = chiba_co_stack_class(size);
+  chiba_co_stack_hdr *hdr = NULL;
+  if (unlikely(k < 0)) {
+    // Too large to be worth caching
+#if defined(CHIBA_CO_STACK_MMAP)
+    u64 page = chiba_co_stack_page_size();
+    hdr = chiba_co_stack_block_new((size + page - 1) & ~(page - 1), -1, NULL);
+#else
+    hdr = chiba_co_stack_block_new((size + 63) & ~(u64)63, -1, NULL);
+#endif
+  } else {
+    chiba_co_stack_cache *cache = chiba_co_stack_cache_get();
+    if (!cache->free[k])
+      chiba_co_stack_cache_drain(cache);
+    hdr = cache->free[k];
+    if (hdr) {
+      cache->free[k] = hdr->next;
+      if (hdr->dirty)
+        cache->ndirty--;
+      if (--cache->nfree[k] < cache->lowwater[k])
+        cache->lowwater[k] = cache->nfree[k];
+      chiba_co_stack_cache_tick(cache);
+    } else {
+      hdr = chiba_co_stack_block_new(chiba_co_stack_class_size(k), k, cache);
+    }
+  }
+  if (unlikely(!hdr))
+    CHIBA_PANIC("Could not allocate coroutine stack of %llu bytes",
+                (unsigned long long)size);
+  hdr->next = NULL;
+  hdr->defer = NULL;
+  hdr->dirty = true;
+  hdr->profile = NULL;
+  if (size_out)
+    *size_out = hdr->size;
+  return chiba_co_stack_of(hdr);
+}
+
+// Give a stack back to the pool it was acquired from
+PUBLIC void chiba_co_stack_release(anyptr stack, u64 stack_size) {
+  if (unlikely(!stack))
+    return;
+  chiba_co_stack_hdr *hdr = chiba_co_stack_hdr_of(stack, stack_size);
+  if (unlikely(hdr->profile))
+    chiba_co_stack_profile_record(hdr);
+  chiba_co_stack_cache *home = hdr->home;
+  if (unlikely(!home)) {
+    chiba_co_stack_block_drop(hdr);
+    return;
+  }
+  if (likely(home == chiba_co_stack_tls)) {
+    chiba_co_stack_cache_put(home, hdr);
+    return;
+  }
+  // Cross-thread return path
+  chiba_co_stack_hdr *head =
+      atomic_load_explicit(&home->inbox, memory_order_relaxed);
+  do {
+    if (head == CHIBA_CO_STACK_INBOX_CLOSED) {
+      chiba_co_stack_block_drop(hdr);
+      return;
+    }
+    hdr->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(
+      &home->inbox, &head, hdr, memory_order_release, memory_order_relaxed));
+}
+
+// Defer handler for pooled stacks: runs the user defer, then releases
+PUBLIC void chiba_co_stack_defer(anyptr stack, u64 stack_size, anyptr ctx) {
+  chiba_co_stack_hdr *hdr = chiba_co_stack_hdr_of(stack, stack_size);
+  if (hdr->defer)
+    hdr->defer(stack, stack_size, ctx);
+  chiba_co_stack_release(stack, stack_size);
+}
+
+// Free every idle stack cached by the calling thread
+PUBLIC void chiba_co_stack_pool_trim(void) {
+  chiba_co_stack_cache *cache = chiba_co_stack_tls;
+  if (!cache)
+    return;
+  chiba_co_stack_cache_drain(cache);
+  chiba_co_stack_cache_clear(cache);
+}
+
+// Return the memory of every idle stack cached by the calling thread to the
+// kernel while keeping the address space reserved for reuse. Returns the
+// number of bytes advised (0 where stacks are not mmap'd).
+PUBLIC u64 chiba_co_stack_pool_purge(void) {
+  chiba_co_stack_cache *cache = chiba_co_stack_tls;
+  if (!cache)
+    return 0;
+  chiba_co_stack_cache_drain(cache);
+  u64 bytes = 0;
+  for (i32 k = 0; k < CHIBA_CO_STACK_NCLASSES; k++) {
+    bytes += chiba_co_stack_cache_purge_class(cache, k, cache->nfree[k]);
+    cache->lowwater[k] = cache->nfree[k];
+  }
+  return bytes;
+}
+
+// Run the periodic purge of the calling thread's pool without waiting for pool
+// traffic, for threads about to go idle. Returns when it is next due (ns), or
+// UINT64_MAX once no idle stack holds memory.
+PUBLIC u64 chiba_co_stack_pool_tick(void) {
+  chiba_co_stack_cache *cache = chiba_co_stack_tls;
+  if (!cache)
+    return UINT64_MAX;
+  chiba_co_stack_cache_drain(cache);
+  chiba_co_stack_cache_purge_due(cache, get_time_in_nanoseconds());
+  return cache->ndirty ? cache->purge_at : UINT64_MAX;
+}
+
+// Turn canary profiling of spawned stacks on or off
+PUBLIC void chiba_co_stack_profile_enable(bool on) {
+  atomic_store_explicit(&chiba_co_stack_profiling, on, memory_order_relaxed);
+}
+
+// Keep using recorded peaks to size spawns while profiling is off
+PUBLIC void chiba_co_stack_profile_autosize(bool on) {
+  atomic_store_explicit(&chiba_co_stack_autosizing, on, memory_order_relaxed);
+}
+
+// Deepest stack use recorded for `entry` in bytes, 0 if unknown
+PUBLIC u64 chiba_co_stack_profile_peak(anyptr entry) {
+  chiba_co_stack_profile_slot *slot =
+      chiba_co_stack_profile_slot_of(entry, false);
+  return slot ? atomic_load_explicit(&slot->peak, memory_order_relaxed) : 0;
+}
+
+// Forget every recorded peak. Must not race with profiled spawns.
+PUBLIC void chiba_co_stack_profile_reset(void) {
+  for (u64 i = 0; i < CHIBA_CO_STACK_PROFILE_SLOTS; i++) {
+    atomic_store_explicit(&chiba_co_stack_profiles[i].peak, 0,
+                          memory_order_relaxed);
+    atomic_store_explicit(&chiba_co_stack_profiles[i].key, NULL,
+                          memory_order_release);
+  }
+}
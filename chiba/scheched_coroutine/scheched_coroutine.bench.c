@@ -1,6 +1,10 @@
 #include "scheched_coroutine.h"
 #include "../basic_memory.h"
+#include "../concurrency/aatree.h"
+#include "../concurrency/array_queue.h"
+#include "../utils/idmap.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,6 +15,11 @@
 // -----------------------------------------------
 #define STKSZ 32768
 #define SWITCH_TARGET 1000000LL // 总切换次数
+#define SPAWN_TARGET 200000LL   // 短命协程数量
+#define PARK_OPS 1000000LL      // 每种规模的 resume+pause 次数
+#define MIG_MAX_THREADS 8       // 迁移测试的最大线程数
+#define MIG_COROS 16            // 每个线程的迁移协程数
+#define MIG_HOPS 2000           // 每个协程的迁移次数
 
 typedef struct {
   double elapsed_us;    // 总耗时 (microseconds)
@@ -188,6 +197,269 @@ static BenchResult bench_pthread_pingpong(void) {
   return r;
 }
 
+// -----------------------------------------------
+// Spawn churn: short coroutines, malloc'd vs pooled stacks
+// -----------------------------------------------
+static long long churn_done = 0;
+
+static void co_churn(anyptr u) {
+  (void)u;
+  churn_done++;
+}
+
+static BenchResult bench_spawn_churn(bool pooled) {
+  churn_done = 0;
+  u64 start_ns = now_ns();
+  for (long long i = 0; i < SPAWN_TARGET; ++i) {
+    chiba_sco_desc d = {0};
+    d.stack_size = STKSZ;
+    d.entry = co_churn;
+    if (pooled) {
+      chiba_sco_spawn(&d);
+    } else {
+      d.stack = CHIBA_INTERNAL_malloc(STKSZ);
+      d.defer = co_free_stack;
+      chiba_sco_start(&d);
+    }
+  }
+  while (chiba_sco_active()) {
+    chiba_sco_resume(0);
+  }
+  u64 end_ns = now_ns();
+
+  double elapsed_us = (double)(end_ns - start_ns) / 1000.0;
+  BenchResult r;
+  r.elapsed_us = elapsed_us;
+  r.throughput_ms = (churn_done) / (elapsed_us / 1000.0); // spawns/ms
+  r.per_switch_us = elapsed_us / churn_done;
+  return r;
+}
+
+// -----------------------------------------------
+// Parked coroutines: resume a random paused coroutine, which pauses again
+// -----------------------------------------------
+static chiba_sco_id_t *park_ids = NULL;
+static long long park_n = 0;
+static bool park_stop = false;
+
+static inline u64 park_rand(u64 *x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 7;
+  *x ^= *x << 17;
+  return *x;
+}
+
+static void co_parked(anyptr u) {
+  (void)u;
+  park_ids[park_n++] = chiba_sco_id();
+  while (!park_stop)
+    chiba_sco_pause();
+}
+
+static BenchResult bench_park(long long parked) {
+  park_ids = CHIBA_INTERNAL_malloc(sizeof(chiba_sco_id_t) * parked);
+  park_n = 0;
+  park_stop = false;
+  for (long long i = 0; i < parked; i++) {
+    chiba_sco_desc d = {0};
+    d.stack_size = CHIBA_CO_MINSTACKSIZE;
+    d.entry = co_parked;
+    chiba_sco_spawn(&d);
+  }
+  while (park_n < parked)
+    chiba_sco_resume(0);
+
+  u64 x = 0x9E3779B97F4A7C15ULL;
+  u64 start_ns = now_ns();
+  for (long long i = 0; i < PARK_OPS; i++) {
+    chiba_sco_resume(park_ids[park_rand(&x) % (u64)parked]);
+    chiba_sco_resume(0);
+  }
+  u64 end_ns = now_ns();
+
+  park_stop = true;
+  for (long long i = 0; i < parked; i++)
+    chiba_sco_resume(park_ids[i]);
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  CHIBA_INTERNAL_free(park_ids);
+
+  double elapsed_us = (double)(end_ns - start_ns) / 1000.0;
+  BenchResult r;
+  r.elapsed_us = elapsed_us;
+  r.throughput_ms = PARK_OPS / (elapsed_us / 1000.0); // resumes/ms
+  r.per_switch_us = elapsed_us / PARK_OPS;
+  return r;
+}
+
+// -----------------------------------------------
+// Paused-set maps alone: the former 512-shard AA-tree map vs chiba_idmap.
+// Each op is a resume (delete) followed by a pause (insert) of a random id.
+// -----------------------------------------------
+typedef struct park_node {
+  AAT_FIELDS(struct park_node, left, right, level)
+  i64 id;
+} park_node;
+
+static inline i32 park_node_compare(park_node *a, park_node *b) {
+  return a->id < b->id ? -1 : a->id > b->id;
+}
+
+AAT_DEF(static inline, park_aat, park_node)
+AAT_IMPL(park_aat, park_node, left, right, level, park_node_compare)
+
+#define park_shard(roots, id)                                                  \
+  (&(roots)[CHIBA_HASH_mix13(id) & (CHIBA_SCO_NSHARDS - 1)])
+
+static BenchResult bench_map(long long parked, bool flat) {
+  park_node *nodes = CHIBA_INTERNAL_malloc(sizeof(park_node) * parked);
+  park_node **roots = CHIBA_INTERNAL_malloc(sizeof(park_node *) *
+                                            CHIBA_SCO_NSHARDS);
+  memset(roots, 0, sizeof(park_node *) * CHIBA_SCO_NSHARDS);
+  chiba_idmap map = {0};
+  for (long long i = 0; i < parked; i++) {
+    nodes[i].id = i + 1;
+    if (flat)
+      chiba_idmap_insert(&map, i + 1, &nodes[i]);
+    else
+      park_aat_insert(park_shard(roots, i + 1), &nodes[i]);
+  }
+
+  u64 x = 0x9E3779B97F4A7C15ULL;
+  long long missing = 0;
+  u64 start_ns = now_ns();
+  for (long long i = 0; i < PARK_OPS; i++) {
+    i64 id = (i64)(park_rand(&x) % (u64)parked) + 1;
+    park_node *n;
+    if (flat) {
+      n = chiba_idmap_delete(&map, id);
+      if (n)
+        chiba_idmap_insert(&map, id, n);
+    } else {
+      park_node key = {.id = id};
+      n = park_aat_delete(park_shard(roots, id), &key);
+      if (n)
+        park_aat_insert(park_shard(roots, id), n);
+    }
+    missing += !n;
+  }
+  u64 end_ns = now_ns();
+  if (missing)
+    printf("  (%lld lookups missed)\n", missing);
+
+  chiba_idmap_free(&map);
+  CHIBA_INTERNAL_free(roots);
+  CHIBA_INTERNAL_free(nodes);
+
+  double elapsed_us = (double)(end_ns - start_ns) / 1000.0;
+  BenchResult r;
+  r.elapsed_us = elapsed_us;
+  r.throughput_ms = PARK_OPS / (elapsed_us / 1000.0); // ops/ms
+  r.per_switch_us = elapsed_us / PARK_OPS;
+  return r;
+}
+
+// -----------------------------------------------
+// Migration ring: N threads hand paused coroutines around a ring. Each hop is
+// pause, detach, push the id to the next thread's inbox, attach, resume.
+// The locked run wraps detach/attach in one global spin-CAS, like the former
+// registry lock, to measure what it cost under contention.
+// -----------------------------------------------
+static chiba_arrayqueue *mig_inbox[MIG_MAX_THREADS];
+static int mig_nthreads = 0;
+static bool mig_locked = false;
+static atomic_bool mig_locker = false;
+static atomic_llong mig_alive = 0;
+static atomic_int mig_ready = 0;
+static THREAD_LOCAL chiba_sco_id_t mig_out[MIG_MAX_THREADS * MIG_COROS];
+static THREAD_LOCAL int mig_nout = 0;
+
+static inline void mig_lock(void) {
+  bool expected = false;
+  while (!atomic_compare_exchange_weak(&mig_locker, &expected, true))
+    expected = false;
+}
+
+static inline void mig_unlock(void) { atomic_store(&mig_locker, false); }
+
+static void co_migrant(anyptr u) {
+  (void)u;
+  for (int i = 0; i < MIG_HOPS; i++) {
+    mig_out[mig_nout++] = chiba_sco_id();
+    chiba_sco_pause();
+  }
+  atomic_fetch_sub(&mig_alive, 1);
+}
+
+static void *mig_thread(void *arg) {
+  int me = (int)(intptr_t)arg;
+  chiba_arrayqueue *next = mig_inbox[(me + 1) % mig_nthreads];
+  for (int i = 0; i < MIG_COROS; i++) {
+    chiba_sco_desc d = {0};
+    d.stack_size = CHIBA_CO_MINSTACKSIZE;
+    d.entry = co_migrant;
+    chiba_sco_spawn(&d);
+  }
+  atomic_fetch_add(&mig_ready, 1);
+  while (atomic_load(&mig_ready) < mig_nthreads)
+    sched_yield();
+  while (atomic_load_explicit(&mig_alive, memory_order_relaxed) > 0 ||
+         chiba_sco_active()) {
+    anyptr id;
+    int got = 0;
+    while ((id = chiba_arrayqueue_pop(mig_inbox[me]))) {
+      got++;
+      if (mig_locked)
+        mig_lock();
+      chiba_sco_attach((chiba_sco_id_t)id);
+      if (mig_locked)
+        mig_unlock();
+      chiba_sco_resume((chiba_sco_id_t)id);
+    }
+    chiba_sco_resume(0);
+    for (int i = 0; i < mig_nout; i++) {
+      if (mig_locked)
+        mig_lock();
+      chiba_sco_detach(mig_out[i]);
+      if (mig_locked)
+        mig_unlock();
+      while (!chiba_arrayqueue_push(next, (anyptr)mig_out[i]))
+        ;
+    }
+    mig_nout = 0;
+    if (!got)
+      sched_yield();
+  }
+  return NULL;
+}
+
+static BenchResult bench_migrate(int nthreads, bool locked) {
+  mig_nthreads = nthreads;
+  mig_locked = locked;
+  atomic_store(&mig_alive, (long long)nthreads * MIG_COROS);
+  atomic_store(&mig_ready, 0);
+  for (int i = 0; i < nthreads; i++)
+    mig_inbox[i] = chiba_arrayqueue_new(MIG_MAX_THREADS * MIG_COROS);
+
+  pthread_t th[MIG_MAX_THREADS];
+  u64 start_ns = now_ns();
+  for (int i = 0; i < nthreads; i++)
+    pthread_create(&th[i], NULL, mig_thread, (void *)(intptr_t)i);
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(th[i], NULL);
+  u64 end_ns = now_ns();
+  for (int i = 0; i < nthreads; i++)
+    chiba_arrayqueue_drop(mig_inbox[i]);
+
+  long long hops = (long long)nthreads * MIG_COROS * MIG_HOPS;
+  double elapsed_us = (double)(end_ns - start_ns) / 1000.0;
+  BenchResult r;
+  r.elapsed_us = elapsed_us;
+  r.throughput_ms = hops / (elapsed_us / 1000.0); // hops/ms
+  r.per_switch_us = elapsed_us / hops;
+  return r;
+}
+
 // -----------------------------------------------
 // Main
 // -----------------------------------------------
@@ -216,6 +488,63 @@ int main(void) {
   printf("  Throughput: %.2f switches/ms\n", pt.throughput_ms);
   printf("  Avg switch: %.4f us\n\n", pt.per_switch_us);
 
+  // Benchmark 3: spawn churn
+  printf("========================================\n");
+  printf("Benchmark 3: spawn churn (%lld coroutines)\n",
+         (long long)SPAWN_TARGET);
+  printf("========================================\n");
+  BenchResult sm = bench_spawn_churn(false);
+  printf("  malloc stacks: %.2f us (%.2f spawns/ms, %.4f us/spawn)\n",
+         sm.elapsed_us, sm.throughput_ms, sm.per_switch_us);
+  BenchResult sp = bench_spawn_churn(true);
+  printf("  pooled stacks: %.2f us (%.2f spawns/ms, %.4f us/spawn)\n\n",
+         sp.elapsed_us, sp.throughput_ms, sp.per_switch_us);
+
+  // Benchmark 4: resume latency with parked coroutines
+  // 1M live coroutines would need 1M stacks, so that size is only measured
+  // on the paused map itself (Benchmark 5).
+  printf("========================================\n");
+  printf("Benchmark 4: resume+pause with N paused coroutines\n");
+  printf("========================================\n");
+  long long park_sizes[] = {10LL, 10000LL};
+  for (int i = 0; i < 2; i++) {
+    BenchResult pk = bench_park(park_sizes[i]);
+    printf("  N=%-8lld %.2f us (%.2f resumes/ms, %.4f us/resume)\n",
+           park_sizes[i], pk.elapsed_us, pk.throughput_ms, pk.per_switch_us);
+  }
+  printf("\n");
+
+  // Benchmark 5: paused map alone
+  printf("========================================\n");
+  printf("Benchmark 5: paused map delete+insert, AA-tree shards vs idmap\n");
+  printf("========================================\n");
+  long long map_sizes[] = {10LL, 10000LL, 1000000LL};
+  double map_factor[3];
+  for (int i = 0; i < 3; i++) {
+    BenchResult aa = bench_map(map_sizes[i], false);
+    BenchResult fl = bench_map(map_sizes[i], true);
+    map_factor[i] = aa.elapsed_us / fl.elapsed_us;
+    printf("  N=%-8lld aatree: %.4f us/op   idmap: %.4f us/op\n",
+           map_sizes[i], aa.per_switch_us, fl.per_switch_us);
+  }
+  printf("\n");
+
+  // Benchmark 6: migration ring
+  printf("========================================\n");
+  printf("Benchmark 6: migration ring, %d coroutines x %d hops per thread\n",
+         MIG_COROS, MIG_HOPS);
+  printf("========================================\n");
+  int mig_sizes[] = {2, 4, MIG_MAX_THREADS};
+  double lock_factor[3];
+  for (int i = 0; i < 3; i++) {
+    BenchResult lk = bench_migrate(mig_sizes[i], true);
+    BenchResult lf = bench_migrate(mig_sizes[i], false);
+    lock_factor[i] = lk.elapsed_us / lf.elapsed_us;
+    printf("  threads=%d  global lock: %.2f hops/ms   lock-free: %.2f hops/ms\n",
+           mig_sizes[i], lk.throughput_ms, lf.throughput_ms);
+  }
+  printf("\n");
+
   // Summary
   printf("========================================\n");
   printf("Summary\n");
@@ -227,6 +556,14 @@ int main(void) {
 
   double factor = pt.elapsed_us / co.elapsed_us;
   printf("\nSpeed factor (elapsed, >1 => pthread slower): %.2fx\n", factor);
+  printf("Spawn factor (elapsed, >1 => malloc slower): %.2fx\n",
+         sm.elapsed_us / sp.elapsed_us);
+  printf("Map factor   (elapsed, >1 => aatree slower): %.2fx / %.2fx / %.2fx "
+         "(N=10 / 10K / 1M)\n",
+         map_factor[0], map_factor[1], map_factor[2]);
+  printf("Lock factor  (elapsed, >1 => global lock slower): %.2fx / %.2fx / "
+         "%.2fx (threads=2 / 4 / %d)\n",
+         lock_factor[0], lock_factor[1], lock_factor[2], MIG_MAX_THREADS);
   printf("========================================\n");
   return 0;
 }
@@ -1,6 +1,13 @@
+// clock_gettime, used for timed parks, is not part of ISO C; ask for it
+// before any system header is pulled in
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "scheched_coroutine.h"
-#include "../concurrency/aatree.h"
-#include "../utils/backoff.h"
+#include "../basic_memory.h"
+#include <pthread.h>
+#include <stdint.h>
 
 typedef struct chiba_sco_link {
   struct chiba_sco *prev;
@@ -10,51 +17,162 @@ typedef struct chiba_sco_link {
 typedef struct chiba_sco chiba_sco;
 
 typedef struct chiba_sco {
-  union {
-    // Linked list
-    struct {
-      chiba_sco *prev;
-      chiba_sco *next;
-    };
-    // Binary tree (AA-tree)
-    struct {
-      AAT_FIELDS(chiba_sco, left, right, level)
-    };
-  };
-  chiba_sco_id_t id;
+  // Linked list
+  chiba_sco *prev;
+  chiba_sco *next;
+  // Read from any thread to resolve ids, rewritten when the slot is retired
+  _Atomic(chiba_sco_id_t) id;
   void *ctx;
   chiba_co *co;
 } chiba_sco;
 
-UTILS i32 sco_compare(chiba_sco *a, chiba_sco *b) {
-  return a->id < b->id ? -1 : a->id > b->id;
+////////////////////////////////////////////////////////////////////////////////
+// Coroutine slots
+////////////////////////////////////////////////////////////////////////////////
+// Every coroutine lives in a slot of one global slab. Its id is a handle
+// (generation << 32 | index), so resolving an id is an array index plus a
+// generation check, and a slot being reused gets a new generation so stale
+// ids are rejected.
+// - the slab grows in chunks that are never moved or freed, so any thread
+//   can resolve an id without locking
+// - free slots form a lock-free stack with an ABA tag in the head word
+
+enum {
+  CHIBA_SCO_FREE = 0,
+  CHIBA_SCO_LIVE,     // running or scheduled
+  CHIBA_SCO_PAUSED,   // paused on its owner thread
+  CHIBA_SCO_DETACHED, // paused and not owned by any thread
+};
+
+// Per-thread scheduler state that other threads reach through slot owners
+typedef struct chiba_sco_thread {
+  _Atomic(u32) wakeups; // index + 1 of the first slot unparked from elsewhere
+} chiba_sco_thread;
+
+typedef struct chiba_sco_slot {
+  chiba_sco sco;
+  _Atomic(u32) state;
+  _Atomic(u32) next_free; // index + 1 of the next free slot, 0 ends the list
+  _Atomic(chiba_sco_thread *) owner; // thread that may resume the coroutine
+  _Atomic(chiba_sco_id_t) permit;    // id of the last unpark not yet consumed
+  _Atomic(u32) next_wakeup;          // index + 1, links a thread's wakeups
+  _Atomic(bool) queued;              // on some thread's wakeup stack
+  u64 deadline; // chiba_sco_park_until deadline while timed, otherwise 0
+  bool parked;  // paused by a park, so an unpark may schedule it
+} chiba_sco_slot;
+
+#define CHIBA_SCO_GEN_MAX 0x7fffffffU
+
+PRIVATE _Atomic(chiba_sco_slot *) chiba_sco_chunks[CHIBA_SCO_SLOT_CHUNKS];
+PRIVATE _Atomic(u64) chiba_sco_nslots = 0;
+PRIVATE _Atomic(u64) chiba_sco_free_head = 0; // tag << 32 | (index + 1)
+PRIVATE pthread_mutex_t chiba_sco_grow_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The calling thread; its address identifies it
+PRIVATE THREAD_LOCAL chiba_sco_thread chiba_sco_thread_self;
+
+UTILS u32 chiba_sco_id_index(chiba_sco_id_t id) { return (u32)id; }
+UTILS u32 chiba_sco_id_gen(chiba_sco_id_t id) { return (u32)((u64)id >> 32); }
+
+UTILS chiba_sco_slot *chiba_sco_slot_at(u64 index) {
+  chiba_sco_slot *chunk = atomic_load_explicit(
+      &chiba_sco_chunks[index / CHIBA_SCO_SLOT_CHUNK], memory_order_acquire);
+  return &chunk[index % CHIBA_SCO_SLOT_CHUNK];
 }
 
-AAT_DEF(UTILS, chiba_sco_aat, chiba_sco)
-AAT_IMPL(chiba_sco_aat, chiba_sco, left, right, level, sco_compare)
+// Resolve an id to its slot, or NULL if the id is stale or invalid
+UTILS chiba_sco_slot *chiba_sco_slot_of(chiba_sco_id_t id) {
+  u64 index = chiba_sco_id_index(id);
+  if (unlikely(chiba_sco_id_gen(id) == 0 ||
+               index >= atomic_load_explicit(&chiba_sco_nslots,
+                                             memory_order_acquire)))
+    return NULL;
+  chiba_sco_slot *slot = chiba_sco_slot_at(index);
+  return atomic_load_explicit(&slot->sco.id, memory_order_acquire) == id
+             ? slot
+             : NULL;
+}
 
-typedef struct chiba_sco_map {
-  chiba_sco *roots[CHIBA_SCO_NSHARDS];
-  i32 count;
-} chiba_sco_map;
+PRIVATE chiba_sco_slot *chiba_sco_slot_pop(void) {
+  u64 head = atomic_load_explicit(&chiba_sco_free_head, memory_order_acquire);
+  while ((u32)head) {
+    chiba_sco_slot *slot = chiba_sco_slot_at((u32)head - 1);
+    u64 next = ((head >> 32) + 1) << 32 |
+               atomic_load_explicit(&slot->next_free, memory_order_relaxed);
+    if (atomic_compare_exchange_weak_explicit(&chiba_sco_free_head, &head, next,
+                                              memory_order_acquire,
+                                              memory_order_acquire))
+      return slot;
+  }
+  return NULL;
+}
 
-#define scp_map_getaat(sco)                                                    \
-  (&map->roots[CHIBA_HASH_mix13((sco)->id) & (CHIBA_SCO_NSHARDS - 1)])
+// Push the chain starting at slot `first` and ending at `last` (linked
+// through next_free) onto the free stack
+PRIVATE void chiba_sco_slot_push(u32 first, chiba_sco_slot *last) {
+  u64 head = atomic_load_explicit(&chiba_sco_free_head, memory_order_relaxed);
+  u64 next;
+  do {
+    atomic_store_explicit(&last->next_free, (u32)head, memory_order_relaxed);
+    next = ((head >> 32) + 1) << 32 | (first + 1);
+  } while (!atomic_compare_exchange_weak_explicit(&chiba_sco_free_head, &head,
+                                                  next, memory_order_release,
+                                                  memory_order_relaxed));
+}
 
-UTILS chiba_sco *chiba_sco_map_insert(chiba_sco_map *map, chiba_sco *sco) {
-  chiba_sco *prev = chiba_sco_aat_insert(scp_map_getaat(sco), sco);
-  if (!prev) {
-    map->count++;
+// Add a chunk to the slab and return one of its slots
+PRIVATE chiba_sco_slot *chiba_sco_slot_grow(void) {
+  pthread_mutex_lock(&chiba_sco_grow_lock);
+  chiba_sco_slot *slot = chiba_sco_slot_pop();
+  if (slot) {
+    pthread_mutex_unlock(&chiba_sco_grow_lock);
+    return slot;
   }
-  return prev;
+  u64 base = atomic_load_explicit(&chiba_sco_nslots, memory_order_relaxed);
+  u64 c = base / CHIBA_SCO_SLOT_CHUNK;
+  if (c >= CHIBA_SCO_SLOT_CHUNKS)
+    CHIBA_PANIC("Too many coroutines (limit %llu)",
+                (unsigned long long)CHIBA_SCO_SLOT_CHUNKS *
+                    CHIBA_SCO_SLOT_CHUNK);
+  chiba_sco_slot *chunk = (chiba_sco_slot *)CHIBA_INTERNAL_malloc(
+      sizeof(chiba_sco_slot) * CHIBA_SCO_SLOT_CHUNK);
+  if (!chunk)
+    CHIBA_PANIC("Could not allocate coroutine slots");
+  memset(chunk, 0, sizeof(chiba_sco_slot) * CHIBA_SCO_SLOT_CHUNK);
+  for (u32 i = 1; i < CHIBA_SCO_SLOT_CHUNK; i++) {
+    atomic_init(&chunk[i].sco.id, (chiba_sco_id_t)((u64)1 << 32 | (base + i)));
+    if (i + 1 < CHIBA_SCO_SLOT_CHUNK)
+      atomic_init(&chunk[i].next_free, (u32)(base + i + 2));
+  }
+  atomic_init(&chunk[0].sco.id, (chiba_sco_id_t)((u64)1 << 32 | base));
+  atomic_store_explicit(&chiba_sco_chunks[c], chunk, memory_order_release);
+  atomic_store_explicit(&chiba_sco_nslots, base + CHIBA_SCO_SLOT_CHUNK,
+                        memory_order_release);
+  chiba_sco_slot_push((u32)base + 1, &chunk[CHIBA_SCO_SLOT_CHUNK - 1]);
+  pthread_mutex_unlock(&chiba_sco_grow_lock);
+  return &chunk[0];
 }
 
-UTILS chiba_sco *chiba_sco_map_delete(chiba_sco_map *map, chiba_sco *key) {
-  chiba_sco *prev = chiba_sco_aat_delete(scp_map_getaat(key), key);
-  if (prev) {
-    map->count--;
-  }
-  return prev;
+PRIVATE chiba_sco *chiba_sco_slot_alloc(void) {
+  chiba_sco_slot *slot = chiba_sco_slot_pop();
+  if (!slot)
+    slot = chiba_sco_slot_grow();
+  atomic_store_explicit(&slot->state, CHIBA_SCO_LIVE, memory_order_relaxed);
+  return &slot->sco;
+}
+
+// Retire a finished coroutine's slot, invalidating its id
+PRIVATE void chiba_sco_slot_free(chiba_sco *co) {
+  chiba_sco_slot *slot = (chiba_sco_slot *)co;
+  chiba_sco_id_t id = atomic_load_explicit(&co->id, memory_order_relaxed);
+  u32 gen = chiba_sco_id_gen(id);
+  u32 index = chiba_sco_id_index(id);
+  gen = gen >= CHIBA_SCO_GEN_MAX ? 1 : gen + 1;
+  atomic_store_explicit(&co->id, (chiba_sco_id_t)((u64)gen << 32 | index),
+                        memory_order_release);
+  atomic_store_explicit(&slot->owner, NULL, memory_order_relaxed);
+  atomic_store_explicit(&slot->state, CHIBA_SCO_FREE, memory_order_relaxed);
+  chiba_sco_slot_push(index, slot);
 }
 
 typedef struct chiba_sco_list {
@@ -71,27 +189,39 @@ PRIVATE THREAD_LOCAL i64 chiba_sco_nrunners = 0;
 PRIVATE THREAD_LOCAL chiba_sco_list chiba_sco_runners = {0};
 PRIVATE THREAD_LOCAL i64 chiba_sco_nyielders = 0;
 PRIVATE THREAD_LOCAL chiba_sco_list chiba_sco_yielders = {0};
+PRIVATE THREAD_LOCAL i64 chiba_sco_nsleepers = 0;
+PRIVATE THREAD_LOCAL chiba_sco_list chiba_sco_sleepers = {0};
 PRIVATE THREAD_LOCAL chiba_sco *chiba_sco_cur = NULL;
-PRIVATE THREAD_LOCAL chiba_sco_map chiba_sco_paused = {0};
 PRIVATE THREAD_LOCAL i64 chiba_sco_npaused = 0;
 PRIVATE THREAD_LOCAL bool chiba_sco_exit_to_main_requested = false;
 PRIVATE THREAD_LOCAL void (*chiba_sco_user_entry)(void *udata);
 
-PRIVATE _Atomic(i64) chiba_sco_next_id = 0;
-PRIVATE _Atomic(bool) chiba_sco_locker = 0;
-PRIVATE chiba_sco_map chiba_sco_detached = {0};
-PRIVATE i64 chiba_sco_ndetached = 0;
-
-UTILS void chiba_sco_lock(void) {
-  bool expected = false;
-  chiba_backoff b = {.step = 0};
-  while (!atomic_compare_exchange_weak(&chiba_sco_locker, &expected, true)) {
-    expected = false;
-    backoff_snooze(&b);
-  }
+// Detached coroutines need no registry: detach and attach hand a coroutine
+// over with a single CAS on its slot state, so migrations of different
+// coroutines never touch a shared lock. Only the detached count is global,
+// and it is spread over cache-line sized shards picked by thread, so that
+// threads migrating at the same time do not all hit one counter.
+#define CHIBA_SCO_COUNT_SHARDS 16
+
+typedef struct chiba_sco_count_shard {
+  _Atomic(i64) n;
+} __attribute__((aligned(64))) chiba_sco_count_shard;
+
+PRIVATE chiba_sco_count_shard chiba_sco_ndetached[CHIBA_SCO_COUNT_SHARDS];
+
+UTILS void chiba_sco_ndetached_add(i64 delta) {
+  u64 shard = CHIBA_HASH_mix13((u64)&chiba_sco_thread_self) %
+              CHIBA_SCO_COUNT_SHARDS;
+  atomic_fetch_add_explicit(&chiba_sco_ndetached[shard].n, delta,
+                            memory_order_relaxed);
 }
 
-UTILS void chiba_sco_unlock(void) { atomic_store(&chiba_sco_locker, false); }
+UTILS i64 chiba_sco_ndetached_sum(void) {
+  i64 n = 0;
+  for (u32 i = 0; i < CHIBA_SCO_COUNT_SHARDS; i++)
+    n += atomic_load_explicit(&chiba_sco_ndetached[i].n, memory_order_relaxed);
+  return n;
+}
 
 UTILS void chiba_sco_list_init(chiba_sco_list *list) {
   list->head.prev = NULL;
@@ -125,10 +255,133 @@ UTILS void chiba_sco_list_push_back(chiba_sco_list *list, chiba_sco *co) {
   list->tail.prev = co;
 }
 
+UTILS bool chiba_sco_is_paused_here(chiba_sco_slot *slot) {
+  return atomic_load_explicit(&slot->owner, memory_order_relaxed) ==
+             &chiba_sco_thread_self &&
+         atomic_load_explicit(&slot->state, memory_order_seq_cst) ==
+             CHIBA_SCO_PAUSED;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Timed parks
+////////////////////////////////////////////////////////////////////////////////
+// A coroutine in chiba_sco_park_until sits on its thread's sleepers list,
+// ordered by deadline, through the same links the run queues use. The runloop
+// schedules the expired ones whenever it runs out of runners, at the point
+// where it takes wakeups. Scheduling a sleeper by any other path, or
+// detaching it, takes it off the list; attaching puts it on the new thread's.
+
+UTILS void chiba_sco_sleepers_insert(chiba_sco_slot *slot) {
+  chiba_sco *co = &slot->sco;
+  // Deadlines mostly come in increasing order, so search from the back
+  chiba_sco *at = chiba_sco_sleepers.tail.prev;
+  while (at != (chiba_sco *)&chiba_sco_sleepers.head &&
+         ((chiba_sco_slot *)at)->deadline > slot->deadline)
+    at = at->prev;
+  co->prev = at;
+  co->next = at->next;
+  at->next->prev = co;
+  at->next = co;
+  chiba_sco_nsleepers++;
+}
+
+UTILS void chiba_sco_sleepers_remove(chiba_sco_slot *slot) {
+  if (slot->deadline) {
+    chiba_sco_remove_from_list(&slot->sco);
+    chiba_sco_nsleepers--;
+  }
+}
+
+// Move a coroutine paused on this thread to the back of the yielders
+UTILS void chiba_sco_schedule_paused(chiba_sco_slot *slot) {
+  struct chiba_sco *co = &slot->sco;
+  atomic_store_explicit(&slot->state, CHIBA_SCO_LIVE, memory_order_relaxed);
+  chiba_sco_npaused--;
+  chiba_sco_sleepers_remove(slot);
+  slot->deadline = 0;
+  slot->parked = false;
+  co->prev = co;
+  co->next = co;
+  chiba_sco_list_push_back(&chiba_sco_yielders, co);
+  chiba_sco_nyielders++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Wakeups from other threads
+////////////////////////////////////////////////////////////////////////////////
+// chiba_sco_unpark leaves a permit (the coroutine's id) in the slot and, when
+// the coroutine belongs to another thread, pushes the slot onto that thread's
+// wakeup stack. The owner takes the whole stack in one exchange whenever it
+// runs out of runners, and schedules each coroutine that is parked with its
+// permit still set.
+// - a slot sits on at most one stack at a time; an unpark that finds it queued
+//   only leaves the permit, which the pending pass is guaranteed to see
+// - a slot that changed owner while queued is passed on to its new owner
+
+UTILS void chiba_sco_wakeup_push(chiba_sco_thread *thread,
+                                 chiba_sco_slot *slot) {
+  if (atomic_exchange_explicit(&slot->queued, true, memory_order_seq_cst))
+    return;
+  u32 index = chiba_sco_id_index(
+      atomic_load_explicit(&slot->sco.id, memory_order_relaxed));
+  u32 head = atomic_load_explicit(&thread->wakeups, memory_order_relaxed);
+  do {
+    atomic_store_explicit(&slot->next_wakeup, head, memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(&thread->wakeups, &head,
+                                                  index + 1,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+// Take the permit of a coroutine parked on this thread and schedule it. A
+// permit that came too late for a park stays behind for the next park and
+// must not end a plain chiba_sco_pause.
+UTILS void chiba_sco_wake_here(chiba_sco_slot *slot) {
+  chiba_sco_id_t id = atomic_load_explicit(&slot->sco.id, memory_order_relaxed);
+  if (chiba_sco_is_paused_here(slot) && slot->parked &&
+      atomic_compare_exchange_strong_explicit(&slot->permit, &id, 0,
+                                              memory_order_seq_cst,
+                                              memory_order_relaxed))
+    chiba_sco_schedule_paused(slot);
+}
+
+UTILS void chiba_sco_drain_wakeups(void) {
+  if (likely(!atomic_load_explicit(&chiba_sco_thread_self.wakeups,
+                                   memory_order_relaxed)))
+    return;
+  u32 next = atomic_exchange_explicit(&chiba_sco_thread_self.wakeups, 0,
+                                      memory_order_acquire);
+  while (next) {
+    chiba_sco_slot *slot = chiba_sco_slot_at(next - 1);
+    next = atomic_load_explicit(&slot->next_wakeup, memory_order_relaxed);
+    atomic_store_explicit(&slot->queued, false, memory_order_seq_cst);
+    chiba_sco_thread *owner =
+        atomic_load_explicit(&slot->owner, memory_order_seq_cst);
+    if (owner == &chiba_sco_thread_self)
+      chiba_sco_wake_here(slot);
+    else if (owner)
+      chiba_sco_wakeup_push(owner, slot);
+  }
+}
+
+// Schedule the sleepers whose deadline has passed
+UTILS void chiba_sco_wake_sleepers(void) {
+  if (likely(!chiba_sco_nsleepers))
+    return;
+  u64 now = get_time_in_nanoseconds();
+  while (chiba_sco_nsleepers) {
+    chiba_sco_slot *slot = (chiba_sco_slot *)chiba_sco_sleepers.head.next;
+    if (slot->deadline > now)
+      break;
+    chiba_sco_schedule_paused(slot);
+  }
+}
+
 UTILS void chiba_sco_init(void) {
   if (!chiba_sco_initialized) {
     chiba_sco_list_init(&chiba_sco_runners);
     chiba_sco_list_init(&chiba_sco_yielders);
+    chiba_sco_list_init(&chiba_sco_sleepers);
     chiba_sco_initialized = true;
   }
 }
@@ -141,6 +394,8 @@ UTILS void chiba_sco_return_to_main(bool final) {
 
 UTILS void chiba_sco_switch(bool resumed_from_main, bool final) {
   if (chiba_sco_nrunners == 0) {
+    chiba_sco_drain_wakeups();
+    chiba_sco_wake_sleepers();
     // No more runners.
     if (chiba_sco_nyielders == 0 || chiba_sco_exit_to_main_requested ||
         (!resumed_from_main && chiba_sco_npaused > 0)) {
@@ -163,11 +418,12 @@ UTILS void chiba_sco_switch(bool resumed_from_main, bool final) {
 }
 
 UTILS void chiba_sco_entry(anyptr ctx) {
-  // Initialize a new coroutine on the user's stack.
-  chiba_sco scostk = {0};
-  chiba_sco *co = &scostk;
+  // Take a slot for the new coroutine; its id was set when the slot was
+  // retired last.
+  chiba_sco *co = chiba_sco_slot_alloc();
+  atomic_store_explicit(&((chiba_sco_slot *)co)->owner, &chiba_sco_thread_self,
+                        memory_order_relaxed);
   co->co = chiba_co_current();
-  co->id = atomic_fetch_add(&chiba_sco_next_id, 1) + 1;
   co->ctx = ctx;
   co->prev = co;
   co->next = co;
@@ -183,12 +439,14 @@ UTILS void chiba_sco_entry(anyptr ctx) {
     chiba_sco_user_entry(ctx);
   }
   // This coroutine is finished. Switch to the next coroutine.
+  chiba_sco_slot_free(co);
   chiba_sco_switch(false, true);
 }
 
 PUBLIC void chiba_sco_exit(void) {
   if (chiba_sco_cur) {
     chiba_sco_exit_to_main_requested = true;
+    chiba_sco_slot_free(chiba_sco_cur);
     chiba_sco_switch(false, true);
   }
 }
@@ -206,8 +464,23 @@ PUBLIC void chiba_sco_start(chiba_sco_desc *desc) {
   chiba_co_start(&co_desc, false);
 }
 
+PUBLIC void chiba_sco_spawn(chiba_sco_desc *desc) {
+  chiba_sco_init();
+  chiba_co_desc co_desc = {
+      .entry = chiba_sco_entry,
+      .defer = desc->defer,
+      .stack = NULL,
+      .stack_size = desc->stack_size > 0 ? (u64)desc->stack_size : 0,
+      .ctx = desc->ctx,
+  };
+  chiba_sco_user_entry = desc->entry;
+  chiba_co_spawn_keyed(&co_desc, false, (anyptr)desc->entry);
+}
+
 PUBLIC chiba_sco_id_t chiba_sco_id(void) {
-  return chiba_sco_cur ? chiba_sco_cur->id : 0;
+  return chiba_sco_cur
+             ? atomic_load_explicit(&chiba_sco_cur->id, memory_order_relaxed)
+             : 0;
 }
 
 PUBLIC void chiba_sco_yield(void) {
@@ -220,12 +493,66 @@ PUBLIC void chiba_sco_yield(void) {
 
 PUBLIC void chiba_sco_pause(void) {
   if (chiba_sco_cur) {
-    chiba_sco_map_insert(&chiba_sco_paused, chiba_sco_cur);
+    chiba_sco_slot *slot = (chiba_sco_slot *)chiba_sco_cur;
+    atomic_store_explicit(&slot->owner, &chiba_sco_thread_self,
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->state, CHIBA_SCO_PAUSED,
+                          memory_order_relaxed);
     chiba_sco_npaused++;
     chiba_sco_switch(false, false);
   }
 }
 
+PUBLIC void chiba_sco_park(void) { chiba_sco_park_until(UINT64_MAX); }
+
+PUBLIC void chiba_sco_park_until(u64 deadline) {
+  if (chiba_sco_cur && (deadline == UINT64_MAX ||
+                        get_time_in_nanoseconds() < deadline)) {
+    chiba_sco_slot *slot = (chiba_sco_slot *)chiba_sco_cur;
+    // Paused before the permit is checked: an unpark either leaves its permit
+    // in time to be seen here or finds the coroutine paused
+    atomic_store_explicit(&slot->state, CHIBA_SCO_PAUSED, memory_order_seq_cst);
+    chiba_sco_id_t id =
+        atomic_load_explicit(&chiba_sco_cur->id, memory_order_relaxed);
+    if (atomic_compare_exchange_strong_explicit(&slot->permit, &id, 0,
+                                                memory_order_seq_cst,
+                                                memory_order_relaxed)) {
+      atomic_store_explicit(&slot->state, CHIBA_SCO_LIVE,
+                            memory_order_relaxed);
+      return;
+    }
+    if (deadline != UINT64_MAX) {
+      slot->deadline = deadline;
+      chiba_sco_sleepers_insert(slot);
+    }
+    slot->parked = true;
+    chiba_sco_npaused++;
+    chiba_sco_switch(false, false);
+  }
+}
+
+PUBLIC void chiba_sco_unpark(chiba_sco_id_t id) {
+  chiba_sco_slot *slot = chiba_sco_slot_of(id);
+  if (!slot)
+    return;
+  // A permit left for an earlier coroutine in this slot is stale
+  chiba_sco_id_t permit =
+      atomic_load_explicit(&slot->permit, memory_order_relaxed);
+  do {
+    if (permit == id)
+      return;
+  } while (!atomic_compare_exchange_weak_explicit(&slot->permit, &permit, id,
+                                                  memory_order_seq_cst,
+                                                  memory_order_relaxed));
+  chiba_sco_thread *owner =
+      atomic_load_explicit(&slot->owner, memory_order_seq_cst);
+  if (owner == &chiba_sco_thread_self)
+    chiba_sco_wake_here(slot);
+  else if (owner)
+    chiba_sco_wakeup_push(owner, slot);
+  // A detached coroutine keeps the permit until it parks again
+}
+
 PUBLIC void chiba_sco_resume(chiba_sco_id_t id) {
   chiba_sco_init();
   if (id == 0 && !chiba_sco_cur) {
@@ -233,42 +560,48 @@ PUBLIC void chiba_sco_resume(chiba_sco_id_t id) {
     chiba_sco_switch(true, false);
   } else {
     // Resuming from coroutine
-    struct chiba_sco *co =
-        chiba_sco_map_delete(&chiba_sco_paused, &(struct chiba_sco){.id = id});
-    if (co) {
-      chiba_sco_npaused--;
-      co->prev = co;
-      co->next = co;
-      chiba_sco_list_push_back(&chiba_sco_yielders, co);
-      chiba_sco_nyielders++;
+    chiba_sco_slot *slot = chiba_sco_slot_of(id);
+    if (slot && chiba_sco_is_paused_here(slot)) {
+      chiba_sco_schedule_paused(slot);
       chiba_sco_yield();
     }
   }
 }
 
 PUBLIC void chiba_sco_detach(chiba_sco_id_t id) {
-  struct chiba_sco *co =
-      chiba_sco_map_delete(&chiba_sco_paused, &(struct chiba_sco){.id = id});
-  if (co) {
+  chiba_sco_slot *slot = chiba_sco_slot_of(id);
+  if (slot && chiba_sco_is_paused_here(slot)) {
     chiba_sco_npaused--;
-    chiba_sco_lock();
-    chiba_sco_map_insert(&chiba_sco_detached, co);
-    chiba_sco_ndetached++;
-    chiba_sco_unlock();
+    // A timed park keeps its deadline for the thread that attaches it
+    chiba_sco_sleepers_remove(slot);
+    atomic_store_explicit(&slot->owner, NULL, memory_order_relaxed);
+    // Publishes the paused context to whichever thread attaches it
+    atomic_store_explicit(&slot->state, CHIBA_SCO_DETACHED,
+                          memory_order_release);
+    chiba_sco_ndetached_add(1);
   }
 }
 
 PUBLIC void chiba_sco_attach(chiba_sco_id_t id) {
-  chiba_sco_lock();
-  struct chiba_sco *co =
-      chiba_sco_map_delete(&chiba_sco_detached, &(struct chiba_sco){.id = id});
-  if (co) {
-    chiba_sco_ndetached--;
-  }
-  chiba_sco_unlock();
-  if (co) {
-    chiba_sco_map_insert(&chiba_sco_paused, co);
+  chiba_sco_slot *slot = chiba_sco_slot_of(id);
+  if (!slot)
+    return;
+  // Only one of several threads racing to attach the same id wins
+  u32 state = CHIBA_SCO_DETACHED;
+  if (atomic_compare_exchange_strong_explicit(
+          &slot->state, &state, CHIBA_SCO_PAUSED, memory_order_acquire,
+          memory_order_relaxed)) {
+    chiba_sco_init();
+    // Owner is published before the permit is checked: an unpark that ran
+    // while detached either left its permit in time to be seen here or
+    // finds this thread as the owner
+    atomic_store_explicit(&slot->owner, &chiba_sco_thread_self,
+                          memory_order_seq_cst);
+    chiba_sco_ndetached_add(-1);
     chiba_sco_npaused++;
+    if (slot->deadline)
+      chiba_sco_sleepers_insert(slot);
+    chiba_sco_wake_here(slot);
   }
 }
 
@@ -281,7 +614,7 @@ PUBLIC chiba_sco_info chiba_sco_info_all(void) {
       .scheduled = chiba_sco_nyielders,
       .running = chiba_sco_nrunners + (chiba_sco_cur ? 1 : 0),
       .paused = chiba_sco_npaused,
-      .detached = chiba_sco_ndetached,
+      .detached = chiba_sco_ndetached_sum(),
       .method = chiba_co_method(0),
   };
   return info;
@@ -10,11 +10,20 @@ typedef struct chiba_sco_desc {
   anyptr ctx;
 } chiba_sco_desc;
 
+// Coroutine id. Ids are generational handles into a global slot table: they
+// resolve in constant time, are never zero, and an id of a finished coroutine
+// is ignored by every operation even after its slot has been reused.
 typedef i64 chiba_sco_id_t;
 
 // Starts a new coroutine with the provided description.
 void chiba_sco_start(chiba_sco_desc *desc);
 
+// Starts a new coroutine on a stack taken from the coroutine stack pool.
+// desc->stack is ignored and desc->stack_size is the minimum size wanted
+// (0 selects CHIBA_CO_DEFAULT_STACKSIZE). desc->defer, if set, runs before
+// the stack goes back to the pool.
+void chiba_sco_spawn(chiba_sco_desc *desc);
+
 // Causes the calling coroutine to relinquish the CPU.
 // This operation should be called from a coroutine, otherwise it does nothing.
 void chiba_sco_yield(void);
@@ -37,6 +46,29 @@ void chiba_sco_resume(chiba_sco_id_t id);
 // Returns true if there are any coroutines running, yielding, or paused.
 bool chiba_sco_active(void);
 
+// Park the current coroutine until chiba_sco_unpark is called with its id.
+// Returns at once if such an unpark came in since the last park returned.
+// Like chiba_sco_pause it may also be ended by chiba_sco_resume, so callers
+// re-check what they wait for in a loop.
+// This operation should be called from a coroutine, otherwise it does nothing.
+void chiba_sco_park(void);
+
+// Like chiba_sco_park, but the coroutine is also scheduled again once
+// `deadline` (get_time_in_nanoseconds) has passed; UINT64_MAX never times
+// out. Deadlines are checked by the runloop when it runs out of runners, so
+// a runloop must keep calling chiba_sco_resume(0) until they expire. Returns
+// at once if the deadline has already passed.
+// This operation should be called from a coroutine, otherwise it does nothing.
+void chiba_sco_park_until(u64 deadline);
+
+// Wake a parked coroutine. Unlike chiba_sco_resume this may be called from
+// any thread: on the coroutine's own thread it is scheduled right away,
+// otherwise the wakeup is queued for its thread, which schedules it the next
+// time its runloop runs out of runners (a runloop must keep calling
+// chiba_sco_resume(0) while coroutines are paused). The caller keeps running.
+// If the id is invalid, then this operation does nothing.
+void chiba_sco_unpark(chiba_sco_id_t id);
+
 // Detach a coroutine from a thread.
 // This allows for moving coroutines between threads.
 // The coroutine must be currently paused before it can be detached, thus this
@@ -4,7 +4,9 @@
 #include "../chiba_testing.h"
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -271,7 +273,7 @@ TEST_CASE(exit_order, scheched_coroutine, "exit ordering", {
 
 // detach/attach across threads (mirrors sco_detach test)
 #ifndef __EMSCRIPTEN__
-PRIVATE i64 thpaused[NCHILDREN] = {0};
+PRIVATE _Atomic(i64) thpaused[NCHILDREN];
 PRIVATE void co_thread_one(anyptr udata) {
   i32 index = *(i32 *)udata;
   i64 id = chiba_sco_id();
@@ -332,6 +334,7 @@ TEST_CASE(detach_attach, scheched_coroutine, "detach/attach between threads", {
 // Multi-threading test: producer + 3 consumers printing thread ids
 #ifndef __EMSCRIPTEN__
 PRIVATE atomic_int mt_printed = 0;
+PRIVATE atomic_bool mt_detached = false;
 PRIVATE i64 mt_ids[NCHILDREN] = {0};
 PRIVATE i32 mt_indices[NCHILDREN] = {0};
 PRIVATE void co_mt_worker(anyptr u) {
@@ -363,6 +366,7 @@ PRIVATE void *mt_producer(void *arg) {
           chiba_sco_detach(id);
         }
       }
+      atomic_store(&mt_detached, true);
     }
     chiba_sco_resume(0);
   }
@@ -374,9 +378,10 @@ PRIVATE void *mt_consumer(void *arg) {
   const i32 ncons = 3;
   (void)cid;
   reset_stats();
-  // Wait until all are detached globally
-  while (chiba_sco_info_all().detached < NCHILDREN) {
-    // spin
+  // Wait until all are detached. The detached count itself cannot be
+  // awaited: it drops again as soon as the first consumer attaches.
+  while (!atomic_load(&mt_detached)) {
+    sched_yield();
   }
   // Attach and resume a stripe of ids for this consumer
   for (i32 i = (i32)cid; i < NCHILDREN; i += ncons) {
@@ -397,6 +402,7 @@ TEST_CASE(
     multithread_ids, scheched_coroutine, "multi-thread print thread ids", {
       DESC(multithread_ids);
       mt_printed = 0;
+      mt_detached = false;
       memset(mt_ids, 0, sizeof(mt_ids));
       pthread_t prod;
       pthread_t cons[3];
@@ -454,6 +460,207 @@ TEST_CASE(ordering, scheched_coroutine, "scheduling order", {
   return 0;
 })
 
+// stale ids: a finished coroutine's id must not resume the coroutine that
+// reuses its slot
+PRIVATE i64 stale_first = 0;
+PRIVATE i64 stale_second = 0;
+PRIVATE i32 stale_wakeups = 0;
+PRIVATE void co_stale_once(anyptr u) {
+  (void)u;
+  stale_first = chiba_sco_id();
+}
+PRIVATE void co_stale_parked(anyptr u) {
+  (void)u;
+  stale_second = chiba_sco_id();
+  chiba_sco_pause();
+  stale_wakeups++;
+}
+PRIVATE void co_stale_driver(anyptr u) {
+  (void)u;
+  quick_start(co_stale_once, co_cleanup, 0);
+  quick_start(co_stale_parked, co_cleanup, 0);
+  chiba_sco_resume(stale_first);
+  chiba_sco_yield();
+}
+TEST_CASE(stale_ids, scheched_coroutine, "stale ids are rejected", {
+  DESC(stale_ids);
+  stale_wakeups = 0;
+  quick_start(co_stale_driver, co_cleanup, 0);
+  while (chiba_sco_info_all().running + chiba_sco_info_all().scheduled > 0)
+    chiba_sco_resume(0);
+  ASSERT_TRUE(stale_first != 0, "first coroutine ran");
+  ASSERT_TRUE(stale_second != stale_first, "slot reuse changes the id");
+  ASSERT_EQ((u32)stale_first, (u32)stale_second, "slot was reused");
+  ASSERT_EQ(0, stale_wakeups, "stale id did not wake the new coroutine");
+  ASSERT_EQ(1, chiba_sco_info_all().paused, "new coroutine still paused");
+  chiba_sco_resume(stale_second);
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_EQ(1, stale_wakeups, "current id wakes it");
+  return 0;
+})
+
+// park/unpark: an unpark before the park is not lost, and unparks may come
+// from other threads
+PRIVATE i32 park_early_returns = 0;
+PRIVATE i64 park_parked_id = 0;
+PRIVATE i32 park_wakeups = 0;
+PRIVATE void co_park_self(anyptr u) {
+  (void)u;
+  chiba_sco_unpark(chiba_sco_id());
+  chiba_sco_park();
+  park_early_returns++;
+  park_parked_id = chiba_sco_id();
+  chiba_sco_park();
+  park_wakeups++;
+}
+PRIVATE void co_park_waker(anyptr u) {
+  (void)u;
+  chiba_sco_unpark(park_parked_id);
+  // The unparked coroutine is scheduled, the caller keeps running
+  park_wakeups += 10;
+}
+PRIVATE void co_park_once(anyptr u) {
+  (void)u;
+  park_parked_id = chiba_sco_id();
+  chiba_sco_park();
+  park_wakeups++;
+}
+#ifndef __EMSCRIPTEN__
+PRIVATE void *park_late_unparker(void *arg) {
+  (void)arg;
+  chiba_sco_unpark(park_parked_id);
+  return NULL;
+}
+#endif
+
+PRIVATE i32 park_pause_runs = 0;
+PRIVATE void co_unpark_then_pause(anyptr u) {
+  park_parked_id = chiba_sco_id();
+  // Unparked while running, like a channel waiter that saw its wakeup
+  // before the waker got to chiba_sco_unpark. From another thread this
+  // also queues a wakeup for the runloop.
+#ifndef __EMSCRIPTEN__
+  if (u) {
+    pthread_t late;
+    pthread_create(&late, 0, park_late_unparker, 0);
+    pthread_join(late, 0);
+  } else
+#endif
+    chiba_sco_unpark(park_parked_id);
+  chiba_sco_pause();
+  park_pause_runs++;
+}
+
+PRIVATE u64 park_deadline = 0;
+PRIVATE u64 park_woke_at = 0;
+PRIVATE void co_park_timed(anyptr u) {
+  (void)u;
+  park_parked_id = chiba_sco_id();
+  chiba_sco_park_until(park_deadline);
+  park_woke_at = get_time_in_nanoseconds();
+}
+
+#ifndef __EMSCRIPTEN__
+PRIVATE _Atomic(i64) park_ids[NCHILDREN];
+PRIVATE atomic_bool park_go[NCHILDREN];
+PRIVATE atomic_int park_registered = 0;
+PRIVATE atomic_int park_done = 0;
+PRIVATE void co_park_remote(anyptr u) {
+  i32 i = *(i32 *)u;
+  atomic_store(&park_ids[i], chiba_sco_id());
+  atomic_fetch_add(&park_registered, 1);
+  while (!atomic_load(&park_go[i]))
+    chiba_sco_park();
+  atomic_fetch_add(&park_done, 1);
+}
+PRIVATE void *park_unparker(void *arg) {
+  (void)arg;
+  while (atomic_load(&park_registered) < NCHILDREN)
+    sched_yield();
+  for (i32 i = NCHILDREN - 1; i >= 0; i--) {
+    atomic_store(&park_go[i], true);
+    chiba_sco_unpark(atomic_load(&park_ids[i]));
+  }
+  return NULL;
+}
+#endif
+
+TEST_CASE(park_unpark, scheched_coroutine, "park and unpark", {
+  DESC(park_unpark);
+  reset_stats();
+  quick_start(co_park_self, co_cleanup, 0);
+  ASSERT_EQ(1, park_early_returns, "unpark before park is kept");
+  ASSERT_EQ(1, chiba_sco_info_all().paused, "parked the second time");
+  quick_start(co_park_waker, co_cleanup, 0);
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_EQ(11, park_wakeups, "waker ran on, then the parked one woke");
+
+  // Unparked while detached: the permit is picked up on attach
+  park_wakeups = 0;
+  quick_start(co_park_once, co_cleanup, 0);
+  chiba_sco_detach(park_parked_id);
+  chiba_sco_unpark(park_parked_id);
+  chiba_sco_attach(park_parked_id);
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_EQ(1, park_wakeups, "unpark while detached is not lost");
+  ASSERT_EQ(0, chiba_sco_info_all().detached, "attached again");
+
+  // A left over permit does not end a plain pause, neither on attach nor
+  // when the wakeup queued by a late unpark from another thread is drained
+  for (i32 remote = 0; remote < 2; remote++) {
+    park_pause_runs = 0;
+    quick_start(co_unpark_then_pause, co_cleanup, remote ? &remote : 0);
+    if (!remote) {
+      chiba_sco_detach(park_parked_id);
+      chiba_sco_attach(park_parked_id);
+    }
+    chiba_sco_resume(0);
+    ASSERT_EQ(1, chiba_sco_info_all().paused, "still paused");
+    ASSERT_EQ(0, park_pause_runs, "pause not ended by an unpark");
+    chiba_sco_resume(park_parked_id);
+    while (chiba_sco_active())
+      chiba_sco_resume(0);
+    ASSERT_EQ(1, park_pause_runs, "ended by resume");
+  }
+
+  // Timed park: nothing unparks it, the runloop wakes it at the deadline
+  park_deadline = get_time_in_nanoseconds() + 20000000ULL;
+  quick_start(co_park_timed, co_cleanup, 0);
+  chiba_sco_resume(0);
+  ASSERT_EQ(1, chiba_sco_info_all().paused, "parked, not yielding");
+  ASSERT_EQ(0, chiba_sco_info_all().scheduled, "nothing to run meanwhile");
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_TRUE(park_woke_at >= park_deadline, "woken at the deadline");
+
+  // An unpark before the deadline ends the timed park early
+  park_deadline = get_time_in_nanoseconds() + 10000000000ULL;
+  quick_start(co_park_timed, co_cleanup, 0);
+  chiba_sco_unpark(park_parked_id);
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_TRUE(park_woke_at < park_deadline, "unparked before the deadline");
+
+#ifndef __EMSCRIPTEN__
+  i32 idx[NCHILDREN];
+  for (i32 i = 0; i < NCHILDREN; i++) {
+    idx[i] = i;
+    atomic_store(&park_go[i], false);
+    quick_start(co_park_remote, co_cleanup, &idx[i]);
+  }
+  pthread_t t;
+  ASSERT_EQ(0, pthread_create(&t, 0, park_unparker, 0), "create unparker");
+  while (chiba_sco_active())
+    chiba_sco_resume(0);
+  ASSERT_EQ(0, pthread_join(t, 0), "join unparker");
+  ASSERT_EQ(NCHILDREN, atomic_load(&park_done), "woken from another thread");
+#endif
+  return 0;
+})
+
 // Register tests
 REGISTER_TEST_GROUP(scheched_coroutine) {
   // REGISTER_TEST(start_children, scheched_coroutine);
@@ -461,10 +668,12 @@ REGISTER_TEST_GROUP(scheched_coroutine) {
   // REGISTER_TEST(pause_and_resume, scheched_coroutine);
   // REGISTER_TEST(exit_order, scheched_coroutine);
   // REGISTER_TEST(ordering, scheched_coroutine);
+  REGISTER_TEST(stale_ids, scheched_coroutine);
+  REGISTER_TEST(park_unpark, scheched_coroutine);
 
 #ifndef __EMSCRIPTEN__
   REGISTER_TEST(multithread_ids, scheched_coroutine);
-  // REGISTER_TEST(detach_attach, scheched_coroutine);
+  REGISTER_TEST(detach_attach, scheched_coroutine);
 #endif
   // REGISTER_TEST(various_info, scheched_coroutine);
 }
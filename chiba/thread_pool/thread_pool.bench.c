@@ -0,0 +1,165 @@
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "thread_pool.h"
+#include "../basic_memory.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// -----------------------------------------------
+// Benchmark configuration
+// -----------------------------------------------
+#define JOB_TARGET 1000000LL // 每轮提交的任务数
+#define ROUNDS 5             // 轮数
+#define FANOUT 64            // 嵌套模式下每个任务派生的子任务数
+#define THREADS 4            // 线程池线程数
+
+static inline u64 now_ns(void) { return get_time_in_nanoseconds(); }
+
+// -----------------------------------------------
+// Counting allocator: heap allocations made while jobs are submitted
+// -----------------------------------------------
+static _Atomic(long long) heap_allocs = 0;
+
+static anyptr count_malloc(size_t n) {
+  atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+  return malloc(n);
+}
+
+static anyptr count_aligned(size_t align, size_t n) {
+  atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+  return aligned_alloc(align, ((n + align - 1) / align) * align);
+}
+
+static anyptr count_realloc(anyptr ptr, size_t n) {
+  atomic_fetch_add_explicit(&heap_allocs, 1, memory_order_relaxed);
+  return realloc(ptr, n);
+}
+
+static void count_free(anyptr ptr) { free(ptr); }
+
+// -----------------------------------------------
+// Jobs
+// -----------------------------------------------
+static _Atomic(long long) done = 0;
+static chiba_thread_pool *bench_pool;
+
+static void tiny_job(anyptr arg) {
+  (void)arg;
+  atomic_fetch_add_explicit(&done, 1, memory_order_relaxed);
+}
+
+static void spawn_job(anyptr arg) {
+  (void)arg;
+  for (int i = 0; i < FANOUT; i++)
+    chiba_thread_pool_add_work(bench_pool, tiny_job, NULL);
+}
+
+typedef struct {
+  double per_job_ns;     // 单个任务耗时 (nanoseconds)
+  double allocs_per_job; // 单个任务的堆分配次数
+} BenchResult;
+
+// 外部线程提交 JOB_TARGET 个空任务
+static BenchResult bench_external(void) {
+  u64 elapsed = 0;
+  long long allocs = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    atomic_store(&done, 0);
+    long long a0 = atomic_load(&heap_allocs);
+    u64 start = now_ns();
+    for (long long i = 0; i < JOB_TARGET; i++)
+      chiba_thread_pool_add_work(bench_pool, tiny_job, NULL);
+    chiba_thread_pool_wait(bench_pool);
+    elapsed += now_ns() - start;
+    // 第一轮用来预热任务缓存
+    if (r > 0)
+      allocs += atomic_load(&heap_allocs) - a0;
+  }
+  return (BenchResult){
+      .per_job_ns = (double)elapsed / (ROUNDS * JOB_TARGET),
+      .allocs_per_job = (double)allocs / ((ROUNDS - 1) * JOB_TARGET)};
+}
+
+// 外部线程分批提交, 每批 FANOUT 个任务
+static void (*batch_entries[FANOUT])(anyptr);
+static anyptr batch_args[FANOUT];
+
+static BenchResult bench_batch(void) {
+  for (int i = 0; i < FANOUT; i++)
+    batch_entries[i] = tiny_job;
+  u64 elapsed = 0;
+  long long allocs = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    atomic_store(&done, 0);
+    long long a0 = atomic_load(&heap_allocs);
+    u64 start = now_ns();
+    for (long long i = 0; i < JOB_TARGET / FANOUT; i++)
+      chiba_thread_pool_add_work_batch(bench_pool, batch_entries, batch_args,
+                                       FANOUT);
+    chiba_thread_pool_wait(bench_pool);
+    elapsed += now_ns() - start;
+    if (r > 0)
+      allocs += atomic_load(&heap_allocs) - a0;
+  }
+  long long jobs = (JOB_TARGET / FANOUT) * FANOUT;
+  return (BenchResult){
+      .per_job_ns = (double)elapsed / (ROUNDS * jobs),
+      .allocs_per_job = (double)allocs / ((ROUNDS - 1) * jobs)};
+}
+
+// 工作线程内提交: 每个任务派生 FANOUT 个子任务
+static BenchResult bench_nested(void) {
+  u64 elapsed = 0;
+  long long allocs = 0;
+  for (int r = 0; r < ROUNDS; r++) {
+    atomic_store(&done, 0);
+    long long a0 = atomic_load(&heap_allocs);
+    u64 start = now_ns();
+    for (long long i = 0; i < JOB_TARGET / FANOUT; i++)
+      chiba_thread_pool_add_work(bench_pool, spawn_job, NULL);
+    chiba_thread_pool_wait(bench_pool);
+    elapsed += now_ns() - start;
+    if (r > 0)
+      allocs += atomic_load(&heap_allocs) - a0;
+  }
+  long long jobs = (JOB_TARGET / FANOUT) * (FANOUT + 1);
+  return (BenchResult){
+      .per_job_ns = (double)elapsed / (ROUNDS * jobs),
+      .allocs_per_job = (double)allocs / ((ROUNDS - 1) * jobs)};
+}
+
+int main(void) {
+  CHIBA_INTERNAL_set_alloc_funcs(count_malloc, count_aligned, count_realloc,
+                                 count_free);
+  bench_pool = chiba_thread_pool_new(THREADS);
+
+  printf("========================================\n");
+  printf("  Thread Pool Submission Benchmark\n");
+  printf("========================================\n");
+  printf("  Threads: %d\n", THREADS);
+  printf("  Jobs per round: %lld, rounds: %d\n\n", (long long)JOB_TARGET,
+         ROUNDS);
+
+  BenchResult ext = bench_external();
+  printf("Benchmark 1: external submit\n");
+  printf("  %.2f ns/job, %.4f allocs/job\n\n", ext.per_job_ns,
+         ext.allocs_per_job);
+
+  BenchResult batch = bench_batch();
+  printf("Benchmark 2: external batch submit (batch %d)\n", FANOUT);
+  printf("  %.2f ns/job, %.4f allocs/job\n\n", batch.per_job_ns,
+         batch.allocs_per_job);
+
+  BenchResult nested = bench_nested();
+  printf("Benchmark 3: nested submit (fan-out %d)\n", FANOUT);
+  printf("  %.2f ns/job, %.4f allocs/job\n", nested.per_job_ns,
+         nested.allocs_per_job);
+  printf("========================================\n");
+
+  chiba_thread_pool_drop(bench_pool);
+  return 0;
+}
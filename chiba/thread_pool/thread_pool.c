@@ -1,31 +1,80 @@
+/* The futex eventcount calls syscall(), which -std=c11 hides unless
+ * _DEFAULT_SOURCE is defined before the first system header */
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
 #include "thread_pool.h"
+#include "../concurrency/dequeue.h"
 #include "thread_pool_jobqueue.h"
+#include "thread_pool_topology.h"
+#include <stdint.h>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+/* Scheduling
+ *
+ * - every worker owns a Chase-Lev deque (chiba_wsqueue). Jobs submitted from
+ *   a worker go to the bottom of its own deque and it pops them newest first,
+ *   so fan-out stays on the core whose cache holds the parent's data
+ * - jobs submitted from outside the pool go through the injector queue of
+ *   the submitter's NUMA node (there is one node unless config.numa)
+ * - a worker with an empty deque takes from its node's injector, then the
+ *   other nodes', then steals the oldest job of another worker starting at a
+ *   random victim on its own node, backs off, and finally parks on its
+ *   node's has_jobs eventcount
+ * - a parallel_for splitter waiting for a stolen half helps with other jobs
+ *   and parks on the pool's joined eventcount, which submitting also wakes
+ * - submitting costs a fence and a load per eventcount while every worker is
+ *   busy; the futex is only woken when some thread actually went to sleep.
+ *   Parked workers of other nodes are woken only if none of the submitter's
+ *   node is waiting
+ */
 
 /* ========================== STRUCTURES ============================ */
 typedef struct chiba_thread chiba_thread;
 /* Threadpool */
 typedef struct chiba_thread_pool {
   chiba_thread **threads; /* pointer to threads        */
+  i32 num_threads;        /* threads started           */
 
-  pthread_mutex_t thcount_lock;     /* used for thread count etc */
-  volatile i32 num_threads_alive;   /* threads currently alive   */
-  volatile i32 num_threads_working; /* threads currently working */
+  _Atomic(i32) num_threads_alive; /* threads currently alive   */
+  _Atomic(i64) num_jobs_pending;  /* submitted, not finished   */
+  _Atomic(bool) keepalive;        /* cleared by drop           */
+  _Atomic(bool) on_hold;          /* set by pause              */
 
-  pthread_cond_t threads_all_idle; /* signal to chiba_thread_poolwait     */
+  pthread_mutex_t thcount_lock;    /* guards threads_all_idle   */
+  pthread_cond_t threads_all_idle; /* signal to chiba_thread_pool_wait */
 
-  chiba_thread_pool_jobqueue *jobqueue; /* job queue                 */
-} chiba_thread_pool;
+  chiba_thread_pool_jobqueue **jobqueues; /* injector per node       */
+  i32 num_nodes;                          /* NUMA nodes in use        */
+  i32 *cpu_node; /* node of each CPU, NULL with one node   */
+
+  chiba_thread_pool_jobcache external;          /* non-worker submitters */
+  _Atomic(chiba_thread_pool_jobchunk *) chunks; /* job slab              */
 
-static volatile i32 threads_keepalive;
-static volatile i32 threads_on_hold;
+  chiba_event joined; /* parallel_for splitters waiting for a stolen half */
+} chiba_thread_pool;
 
 /* Thread */
 typedef struct chiba_thread {
   i32 id;                  /* friendly id               */
   pthread_t pthread;       /* pointer to actual thread  */
   chiba_thread_pool *pool; /* access to thpool          */
+  chiba_wsqueue *deque;    /* jobs this thread submits  */
+  u64 rng;                 /* victim selection          */
+  chiba_thread_pool_jobcache jobs; /* free jobs              */
+  i32 node;                        /* NUMA node in the pool   */
+  bool bind;                       /* restrict to affinity    */
+  u64 affinity[TOPOLOGY_MASK_WORDS];
 } chiba_thread;
 
+/* Worker running on the calling thread, NULL outside any pool */
+static THREAD_LOCAL chiba_thread *thread_self = NULL;
+/* Victim selection for threads outside the pool that help run jobs */
+static THREAD_LOCAL u64 external_rng = 0x9e3779b97f4a7c15ULL;
+
 UTILS anyptr thread_do(chiba_thread *thread_p);
 UTILS i32 thread_init(chiba_thread_pool *pool, chiba_thread **thread_p,
                       i32 id) {
@@ -38,27 +87,227 @@ UTILS i32 thread_init(chiba_thread_pool *pool, chiba_thread **thread_p,
 
   (*thread_p)->pool = pool;
   (*thread_p)->id = id;
-
-  pthread_create(&(*thread_p)->pthread, NULL, (anyptr(*)(anyptr))thread_do,
-                 (*thread_p));
-  pthread_detach((*thread_p)->pthread);
+  (*thread_p)->rng = CHIBA_HASH_mix13((u64)id + 1) | 1;
+  (*thread_p)->jobs.free = NULL;
+  atomic_init(&(*thread_p)->jobs.inbox, NULL);
+  atomic_init(&(*thread_p)->jobs.locker, false);
+  (*thread_p)->node = 0;
+  (*thread_p)->bind = false;
+  memset((*thread_p)->affinity, 0, sizeof((*thread_p)->affinity));
+  /* Allocated by the thread itself once it runs where it belongs */
+  (*thread_p)->deque = NULL;
   return 0;
 }
 
-/* Sets the calling thread on hold */
-UTILS void thread_hold(i32 sig_id) {
-  (void)sig_id;
-  threads_on_hold = 1;
-  while (threads_on_hold) {
-    sleep(1);
+UTILS void thread_start(chiba_thread *thread_p) {
+  if (pthread_create(&thread_p->pthread, NULL, (anyptr(*)(anyptr))thread_do,
+                     thread_p) != 0)
+    CHIBA_PANIC("Could not start thread %d\n", thread_p->id);
+}
+
+/* ============================ JOBS ================================ */
+
+/* The calling thread if it is one of `pool`'s workers, else NULL */
+UTILS chiba_thread *thread_pool_self(chiba_thread_pool *pool) {
+  chiba_thread *self = thread_self;
+  return self && self->pool == pool ? self : NULL;
+}
+
+/* Cache of the calling thread in `pool`, NULL if it is not one of its
+ * workers */
+UTILS chiba_thread_pool_jobcache *thread_pool_local_jobs(
+    chiba_thread_pool *pool) {
+  chiba_thread *self = thread_pool_self(pool);
+  return self ? &self->jobs : NULL;
+}
+
+/* Take `n` free jobs from the calling thread's cache, taking the external
+ * cache's lock once for all of them. False if the slab could not grow. */
+UTILS bool thread_pool_jobs_new(chiba_thread_pool *pool,
+                                chiba_thread_pool_job **jobs, u32 n) {
+  chiba_thread_pool_jobcache *cache = thread_pool_local_jobs(pool);
+  if (!cache) {
+    cache = &pool->external;
+    chiba_backoff b = {.step = 0};
+    bool expected = false;
+    while (!atomic_compare_exchange_weak_explicit(
+        &cache->locker, &expected, true, memory_order_acquire,
+        memory_order_relaxed)) {
+      expected = false;
+      backoff_snooze(&b);
+    }
+  }
+  u32 i = 0;
+  while (i < n && (jobs[i] = jobcache_get(cache, &pool->chunks)))
+    i++;
+  if (cache == &pool->external)
+    atomic_store_explicit(&cache->locker, false, memory_order_release);
+  return i == n;
+}
+
+/* Take a free job from the calling thread's cache */
+UTILS chiba_thread_pool_job *thread_pool_job_new(chiba_thread_pool *pool) {
+  chiba_thread_pool_job *job;
+  return thread_pool_jobs_new(pool, &job, 1) ? job : NULL;
+}
+
+/* Node of the calling thread: its own if a worker, else the node of the
+ * CPU it runs on */
+UTILS i32 thread_pool_node(chiba_thread_pool *pool, chiba_thread *self) {
+  if (self)
+    return self->node;
+  if (pool->num_nodes == 1)
+    return 0;
+  i32 cpu = topology_current_cpu();
+  return cpu >= 0 && cpu < CHIBA_TP_MAX_CPUS ? pool->cpu_node[cpu] : 0;
+}
+
+/* Wake up to `n` parked threads, if any, after `n` jobs were queued. The
+ * threads of `node` go first; other nodes only if none of them waits.
+ * Splitters parked in parallel_join_wait are woken as well, so that they
+ * help with the halves a thief fans out. */
+UTILS void thread_pool_notify_n(chiba_thread_pool *pool, i32 node, u64 n) {
+  if (n == 0)
+    return;
+  chiba_event_notify(&pool->joined, n < UINT32_MAX ? (u32)n : UINT32_MAX);
+  for (i32 i = 0; i < pool->num_nodes; i++) {
+    chiba_thread_pool_jobqueue *jq =
+        pool->jobqueues[(node + i) % pool->num_nodes];
+    if (chiba_event_notify(&jq->has_jobs,
+                           n < UINT32_MAX ? (u32)n : UINT32_MAX))
+      return;
+  }
+}
+
+/* Wake every parked thread */
+UTILS void thread_pool_notify_all(chiba_thread_pool *pool) {
+  for (i32 i = 0; i < pool->num_nodes; i++)
+    chiba_event_notify_all(&pool->jobqueues[i]->has_jobs);
+}
+
+/* Queue a job on the calling worker's deque, or on the injector when called
+ * from outside the pool */
+UTILS void thread_pool_push(chiba_thread_pool *pool,
+                            chiba_thread_pool_job *job) {
+  atomic_fetch_add_explicit(&pool->num_jobs_pending, 1, memory_order_relaxed);
+  chiba_thread *self = thread_pool_self(pool);
+  i32 node = thread_pool_node(pool, self);
+  if (self) {
+    if (unlikely(!chiba_wsqueue_push(self->deque, job, true)))
+      CHIBA_PANIC("Could not grow the deque of thread %d\n", self->id);
+  } else {
+    jobqueue_push(pool->jobqueues[node], job);
+  }
+  thread_pool_notify_n(pool, node, 1);
+}
+
+/* A job has finished running */
+UTILS void thread_pool_job_done(chiba_thread_pool *pool) {
+  if (atomic_fetch_sub_explicit(&pool->num_jobs_pending, 1,
+                                memory_order_acq_rel) == 1) {
+    pthread_mutex_lock(&pool->thcount_lock);
+    pthread_cond_broadcast(&pool->threads_all_idle);
+    pthread_mutex_unlock(&pool->thcount_lock);
+  }
+}
+
+UTILS bool thread_pool_has_jobs(chiba_thread_pool *pool) {
+  for (i32 i = 0; i < pool->num_nodes; i++) {
+    if (!jobqueue_is_empty(pool->jobqueues[i]))
+      return true;
+  }
+  for (i32 n = 0; n < pool->num_threads; n++) {
+    if (!chiba_wsqueue_is_empty(pool->threads[n]->deque))
+      return true;
+  }
+  return false;
+}
+
+/* Find a job for the calling thread: own deque, injectors starting with
+ * its node's, then a random victim's deque, on its node first. `self` is
+ * NULL when called from outside the pool. */
+UTILS chiba_thread_pool_job *thread_pool_find_job(chiba_thread_pool *pool,
+                                                  chiba_thread *self) {
+  chiba_thread_pool_job *job;
+  if (self &&
+      (job = (chiba_thread_pool_job *)chiba_wsqueue_pop(self->deque)))
+    return job;
+  i32 node = thread_pool_node(pool, self);
+  for (i32 i = 0; i < pool->num_nodes; i++) {
+    if ((job = jobqueue_pull(pool->jobqueues[(node + i) % pool->num_nodes])))
+      return job;
+  }
+  u64 *rng = self ? &self->rng : &external_rng;
+  *rng ^= *rng << 13;
+  *rng ^= *rng >> 7;
+  *rng ^= *rng << 17;
+  i32 start = (i32)(*rng % (u64)pool->num_threads);
+  for (i32 remote = 0; remote < (pool->num_nodes > 1 ? 2 : 1); remote++) {
+    for (i32 n = 0; n < pool->num_threads; n++) {
+      chiba_thread *victim = pool->threads[(start + n) % pool->num_threads];
+      if (victim == self || (victim->node != node) != remote ||
+          chiba_wsqueue_is_empty(victim->deque))
+        continue;
+      if ((job = (chiba_thread_pool_job *)chiba_wsqueue_steal(victim->deque)))
+        return job;
+    }
+  }
+  return NULL;
+}
+
+/* Run a job found by thread_pool_find_job. The job goes back to the slab
+ * first so that jobs it submits can reuse it. */
+UTILS void thread_pool_run_job(chiba_thread_pool *pool, chiba_thread *self,
+                               chiba_thread_pool_job *job) {
+  void (*func_buff)(anyptr) = job->entry;
+  anyptr arg_buff = job->arg;
+  jobcache_put(job, self ? &self->jobs : NULL);
+  func_buff(arg_buff);
+  thread_pool_job_done(pool);
+}
+
+/* Park the calling thread until a job is queued, the pool is resumed or
+ * dropped */
+UTILS void thread_park(chiba_thread_pool *pool, chiba_thread *thread_p) {
+  chiba_event *ev = &pool->jobqueues[thread_p->node]->has_jobs;
+  u32 key = chiba_event_prepare(ev);
+  if (atomic_load(&pool->keepalive) &&
+      (atomic_load(&pool->on_hold) || !thread_pool_has_jobs(pool)))
+    chiba_event_wait(ev, key);
+  else
+    chiba_event_cancel(ev);
+}
+
+/* Job of chiba_thread_pool_submit. Its argument is the future's control
+ * block, carrying the strong reference taken at submission. */
+PRIVATE void thread_pool_future_job(anyptr arg) {
+  chiba_shared_ptr ptr = {.control = (chiba_control_block *)arg};
+  chiba_future *future = (chiba_future *)chiba_shared_get(&ptr);
+  FutureState expected = FUTURE_PENDING;
+  /* A future cancelled before it ran skips its task */
+  if (atomic_compare_exchange_strong(&future->state, &expected,
+                                     FUTURE_RUNNING)) {
+    future->worker_tid = pthread_self();
+    chiba_future_complete(ptr, future->task(future->task_arg));
   }
+  chiba_shared_drop(&ptr);
+}
+
+/* Forget a job that will never run, failing its future if it has one */
+UTILS void thread_pool_discard(chiba_thread_pool_job *job) {
+  if (job->entry != thread_pool_future_job)
+    return;
+  chiba_shared_ptr ptr = {.control = (chiba_control_block *)job->arg};
+  chiba_future_fail(ptr, FUTURE_ERR_POOL_SHUTDOWN);
+  chiba_shared_drop(&ptr);
 }
 
+/* ============================ THREADS ============================= */
+
 /* What each thread is doing
  *
  * In principle this is an endless loop. The only time this loop gets
- * interrupted is once chiba_thread_pooldestroy() is invoked or the program
- * exits.
+ * interrupted is once chiba_thread_pool_drop() is invoked.
  *
  * @param  thread        thread that will run this function
  * @return nothing
@@ -70,7 +319,7 @@ UTILS anyptr thread_do(chiba_thread *thread_p) {
 #if defined(__linux__)
   char thread_name[16] = {0};
   snprintf(thread_name, 16,
-           "CHIBA_TP_THREAD"
+           "CHIBA_TP"
            "-%d",
            thread_p->id);
   /* Use prctl instead to prevent using _GNU_SOURCE flag and implicit
@@ -79,85 +328,161 @@ UTILS anyptr thread_do(chiba_thread *thread_p) {
 #elif defined(__APPLE__) && defined(__MACH__)
   char thread_name[16] = {0};
   snprintf(thread_name, 16,
-           "CHIBA_TP_THREAD"
+           "CHIBA_TP"
            "-%d",
            thread_p->id);
   pthread_setname_np(thread_name);
 #elif defined(__FreeBSD__) || defined(__OpenBSD__)
   char thread_name[16] = {0};
   snprintf(thread_name, 16,
-           "CHIBA_TP_THREAD"
+           "CHIBA_TP"
            "-%d",
            thread_p->id);
   pthread_set_name_np(thread_p->pthread, thread_name);
 #else
 #endif
 
-  /* Assure all threads have been created before starting serving */
   chiba_thread_pool *pool = thread_p->pool;
+  thread_self = thread_p;
 
-  /* Register signal handler */
-  // struct sigaction act;
-  // sigemptyset(&act.sa_mask);
-  // act.sa_flags = SA_ONSTACK;
-  // act.sa_handler = thread_hold;
-  // if (sigaction(SIGUSR1, &act, NULL) == -1) {
-  //   err("thread_do(): cannot handle SIGUSR1");
-  // }
-
-  /* Mark thread as alive (initialized) */
-  pthread_mutex_lock(&pool->thcount_lock);
-  pool->num_threads_alive += 1;
-  pthread_mutex_unlock(&pool->thcount_lock);
-
-  while (threads_keepalive) {
-
-    chiba_sem_wait(pool->jobqueue->has_jobs);
-
-    if (threads_keepalive) {
-      pthread_mutex_lock(&pool->thcount_lock);
-      pool->num_threads_working++;
-      pthread_mutex_unlock(&pool->thcount_lock);
+  /* Move to the assigned CPUs first, so that the deque and the job chunks
+   * this thread allocates are first touched on its node */
+  if (thread_p->bind)
+    topology_bind(thread_p->affinity);
+  thread_p->deque = chiba_wsqueue_new(CHIBA_TP_DEQUE_CAP);
+  if (thread_p->deque == NULL)
+    CHIBA_PANIC("Could not allocate the deque of thread %d\n", thread_p->id);
 
-      /* Read job from queue and execute it */
-      void (*func_buff)(anyptr);
-      anyptr arg_buff;
-      chiba_thread_pool_job *job_p = jobqueue_pull(pool->jobqueue);
-      if (job_p) {
-        func_buff = job_p->entry;
-        arg_buff = job_p->arg;
-        func_buff(arg_buff);
-        CHIBA_INTERNAL_free(job_p);
-      }
+  /* Mark thread as alive (initialized), then wait for every other deque to
+   * exist before stealing from them */
+  atomic_fetch_add(&pool->num_threads_alive, 1);
+  while (atomic_load(&pool->num_threads_alive) < pool->num_threads)
+    sched_yield();
 
-      pthread_mutex_lock(&pool->thcount_lock);
-      pool->num_threads_working--;
-      if (!pool->num_threads_working) {
-        pthread_cond_signal(&pool->threads_all_idle);
-      }
-      pthread_mutex_unlock(&pool->thcount_lock);
+  chiba_backoff b = {.step = 0};
+  while (atomic_load_explicit(&pool->keepalive, memory_order_acquire)) {
+    chiba_thread_pool_job *job_p = NULL;
+    if (!atomic_load_explicit(&pool->on_hold, memory_order_relaxed))
+      job_p = thread_pool_find_job(pool, thread_p);
+    if (job_p) {
+      thread_pool_run_job(pool, thread_p, job_p);
+      b.step = 0;
+    } else if (!backoff_is_completed(&b)) {
+      backoff_snooze(&b);
+    } else {
+      thread_park(pool, thread_p);
+      b.step = 0;
     }
   }
-  pthread_mutex_lock(&pool->thcount_lock);
-  pool->num_threads_alive--;
-  pthread_mutex_unlock(&pool->thcount_lock);
+
+  thread_self = NULL;
+  atomic_fetch_sub(&pool->num_threads_alive, 1);
   return NULL;
 }
 
 /* Frees a thread  */
 static void thread_destroy(chiba_thread *thread_p) {
+  chiba_wsqueue_drop(thread_p->deque);
   CHIBA_INTERNAL_free(thread_p);
 }
 
 /* ========================== THREADPOOL ============================ */
 
+/* Decide where each worker runs and which node it belongs to, and map the
+ * CPUs to the pool's nodes */
+UTILS void thread_pool_place(chiba_thread_pool *pool,
+                             const chiba_thread_pool_config *config) {
+  chiba_topology topo;
+  if (!topology_load(&topo))
+    CHIBA_PANIC("Could not read the CPU topology\n");
+  if (config->pinning == CHIBA_TP_PIN_CORES)
+    topology_spread(&topo);
+
+  /* OS node of each worker, -1 if it is not pinned */
+  i32 *os_node = (i32 *)CHIBA_INTERNAL_malloc(sizeof(i32) *
+                                              (u64)pool->num_threads);
+  if (os_node == NULL)
+    CHIBA_PANIC("Could not allocate memory for thread placement\n");
+  for (i32 n = 0; n < pool->num_threads; n++) {
+    chiba_thread *thread_p = pool->threads[n];
+    i32 cpu = -1;
+    if (config->cpus)
+      cpu = config->cpus[n % config->num_cpus];
+    else if (config->pinning != CHIBA_TP_PIN_NONE)
+      cpu = topo.cpus[n % topo.num_cpus].cpu;
+    if (cpu >= 0 && cpu < CHIBA_TP_MAX_CPUS) {
+      thread_p->bind = true;
+      thread_p->affinity[cpu / 64] |= 1ULL << (cpu % 64);
+      os_node[n] = topology_node_of(&topo, cpu);
+    } else {
+      /* Unpinned workers are spread over the nodes in proportion to their
+       * CPUs; topo.cpus is ordered by node unless spread */
+      os_node[n] = config->numa ? topo.cpus[(i64)n * topo.num_cpus /
+                                            pool->num_threads]
+                                      .node
+                                : -1;
+    }
+  }
+
+  /* Number the nodes that got workers densely */
+  i32 dense[CHIBA_TP_MAX_CPUS];
+  for (i32 i = 0; i < CHIBA_TP_MAX_CPUS; i++)
+    dense[i] = -1;
+  pool->num_nodes = 0;
+  for (i32 n = 0; n < pool->num_threads; n++) {
+    i32 node = config->numa && os_node[n] >= 0 ? os_node[n] : -1;
+    if (node >= 0 && node < CHIBA_TP_MAX_CPUS && dense[node] < 0)
+      dense[node] = pool->num_nodes++;
+    pool->threads[n]->node = node >= 0 ? dense[node] : 0;
+  }
+  if (pool->num_nodes == 0)
+    pool->num_nodes = 1;
+
+  if (pool->num_nodes > 1) {
+    pool->cpu_node =
+        (i32 *)CHIBA_INTERNAL_malloc(sizeof(i32) * CHIBA_TP_MAX_CPUS);
+    if (pool->cpu_node == NULL)
+      CHIBA_PANIC("Could not allocate memory for the CPU map\n");
+    memset(pool->cpu_node, 0, sizeof(i32) * CHIBA_TP_MAX_CPUS);
+    for (i32 i = 0; i < topo.num_cpus; i++) {
+      i32 node = topo.cpus[i].node;
+      if (topo.cpus[i].cpu < CHIBA_TP_MAX_CPUS && dense[node] >= 0)
+        pool->cpu_node[topo.cpus[i].cpu] = dense[node];
+    }
+    /* Unpinned workers still stay on their node */
+    for (i32 n = 0; n < pool->num_threads; n++) {
+      chiba_thread *thread_p = pool->threads[n];
+      if (thread_p->bind)
+        continue;
+      thread_p->bind = true;
+      for (i32 i = 0; i < topo.num_cpus; i++) {
+        i32 cpu = topo.cpus[i].cpu;
+        if (topo.cpus[i].node == os_node[n] && cpu < CHIBA_TP_MAX_CPUS)
+          thread_p->affinity[cpu / 64] |= 1ULL << (cpu % 64);
+      }
+    }
+  }
+
+  CHIBA_INTERNAL_free(os_node);
+  topology_drop(&topo);
+}
+
 /* Initialise thread pool */
 PUBLIC chiba_thread_pool *chiba_thread_pool_new() {
+  return chiba_thread_pool_new_with(NULL);
+}
 
-  threads_on_hold = 0;
-  threads_keepalive = 1;
+/* Initialise thread pool as configured, defaults for a NULL config */
+PUBLIC chiba_thread_pool *
+chiba_thread_pool_new_with(const chiba_thread_pool_config *config) {
+  chiba_thread_pool_config defaults = {0};
+  if (config == NULL)
+    config = &defaults;
+  if (config->num_threads < 0 || (config->cpus && config->num_cpus <= 0))
+    CHIBA_PANIC("Invalid thread pool config\n");
 
-  i32 num_threads = (i32)get_cpu_count();
+  i32 num_threads =
+      config->num_threads > 0 ? config->num_threads : (i32)get_cpu_count();
 
   /* Make new thread pool */
   chiba_thread_pool *pool;
@@ -167,40 +492,55 @@ PUBLIC chiba_thread_pool *chiba_thread_pool_new() {
     CHIBA_PANIC("Could not allocate memory for thread pool\n");
     return NULL;
   }
-  pool->num_threads_alive = 0;
-  pool->num_threads_working = 0;
-
-  /* Initialise the job queue */
-  pool->jobqueue = jobqueue_new();
-  if (!pool->jobqueue) {
-    CHIBA_PANIC("Could not allocate memory for job queue\n");
-    CHIBA_INTERNAL_free(pool);
-    return NULL;
-  }
+  pool->num_threads = num_threads;
+  atomic_init(&pool->num_threads_alive, 0);
+  atomic_init(&pool->num_jobs_pending, 0);
+  atomic_init(&pool->keepalive, true);
+  atomic_init(&pool->on_hold, false);
+  pool->external.free = NULL;
+  atomic_init(&pool->external.inbox, NULL);
+  atomic_init(&pool->external.locker, false);
+  atomic_init(&pool->chunks, NULL);
+  chiba_event_init(&pool->joined);
+  pool->cpu_node = NULL;
 
   /* Make threads in pool */
   pool->threads = (chiba_thread **)CHIBA_INTERNAL_malloc(
       num_threads * sizeof(chiba_thread *));
   if (pool->threads == NULL) {
     CHIBA_PANIC("Could not allocate memory for threads\n");
-    jobqueue_destroy(pool->jobqueue);
     CHIBA_INTERNAL_free(pool);
     return NULL;
   }
+  i32 n;
+  for (n = 0; n < num_threads; n++)
+    thread_init(pool, &pool->threads[n], n);
+  thread_pool_place(pool, config);
+
+  /* Initialise the job queues */
+  pool->jobqueues = (chiba_thread_pool_jobqueue **)CHIBA_INTERNAL_malloc(
+      sizeof(chiba_thread_pool_jobqueue *) * (u64)pool->num_nodes);
+  if (pool->jobqueues == NULL) {
+    CHIBA_PANIC("Could not allocate memory for job queue\n");
+    return NULL;
+  }
+  for (i32 i = 0; i < pool->num_nodes; i++)
+    pool->jobqueues[i] = jobqueue_new();
 
+  pthread_mutex_init(&pool->thcount_lock, NULL);
   pthread_cond_init(&pool->threads_all_idle, NULL);
 
-  /* Thread init */
-  i32 n;
+  /* Threads allocate their own deques and wait for each other before
+   * stealing */
   for (n = 0; n < num_threads; n++) {
-    thread_init(pool, &pool->threads[n], n);
+    thread_start(pool->threads[n]);
 #if THPOOL_DEBUG
     printf("THPOOL_DEBUG: Created thread %d in pool \n", n);
 #endif
   }
 
   /* Wait for threads to initialize */
-  while (pool->num_threads_alive != num_threads) {
+  while (atomic_load(&pool->num_threads_alive) != num_threads) {
   }
 
   return pool;
@@ -210,10 +550,7 @@ PUBLIC chiba_thread_pool *chiba_thread_pool_new() {
 PUBLIC i32 chiba_thread_pool_add_work(chiba_thread_pool *pool,
                                       void (*function_p)(anyptr),
                                       anyptr arg_p) {
-  chiba_thread_pool_job *newjob;
-
-  newjob = (chiba_thread_pool_job *)CHIBA_INTERNAL_malloc(
-      sizeof(chiba_thread_pool_job));
+  chiba_thread_pool_job *newjob = thread_pool_job_new(pool);
   if (newjob == NULL) {
     CHIBA_PANIC("Could not allocate memory for new job\n");
     return -1;
@@ -224,73 +561,489 @@ PUBLIC i32 chiba_thread_pool_add_work(chiba_thread_pool *pool,
   newjob->arg = arg_p;
 
   /* add job to queue */
-  jobqueue_push(pool->jobqueue, newjob);
+  thread_pool_push(pool, newjob);
 
   return 0;
 }
 
+/* Add n jobs at once. Jobs are queued in groups of CHIBA_TP_SUBMIT_BATCH,
+ * each taking one reservation of the injector, and parked threads are woken
+ * once at the end rather than once per job. */
+PUBLIC i32 chiba_thread_pool_add_work_batch(chiba_thread_pool *pool,
+                                            void (*entries[])(anyptr),
+                                            anyptr args[], u64 n) {
+  chiba_thread_pool_job *jobs[CHIBA_TP_SUBMIT_BATCH];
+  chiba_thread *self = thread_pool_self(pool);
+  i32 node = thread_pool_node(pool, self);
+  u64 queued = 0, announced = 0;
+
+  atomic_fetch_add_explicit(&pool->num_jobs_pending, (i64)n,
+                            memory_order_relaxed);
+  while (queued < n) {
+    u32 m = (u32)(n - queued < CHIBA_TP_SUBMIT_BATCH ? n - queued
+                                                     : CHIBA_TP_SUBMIT_BATCH);
+    if (!thread_pool_jobs_new(pool, jobs, m)) {
+      CHIBA_PANIC("Could not allocate memory for new jobs\n");
+      return -1;
+    }
+    for (u32 i = 0; i < m; i++) {
+      jobs[i]->entry = entries[queued + i];
+      jobs[i]->arg = args[queued + i];
+    }
+
+    if (self) {
+      for (u32 i = 0; i < m; i++) {
+        if (unlikely(!chiba_wsqueue_push(self->deque, jobs[i], true)))
+          CHIBA_PANIC("Could not grow the deque of thread %d\n", self->id);
+      }
+      queued += m;
+      continue;
+    }
+
+    chiba_backoff b = {.step = 0};
+    u32 pushed = 0;
+    while (pushed < m) {
+      u64 k = chiba_arrayqueue_push_n(pool->jobqueues[node]->jobs,
+                                      (anyptr *)jobs + pushed, m - pushed);
+      if (k) {
+        pushed += (u32)k;
+        queued += k;
+        continue;
+      }
+      /* Injector full: let parked threads drain what is already queued */
+      thread_pool_notify_n(pool, node, queued - announced);
+      announced = queued;
+      backoff_snooze(&b);
+    }
+  }
+  thread_pool_notify_n(pool, node, queued - announced);
+
+  return 0;
+}
+
+/* Add a job whose result is delivered through the returned future. Drop
+ * the future when done with it; a null pointer means out of memory. */
+PUBLIC chiba_shared_ptr chiba_thread_pool_submit(chiba_thread_pool *pool,
+                                                 anyptr (*function_p)(anyptr),
+                                                 anyptr arg_p) {
+  chiba_shared_ptr future = chiba_future_init();
+  chiba_future *f = (chiba_future *)chiba_shared_get(&future);
+  if (f == NULL)
+    return chiba_shared_null();
+  f->task = function_p;
+  f->task_arg = arg_p;
+
+  /* The job owns a second reference until it has run */
+  chiba_shared_ptr job_ref = chiba_shared_clone(&future);
+  if (chiba_thread_pool_add_work(pool, thread_pool_future_job,
+                                 job_ref.control) != 0) {
+    chiba_shared_drop(&job_ref);
+    chiba_shared_drop(&future);
+  }
+  return future;
+}
+
 /* Wait until all jobs have finished */
 PUBLIC void chiba_thread_pool_wait(chiba_thread_pool *pool) {
   pthread_mutex_lock(&pool->thcount_lock);
-  while (jobqueue_is_empty(pool->jobqueue) || pool->num_threads_working) {
+  while (atomic_load(&pool->num_jobs_pending)) {
     pthread_cond_wait(&pool->threads_all_idle, &pool->thcount_lock);
   }
   pthread_mutex_unlock(&pool->thcount_lock);
 }
 
-/* Pause all threads in threadpool */
-void chiba_thread_pool_pause(chiba_thread_pool *pool) {
-  i32 n;
-  for (n = 0; n < pool->num_threads_alive; n++) {
-    pthread_kill(pool->threads[n]->pthread, SIGUSR1);
-  }
+/* Pause all threads in threadpool; running jobs finish first */
+PUBLIC void chiba_thread_pool_pause(chiba_thread_pool *pool) {
+  atomic_store(&pool->on_hold, true);
 }
 
 /* Resume all threads in threadpool */
 PUBLIC void chiba_thread_pool_resume(chiba_thread_pool *pool) {
-  // resuming a single threadpool hasn't been
-  // implemented yet, meanwhile this suppresses
-  // the warnings
-  (void)pool;
-
-  threads_on_hold = 0;
+  atomic_store(&pool->on_hold, false);
+  thread_pool_notify_all(pool);
 }
 
-/* Destroy the threadpool */
+/* Destroy the threadpool. Jobs still queued are discarded. */
 PUBLIC void chiba_thread_pool_drop(chiba_thread_pool *pool) {
   /* No need to destroy if it's NULL */
   if (pool == NULL)
     return;
 
-  volatile i32 threads_total = pool->num_threads_alive;
-
   /* End each thread 's infinite loop */
-  threads_keepalive = 0;
+  atomic_store(&pool->keepalive, false);
+  thread_pool_notify_all(pool);
+  i32 n;
+  for (n = 0; n < pool->num_threads; n++)
+    pthread_join(pool->threads[n]->pthread, NULL);
 
-  /* Give one second to kill idle threads */
-  double TIMEOUT = 1.0;
-  time_t start, end;
-  double tpassed = 0.0;
-  time(&start);
-  while (tpassed < TIMEOUT && pool->num_threads_alive) {
-    chiba_sem_post_all(pool->jobqueue->has_jobs);
-    time(&end);
-    tpassed = difftime(end, start);
+  /* Job queue cleanup; queued jobs live in the slab, their futures fail
+   * with FUTURE_ERR_POOL_SHUTDOWN */
+  chiba_thread_pool_job *job_p;
+  for (n = 0; n < pool->num_nodes; n++) {
+    while ((job_p = jobqueue_pull(pool->jobqueues[n])))
+      thread_pool_discard(job_p);
   }
-
-  /* Poll remaining threads */
-  while (pool->num_threads_alive) {
-    chiba_sem_post_all(pool->jobqueue->has_jobs);
-    sleep(1);
+  for (n = 0; n < pool->num_threads; n++) {
+    while ((job_p = (chiba_thread_pool_job *)chiba_wsqueue_pop(
+                pool->threads[n]->deque)))
+      thread_pool_discard(job_p);
   }
-
-  /* Job queue cleanup */
-  jobqueue_destroy(pool->jobqueue);
+  for (n = 0; n < pool->num_nodes; n++)
+    jobqueue_destroy(pool->jobqueues[n]);
+  CHIBA_INTERNAL_free(pool->jobqueues);
+  CHIBA_INTERNAL_free(pool->cpu_node);
+  jobchunks_drop(&pool->chunks);
   /* Deallocs */
-  i32 n;
-  for (n = 0; n < threads_total; n++) {
+  for (n = 0; n < pool->num_threads; n++) {
     thread_destroy(pool->threads[n]);
   }
+  chiba_event_drop(&pool->joined);
+  pthread_mutex_destroy(&pool->thcount_lock);
+  pthread_cond_destroy(&pool->threads_all_idle);
   CHIBA_INTERNAL_free(pool->threads);
   CHIBA_INTERNAL_free(pool);
 }
+
+/* ============================ PARALLEL ============================ */
+
+/* Parallel loops
+ *
+ * A range larger than the grain is split in half: the right half is
+ * submitted as a job, the splitting thread carries on with the left half.
+ * Submitted halves land on the splitter's deque when it is a worker, so an
+ * idle worker steals the biggest pending half. Once done with its half, the
+ * splitter runs pending jobs itself, most likely its own right half, until
+ * that half has finished. The calling thread takes part the same way.
+ * Split descriptors live on the splitters' stacks; jobs come from the slab.
+ */
+
+typedef struct parallel_desc {
+  chiba_thread_pool *pool;
+  i64 grain;
+  void (*body)(i64 begin, i64 end, anyptr ctx);
+  anyptr (*reduce)(i64 begin, i64 end, anyptr acc, anyptr ctx);
+  anyptr (*join)(anyptr left, anyptr right, anyptr ctx);
+  anyptr identity;
+  anyptr ctx;
+} parallel_desc;
+
+typedef struct parallel_range {
+  parallel_desc *desc;
+  i64 begin;
+  i64 end;
+  anyptr acc;          /* right half's result        */
+  _Atomic(bool) done;  /* set once acc is final      */
+} parallel_range;
+
+PRIVATE anyptr parallel_run(parallel_desc *d, i64 begin, i64 end, anyptr acc);
+
+PRIVATE void parallel_job(anyptr arg) {
+  parallel_range *r = (parallel_range *)arg;
+  chiba_thread_pool *pool = r->desc->pool;
+  r->acc = parallel_run(r->desc, r->begin, r->end, r->desc->identity);
+  /* r belongs to the splitter's stack, which may unwind right after this */
+  atomic_store_explicit(&r->done, true, memory_order_release);
+  chiba_event_notify_all(&pool->joined);
+}
+
+/* Run other jobs until `done` is set, then park on the pool's joined
+ * eventcount once there is nothing left to help with. Finished halves and
+ * newly queued jobs both notify it. */
+PRIVATE void parallel_join_wait(chiba_thread_pool *pool, _Atomic(bool) *done) {
+  chiba_thread *self = thread_pool_self(pool);
+  chiba_backoff b = {.step = 0};
+  while (!atomic_load_explicit(done, memory_order_acquire)) {
+    chiba_thread_pool_job *job = thread_pool_find_job(pool, self);
+    if (job) {
+      thread_pool_run_job(pool, self, job);
+      b.step = 0;
+    } else if (!backoff_is_completed(&b)) {
+      backoff_snooze(&b);
+    } else {
+      u32 key = chiba_event_prepare(&pool->joined);
+      if (atomic_load_explicit(done, memory_order_acquire) ||
+          thread_pool_has_jobs(pool))
+        chiba_event_cancel(&pool->joined);
+      else
+        chiba_event_wait(&pool->joined, key);
+      b.step = 0;
+    }
+  }
+}
+
+PRIVATE anyptr parallel_run(parallel_desc *d, i64 begin, i64 end, anyptr acc) {
+  if (end - begin <= d->grain) {
+    if (d->reduce)
+      return d->reduce(begin, end, acc, d->ctx);
+    d->body(begin, end, d->ctx);
+    return acc;
+  }
+  i64 mid = begin + (end - begin) / 2;
+  parallel_range right = {.desc = d, .begin = mid, .end = end, .acc = NULL};
+  atomic_init(&right.done, false);
+  chiba_thread_pool_add_work(d->pool, parallel_job, &right);
+  acc = parallel_run(d, begin, mid, acc);
+  parallel_join_wait(d->pool, &right.done);
+  return d->join ? d->join(acc, right.acc, d->ctx) : acc;
+}
+
+/* Default grain: about eight ranges per thread */
+UTILS i64 parallel_grain(chiba_thread_pool *pool, i64 begin, i64 end,
+                         i64 grain) {
+  if (grain > 0)
+    return grain;
+  grain = (end - begin) / ((i64)pool->num_threads * 8);
+  return grain > 0 ? grain : 1;
+}
+
+/* Run body over [begin, end) in ranges of at most `grain` indices, or an
+ * automatic grain when grain <= 0. Returns once every range has run. */
+PUBLIC void chiba_parallel_for(chiba_thread_pool *pool, i64 begin, i64 end,
+                               i64 grain,
+                               void (*body)(i64 begin, i64 end, anyptr ctx),
+                               anyptr ctx) {
+  if (end <= begin)
+    return;
+  parallel_desc d = {.pool = pool,
+                     .grain = parallel_grain(pool, begin, end, grain),
+                     .body = body,
+                     .ctx = ctx};
+  parallel_run(&d, begin, end, NULL);
+}
+
+/* Fold [begin, end) into one value. Every range starts from `identity` and
+ * is folded by body; adjacent results are combined left to right by join,
+ * so join only needs to be associative. */
+PUBLIC anyptr chiba_parallel_reduce(
+    chiba_thread_pool *pool, i64 begin, i64 end, i64 grain, anyptr identity,
+    anyptr (*body)(i64 begin, i64 end, anyptr acc, anyptr ctx),
+    anyptr (*join)(anyptr left, anyptr right, anyptr ctx), anyptr ctx) {
+  if (end <= begin)
+    return identity;
+  parallel_desc d = {.pool = pool,
+                     .grain = parallel_grain(pool, begin, end, grain),
+                     .reduce = body,
+                     .join = join,
+                     .identity = identity,
+                     .ctx = ctx};
+  return parallel_run(&d, begin, end, identity);
+}
+
+/* ========================== TASK GRAPHS =========================== */
+
+/* Task graphs
+ *
+ * Every task counts its unfinished predecessors; there is no scheduler. The
+ * thread finishing a task decrements the counters of its successors and
+ * queues those reaching zero itself, onto its own deque when it is a worker,
+ * so a successor runs on the core that produced its inputs unless an idle
+ * worker steals it. The last successor made ready is not queued at all: the
+ * same job runs it next. The graph is done once its count of unfinished
+ * tasks reaches zero, and waiting threads help run jobs like parallel_for
+ * splitters do.
+ */
+
+typedef struct chiba_task {
+  void (*entry)(anyptr arg); /* function pointer          */
+  anyptr arg;                /* function's argument       */
+  chiba_task_graph *graph;
+  chiba_task **succ; /* tasks waiting for this one */
+  i32 num_succ;
+  i32 cap_succ;
+  i32 num_preds;         /* edges into this task      */
+  _Atomic(i32) pending;  /* predecessors not finished */
+} chiba_task;
+
+typedef struct chiba_task_graph {
+  chiba_thread_pool *pool;
+  chiba_task **tasks;
+  i32 num_tasks;
+  i32 cap_tasks;
+  chiba_task **order; /* topological order, NULL after a change */
+  i32 num_roots;      /* tasks without predecessors lead order  */
+  _Atomic(i32) remaining; /* tasks of the current run left */
+  _Atomic(bool) done;     /* no run in progress            */
+} chiba_task_graph;
+
+/* Append to a growable array of tasks */
+UTILS void task_list_push(chiba_task ***list, i32 *len, i32 *cap,
+                          chiba_task *task) {
+  if (*len == *cap) {
+    i32 cap_new = *cap ? *cap * 2 : 4;
+    chiba_task **grown = (chiba_task **)CHIBA_INTERNAL_realloc(
+        *list, sizeof(chiba_task *) * (u64)cap_new);
+    if (grown == NULL)
+      CHIBA_PANIC("Could not allocate memory for task graph\n");
+    *list = grown;
+    *cap = cap_new;
+  }
+  (*list)[(*len)++] = task;
+}
+
+UTILS void task_graph_changed(chiba_task_graph *graph) {
+  if (!atomic_load_explicit(&graph->done, memory_order_acquire))
+    CHIBA_PANIC("Task graph changed while running\n");
+  CHIBA_INTERNAL_free(graph->order);
+  graph->order = NULL;
+}
+
+/* Sort the tasks topologically, roots first, and refuse cycles */
+UTILS void task_graph_sort(chiba_task_graph *graph) {
+  chiba_task **order = (chiba_task **)CHIBA_INTERNAL_malloc(
+      sizeof(chiba_task *) * (u64)graph->num_tasks);
+  if (order == NULL)
+    CHIBA_PANIC("Could not allocate memory for task graph\n");
+  i32 len = 0;
+  for (i32 i = 0; i < graph->num_tasks; i++) {
+    chiba_task *task = graph->tasks[i];
+    atomic_store_explicit(&task->pending, task->num_preds,
+                          memory_order_relaxed);
+    if (task->num_preds == 0)
+      order[len++] = task;
+  }
+  graph->num_roots = len;
+  for (i32 i = 0; i < len; i++) {
+    chiba_task *task = order[i];
+    for (i32 s = 0; s < task->num_succ; s++) {
+      if (atomic_fetch_sub_explicit(&task->succ[s]->pending, 1,
+                                    memory_order_relaxed) == 1)
+        order[len++] = task->succ[s];
+    }
+  }
+  if (len != graph->num_tasks)
+    CHIBA_PANIC("Task graph has a cycle\n");
+  graph->order = order;
+}
+
+/* Job running a task whose predecessors have all finished, then each
+ * successor it makes ready last */
+PRIVATE void task_graph_job(anyptr arg) {
+  chiba_task *task = (chiba_task *)arg;
+  chiba_task_graph *graph = task->graph;
+  chiba_thread_pool *pool = graph->pool;
+  while (task) {
+    task->entry(task->arg);
+    chiba_task *next = NULL;
+    for (i32 s = 0; s < task->num_succ; s++) {
+      chiba_task *succ = task->succ[s];
+      if (atomic_fetch_sub_explicit(&succ->pending, 1, memory_order_acq_rel) !=
+          1)
+        continue;
+      if (next)
+        chiba_thread_pool_add_work(pool, task_graph_job, next);
+      next = succ;
+    }
+    if (atomic_fetch_sub_explicit(&graph->remaining, 1,
+                                  memory_order_acq_rel) == 1) {
+      /* The graph may be dropped right after this */
+      atomic_store_explicit(&graph->done, true, memory_order_release);
+      chiba_event_notify_all(&pool->joined);
+      return;
+    }
+    task = next;
+  }
+}
+
+/* Make an empty graph running on `pool` */
+PUBLIC chiba_task_graph *chiba_task_graph_new(chiba_thread_pool *pool) {
+  chiba_task_graph *graph =
+      (chiba_task_graph *)CHIBA_INTERNAL_malloc(sizeof(chiba_task_graph));
+  if (graph == NULL) {
+    CHIBA_PANIC("Could not allocate memory for task graph\n");
+    return NULL;
+  }
+  graph->pool = pool;
+  graph->tasks = NULL;
+  graph->num_tasks = 0;
+  graph->cap_tasks = 0;
+  graph->order = NULL;
+  graph->num_roots = 0;
+  atomic_init(&graph->remaining, 0);
+  atomic_init(&graph->done, true);
+  return graph;
+}
+
+/* Add a task without edges */
+PUBLIC chiba_task *chiba_task_graph_add(chiba_task_graph *graph,
+                                        void (*function_p)(anyptr),
+                                        anyptr arg_p) {
+  task_graph_changed(graph);
+  chiba_task *task = (chiba_task *)CHIBA_INTERNAL_malloc(sizeof(chiba_task));
+  if (task == NULL) {
+    CHIBA_PANIC("Could not allocate memory for task\n");
+    return NULL;
+  }
+  task->entry = function_p;
+  task->arg = arg_p;
+  task->graph = graph;
+  task->succ = NULL;
+  task->num_succ = 0;
+  task->cap_succ = 0;
+  task->num_preds = 0;
+  atomic_init(&task->pending, 0);
+  task_list_push(&graph->tasks, &graph->num_tasks, &graph->cap_tasks, task);
+  return task;
+}
+
+/* Add an edge; both tasks must belong to the same graph */
+PUBLIC void chiba_task_precede(chiba_task *before, chiba_task *after) {
+  if (before->graph != after->graph)
+    CHIBA_PANIC("Tasks of different graphs cannot be linked\n");
+  task_graph_changed(before->graph);
+  task_list_push(&before->succ, &before->num_succ, &before->cap_succ, after);
+  after->num_preds++;
+}
+
+/* Start running the graph. Returns at once; the tasks without predecessors
+ * are queued together like chiba_thread_pool_add_work_batch. */
+PUBLIC void chiba_task_graph_submit(chiba_task_graph *graph) {
+  if (!atomic_load_explicit(&graph->done, memory_order_acquire))
+    CHIBA_PANIC("Task graph submitted while running\n");
+  if (graph->num_tasks == 0)
+    return;
+  if (graph->order == NULL)
+    task_graph_sort(graph);
+  for (i32 i = 0; i < graph->num_tasks; i++)
+    atomic_store_explicit(&graph->tasks[i]->pending,
+                          graph->tasks[i]->num_preds, memory_order_relaxed);
+  atomic_store_explicit(&graph->remaining, graph->num_tasks,
+                        memory_order_relaxed);
+  atomic_store_explicit(&graph->done, false, memory_order_relaxed);
+
+  /* Queueing publishes the counters to the workers */
+  void (*entries[CHIBA_TP_SUBMIT_BATCH])(anyptr);
+  for (i32 i = 0; i < CHIBA_TP_SUBMIT_BATCH; i++)
+    entries[i] = task_graph_job;
+  for (i32 i = 0; i < graph->num_roots; i += CHIBA_TP_SUBMIT_BATCH) {
+    i32 m = graph->num_roots - i < CHIBA_TP_SUBMIT_BATCH
+                ? graph->num_roots - i
+                : CHIBA_TP_SUBMIT_BATCH;
+    chiba_thread_pool_add_work_batch(graph->pool, entries,
+                                     (anyptr *)graph->order + i, (u64)m);
+  }
+}
+
+/* Wait until every task of the current run has finished, running other
+ * jobs of the pool meanwhile */
+PUBLIC void chiba_task_graph_wait(chiba_task_graph *graph) {
+  parallel_join_wait(graph->pool, &graph->done);
+}
+
+PUBLIC void chiba_task_graph_run(chiba_task_graph *graph) {
+  chiba_task_graph_submit(graph);
+  chiba_task_graph_wait(graph);
+}
+
+/* Free the graph and its tasks, after waiting for a run in progress */
+PUBLIC void chiba_task_graph_drop(chiba_task_graph *graph) {
+  if (graph == NULL)
+    return;
+  chiba_task_graph_wait(graph);
+  for (i32 i = 0; i < graph->num_tasks; i++) {
+    CHIBA_INTERNAL_free(graph->tasks[i]->succ);
+    CHIBA_INTERNAL_free(graph->tasks[i]);
+  }
+  CHIBA_INTERNAL_free(graph->tasks);
+  CHIBA_INTERNAL_free(graph->order);
+  CHIBA_INTERNAL_free(graph);
+}
@@ -1,14 +1,68 @@
 #pragma once
 #include "../basic_memory.h"
 #include "../concurrency/array_queue.h"
-#include "../utils/chiba_sem.h"
+#include "../concurrency/future.h"
 
 typedef struct chiba_thread_pool chiba_thread_pool;
 
+/* Where workers run */
+typedef enum {
+  CHIBA_TP_PIN_NONE = 0, /* let the OS schedule workers (default)          */
+  CHIBA_TP_PIN_CORES,    /* one worker per physical core, SMT siblings last */
+  CHIBA_TP_PIN_SIBLINGS, /* both SMT siblings of a core before the next     */
+} chiba_thread_pool_pinning;
+
+typedef struct chiba_thread_pool_config {
+  i32 num_threads; /* 0: get_cpu_count()                              */
+  chiba_thread_pool_pinning pinning;
+  const i32 *cpus; /* pin worker i to cpus[i % num_cpus], overrides pinning */
+  i32 num_cpus;
+  bool numa; /* group workers by NUMA node: per-node injector and parking,
+              * stealing within the node first, memory touched by the node;
+              * unpinned workers are bound to their node's CPUs */
+} chiba_thread_pool_config;
+
 chiba_thread_pool *chiba_thread_pool_new();
+/* Pinning is best effort: workers whose CPU cannot be used are left
+ * unpinned, and it is a no-op off Linux */
+chiba_thread_pool *chiba_thread_pool_new_with(const chiba_thread_pool_config *);
 i32 chiba_thread_pool_add_work(chiba_thread_pool *, void (*function_p)(anyptr),
                                anyptr arg_p);
+i32 chiba_thread_pool_add_work_batch(chiba_thread_pool *,
+                                     void (*entries[])(anyptr), anyptr args[],
+                                     u64 n);
+/* Submit a job returning a value; wait on it with chiba_future_wait */
+chiba_shared_ptr chiba_thread_pool_submit(chiba_thread_pool *,
+                                          anyptr (*function_p)(anyptr),
+                                          anyptr arg_p);
 void chiba_thread_pool_wait(chiba_thread_pool *);
 void chiba_thread_pool_pause(chiba_thread_pool *);
 void chiba_thread_pool_resume(chiba_thread_pool *);
 void chiba_thread_pool_drop(chiba_thread_pool *);
+
+/* Parallel loops over [begin, end), split recursively across the workers.
+ * The calling thread runs ranges too. grain <= 0 picks one. */
+void chiba_parallel_for(chiba_thread_pool *, i64 begin, i64 end, i64 grain,
+                        void (*body)(i64 begin, i64 end, anyptr ctx),
+                        anyptr ctx);
+anyptr chiba_parallel_reduce(
+    chiba_thread_pool *, i64 begin, i64 end, i64 grain, anyptr identity,
+    anyptr (*body)(i64 begin, i64 end, anyptr acc, anyptr ctx),
+    anyptr (*join)(anyptr left, anyptr right, anyptr ctx), anyptr ctx);
+
+/* Task graphs: tasks run as soon as all their predecessors have finished,
+ * with no barrier between levels. A graph can be run again once its last
+ * run has finished; add tasks and edges only while it is not running. */
+typedef struct chiba_task_graph chiba_task_graph;
+typedef struct chiba_task chiba_task;
+
+chiba_task_graph *chiba_task_graph_new(chiba_thread_pool *);
+chiba_task *chiba_task_graph_add(chiba_task_graph *, void (*function_p)(anyptr),
+                                 anyptr arg_p);
+/* `before` finishes before `after` starts */
+void chiba_task_precede(chiba_task *before, chiba_task *after);
+void chiba_task_graph_submit(chiba_task_graph *);
+void chiba_task_graph_wait(chiba_task_graph *);
+/* Submit and wait */
+void chiba_task_graph_run(chiba_task_graph *);
+void chiba_task_graph_drop(chiba_task_graph *);
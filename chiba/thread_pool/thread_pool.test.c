@@ -0,0 +1,467 @@
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "thread_pool.h"
+#include "../chiba_testing.h"
+#include "thread_pool_topology.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+TEST_GROUP(thread_pool);
+
+//////////
+// external submission
+//////////
+
+#define NJOBS 100000
+
+PRIVATE _Atomic(i64) job_sum = 0;
+
+PRIVATE void job_add(anyptr arg) {
+  atomic_fetch_add_explicit(&job_sum, (i64)(intptr_t)arg,
+                            memory_order_relaxed);
+}
+
+TEST_CASE(add_work_wait, thread_pool, "Every submitted job runs once", {
+  DESC(add_work_wait);
+
+  chiba_thread_pool *pool = chiba_thread_pool_new();
+  ASSERT_NOT_NULL(pool, "Pool created");
+  atomic_store(&job_sum, 0);
+  i64 failed = 0;
+  for (i64 i = 1; i <= NJOBS; i++)
+    failed += chiba_thread_pool_add_work(pool, job_add, (anyptr)(intptr_t)i);
+  ASSERT_EQ(0, failed, "Jobs queued");
+  chiba_thread_pool_wait(pool);
+  ASSERT_EQ((i64)NJOBS * (NJOBS + 1) / 2, atomic_load(&job_sum),
+            "Wait returned after the last job");
+  // The pool can be reused after a wait
+  ASSERT_EQ(0, chiba_thread_pool_add_work(pool, job_add, (anyptr)(intptr_t)1),
+            "Job queued");
+  chiba_thread_pool_wait(pool);
+  ASSERT_EQ((i64)NJOBS * (NJOBS + 1) / 2 + 1, atomic_load(&job_sum),
+            "Second round ran");
+  chiba_thread_pool_drop(pool);
+  return 0;
+})
+
+//////////
+// fan-out from inside the pool
+//////////
+
+#define FANOUT_DEPTH 14
+
+PRIVATE chiba_thread_pool *tree_pool = NULL;
+PRIVATE _Atomic(i64) leaves = 0;
+
+// Each job spawns two children until FANOUT_DEPTH; children land on the
+// spawning worker's deque and are stolen by the others
+PRIVATE void job_tree(anyptr arg) {
+  i64 depth = (i64)(intptr_t)arg;
+  if (depth == FANOUT_DEPTH) {
+    atomic_fetch_add_explicit(&leaves, 1, memory_order_relaxed);
+    return;
+  }
+  chiba_thread_pool_add_work(tree_pool, job_tree, (anyptr)(intptr_t)(depth + 1));
+  chiba_thread_pool_add_work(tree_pool, job_tree, (anyptr)(intptr_t)(depth + 1));
+}
+
+TEST_CASE(nested_fanout, thread_pool, "Jobs submitted by jobs", {
+  DESC(nested_fanout);
+
+  tree_pool = chiba_thread_pool_new();
+  atomic_store(&leaves, 0);
+  chiba_thread_pool_add_work(tree_pool, job_tree, (anyptr)(intptr_t)0);
+  chiba_thread_pool_wait(tree_pool);
+  ASSERT_EQ(1LL << FANOUT_DEPTH, atomic_load(&leaves),
+            "Wait covers jobs spawned by jobs");
+  chiba_thread_pool_drop(tree_pool);
+  return 0;
+})
+
+//////////
+// batch submission
+//////////
+
+#define NBATCH 70000 // larger than the injector, so the batch waits for room
+
+PRIVATE void (*batch_entries[NBATCH])(anyptr);
+PRIVATE anyptr batch_args[NBATCH];
+PRIVATE chiba_thread_pool *batch_pool = NULL;
+
+// Runs on a worker: the second batch lands on its own deque
+PRIVATE void job_batch_inner(anyptr arg) {
+  (void)arg;
+  chiba_thread_pool_add_work_batch(batch_pool, batch_entries, batch_args,
+                                   1000);
+}
+
+TEST_CASE(add_work_batch, thread_pool, "Batches from outside and inside", {
+  DESC(add_work_batch);
+
+  batch_pool = chiba_thread_pool_new();
+  for (i64 i = 0; i < NBATCH; i++) {
+    batch_entries[i] = job_add;
+    batch_args[i] = (anyptr)(intptr_t)(i + 1);
+  }
+  atomic_store(&job_sum, 0);
+  ASSERT_EQ(0,
+            chiba_thread_pool_add_work_batch(batch_pool, batch_entries,
+                                             batch_args, NBATCH),
+            "Batch queued");
+  chiba_thread_pool_wait(batch_pool);
+  ASSERT_EQ((i64)NBATCH * (NBATCH + 1) / 2, atomic_load(&job_sum),
+            "Every job of the batch ran once");
+
+  atomic_store(&job_sum, 0);
+  for (i64 i = 0; i < 8; i++)
+    chiba_thread_pool_add_work(batch_pool, job_batch_inner, NULL);
+  chiba_thread_pool_wait(batch_pool);
+  ASSERT_EQ(8 * 1000LL * 1001 / 2, atomic_load(&job_sum),
+            "Batches submitted by jobs ran");
+
+  ASSERT_EQ(0,
+            chiba_thread_pool_add_work_batch(batch_pool, batch_entries,
+                                             batch_args, 0),
+            "Empty batch");
+  chiba_thread_pool_wait(batch_pool);
+  chiba_thread_pool_drop(batch_pool);
+  return 0;
+})
+
+//////////
+// parallel_for / parallel_reduce
+//////////
+
+#define NRANGE 100000
+
+PRIVATE _Atomic(i32) visits[NRANGE];
+PRIVATE const i64 grains[] = {1, 7, 0, NRANGE * 2}; // 0: automatic
+PRIVATE chiba_thread_pool *par_pool = NULL;
+
+PRIVATE void body_visit(i64 begin, i64 end, anyptr ctx) {
+  i64 offset = (i64)(intptr_t)ctx;
+  for (i64 i = begin; i < end; i++)
+    atomic_fetch_add_explicit(&visits[i - offset], 1, memory_order_relaxed);
+}
+
+PRIVATE anyptr body_sum(i64 begin, i64 end, anyptr acc, anyptr ctx) {
+  (void)ctx;
+  i64 sum = (i64)(intptr_t)acc;
+  for (i64 i = begin; i < end; i++)
+    sum += i;
+  return (anyptr)(intptr_t)sum;
+}
+
+PRIVATE anyptr join_sum(anyptr left, anyptr right, anyptr ctx) {
+  (void)ctx;
+  return (anyptr)(intptr_t)((i64)(intptr_t)left + (i64)(intptr_t)right);
+}
+
+// Each outer index runs an inner loop over its own block of visits
+PRIVATE void body_nested(i64 begin, i64 end, anyptr ctx) {
+  (void)ctx;
+  for (i64 i = begin; i < end; i++)
+    chiba_parallel_for(par_pool, i * 1000, (i + 1) * 1000, 16, body_visit,
+                       NULL);
+}
+
+PRIVATE void body_visit_sink(i64 begin, i64 end, anyptr ctx) {
+  (void)begin;
+  (void)end;
+  (void)ctx;
+}
+
+PRIVATE bool visited_once(i64 n) {
+  for (i64 i = 0; i < n; i++) {
+    if (atomic_load(&visits[i]) != 1)
+      return false;
+  }
+  return true;
+}
+
+TEST_CASE(parallel_loops, thread_pool, "parallel_for and parallel_reduce", {
+  DESC(parallel_loops);
+
+  par_pool = chiba_thread_pool_new();
+  for (i32 g = 0; g < 4; g++) {
+    for (i64 i = 0; i < NRANGE; i++)
+      atomic_store(&visits[i], 0);
+    chiba_parallel_for(par_pool, 5, NRANGE + 5, grains[g], body_visit,
+                       (anyptr)(intptr_t)5);
+    ASSERT_TRUE(visited_once(NRANGE), "Every index ran once");
+    ASSERT_EQ((i64)NRANGE * (NRANGE - 1) / 2,
+              (i64)(intptr_t)chiba_parallel_reduce(
+                  par_pool, 0, NRANGE, grains[g], (anyptr)(intptr_t)0,
+                  body_sum, join_sum, NULL),
+              "Sum matches");
+  }
+  ASSERT_EQ(42,
+            (i64)(intptr_t)chiba_parallel_reduce(par_pool, 3, 3, 1,
+                                                 (anyptr)(intptr_t)42,
+                                                 body_sum, join_sum, NULL),
+            "Empty range gives the identity");
+
+  // Loops started from inside the pool
+  for (i64 i = 0; i < NRANGE; i++)
+    atomic_store(&visits[i], 0);
+  chiba_parallel_for(par_pool, 0, NRANGE / 1000, 1, body_nested, NULL);
+  ASSERT_TRUE(visited_once(NRANGE), "Nested loops ran every index once");
+  chiba_thread_pool_wait(par_pool);
+  chiba_thread_pool_drop(par_pool);
+  return 0;
+})
+
+//////////
+// futures
+//////////
+
+PRIVATE _Atomic(bool) release_job = false;
+PRIVATE _Atomic(i64) task_runs = 0;
+
+PRIVATE anyptr task_square(anyptr arg) {
+  i64 x = (i64)(intptr_t)arg;
+  atomic_fetch_add(&task_runs, 1);
+  return (anyptr)(intptr_t)(x * x);
+}
+
+PRIVATE anyptr task_blocked(anyptr arg) {
+  while (!atomic_load(&release_job))
+    CHIBA_INTERNAL_usleep(1000);
+  return arg;
+}
+
+#define NFUTURES 1000
+
+TEST_CASE(futures, thread_pool, "Submitted jobs deliver results", {
+  DESC(futures);
+
+  chiba_thread_pool *pool = chiba_thread_pool_new();
+  chiba_shared_ptr futures[NFUTURES];
+  for (i64 i = 0; i < NFUTURES; i++)
+    futures[i] = chiba_thread_pool_submit(pool, task_square,
+                                          (anyptr)(intptr_t)i);
+  i64 wrong = 0;
+  for (i64 i = 0; i < NFUTURES; i++) {
+    anyptr result = NULL;
+    if (chiba_future_wait(futures[i], &result) != FUTURE_ERR_OK ||
+        (i64)(intptr_t)result != i * i)
+      wrong++;
+    chiba_shared_drop(&futures[i]);
+  }
+  ASSERT_EQ(0, wrong, "Every future holds its square");
+
+  // Timed wait on a job that has not finished
+  atomic_store(&release_job, false);
+  chiba_shared_ptr f = chiba_thread_pool_submit(pool, task_blocked,
+                                                (anyptr)(intptr_t)7);
+  u64 start = get_time_in_nanoseconds();
+  anyptr result = NULL;
+  ASSERT_EQ(FUTURE_ERR_TIMEOUT,
+            chiba_future_wait_timeout(f, 20000000ULL, &result), "Timed out");
+  ASSERT_TRUE(get_time_in_nanoseconds() - start >= 20000000ULL,
+              "Waited the full timeout");
+  atomic_store(&release_job, true);
+  ASSERT_EQ(FUTURE_ERR_OK, chiba_future_wait(f, &result), "Finished");
+  ASSERT_EQ(7, (i64)(intptr_t)result, "Result delivered");
+  ASSERT_EQ(FUTURE_COMPLETED, chiba_future_state(f), "Completed");
+  chiba_shared_drop(&f);
+
+  // Cancelled before it ran
+  atomic_store(&task_runs, 0);
+  chiba_thread_pool_pause(pool);
+  f = chiba_thread_pool_submit(pool, task_square, (anyptr)(intptr_t)3);
+  chiba_future_cancel(f);
+  ASSERT_EQ(FUTURE_ERR_CANCELLED, chiba_future_wait(f, &result),
+            "Waiters see the cancellation");
+  chiba_thread_pool_resume(pool);
+  chiba_thread_pool_wait(pool);
+  ASSERT_EQ(0, atomic_load(&task_runs), "Cancelled task never ran");
+  chiba_shared_drop(&f);
+
+  // Completing after a cancel leaves the cancellation and no result behind
+  f = chiba_future_init();
+  chiba_future_cancel(f);
+  chiba_future_complete(f, (anyptr)(intptr_t)9);
+  ASSERT_EQ(FUTURE_CANCELLED, chiba_future_state(f), "Still cancelled");
+  ASSERT_NULL(atomic_load(&((chiba_future *)chiba_shared_get(&f))->result),
+              "Late result is not stored");
+  chiba_shared_drop(&f);
+
+  // Still queued when the pool goes away
+  chiba_thread_pool_pause(pool);
+  f = chiba_thread_pool_submit(pool, task_square, (anyptr)(intptr_t)3);
+  chiba_thread_pool_drop(pool);
+  ASSERT_EQ(FUTURE_ERR_POOL_SHUTDOWN, chiba_future_wait(f, &result),
+            "Dropping the pool fails queued futures");
+  ASSERT_EQ(1, chiba_shared_strong_count(&f), "Job released its reference");
+  chiba_shared_drop(&f);
+  return 0;
+})
+
+//////////
+// configuration
+//////////
+
+PRIVATE _Atomic(i64) off_cpu = 0;
+PRIVATE const i32 only_cpu0[] = {0};
+PRIVATE const chiba_thread_pool_pinning modes[] = {
+    CHIBA_TP_PIN_CORES, CHIBA_TP_PIN_SIBLINGS, CHIBA_TP_PIN_NONE};
+
+PRIVATE void job_check_cpu(anyptr arg) {
+  i32 cpu = topology_current_cpu();
+  if (cpu >= 0 && cpu != (i32)(intptr_t)arg)
+    atomic_fetch_add(&off_cpu, 1);
+  atomic_fetch_add(&job_sum, 1);
+}
+
+TEST_CASE(config, thread_pool, "Sized, pinned and NUMA pools", {
+  DESC(config);
+
+  // Three workers all pinned to CPU 0
+  chiba_thread_pool_config config = {0};
+  config.num_threads = 3;
+  config.cpus = only_cpu0;
+  config.num_cpus = 1;
+  chiba_thread_pool *pool = chiba_thread_pool_new_with(&config);
+  ASSERT_NOT_NULL(pool, "Pinned pool created");
+  atomic_store(&job_sum, 0);
+  atomic_store(&off_cpu, 0);
+  for (i64 i = 0; i < 300; i++)
+    chiba_thread_pool_add_work(pool, job_check_cpu, (anyptr)(intptr_t)0);
+  chiba_thread_pool_wait(pool);
+  ASSERT_EQ(300, atomic_load(&job_sum), "Every job ran");
+  ASSERT_EQ(0, atomic_load(&off_cpu), "Workers stayed on CPU 0");
+  chiba_thread_pool_drop(pool);
+
+  // Topology-driven placement on whatever this machine has
+  for (i32 m = 0; m < 3; m++) {
+    chiba_thread_pool_config numa = {0};
+    numa.pinning = modes[m];
+    numa.numa = true;
+    pool = chiba_thread_pool_new_with(&numa);
+    atomic_store(&job_sum, 0);
+    for (i64 i = 1; i <= 1000; i++)
+      chiba_thread_pool_add_work(pool, job_add, (anyptr)(intptr_t)i);
+    chiba_parallel_for(pool, 0, 1000, 1, body_visit_sink, NULL);
+    chiba_thread_pool_wait(pool);
+    ASSERT_EQ(1000LL * 1001 / 2, atomic_load(&job_sum), "Every job ran");
+    chiba_thread_pool_drop(pool);
+  }
+  return 0;
+})
+
+//////////
+// task graphs
+//////////
+
+#define DAG_TASKS 3000
+#define DAG_PREDS 3
+
+PRIVATE i32 dag_preds[DAG_TASKS][DAG_PREDS];
+PRIVATE _Atomic(bool) dag_finished[DAG_TASKS];
+PRIVATE _Atomic(i64) dag_early = 0;
+
+// Fails the order check if any predecessor has not finished yet
+PRIVATE void task_check(anyptr arg) {
+  i32 i = (i32)(intptr_t)arg;
+  for (i32 p = 0; p < DAG_PREDS; p++) {
+    if (dag_preds[i][p] >= 0 && !atomic_load(&dag_finished[dag_preds[i][p]]))
+      atomic_fetch_add(&dag_early, 1);
+  }
+  atomic_store(&dag_finished[i], true);
+  atomic_fetch_add(&job_sum, 1);
+}
+
+TEST_CASE(task_graph, thread_pool, "Tasks wait for their predecessors", {
+  DESC(task_graph);
+
+  chiba_thread_pool *pool = chiba_thread_pool_new();
+  chiba_task_graph *graph = chiba_task_graph_new(pool);
+  chiba_task_graph_run(graph);
+
+  // Random DAG: every task depends on up to DAG_PREDS earlier ones
+  chiba_task *tasks[DAG_TASKS];
+  u64 rng = 0x2545f4914f6cdd1dULL;
+  for (i32 i = 0; i < DAG_TASKS; i++) {
+    tasks[i] = chiba_task_graph_add(graph, task_check, (anyptr)(intptr_t)i);
+    for (i32 p = 0; p < DAG_PREDS; p++) {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      dag_preds[i][p] = i > 0 && rng % 4 ? (i32)(rng % (u64)i) : -1;
+      if (dag_preds[i][p] >= 0)
+        chiba_task_precede(tasks[dag_preds[i][p]], tasks[i]);
+    }
+  }
+
+  // Run twice: counters are reset by every submission
+  for (i32 round = 1; round <= 2; round++) {
+    for (i32 i = 0; i < DAG_TASKS; i++)
+      atomic_store(&dag_finished[i], false);
+    atomic_store(&job_sum, 0);
+    atomic_store(&dag_early, 0);
+    chiba_task_graph_submit(graph);
+    chiba_task_graph_wait(graph);
+    ASSERT_EQ(DAG_TASKS, atomic_load(&job_sum), "Every task ran once");
+    ASSERT_EQ(0, atomic_load(&dag_early), "No task ran before its inputs");
+  }
+  chiba_task_graph_drop(graph);
+
+  // A chain runs as one job, every task continuing into the next
+  graph = chiba_task_graph_new(pool);
+  atomic_store(&job_sum, 0);
+  chiba_task *prev = NULL;
+  for (i32 i = 0; i < 1000; i++) {
+    chiba_task *task = chiba_task_graph_add(graph, job_add, (anyptr)(intptr_t)1);
+    if (prev)
+      chiba_task_precede(prev, task);
+    prev = task;
+  }
+  chiba_task_graph_run(graph);
+  ASSERT_EQ(1000, atomic_load(&job_sum), "Chain ran");
+  chiba_task_graph_drop(graph);
+  chiba_thread_pool_drop(pool);
+  return 0;
+})
+
+//////////
+// pause / resume / drop
+//////////
+
+TEST_CASE(pause_resume, thread_pool, "Paused pools run nothing new", {
+  DESC(pause_resume);
+
+  chiba_thread_pool *pool = chiba_thread_pool_new();
+  atomic_store(&job_sum, 0);
+  chiba_thread_pool_pause(pool);
+  for (i64 i = 0; i < 100; i++)
+    chiba_thread_pool_add_work(pool, job_add, (anyptr)(intptr_t)1);
+  CHIBA_INTERNAL_usleep(20000);
+  ASSERT_EQ(0, atomic_load(&job_sum), "Nothing ran while paused");
+  chiba_thread_pool_resume(pool);
+  chiba_thread_pool_wait(pool);
+  ASSERT_EQ(100, atomic_load(&job_sum), "Everything ran after resume");
+
+  // Dropping a paused pool discards its queued jobs
+  chiba_thread_pool_pause(pool);
+  for (i64 i = 0; i < 100; i++)
+    chiba_thread_pool_add_work(pool, job_add, (anyptr)(intptr_t)1);
+  chiba_thread_pool_drop(pool);
+  ASSERT_EQ(100, atomic_load(&job_sum), "Queued jobs were discarded");
+  return 0;
+})
+
+REGISTER_TEST_GROUP(thread_pool) {
+  REGISTER_TEST(add_work_wait, thread_pool);
+  REGISTER_TEST(nested_fanout, thread_pool);
+  REGISTER_TEST(add_work_batch, thread_pool);
+  REGISTER_TEST(parallel_loops, thread_pool);
+  REGISTER_TEST(futures, thread_pool);
+  REGISTER_TEST(config, thread_pool);
+  REGISTER_TEST(task_graph, thread_pool);
+  REGISTER_TEST(pause_resume, thread_pool);
+}
+
+ENABLE_TEST_GROUP(thread_pool);
@@ -1,19 +1,112 @@
 #pragma once
 #include "../basic_memory.h"
 #include "../concurrency/array_queue.h"
-#include "../utils/chiba_sem.h"
+#include "../utils/backoff.h"
+#include "../utils/eventcount.h"
 #include "thread_pool.h"
 
+typedef struct chiba_thread_pool_jobcache chiba_thread_pool_jobcache;
+
 /* Job */
 typedef struct chiba_thread_pool_job {
-  void (*entry)(anyptr arg); /* function pointer          */
-  anyptr arg;                /* function's argument       */
+  void (*entry)(anyptr arg);          /* function pointer          */
+  anyptr arg;                         /* function's argument       */
+  struct chiba_thread_pool_job *next; /* free list / inbox link    */
+  chiba_thread_pool_jobcache *home;   /* cache it goes back to     */
 } chiba_thread_pool_job;
 
-/* Job queue */
+/* Job slab
+ *
+ * Submitting a job allocates nothing in the steady state. Jobs are carved out
+ * of chunks of CHIBA_TP_JOB_CHUNK that live as long as the pool, and every
+ * worker keeps a free list of the jobs it handed out:
+ * - a worker takes jobs from its own list and gives jobs it allocated back to
+ *   it without any atomics
+ * - a job run by another worker goes back through its home cache's inbox, a
+ *   lock-free stack the owner empties in one exchange when its list runs dry
+ * - threads outside the pool share one external cache whose list is guarded
+ *   by a spinlock
+ */
+typedef struct chiba_thread_pool_jobcache {
+  chiba_thread_pool_job *free;            /* owner's free list         */
+  _Atomic(chiba_thread_pool_job *) inbox; /* jobs freed elsewhere      */
+  _Atomic(bool) locker;                   /* external cache only       */
+} __attribute__((aligned(64))) chiba_thread_pool_jobcache;
+
+typedef struct chiba_thread_pool_jobchunk {
+  struct chiba_thread_pool_jobchunk *next;
+  chiba_thread_pool_job jobs[CHIBA_TP_JOB_CHUNK];
+} chiba_thread_pool_jobchunk;
+
+/* Take a job from `cache`; the caller owns the cache or holds its lock */
+UTILS chiba_thread_pool_job *
+jobcache_get(chiba_thread_pool_jobcache *cache,
+             _Atomic(chiba_thread_pool_jobchunk *) *chunks) {
+  chiba_thread_pool_job *job = cache->free;
+  if (unlikely(!job)) {
+    job = atomic_exchange_explicit(&cache->inbox, NULL, memory_order_acquire);
+    if (!job) {
+      chiba_thread_pool_jobchunk *chunk =
+          (chiba_thread_pool_jobchunk *)CHIBA_INTERNAL_malloc(
+              sizeof(chiba_thread_pool_jobchunk));
+      if (unlikely(!chunk))
+        return NULL;
+      for (i32 i = 0; i < CHIBA_TP_JOB_CHUNK; i++) {
+        chunk->jobs[i].home = cache;
+        chunk->jobs[i].next =
+            i + 1 < CHIBA_TP_JOB_CHUNK ? &chunk->jobs[i + 1] : NULL;
+      }
+      chunk->next = atomic_load_explicit(chunks, memory_order_relaxed);
+      while (!atomic_compare_exchange_weak_explicit(
+          chunks, &chunk->next, chunk, memory_order_release,
+          memory_order_relaxed))
+        ;
+      job = chunk->jobs;
+    }
+  }
+  cache->free = job->next;
+  return job;
+}
+
+/* Give a job back to its home cache. `local` is the calling worker's own
+ * cache, NULL outside the pool. */
+UTILS void jobcache_put(chiba_thread_pool_job *job,
+                        chiba_thread_pool_jobcache *local) {
+  chiba_thread_pool_jobcache *home = job->home;
+  if (likely(home == local)) {
+    job->next = home->free;
+    home->free = job;
+    return;
+  }
+  job->next = atomic_load_explicit(&home->inbox, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(
+      &home->inbox, &job->next, job, memory_order_release,
+      memory_order_relaxed))
+    ;
+}
+
+/* Free every chunk of a pool */
+UTILS void jobchunks_drop(_Atomic(chiba_thread_pool_jobchunk *) *chunks) {
+  chiba_thread_pool_jobchunk *chunk =
+      atomic_exchange_explicit(chunks, NULL, memory_order_acquire);
+  while (chunk) {
+    chiba_thread_pool_jobchunk *next = chunk->next;
+    CHIBA_INTERNAL_free(chunk);
+    chunk = next;
+  }
+}
+
+/* Injector queue
+ *
+ * Jobs submitted from threads outside the pool. Workers submitting jobs
+ * themselves push onto their own chiba_wsqueue instead, so this queue only
+ * sees external producers and workers that ran out of local work.
+ * A pool grouped by NUMA node has one injector per node, and the workers of
+ * a node park on its has_jobs.
+ */
 typedef struct chiba_thread_pool_jobqueue {
-  chiba_arrayqueue *jobs; /* job queue                 */
-  chiba_sem *has_jobs;    /* flag as binary semaphore  */
+  chiba_arrayqueue *jobs; /* bounded MPMC job queue    */
+  chiba_event has_jobs;   /* idle workers park here    */
 } chiba_thread_pool_jobqueue;
 
 /* Initialize queue */
@@ -23,38 +116,35 @@ UTILS chiba_thread_pool_jobqueue *jobqueue_new() {
           sizeof(chiba_thread_pool_jobqueue));
   if (unlikely(!jq))
     goto error;
-  jq->jobs = chiba_arrayqueue_new(65536);
-  jq->has_jobs = chiba_sem_new();
-  if (unlikely(!jq->jobs || !jq->has_jobs))
+  jq->jobs = chiba_arrayqueue_new(CHIBA_TP_INJECTOR_CAP);
+  if (unlikely(!jq->jobs))
     goto error;
+  chiba_event_init(&jq->has_jobs);
   return jq;
 error:
   CHIBA_PANIC("Failed to initialize jobqueue");
 }
 
+/* Add a job, waiting for room while the queue is full */
 UTILS void jobqueue_push(chiba_thread_pool_jobqueue *jobqueue_p,
                          chiba_thread_pool_job *newjob) {
-  chiba_arrayqueue_push(jobqueue_p->jobs, newjob);
-  chiba_sem_post(jobqueue_p->has_jobs);
+  chiba_backoff b = {.step = 0};
+  while (!chiba_arrayqueue_push(jobqueue_p->jobs, newjob))
+    backoff_snooze(&b);
 }
 
 UTILS chiba_thread_pool_job *
 jobqueue_pull(chiba_thread_pool_jobqueue *jobqueue_p) {
-  chiba_thread_pool_job *job_p =
-      (chiba_thread_pool_job *)chiba_arrayqueue_pop(jobqueue_p->jobs);
-  if (unlikely(!job_p))
-    return NULL;
-  chiba_sem_post(jobqueue_p->has_jobs);
-  return job_p;
+  return (chiba_thread_pool_job *)chiba_arrayqueue_pop(jobqueue_p->jobs);
 }
 
 /* Free all queue resources back to the system */
 UTILS void jobqueue_destroy(chiba_thread_pool_jobqueue *jobqueue_p) {
   chiba_arrayqueue_drop(jobqueue_p->jobs);
-  chiba_sem_drop(jobqueue_p->has_jobs);
+  chiba_event_drop(&jobqueue_p->has_jobs);
   CHIBA_INTERNAL_free(jobqueue_p);
 }
 
 UTILS bool jobqueue_is_empty(chiba_thread_pool_jobqueue *jq) {
-  return chiba_arrayqueue_size(jq->jobs) > 0;
-}
\ No newline at end of file
+  return chiba_arrayqueue_is_empty(jq->jobs);
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include "../basic_memory.h"
+#include "thread_pool.h"
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define CHIBA_TP_TOPOLOGY
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* CPU topology
+ *
+ * Read from sysfs with raw sched_{get,set}affinity / getcpu syscalls, so
+ * neither libnuma nor _GNU_SOURCE is needed. Only the CPUs the process may
+ * run on are listed. Elsewhere the topology is a single node of
+ * get_cpu_count() CPUs and pinning is a no-op.
+ */
+
+#define TOPOLOGY_MASK_WORDS (CHIBA_TP_MAX_CPUS / 64)
+
+typedef struct chiba_cpu_info {
+  i32 cpu;     /* OS CPU number             */
+  i32 core;    /* core_id within package    */
+  i32 package; /* physical package (socket) */
+  i32 node;    /* NUMA node, 0 without NUMA */
+  i32 sibling; /* rank among SMT siblings   */
+} chiba_cpu_info;
+
+typedef struct chiba_topology {
+  chiba_cpu_info *cpus; /* usable CPUs               */
+  i32 num_cpus;
+} chiba_topology;
+
+UTILS i32 topology_read_int(const char *path, i32 fallback) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return fallback;
+  i32 v;
+  if (fscanf(f, "%d", &v) != 1)
+    v = fallback;
+  fclose(f);
+  return v;
+}
+
+/* Set the bits of a sysfs cpulist such as "0-3,8-11" */
+UTILS bool topology_read_cpulist(const char *path, u64 *mask) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  i32 lo, hi;
+  while (fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    i32 c = fgetc(f);
+    if (c == '-') {
+      if (fscanf(f, "%d", &hi) != 1)
+        break;
+      c = fgetc(f);
+    }
+    for (i32 cpu = lo; cpu <= hi && cpu < CHIBA_TP_MAX_CPUS; cpu++)
+      mask[cpu / 64] |= 1ULL << (cpu % 64);
+    if (c != ',')
+      break;
+  }
+  fclose(f);
+  return true;
+}
+
+UTILS int topology_cmp_compact(const void *a, const void *b) {
+  const chiba_cpu_info *x = (const chiba_cpu_info *)a;
+  const chiba_cpu_info *y = (const chiba_cpu_info *)b;
+  if (x->node != y->node)
+    return x->node - y->node;
+  if (x->package != y->package)
+    return x->package - y->package;
+  if (x->core != y->core)
+    return x->core - y->core;
+  return x->cpu - y->cpu;
+}
+
+UTILS int topology_cmp_spread(const void *a, const void *b) {
+  const chiba_cpu_info *x = (const chiba_cpu_info *)a;
+  const chiba_cpu_info *y = (const chiba_cpu_info *)b;
+  if (x->sibling != y->sibling)
+    return x->sibling - y->sibling;
+  return topology_cmp_compact(a, b);
+}
+
+/* Discover the usable CPUs, ordered so that SMT siblings are adjacent */
+UTILS bool topology_load(chiba_topology *t) {
+  t->num_cpus = 0;
+  t->cpus = NULL;
+#ifdef CHIBA_TP_TOPOLOGY
+  u64 allowed[TOPOLOGY_MASK_WORDS] = {0};
+  if (syscall(__NR_sched_getaffinity, 0, sizeof(allowed), allowed) > 0) {
+    i32 n = 0;
+    for (i32 cpu = 0; cpu < CHIBA_TP_MAX_CPUS; cpu++)
+      n += (allowed[cpu / 64] >> (cpu % 64)) & 1;
+    t->cpus = (chiba_cpu_info *)CHIBA_INTERNAL_malloc(sizeof(chiba_cpu_info) *
+                                                      (u64)n);
+    if (!t->cpus)
+      return false;
+    char path[96];
+    for (i32 cpu = 0; cpu < CHIBA_TP_MAX_CPUS; cpu++) {
+      if (!((allowed[cpu / 64] >> (cpu % 64)) & 1))
+        continue;
+      chiba_cpu_info *info = &t->cpus[t->num_cpus++];
+      info->cpu = cpu;
+      info->node = 0;
+      snprintf(path, sizeof(path),
+               "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+      info->core = topology_read_int(path, cpu);
+      snprintf(path, sizeof(path),
+               "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+               cpu);
+      info->package = topology_read_int(path, 0);
+    }
+    /* Nodes are numbered densely in sysfs; stop at the first gap */
+    for (i32 node = 0; node < CHIBA_TP_MAX_CPUS; node++) {
+      u64 mask[TOPOLOGY_MASK_WORDS] = {0};
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+               node);
+      if (!topology_read_cpulist(path, mask))
+        break;
+      for (i32 i = 0; i < t->num_cpus; i++) {
+        i32 cpu = t->cpus[i].cpu;
+        if ((mask[cpu / 64] >> (cpu % 64)) & 1)
+          t->cpus[i].node = node;
+      }
+    }
+  }
+#endif
+  if (t->num_cpus == 0) {
+    i32 n = (i32)get_cpu_count();
+    t->cpus = (chiba_cpu_info *)CHIBA_INTERNAL_malloc(sizeof(chiba_cpu_info) *
+                                                      (u64)n);
+    if (!t->cpus)
+      return false;
+    for (i32 i = 0; i < n; i++)
+      t->cpus[i] = (chiba_cpu_info){
+          .cpu = i, .core = i, .package = 0, .node = 0, .sibling = 0};
+    t->num_cpus = n;
+  }
+
+  qsort(t->cpus, (u64)t->num_cpus, sizeof(chiba_cpu_info),
+        topology_cmp_compact);
+  for (i32 i = 1; i < t->num_cpus; i++) {
+    chiba_cpu_info *prev = &t->cpus[i - 1], *cur = &t->cpus[i];
+    cur->sibling = prev->package == cur->package && prev->core == cur->core
+                       ? prev->sibling + 1
+                       : 0;
+  }
+  return true;
+}
+
+/* One CPU per physical core first, then their SMT siblings */
+UTILS void topology_spread(chiba_topology *t) {
+  qsort(t->cpus, (u64)t->num_cpus, sizeof(chiba_cpu_info),
+        topology_cmp_spread);
+}
+
+UTILS i32 topology_node_of(const chiba_topology *t, i32 cpu) {
+  for (i32 i = 0; i < t->num_cpus; i++) {
+    if (t->cpus[i].cpu == cpu)
+      return t->cpus[i].node;
+  }
+  return 0;
+}
+
+UTILS void topology_drop(chiba_topology *t) {
+  CHIBA_INTERNAL_free(t->cpus);
+  t->cpus = NULL;
+  t->num_cpus = 0;
+}
+
+/* Restrict the calling thread to the CPUs set in `mask` */
+UTILS bool topology_bind(const u64 *mask) {
+#ifdef CHIBA_TP_TOPOLOGY
+  return syscall(__NR_sched_setaffinity, 0,
+                 sizeof(u64) * TOPOLOGY_MASK_WORDS, mask) == 0;
+#else
+  (void)mask;
+  return false;
+#endif
+}
+
+/* CPU the calling thread runs on, -1 if unknown */
+UTILS i32 topology_current_cpu(void) {
+#ifdef CHIBA_TP_TOPOLOGY
+  unsigned cpu;
+  if (syscall(__NR_getcpu, &cpu, NULL, NULL) == 0)
+    return (i32)cpu;
+#endif
+  return -1;
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include "../basic_types.h"
+#include "../common_headers.h"
+#include "backoff.h"
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Chiba eventcount
+// Parking spot for threads waiting on a condition they check themselves:
+//   u32 key = chiba_event_prepare(ev);
+//   if (condition holds) chiba_event_cancel(ev);
+//   else chiba_event_wait(ev, key);
+// while the other side makes the condition true, then calls
+// chiba_event_notify. No wakeup is lost between the check and the wait.
+// - notify is one fence and one load while nobody waits: no lock, no syscall
+// - a waiter spins briefly on the epoch before parking, and notify only
+//   enters the kernel when some waiter actually parked
+// - parking is a futex on Linux, a mutex + condvar elsewhere; syscall() is
+//   only declared with _DEFAULT_SOURCE, which strict -std=c11 translation
+//   units including this header define before their first include
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define CHIBA_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+typedef struct chiba_event {
+  _Atomic(u32) epoch;    // bumped by every notify that finds waiters
+  _Atomic(u32) waiters;  // between prepare and wait / cancel
+  _Atomic(u32) sleepers; // parked in the kernel
+#ifndef CHIBA_FUTEX
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+} chiba_event;
+
+UTILS void chiba_event_init(chiba_event *ev) {
+  atomic_init(&ev->epoch, 0);
+  atomic_init(&ev->waiters, 0);
+  atomic_init(&ev->sleepers, 0);
+#ifndef CHIBA_FUTEX
+  pthread_mutex_init(&ev->mutex, NULL);
+  pthread_cond_init(&ev->cond, NULL);
+#endif
+}
+
+UTILS void chiba_event_drop(chiba_event *ev) {
+#ifndef CHIBA_FUTEX
+  pthread_cond_destroy(&ev->cond);
+  pthread_mutex_destroy(&ev->mutex);
+#else
+  (void)ev;
+#endif
+}
+
+// Announce a wait; check the condition after this and before waiting
+UTILS u32 chiba_event_prepare(chiba_event *ev) {
+  atomic_fetch_add_explicit(&ev->waiters, 1, memory_order_seq_cst);
+  return atomic_load_explicit(&ev->epoch, memory_order_seq_cst);
+}
+
+// The condition held after prepare, do not wait
+UTILS void chiba_event_cancel(chiba_event *ev) {
+  atomic_fetch_sub_explicit(&ev->waiters, 1, memory_order_relaxed);
+}
+
+// Block until a notify after the chiba_event_prepare that returned `key`,
+// or until `deadline` (get_time_in_nanoseconds) passes; UINT64_MAX waits
+// forever. Returns false on timeout.
+UTILS bool chiba_event_wait_until(chiba_event *ev, u32 key, u64 deadline) {
+  bool woken = true;
+  chiba_backoff b = {.step = 0};
+  while (b.step <= SPIN_LIMIT) {
+    if (atomic_load_explicit(&ev->epoch, memory_order_acquire) != key)
+      goto done;
+    backoff_spin(&b);
+  }
+
+  atomic_fetch_add_explicit(&ev->sleepers, 1, memory_order_seq_cst);
+#ifdef CHIBA_FUTEX
+  while (atomic_load_explicit(&ev->epoch, memory_order_seq_cst) == key) {
+    struct timespec ts, *timeout = NULL;
+    if (deadline != UINT64_MAX) {
+      u64 now = get_time_in_nanoseconds();
+      if (now >= deadline) {
+        woken = false;
+        break;
+      }
+      ts.tv_sec = (time_t)((deadline - now) / 1000000000ULL);
+      ts.tv_nsec = (long)((deadline - now) % 1000000000ULL);
+      timeout = &ts;
+    }
+    // futex timeouts are relative and measured on CLOCK_MONOTONIC
+    syscall(SYS_futex, &ev->epoch, FUTEX_WAIT_PRIVATE, key, timeout, NULL, 0);
+  }
+#else
+  pthread_mutex_lock(&ev->mutex);
+  while (atomic_load_explicit(&ev->epoch, memory_order_seq_cst) == key) {
+    if (deadline == UINT64_MAX) {
+      pthread_cond_wait(&ev->cond, &ev->mutex);
+      continue;
+    }
+    u64 now = get_time_in_nanoseconds();
+    if (now >= deadline) {
+      woken = false;
+      break;
+    }
+    // condvars time out on CLOCK_REALTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    u64 at = (u64)ts.tv_nsec + (deadline - now);
+    ts.tv_sec += (time_t)(at / 1000000000ULL);
+    ts.tv_nsec = (long)(at % 1000000000ULL);
+    pthread_cond_timedwait(&ev->cond, &ev->mutex, &ts);
+  }
+  pthread_mutex_unlock(&ev->mutex);
+#endif
+  atomic_fetch_sub_explicit(&ev->sleepers, 1, memory_order_relaxed);
+
+done:
+  atomic_fetch_sub_explicit(&ev->waiters, 1, memory_order_relaxed);
+  return woken;
+}
+
+// Block until a notify after the chiba_event_prepare that returned `key`
+UTILS void chiba_event_wait(chiba_event *ev, u32 key) {
+  chiba_event_wait_until(ev, key, UINT64_MAX);
+}
+
+// Wake up to `n` parked waiters; call after making the condition true.
+// Returns false if nobody was waiting.
+UTILS bool chiba_event_notify(chiba_event *ev, u32 n) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ev->waiters, memory_order_relaxed) == 0)
+    return false;
+  atomic_fetch_add_explicit(&ev->epoch, 1, memory_order_seq_cst);
+  if (atomic_load_explicit(&ev->sleepers, memory_order_seq_cst) == 0)
+    return true;
+#ifdef CHIBA_FUTEX
+  syscall(SYS_futex, &ev->epoch, FUTEX_WAKE_PRIVATE,
+          n > (u32)INT_MAX ? INT_MAX : (i32)n, NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&ev->mutex);
+  if (n > 1)
+    pthread_cond_broadcast(&ev->cond);
+  else
+    pthread_cond_signal(&ev->cond);
+  pthread_mutex_unlock(&ev->mutex);
+#endif
+  return true;
+}
+
+UTILS bool chiba_event_notify_all(chiba_event *ev) {
+  return chiba_event_notify(ev, UINT32_MAX);
+}
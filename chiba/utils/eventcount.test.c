@@ -0,0 +1,144 @@
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "eventcount.h"
+#include "../basic_memory.h"
+#include "../chiba_testing.h"
+
+TEST_GROUP(eventcount);
+
+PRIVATE chiba_event ev;
+
+TEST_CASE(notify_without_waiters, eventcount, "Notify with nobody waiting", {
+  DESC(notify_without_waiters);
+
+  chiba_event_init(&ev);
+  chiba_event_notify(&ev, 1);
+  chiba_event_notify_all(&ev);
+  ASSERT_EQ(0, atomic_load(&ev.epoch), "Nobody waited, epoch unchanged");
+
+  // A notify between prepare and wait is not lost
+  u32 key = chiba_event_prepare(&ev);
+  chiba_event_notify(&ev, 1);
+  chiba_event_wait(&ev, key);
+  ASSERT_EQ(0, atomic_load(&ev.waiters), "Waiter left");
+
+  key = chiba_event_prepare(&ev);
+  chiba_event_cancel(&ev);
+  ASSERT_EQ(0, atomic_load(&ev.waiters), "Cancel unregisters");
+  chiba_event_drop(&ev);
+  return 0;
+})
+
+//////////
+// ping-pong: one flag per side, each side waits for its own
+//////////
+
+#define ROUNDS 20000
+
+PRIVATE _Atomic(i64) ping = 0;
+PRIVATE _Atomic(i64) pong = 0;
+
+PRIVATE void wait_for(_Atomic(i64) *flag, i64 value) {
+  while (atomic_load(flag) < value) {
+    u32 key = chiba_event_prepare(&ev);
+    if (atomic_load(flag) >= value) {
+      chiba_event_cancel(&ev);
+      break;
+    }
+    chiba_event_wait(&ev, key);
+  }
+}
+
+PRIVATE anyptr ponger(anyptr arg) {
+  (void)arg;
+  for (i64 i = 1; i <= ROUNDS; i++) {
+    wait_for(&ping, i);
+    atomic_store(&pong, i);
+    chiba_event_notify_all(&ev);
+  }
+  return NULL;
+}
+
+TEST_CASE(ping_pong, eventcount, "No wakeup is lost", {
+  DESC(ping_pong);
+
+  chiba_event_init(&ev);
+  pthread_t t;
+  pthread_create(&t, NULL, ponger, NULL);
+  for (i64 i = 1; i <= ROUNDS; i++) {
+    atomic_store(&ping, i);
+    chiba_event_notify_all(&ev);
+    wait_for(&pong, i);
+  }
+  pthread_join(t, NULL);
+  ASSERT_EQ(ROUNDS, atomic_load(&pong), "Every round answered");
+  chiba_event_drop(&ev);
+  return 0;
+})
+
+//////////
+// parked waiters
+//////////
+
+#define SLEEPERS 4
+
+PRIVATE _Atomic(i64) go = 0;
+PRIVATE _Atomic(i64) woken = 0;
+
+PRIVATE anyptr sleeper(anyptr arg) {
+  (void)arg;
+  wait_for(&go, 1);
+  atomic_fetch_add(&woken, 1);
+  return NULL;
+}
+
+TEST_CASE(wake_parked, eventcount, "Notify reaches parked threads", {
+  DESC(wake_parked);
+
+  chiba_event_init(&ev);
+  pthread_t t[SLEEPERS];
+  for (i32 i = 0; i < SLEEPERS; i++)
+    pthread_create(&t[i], NULL, sleeper, NULL);
+  // Long enough for every waiter to give up spinning
+  CHIBA_INTERNAL_usleep(50000);
+  ASSERT_EQ(SLEEPERS, atomic_load(&ev.sleepers), "Everyone parked");
+  ASSERT_EQ(0, atomic_load(&woken), "Nobody woke early");
+  atomic_store(&go, 1);
+  chiba_event_notify_all(&ev);
+  for (i32 i = 0; i < SLEEPERS; i++)
+    pthread_join(t[i], NULL);
+  ASSERT_EQ(SLEEPERS, atomic_load(&woken), "Everyone woke");
+  ASSERT_EQ(0, atomic_load(&ev.sleepers), "Nobody parked");
+  chiba_event_drop(&ev);
+  return 0;
+})
+
+TEST_CASE(wait_until, eventcount, "Timed waits give up at the deadline", {
+  DESC(wait_until);
+
+  chiba_event_init(&ev);
+  u64 start = get_time_in_nanoseconds();
+  u32 key = chiba_event_prepare(&ev);
+  ASSERT_TRUE(!chiba_event_wait_until(&ev, key, start + 20000000ULL),
+              "Nobody notified");
+  ASSERT_TRUE(get_time_in_nanoseconds() - start >= 20000000ULL,
+              "Waited until the deadline");
+  ASSERT_EQ(0, atomic_load(&ev.waiters), "Waiter left");
+
+  key = chiba_event_prepare(&ev);
+  chiba_event_notify(&ev, 1);
+  ASSERT_TRUE(chiba_event_wait_until(&ev, key, start), "Notified in time");
+  chiba_event_drop(&ev);
+  return 0;
+})
+
+REGISTER_TEST_GROUP(eventcount) {
+  REGISTER_TEST(notify_without_waiters, eventcount);
+  REGISTER_TEST(ping_pong, eventcount);
+  REGISTER_TEST(wake_parked, eventcount);
+  REGISTER_TEST(wait_until, eventcount);
+}
+
+ENABLE_TEST_GROUP(eventcount);
@@ -0,0 +1,158 @@
+#pragma once
+#include "../basic_memory.h"
+
+// Chiba id map
+// Open-addressing hash map from non-zero i64 ids to pointers, used for
+// coroutine handle tables:
+// - one flat array of 16 byte slots, key 0 marks an empty slot
+// - Fibonacci hashing: ids are mostly sequential, and a single multiply
+//   spreads them evenly over the table
+// - Robin Hood probing: an entry far from its home slot takes the place of
+//   one closer to its own, so probe sequences stay short up to 7/8 load and
+//   lookups of missing keys stop early
+// - deletion shifts the following entries back instead of leaving tombstones
+// - a zeroed chiba_idmap is an empty map that owns no memory
+
+#define CHIBA_IDMAP_MINCAP 16
+
+typedef struct chiba_idmap_slot {
+  i64 key;
+  anyptr value;
+} chiba_idmap_slot;
+
+typedef struct chiba_idmap {
+  chiba_idmap_slot *slots;
+  u64 mask;  // capacity - 1
+  u32 shift; // 64 - log2(capacity)
+  u64 count;
+} chiba_idmap;
+
+UTILS u64 chiba_idmap_capacity(chiba_idmap *map) {
+  return map->slots ? map->mask + 1 : 0;
+}
+
+UTILS u64 chiba_idmap_home(chiba_idmap *map, i64 key) {
+  return ((u64)key * 0x9E3779B97F4A7C15ULL) >> map->shift;
+}
+
+// Distance of the entry at slot `i` from its home slot
+UTILS u64 chiba_idmap_dist(chiba_idmap *map, i64 key, u64 i) {
+  return (i - chiba_idmap_home(map, key)) & map->mask;
+}
+
+// Slot index of `key`, or -1 if absent
+UTILS i64 chiba_idmap_find(chiba_idmap *map, i64 key) {
+  if (!map->count)
+    return -1;
+  u64 i = chiba_idmap_home(map, key);
+  for (u64 d = 0;; d++, i = (i + 1) & map->mask) {
+    chiba_idmap_slot *slot = &map->slots[i];
+    if (slot->key == key)
+      return (i64)i;
+    if (!slot->key || chiba_idmap_dist(map, slot->key, i) < d)
+      return -1;
+  }
+}
+
+// Put a key known to be absent into a table with a free slot
+UTILS void chiba_idmap_place(chiba_idmap *map, i64 key, anyptr value) {
+  u64 i = chiba_idmap_home(map, key);
+  for (u64 d = 0;; d++, i = (i + 1) & map->mask) {
+    chiba_idmap_slot *slot = &map->slots[i];
+    if (!slot->key) {
+      slot->key = key;
+      slot->value = value;
+      return;
+    }
+    u64 sd = chiba_idmap_dist(map, slot->key, i);
+    if (sd < d) {
+      chiba_idmap_slot evicted = *slot;
+      slot->key = key;
+      slot->value = value;
+      key = evicted.key;
+      value = evicted.value;
+      d = sd;
+    }
+  }
+}
+
+UTILS bool chiba_idmap_resize(chiba_idmap *map, u64 cap) {
+  chiba_idmap_slot *slots = (chiba_idmap_slot *)CHIBA_INTERNAL_malloc(
+      sizeof(chiba_idmap_slot) * cap);
+  if (unlikely(!slots))
+    return false;
+  memset(slots, 0, sizeof(chiba_idmap_slot) * cap);
+  chiba_idmap_slot *old = map->slots;
+  u64 oldcap = chiba_idmap_capacity(map);
+  map->slots = slots;
+  map->mask = cap - 1;
+  map->shift = (u32)__builtin_clzll(cap) + 1;
+  for (u64 i = 0; i < oldcap; i++) {
+    if (old[i].key)
+      chiba_idmap_place(map, old[i].key, old[i].value);
+  }
+  CHIBA_INTERNAL_free(old);
+  return true;
+}
+
+// Get the value stored for `key`, or NULL
+UTILS anyptr chiba_idmap_get(chiba_idmap *map, i64 key) {
+  i64 i = chiba_idmap_find(map, key);
+  return i < 0 ? NULL : map->slots[i].value;
+}
+
+// Store `value` under `key` (non-zero). Returns the value it replaced, or
+// NULL if the key was new.
+UTILS anyptr chiba_idmap_insert(chiba_idmap *map, i64 key, anyptr value) {
+  i64 i = chiba_idmap_find(map, key);
+  if (i >= 0) {
+    anyptr prev = map->slots[i].value;
+    map->slots[i].value = value;
+    return prev;
+  }
+  u64 cap = chiba_idmap_capacity(map);
+  if ((map->count + 1) * 8 > cap * 7) {
+    u64 next = cap ? cap * 2 : CHIBA_IDMAP_MINCAP;
+    if (unlikely(!chiba_idmap_resize(map, next)))
+      CHIBA_PANIC("Could not grow id map to %llu slots",
+                  (unsigned long long)next);
+  }
+  chiba_idmap_place(map, key, value);
+  map->count++;
+  return NULL;
+}
+
+// Remove `key`. Returns the value it held, or NULL if it was absent.
+UTILS anyptr chiba_idmap_delete(chiba_idmap *map, i64 key) {
+  i64 at = chiba_idmap_find(map, key);
+  if (at < 0)
+    return NULL;
+  u64 i = (u64)at;
+  anyptr value = map->slots[i].value;
+  for (;;) {
+    u64 j = (i + 1) & map->mask;
+    chiba_idmap_slot *next = &map->slots[j];
+    if (!next->key || chiba_idmap_dist(map, next->key, j) == 0)
+      break;
+    map->slots[i] = *next;
+    i = j;
+  }
+  map->slots[i].key = 0;
+  map->slots[i].value = NULL;
+  map->count--;
+  // Shrink with hysteresis so a map hovering around a boundary does not
+  // resize on every call
+  u64 cap = map->mask + 1;
+  if (cap > CHIBA_IDMAP_MINCAP && map->count * 16 < cap)
+    chiba_idmap_resize(map, cap / 2);
+  return value;
+}
+
+// Release the table. The map is empty and reusable afterwards.
+UTILS void chiba_idmap_free(chiba_idmap *map) {
+  CHIBA_INTERNAL_free(map->slots);
+  map->slots = NULL;
+  map->mask = 0;
+  map->shift = 0;
+  map->count = 0;
+}
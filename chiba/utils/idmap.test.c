@@ -0,0 +1,87 @@
+#include "idmap.h"
+#include "../basic_types.h"
+#include "../chiba_testing.h"
+
+TEST_GROUP(idmap);
+
+TEST_CASE(empty_map, idmap, "Zeroed map is empty and owns nothing", {
+  DESC(empty_map);
+
+  chiba_idmap map = {0};
+  ASSERT_EQ(0, chiba_idmap_capacity(&map), "No table before first insert");
+  ASSERT_NULL(chiba_idmap_get(&map, 1), "Lookup on empty map misses");
+  ASSERT_NULL(chiba_idmap_delete(&map, 1), "Delete on empty map misses");
+  chiba_idmap_free(&map);
+  return 0;
+})
+
+TEST_CASE(insert_get_delete, idmap, "Insert, lookup and delete", {
+  DESC(insert_get_delete);
+
+  chiba_idmap map = {0};
+  ASSERT_NULL(chiba_idmap_insert(&map, 7, (anyptr)0x70), "New key");
+  ASSERT_EQ(0x70, (i64)chiba_idmap_get(&map, 7), "Lookup finds value");
+  ASSERT_EQ(0x70, (i64)chiba_idmap_insert(&map, 7, (anyptr)0x71),
+            "Insert over existing key returns old value");
+  ASSERT_EQ(1, map.count, "Replacing keeps count");
+  ASSERT_EQ(0x71, (i64)chiba_idmap_delete(&map, 7), "Delete returns value");
+  ASSERT_NULL(chiba_idmap_get(&map, 7), "Deleted key is gone");
+  ASSERT_EQ(0, map.count, "Map is empty again");
+  chiba_idmap_free(&map);
+  return 0;
+})
+
+TEST_CASE(grow_and_shrink, idmap, "Table grows and shrinks with the load", {
+  DESC(grow_and_shrink);
+
+  chiba_idmap map = {0};
+  for (i64 id = 1; id <= 100000; id++)
+    chiba_idmap_insert(&map, id, (anyptr)(id * 2));
+  ASSERT_EQ(100000, map.count, "All keys inserted");
+  ASSERT_TRUE(map.count * 8 <= chiba_idmap_capacity(&map) * 7,
+              "Load factor stays under 7/8");
+  i64 bad = 0;
+  for (i64 id = 1; id <= 100000; id++)
+    bad += chiba_idmap_get(&map, id) != (anyptr)(id * 2);
+  ASSERT_EQ(0, bad, "Every key maps to its value");
+  ASSERT_NULL(chiba_idmap_get(&map, 100001), "Missing key misses");
+  for (i64 id = 1; id <= 100000; id++)
+    bad += chiba_idmap_delete(&map, id) != (anyptr)(id * 2);
+  ASSERT_EQ(0, bad, "Every key deleted once");
+  ASSERT_EQ(0, map.count, "Map is empty");
+  ASSERT_EQ(CHIBA_IDMAP_MINCAP, chiba_idmap_capacity(&map),
+            "Table shrank back to the minimum");
+  chiba_idmap_free(&map);
+  return 0;
+})
+
+TEST_CASE(interleaved_churn, idmap, "Interleaved inserts and deletes", {
+  DESC(interleaved_churn);
+
+  // Keep a sliding window of live keys so deletes hit shifted clusters
+  chiba_idmap map = {0};
+  i64 bad = 0;
+  for (i64 id = 1; id <= 50000; id++) {
+    chiba_idmap_insert(&map, id, (anyptr)id);
+    if (id > 1000)
+      bad += chiba_idmap_delete(&map, id - 1000) != (anyptr)(id - 1000);
+    if (id > 500 && id % 97 == 0)
+      bad += chiba_idmap_get(&map, id - 500) != (anyptr)(id - 500);
+  }
+  ASSERT_EQ(0, bad, "Window contents stayed consistent");
+  ASSERT_EQ(1000, map.count, "Window size kept");
+  for (i64 id = 49001; id <= 50000; id++)
+    bad += chiba_idmap_get(&map, id) != (anyptr)id;
+  ASSERT_EQ(0, bad, "Window keys present");
+  chiba_idmap_free(&map);
+  return 0;
+})
+
+REGISTER_TEST_GROUP(idmap) {
+  REGISTER_TEST(empty_map, idmap);
+  REGISTER_TEST(insert_get_delete, idmap);
+  REGISTER_TEST(grow_and_shrink, idmap);
+  REGISTER_TEST(interleaved_churn, idmap);
+}
+
+ENABLE_TEST_GROUP(idmap);
@@ -0,0 +1,190 @@
+#pragma once
+#include "../basic_types.h"
+#include "../common_headers.h"
+#include <stdint.h>
+
+// Chiba timing wheel
+// Hierarchical timing wheel for timers that are mostly cancelled before they
+// fire (timeouts around blocking operations):
+// - CHIBA_TWHEEL_LEVELS levels of 64 slots; a slot on level L covers 64^L
+//   ticks, so 6 levels span 2^36 ticks. Deadlines further out are parked in
+//   the top level and re-filed when it comes round
+// - timers are intrusive doubly linked list nodes: insert and cancel are O(1)
+//   and allocation free
+// - a timer is filed on the highest level at which its deadline and the
+//   current tick differ, and moves down one or more levels when that slot
+//   comes due; most timers are cancelled long before moving at all
+// - an occupancy bitmap per level finds the next due slot with one bit scan,
+//   so advancing over idle time costs O(levels), not O(ticks)
+// The wheel is not thread-safe; callers sharing one across threads lock it.
+
+#define CHIBA_TWHEEL_LEVELS 6
+#define CHIBA_TWHEEL_SLOT_BITS 6
+#define CHIBA_TWHEEL_SLOTS (1 << CHIBA_TWHEEL_SLOT_BITS)
+#define CHIBA_TWHEEL_SPAN                                                      \
+  (1ULL << (CHIBA_TWHEEL_LEVELS * CHIBA_TWHEEL_SLOT_BITS))
+
+typedef struct chiba_twheel_timer {
+  struct chiba_twheel_timer *prev;
+  struct chiba_twheel_timer *next; // NULL while the timer is not filed
+  u64 deadline;                    // tick
+  u8 level;
+  u8 slot;
+} chiba_twheel_timer;
+
+typedef struct chiba_twheel {
+  u64 now; // every timer due at or before this tick has been expired
+  u64 count;
+  u64 occupied[CHIBA_TWHEEL_LEVELS];
+  chiba_twheel_timer slots[CHIBA_TWHEEL_LEVELS][CHIBA_TWHEEL_SLOTS]; // heads
+} chiba_twheel;
+
+UTILS void chiba_twheel_init(chiba_twheel *wheel, u64 now) {
+  wheel->now = now;
+  wheel->count = 0;
+  for (u32 l = 0; l < CHIBA_TWHEEL_LEVELS; l++) {
+    wheel->occupied[l] = 0;
+    for (u32 s = 0; s < CHIBA_TWHEEL_SLOTS; s++) {
+      chiba_twheel_timer *head = &wheel->slots[l][s];
+      head->prev = head;
+      head->next = head;
+    }
+  }
+}
+
+UTILS bool chiba_twheel_armed(const chiba_twheel_timer *timer) {
+  return timer->next != NULL;
+}
+
+// File `timer` by its deadline relative to wheel->now
+UTILS void chiba_twheel_file(chiba_twheel *wheel, chiba_twheel_timer *timer) {
+  u64 when = timer->deadline > wheel->now ? timer->deadline : wheel->now;
+  // Further out than the wheel reaches: park in the top-level slot furthest
+  // ahead, which never aliases the slot the wheel is in now
+  u64 top = CHIBA_TWHEEL_SPAN >> CHIBA_TWHEEL_SLOT_BITS;
+  u64 limit = (wheel->now | (top - 1)) + CHIBA_TWHEEL_SPAN - top;
+  if (when > limit)
+    when = limit;
+  // Highest differing digit; the low digit is forced so level 0 is the floor
+  u64 masked = (when ^ wheel->now) | (CHIBA_TWHEEL_SLOTS - 1);
+  u32 level = (63 - (u32)__builtin_clzll(masked)) / CHIBA_TWHEEL_SLOT_BITS;
+  if (level >= CHIBA_TWHEEL_LEVELS)
+    level = CHIBA_TWHEEL_LEVELS - 1;
+  u32 slot = (u32)(when >> (level * CHIBA_TWHEEL_SLOT_BITS)) &
+             (CHIBA_TWHEEL_SLOTS - 1);
+  chiba_twheel_timer *head = &wheel->slots[level][slot];
+  timer->level = (u8)level;
+  timer->slot = (u8)slot;
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+  wheel->occupied[level] |= 1ULL << slot;
+}
+
+// Arm `timer` to expire at tick `deadline`. Deadlines at or before the
+// current tick expire on the next advance.
+UTILS void chiba_twheel_insert(chiba_twheel *wheel, chiba_twheel_timer *timer,
+                               u64 deadline) {
+  timer->deadline = deadline;
+  chiba_twheel_file(wheel, timer);
+  wheel->count++;
+}
+
+UTILS void chiba_twheel_unlink(chiba_twheel *wheel, chiba_twheel_timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  chiba_twheel_timer *head = &wheel->slots[timer->level][timer->slot];
+  if (head->next == head)
+    wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+// Disarm `timer`. Returns false if it was not armed (already expired or never
+// inserted).
+UTILS bool chiba_twheel_cancel(chiba_twheel *wheel, chiba_twheel_timer *timer) {
+  if (!chiba_twheel_armed(timer))
+    return false;
+  chiba_twheel_unlink(wheel, timer);
+  wheel->count--;
+  return true;
+}
+
+// Start tick of the next occupied slot, and where it is. Returns false if the
+// wheel is empty.
+UTILS bool chiba_twheel_next_slot(chiba_twheel *wheel, u64 *tick, u32 *level,
+                                  u32 *slot) {
+  bool found = false;
+  *tick = UINT64_MAX;
+  for (u32 l = 0; l < CHIBA_TWHEEL_LEVELS; l++) {
+    u64 occupied = wheel->occupied[l];
+    if (!occupied)
+      continue;
+    u32 shift = l * CHIBA_TWHEEL_SLOT_BITS;
+    u32 now_slot = (u32)(wheel->now >> shift) & (CHIBA_TWHEEL_SLOTS - 1);
+    u64 rotated = now_slot ? (occupied >> now_slot) |
+                                 (occupied << (CHIBA_TWHEEL_SLOTS - now_slot))
+                           : occupied;
+    u32 s = (now_slot + (u32)__builtin_ctzll(rotated)) &
+            (CHIBA_TWHEEL_SLOTS - 1);
+    u64 level_span = 1ULL << (shift + CHIBA_TWHEEL_SLOT_BITS);
+    u64 start = (wheel->now & ~(level_span - 1)) + ((u64)s << shift);
+    if (s < now_slot)
+      start += level_span;
+    if (start < *tick) {
+      *tick = start;
+      *level = l;
+      *slot = s;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Tick at which the next timer may expire, or UINT64_MAX if none is armed.
+// Timers filed on upper levels report the start of their slot, which is never
+// later than their deadline.
+UTILS u64 chiba_twheel_next_expiry(chiba_twheel *wheel) {
+  u64 tick = 0;
+  u32 level = 0, slot = 0;
+  if (!chiba_twheel_next_slot(wheel, &tick, &level, &slot))
+    return UINT64_MAX;
+  return tick > wheel->now ? tick : wheel->now;
+}
+
+// Move the wheel to tick `now` and return every timer due by then, in due
+// order, linked through `prev` and ending in NULL. Returned timers are
+// already disarmed; take the link before re-inserting one.
+UTILS chiba_twheel_timer *chiba_twheel_advance(chiba_twheel *wheel, u64 now) {
+  chiba_twheel_timer *expired = NULL;
+  chiba_twheel_timer **tail = &expired;
+  u64 tick = 0;
+  u32 level = 0, slot = 0;
+  while (chiba_twheel_next_slot(wheel, &tick, &level, &slot) && tick <= now) {
+    if (tick > wheel->now)
+      wheel->now = tick;
+    chiba_twheel_timer *head = &wheel->slots[level][slot];
+    chiba_twheel_timer *t = head->next;
+    head->prev = head;
+    head->next = head;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    while (t != head) {
+      chiba_twheel_timer *next = t->next;
+      if (t->deadline <= wheel->now) {
+        t->prev = NULL;
+        t->next = NULL;
+        *tail = t;
+        tail = &t->prev;
+        wheel->count--;
+      } else {
+        // Cascade to a lower level now that its slot has come round
+        chiba_twheel_file(wheel, t);
+      }
+      t = next;
+    }
+  }
+  if (now > wheel->now)
+    wheel->now = now;
+  return expired;
+}
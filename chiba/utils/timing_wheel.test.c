@@ -0,0 +1,137 @@
+#include "timing_wheel.h"
+#include "../basic_memory.h"
+#include "../chiba_testing.h"
+
+TEST_GROUP(timing_wheel);
+
+PRIVATE u64 count_expired(chiba_twheel_timer *t, u64 now, u64 *late) {
+  u64 n = 0;
+  for (; t; t = t->prev) {
+    n++;
+    if (t->deadline > now)
+      (*late)++;
+  }
+  return n;
+}
+
+TEST_CASE(insert_expire, timing_wheel, "Timers expire at their tick", {
+  DESC(insert_expire);
+
+  chiba_twheel wheel;
+  chiba_twheel_init(&wheel, 1000);
+  chiba_twheel_timer a;
+  chiba_twheel_timer b;
+  chiba_twheel_timer c;
+  chiba_twheel_insert(&wheel, &a, 1005);
+  chiba_twheel_insert(&wheel, &b, 1070);
+  chiba_twheel_insert(&wheel, &c, 999);
+  ASSERT_EQ(3, wheel.count, "Three armed");
+  ASSERT_EQ(1000, chiba_twheel_next_expiry(&wheel), "Past deadline is due");
+
+  chiba_twheel_timer *t = chiba_twheel_advance(&wheel, 1000);
+  ASSERT_TRUE(t == &c && !t->prev, "Only the past timer expired");
+  ASSERT_TRUE(!chiba_twheel_armed(&c), "Expired timer is disarmed");
+  ASSERT_NULL(chiba_twheel_advance(&wheel, 1004), "Nothing due before 1005");
+  t = chiba_twheel_advance(&wheel, 1005);
+  ASSERT_TRUE(t == &a && !t->prev, "Level 0 timer on time");
+  ASSERT_TRUE(chiba_twheel_next_expiry(&wheel) <= 1070,
+              "Next expiry never later than the deadline");
+  ASSERT_NULL(chiba_twheel_advance(&wheel, 1069), "Cascaded, not fired");
+  t = chiba_twheel_advance(&wheel, 1070);
+  ASSERT_TRUE(t == &b && !t->prev, "Level 1 timer on time");
+  ASSERT_EQ(0, wheel.count, "Wheel empty");
+  ASSERT_EQ(UINT64_MAX, chiba_twheel_next_expiry(&wheel), "No expiry");
+  return 0;
+})
+
+TEST_CASE(cancel, timing_wheel, "Cancelled timers never fire", {
+  DESC(cancel);
+
+  chiba_twheel wheel;
+  chiba_twheel_init(&wheel, 0);
+  chiba_twheel_timer *timers =
+      CHIBA_INTERNAL_malloc(sizeof(chiba_twheel_timer) * 10000);
+  for (u64 i = 0; i < 10000; i++)
+    chiba_twheel_insert(&wheel, &timers[i], i * 37 + 1);
+  u64 cancelled = 0;
+  for (u64 i = 0; i < 10000; i += 2)
+    cancelled += chiba_twheel_cancel(&wheel, &timers[i]);
+  ASSERT_EQ(5000, cancelled, "Half cancelled");
+  ASSERT_TRUE(!chiba_twheel_cancel(&wheel, &timers[0]),
+              "Second cancel is a no-op");
+  u64 late = 0;
+  u64 fired = count_expired(chiba_twheel_advance(&wheel, 10000 * 37), 10000 * 37,
+                            &late);
+  ASSERT_EQ(5000, fired, "Only the armed half fired");
+  ASSERT_EQ(0, late, "None fired early");
+  ASSERT_EQ(0, wheel.count, "Wheel empty");
+  CHIBA_INTERNAL_free(timers);
+  return 0;
+})
+
+TEST_CASE(stepwise, timing_wheel, "Timers fire exactly on their tick", {
+  DESC(stepwise);
+
+  // Deadlines spread over several levels, advanced one tick at a time
+  chiba_twheel wheel;
+  chiba_twheel_init(&wheel, 12345);
+  chiba_twheel_timer *timers =
+      CHIBA_INTERNAL_malloc(sizeof(chiba_twheel_timer) * 3000);
+  u64 x = 0x9E3779B97F4A7C15ULL;
+  for (u64 i = 0; i < 3000; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    chiba_twheel_insert(&wheel, &timers[i], 12345 + x % 300000);
+  }
+  u64 wrong = 0;
+  u64 fired = 0;
+  for (u64 now = 12345; now <= 12345 + 300000; now++) {
+    for (chiba_twheel_timer *t = chiba_twheel_advance(&wheel, now); t;
+         t = t->prev) {
+      wrong += t->deadline != now;
+      fired++;
+    }
+  }
+  ASSERT_EQ(3000, fired, "All fired");
+  ASSERT_EQ(0, wrong, "Each on its own tick");
+  CHIBA_INTERNAL_free(timers);
+  return 0;
+})
+
+TEST_CASE(far_future, timing_wheel, "Deadlines beyond the wheel span", {
+  DESC(far_future);
+
+  chiba_twheel wheel;
+  chiba_twheel_init(&wheel, 5);
+  chiba_twheel_timer far;
+  chiba_twheel_timer near;
+  chiba_twheel_insert(&wheel, &far, 5 + CHIBA_TWHEEL_SPAN * 3 + 17);
+  chiba_twheel_insert(&wheel, &near, 5 + CHIBA_TWHEEL_SPAN - 2);
+  u64 late = 0;
+  ASSERT_EQ(0, count_expired(chiba_twheel_advance(&wheel, CHIBA_TWHEEL_SPAN),
+                             CHIBA_TWHEEL_SPAN, &late),
+            "Nothing due yet");
+  ASSERT_EQ(1, count_expired(chiba_twheel_advance(&wheel, CHIBA_TWHEEL_SPAN + 3),
+                             CHIBA_TWHEEL_SPAN + 3, &late),
+            "Near timer fired");
+  ASSERT_EQ(0, count_expired(chiba_twheel_advance(&wheel,
+                                                  5 + CHIBA_TWHEEL_SPAN * 3 + 16),
+                             5 + CHIBA_TWHEEL_SPAN * 3 + 16, &late),
+            "Far timer re-filed, not fired");
+  ASSERT_EQ(1, count_expired(chiba_twheel_advance(&wheel,
+                                                  5 + CHIBA_TWHEEL_SPAN * 3 + 17),
+                             5 + CHIBA_TWHEEL_SPAN * 3 + 17, &late),
+            "Far timer fired");
+  ASSERT_EQ(0, late, "None fired early");
+  return 0;
+})
+
+REGISTER_TEST_GROUP(timing_wheel) {
+  REGISTER_TEST(insert_expire, timing_wheel);
+  REGISTER_TEST(cancel, timing_wheel);
+  REGISTER_TEST(stepwise, timing_wheel);
+  REGISTER_TEST(far_future, timing_wheel);
+}
+
+ENABLE_TEST_GROUP(timing_wheel);
@@ -0,0 +1,197 @@
+#pragma once
+#include "../basic_types.h"
+#include "../common_headers.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Chiba io_uring
+// Minimal io_uring ring on raw syscalls, no liburing:
+// - chiba_uring_sqe only claims the next submission slot and
+//   chiba_uring_flush makes it visible to the kernel; nothing enters the
+//   kernel until chiba_uring_submit, so any number of queued operations cost
+//   one io_uring_enter
+// - completions are read straight from the mapped completion ring, no
+//   syscall needed to see them
+// The ring is not thread-safe: one thread fills submissions, and callers
+// reaping completions from several threads lock around it.
+// chiba_uring_init fails (returns false) where io_uring is not available:
+// non-Linux builds, old kernels, or a seccomp policy that forbids it.
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__) &&                          \
+    !defined(CHIBA_URING_DISABLE)
+#define CHIBA_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if !defined(MAP_POPULATE)
+#define MAP_POPULATE 0
+#endif
+#endif
+
+#ifdef CHIBA_URING
+
+typedef struct chiba_uring {
+  i32 fd;
+  u32 features; // IORING_FEAT_*
+
+  // submission ring
+  _Atomic(u32) *sq_head; // advanced by the kernel
+  _Atomic(u32) *sq_tail;
+  u32 *sq_array;
+  u32 sq_mask;
+  u32 sq_entries;
+  u32 sqe_tail;  // claimed slots, ahead of *sq_tail until flushed
+  u32 to_submit; // flushed but not yet passed to io_uring_enter
+  struct io_uring_sqe *sqes;
+
+  // completion ring
+  _Atomic(u32) *cq_head;
+  _Atomic(u32) *cq_tail; // advanced by the kernel
+  u32 cq_mask;
+  struct io_uring_cqe *cqes;
+
+  anyptr sq_ring;
+  u64 sq_ring_size;
+  anyptr cq_ring; // same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+  u64 cq_ring_size;
+  u64 sqes_size;
+} chiba_uring;
+
+UTILS i32 chiba_uring_enter(i32 fd, u32 to_submit, u32 min_complete,
+                            u32 flags) {
+  return (i32)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+UTILS void chiba_uring_drop(chiba_uring *ring) {
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+  memset(ring, 0, sizeof(chiba_uring));
+  ring->fd = -1;
+}
+
+// Set up a ring with at least `entries` submission slots (rounded up to a
+// power of two by the kernel). Returns false, with errno set, if io_uring is
+// unusable; the ring is then left dropped.
+UTILS bool chiba_uring_init(chiba_uring *ring, u32 entries) {
+  memset(ring, 0, sizeof(chiba_uring));
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring->fd = (i32)syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0)
+    return false;
+  ring->features = p.features;
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+  ring->cq_ring_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && ring->cq_ring_size > ring->sq_ring_size)
+    ring->sq_ring_size = ring->cq_ring_size;
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED) {
+    ring->sq_ring = NULL;
+    goto fail;
+  }
+  if (single) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      ring->cq_ring = NULL;
+      goto fail;
+    }
+  }
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(
+      NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto fail;
+  }
+
+  char *sq = (char *)ring->sq_ring;
+  ring->sq_head = (_Atomic(u32) *)(sq + p.sq_off.head);
+  ring->sq_tail = (_Atomic(u32) *)(sq + p.sq_off.tail);
+  ring->sq_array = (u32 *)(sq + p.sq_off.array);
+  ring->sq_mask = *(u32 *)(sq + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sqe_tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+  char *cq = (char *)ring->cq_ring;
+  ring->cq_head = (_Atomic(u32) *)(cq + p.cq_off.head);
+  ring->cq_tail = (_Atomic(u32) *)(cq + p.cq_off.tail);
+  ring->cq_mask = *(u32 *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return true;
+
+fail:
+  chiba_uring_drop(ring);
+  return false;
+}
+
+// Claim the next submission slot, zeroed, or NULL if the ring is full
+UTILS struct io_uring_sqe *chiba_uring_sqe(chiba_uring *ring) {
+  u32 head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+  if (ring->sqe_tail - head >= ring->sq_entries)
+    return NULL;
+  u32 idx = ring->sqe_tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sq_array[idx] = idx;
+  ring->sqe_tail++;
+  return sqe;
+}
+
+// Publish the claimed submissions to the kernel's view of the ring
+UTILS void chiba_uring_flush(chiba_uring *ring) {
+  u32 tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+  if (tail == ring->sqe_tail)
+    return;
+  ring->to_submit += ring->sqe_tail - tail;
+  atomic_store_explicit(ring->sq_tail, ring->sqe_tail, memory_order_release);
+}
+
+UTILS bool chiba_uring_pending(chiba_uring *ring) {
+  return ring->to_submit ||
+         ring->sqe_tail !=
+             atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+}
+
+// Pass every queued submission to the kernel in one io_uring_enter,
+// optionally waiting for `min_complete` completions. Returns the number of
+// submissions consumed, or -1 with errno set.
+UTILS i32 chiba_uring_submit(chiba_uring *ring, u32 min_complete) {
+  chiba_uring_flush(ring);
+  u32 flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+  i32 n = chiba_uring_enter(ring->fd, ring->to_submit, min_complete, flags);
+  if (n > 0)
+    ring->to_submit -= (u32)n < ring->to_submit ? (u32)n : ring->to_submit;
+  return n;
+}
+
+// Oldest unseen completion, or NULL
+UTILS struct io_uring_cqe *chiba_uring_peek(chiba_uring *ring) {
+  u32 head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+  if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire))
+    return NULL;
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+// Hand the completion returned by chiba_uring_peek back to the kernel
+UTILS void chiba_uring_seen(chiba_uring *ring) {
+  u32 head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+  atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#include "uring.h"
+#include "../basic_memory.h"
+#include "../chiba_testing.h"
+
+TEST_GROUP(uring);
+
+#ifdef CHIBA_URING
+
+TEST_CASE(nop_batch, uring, "Queued operations share one enter", {
+  DESC(nop_batch);
+
+  chiba_uring ring;
+  if (!chiba_uring_init(&ring, 8)) {
+    printf("   io_uring unavailable (errno %d), skipped\n", errno);
+    return 0;
+  }
+  ASSERT_TRUE(!chiba_uring_pending(&ring), "Nothing queued");
+  for (u64 i = 0; i < 8; i++) {
+    struct io_uring_sqe *sqe = chiba_uring_sqe(&ring);
+    ASSERT_NOT_NULL(sqe, "Slot claimed");
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = i + 1;
+  }
+  ASSERT_NULL(chiba_uring_sqe(&ring), "Ring full");
+  ASSERT_TRUE(chiba_uring_pending(&ring), "Queued");
+  ASSERT_EQ(8, chiba_uring_submit(&ring, 8), "All eight in one enter");
+  ASSERT_TRUE(!chiba_uring_pending(&ring), "Nothing left to submit");
+  u64 seen = 0;
+  struct io_uring_cqe *cqe;
+  while ((cqe = chiba_uring_peek(&ring))) {
+    ASSERT_EQ(0, cqe->res, "Nop succeeded");
+    seen |= 1ULL << (cqe->user_data - 1);
+    chiba_uring_seen(&ring);
+  }
+  ASSERT_EQ(0xff, seen, "Every completion arrived once");
+  chiba_uring_drop(&ring);
+  return 0;
+})
+
+TEST_CASE(pipe_read, uring, "Reads complete when data arrives", {
+  DESC(pipe_read);
+
+  chiba_uring ring;
+  if (!chiba_uring_init(&ring, 4)) {
+    printf("   io_uring unavailable (errno %d), skipped\n", errno);
+    return 0;
+  }
+  i32 fds[2];
+  ASSERT_EQ(0, pipe(fds), "Pipe created");
+  char buf[4] = {0};
+  struct io_uring_sqe *sqe = chiba_uring_sqe(&ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fds[0];
+  sqe->addr = (u64)(uintptr_t)buf;
+  sqe->len = sizeof(buf);
+  sqe->off = (u64)-1;
+  sqe->user_data = 42;
+  ASSERT_EQ(1, chiba_uring_submit(&ring, 0), "Submitted");
+  ASSERT_NULL(chiba_uring_peek(&ring), "Nothing to read yet");
+  ASSERT_EQ(3, write(fds[1], "abc", 3), "Wrote");
+  ASSERT_EQ(0, chiba_uring_submit(&ring, 1), "Waited for the completion");
+  struct io_uring_cqe *cqe = chiba_uring_peek(&ring);
+  ASSERT_NOT_NULL(cqe, "Completed");
+  ASSERT_EQ(42, cqe->user_data, "Our read");
+  ASSERT_EQ(3, cqe->res, "Three bytes");
+  chiba_uring_seen(&ring);
+  ASSERT_EQ(0, memcmp(buf, "abc", 3), "Data landed in the buffer");
+  close(fds[0]);
+  close(fds[1]);
+  chiba_uring_drop(&ring);
+  return 0;
+})
+
+REGISTER_TEST_GROUP(uring) {
+  REGISTER_TEST(nop_batch, uring);
+  REGISTER_TEST(pipe_read, uring);
+}
+
+#else
+
+REGISTER_TEST_GROUP(uring) {}
+
+#endif
+
+ENABLE_TEST_GROUP(uring);